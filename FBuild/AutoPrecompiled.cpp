@@ -0,0 +1,286 @@
+/*
+ * Any copyright is dedicated to the Public Domain.
+ * http://creativecommons.org/publicdomain/zero/1.0/*
+ *
+ * Author: Frank Barwich
+ */
+
+#include "AutoPrecompiled.h"
+#include "Durations.h"
+#include "History.h"
+#include "LastWriteTime.h"
+#include "Snapshot.h"
+
+#include <algorithm>
+#include <cstdint>
+#include <filesystem>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <mutex>
+#include <set>
+#include <sstream>
+#include <unordered_map>
+#include <unordered_set>
+
+
+
+namespace {
+
+   const std::string name = "FBuildPrecompiled";
+
+   constexpr double maxChangeRate = 0.1;   // Of the builds a header changed in, to be precompiled
+   constexpr size_t minFiles = 4;          // Below, the PCH costs more than it saves
+
+   struct Changes {
+      uint64_t time{0};      // LastWriteTime, when last seen
+      unsigned changes{0};
+   };
+
+   struct Pending {
+      std::string                               h;
+      std::unordered_map<std::string, int64_t>  before;     // Object -> milliseconds in earlier builds
+      std::unordered_map<std::string, double>   estimate;   // Object -> milliseconds saved
+   };
+
+   std::mutex                               pendingMutex;
+   std::unordered_map<std::string, Pending> pending;   // By ObjDir, the header changed in this build
+
+   std::filesystem::path Directory (const std::string& objDir)
+   {
+      return std::filesystem::path(objDir) / "AutoPrecompiled";
+   }
+
+   std::string Normal (const std::string& file)
+   {
+      return std::filesystem::absolute(file).lexically_normal().generic_string();
+   }
+
+   bool IsCpp (const std::string& file)
+   {
+      const auto extension = std::filesystem::path(file).extension();
+      return extension == ".cpp" || extension == ".cc" || extension == ".cxx";
+   }
+
+   bool IsSource (const std::string& file)
+   {
+      return IsCpp(file) || std::filesystem::path(file).extension() == ".c";
+   }
+
+   uint64_t Bytes (const std::string& file)
+   {
+      std::error_code error;
+      const auto size = std::filesystem::file_size(file, error);
+      return error ? 0 : size;
+   }
+
+   // Format: builds, then "header" time changes per line
+   unsigned LoadChanges (const std::string& objDir, std::unordered_map<std::string, Changes>& headers)
+   {
+      std::ifstream stream(Directory(objDir) / "Headers.txt");
+
+      unsigned builds = 0;
+      stream >> builds;
+
+      std::string header;
+      Changes changes;
+      while (stream >> std::quoted(header) >> changes.time >> changes.changes) headers[header] = changes;
+
+      return builds;
+   }
+
+   void SaveChanges (const std::string& objDir, unsigned builds, const std::unordered_map<std::string, Changes>& headers)
+   {
+      const auto file = Directory(objDir) / "Headers.txt";
+
+      std::ofstream stream(file, std::ios::trunc);
+      stream << builds << "\n";
+      for (auto&& [header, changes] : headers) stream << std::quoted(header) << " " << changes.time << " " << changes.changes << "\n";
+      if (!stream.flush()) throw std::runtime_error("Error writing " + file.string());
+   }
+
+   bool WriteIfChanged (const std::filesystem::path& file, const std::string& content)
+   {
+      {
+         std::ifstream in{file, std::ios::binary};
+         const std::string existing{std::istreambuf_iterator<char>{in}, std::istreambuf_iterator<char>{}};
+         if (existing == content) return false;   // Same timestamp, nothing is compiled again
+      }
+
+      Snapshot::Invalidate();
+
+      std::ofstream out{file, std::ios::binary | std::ios::trunc};
+      out << content;
+      if (!out.flush()) throw std::runtime_error("Error writing " + file.string());
+
+      return true;
+   }
+
+   std::filesystem::path Object (const std::string& objDir, const std::string& file, const std::string& objExtension)
+   {
+      return (std::filesystem::path(objDir) / std::filesystem::path(file).filename()).replace_extension(objExtension);   // Like ActualCompiler::ObjFiles()
+   }
+
+   void Remove (const std::string& objDir, const std::string& objExtension)
+   {
+      std::error_code error;
+      if (!std::filesystem::exists(Directory(objDir) / (name + ".h"), error)) return;
+
+      Snapshot::Invalidate();
+
+      std::filesystem::remove(Directory(objDir) / (name + ".h"), error);
+      std::filesystem::remove(Directory(objDir) / (name + ".cpp"), error);
+      std::filesystem::remove(Object(objDir, name + ".cpp", objExtension), error);
+
+      std::cout << "\nNo precompiled header for " << objDir << " any more" << std::endl;
+   }
+}
+
+
+
+namespace AutoPrecompiled {
+
+   Header Synthesize (const std::vector<std::string>& files, const std::string& objDir, const std::string& objExtension,
+                      double minShare, const Dependencies& dependencies)
+   {
+      std::filesystem::create_directories(Directory(objDir));
+
+      const auto generated = Normal(objDir) + "/";   // Unity TUs, the header itself
+
+      std::vector<std::string> sources;
+      for (auto&& file : files) {
+         if (IsCpp(file)) sources.push_back(file);
+      }
+
+      // Which files include a header
+      std::vector<std::vector<std::string>> includes(sources.size());
+      std::unordered_map<std::string, size_t> includedBy;
+
+      for (size_t i = 0; i < sources.size(); ++i) {
+         for (auto&& dependency : dependencies(sources[i])) {
+            const auto header = Normal(dependency);
+            if (IsSource(header) || header.rfind(generated, 0) == 0) continue;
+
+            includes[i].push_back(header);
+            ++includedBy[header];
+         }
+      }
+
+      // How often the headers changed, by their timestamps in the builds before
+      std::unordered_map<std::string, Changes> known;
+      auto builds = LoadChanges(objDir, known) + 1;
+
+      std::unordered_map<std::string, Changes> headers;
+      for (auto&& item : includedBy) {
+         const auto time = LastWriteTime(item.first);
+         auto& changes = headers[item.first];
+
+         const auto it = known.find(item.first);
+         if (it != known.end()) changes.changes = it->second.changes + (it->second.time != time ? 1 : 0);
+         changes.time = time;
+      }
+
+      SaveChanges(objDir, builds, headers);
+
+      std::vector<std::string> selected;
+      if (sources.size() >= minFiles) {
+         for (auto&& [header, count] : includedBy) {
+            const auto share = static_cast<double>(count) / static_cast<double>(sources.size());
+            if (share > minShare && headers[header].changes <= maxChangeRate * builds) selected.push_back(header);
+         }
+      }
+
+      if (selected.empty()) {
+         Remove(objDir, objExtension);
+         return {};
+      }
+
+      // The most common first, they are the ones the others build on
+      std::sort(selected.begin(), selected.end(), [&includedBy] (const std::string& l, const std::string& r) {
+         return includedBy[l] != includedBy[r] ? includedBy[l] > includedBy[r] : l < r;
+      });
+
+      std::ostringstream content;
+      content << "// Generated by FBuild for AutoPrecompiledHeader(): The headers included by more than " << static_cast<int>(minShare * 100)
+              << "% of the files that rarely change.\n";
+      for (auto&& header : selected) content << "#include \"" << header << "\"\n";
+
+      Header result;
+      result.h = (Directory(objDir) / (name + ".h")).string();
+      result.cpp = (Directory(objDir) / (name + ".cpp")).string();
+
+      WriteIfChanged(result.cpp, "#include \"" + name + ".h\"\n");
+      if (!WriteIfChanged(result.h, content.str())) return result;
+
+      // Estimated: The share of its bytes a file gets from the PCH, of the time it took before
+      const std::unordered_set<std::string> precompiled(selected.begin(), selected.end());
+      Pending changed;
+      changed.h = result.h;
+
+      double total = 0;
+      bool durationKnown = false;
+
+      for (size_t i = 0; i < sources.size(); ++i) {
+         uint64_t bytes = Bytes(sources[i]), fromPch = 0;
+         for (auto&& header : includes[i]) {
+            const auto size = Bytes(header);
+            bytes += size;
+            if (precompiled.count(header)) fromPch += size;
+         }
+
+         const auto obj = Object(objDir, sources[i], objExtension).string();
+         const auto last = Durations::Last(obj);
+         const auto milliseconds = static_cast<double>(last ? last->count() : Durations::Average().count());
+         const auto saved = bytes ? milliseconds * static_cast<double>(fromPch) / static_cast<double>(bytes) : 0.0;
+
+         total += saved;
+         if (last) {
+            changed.before[obj] = last->count();
+            changed.estimate[obj] = saved;
+            durationKnown = true;
+         }
+      }
+
+      std::cout << "\nPrecompiled header " << result.h << ": " << selected.size() << " headers";
+      if (durationKnown) std::cout << ", estimated to save " << std::fixed << std::setprecision(1) << total / 1000.0 << std::defaultfloat << " s of compile time";
+      std::cout << std::endl;
+
+      const auto lock = std::lock_guard{pendingMutex};
+      pending[objDir] = std::move(changed);
+
+      return result;
+   }
+
+   void Report (const std::string& objDir)
+   {
+      Pending changed;
+      {
+         const auto lock = std::lock_guard{pendingMutex};
+         const auto it = pending.find(objDir);
+         if (it == pending.end()) return;
+
+         changed = std::move(it->second);
+         pending.erase(it);
+      }
+
+      // Only the files compiled on their own in this build, without a Unity() batch or the ObjectCache
+      int64_t before = 0, now = 0;
+      double estimate = 0;
+      size_t files = 0;
+
+      for (auto&& [obj, milliseconds] : changed.before) {
+         const auto took = History::Took(obj);
+         if (!took) continue;
+
+         before += milliseconds;
+         now += took->count();
+         estimate += changed.estimate[obj];
+         ++files;
+      }
+
+      if (!files) return;
+
+      std::cout << "Precompiled header " << changed.h << ": Saved " << std::fixed << std::setprecision(1) << (before - now) / 1000.0 << " s of compile time in "
+                << files << " files, estimated " << estimate / 1000.0 << " s" << std::defaultfloat << std::endl;
+   }
+}
@@ -0,0 +1,34 @@
+/*
+ * Any copyright is dedicated to the Public Domain.
+ * http://creativecommons.org/publicdomain/zero/1.0/*
+ *
+ * Author: Frank Barwich
+ */
+
+#pragma once
+
+#include <functional>
+#include <string>
+#include <vector>
+
+
+// AutoPrecompiledHeader(true, {minShare: 0.5}): Without a PrecompiledHeader(h, cpp), FBuild writes one to
+// ObjDir/AutoPrecompiled from the headers (by CppDepends) that more than minShare of the C++ files include and that
+// changed in at most every tenth build. How often a header changed is kept in ObjDir/AutoPrecompiled/Headers.txt.
+// The header is written again only when that set changes, otherwise it keeps its timestamp and nothing is rebuilt.
+namespace AutoPrecompiled {
+
+   using Dependencies = std::function<std::vector<std::string> (const std::string& file)>;   // All includes of a file
+
+   struct Header {
+      std::string h;
+      std::string cpp;   // Creates the PCH with Visual Studio, it's compiled with the other files
+   };
+
+   // Empty if no header qualifies. Prints the estimated savings when the header changed.
+   Header Synthesize (const std::vector<std::string>& files, const std::string& objDir, const std::string& objExtension,
+                      double minShare, const Dependencies& dependencies);
+
+   // After the compile: What the files that were compiled with the changed header saved, compared to their earlier builds
+   void Report (const std::string& objDir);
+}
@@ -9,6 +9,20 @@
 #include "Compiler.h"
 #include "CppOutOfDate.h"
 #include "ToolChain.h"
+#include "Signatures.h"
+#include "Hash.h"
+#include "Snapshot.h"
+#include "Explain.h"
+#include "Process.h"
+#include "Supervisor.h"
+#include "ObjectCache.h"
+#include "Executor.h"
+#include "Durations.h"
+#include "Trace.h"
+#include "History.h"
+#include "Unity.h"
+#include "AutoPrecompiled.h"
+#include "SharedPch.h"
 
 #include <algorithm>
 #include <cstdlib>
@@ -19,9 +33,27 @@
 #include <sstream>
 #include <atomic>
 #include <random>
+#include <deque>
+#include <future>
+#include <optional>
 
 
 
+// By the durations of their objects in earlier runs. New files count as average ones.
+static void LongestFirst (std::vector<std::string>& files, const std::filesystem::path& objdir, const std::string& extension)
+{
+   const auto average = Durations::Average();
+
+   std::vector<std::pair<std::chrono::milliseconds, std::string>> sorted;
+   for (auto&& file : files) {
+      const auto obj = (objdir / std::filesystem::path(file).filename()).replace_extension(extension);
+      sorted.emplace_back(Durations::Last(obj.string()).value_or(average), file);
+   }
+
+   std::stable_sort(sorted.begin(), sorted.end(), [] (const auto& a, const auto& b) { return a.first > b.first; });
+
+   for (size_t i = 0; i < files.size(); ++i) files[i] = std::move(sorted[i].second);
+}
 
 
 std::vector<std::string> ActualCompiler::ObjFiles (const std::string& extension)
@@ -30,7 +62,7 @@ std::vector<std::string> ActualCompiler::ObjFiles (const std::string& extension)
 
    std::vector<std::string> result{};
 
-   for (auto&& file : compiler.Files()) {
+   for (auto&& file : compiler.TranslationUnits()) {
       std::filesystem::path f{file};
       auto outfile = outpath / f.filename();
       outfile.replace_extension(extension);
@@ -53,6 +85,20 @@ std::vector<std::string> ActualCompiler::CompiledObjFiles (const std::string& ex
       result.push_back(outfile.string());
    }
 
+   for (auto&& file : restored) {   // New as well, only not compiled
+      std::filesystem::path f{file};
+      auto outfile = outpath / f.filename();
+      outfile.replace_extension(extension);
+      result.push_back(outfile.string());
+   }
+
+   for (auto&& file : compiledModules) {
+      std::filesystem::path f{file};
+      auto outfile = outpath / f.filename();
+      outfile.replace_extension(extension);
+      result.push_back(outfile.string());
+   }
+
    return result;
 }
 
@@ -61,41 +107,69 @@ std::vector<std::string> ActualCompiler::CompiledObjFiles (const std::string& ex
 
 
 
-
-void ActualCompilerVisualStudio::CheckParams ()
+void ActualCompiler::UpdateOutOfDateSignatures ()
 {
-   if (compiler.ObjDir().empty()) compiler.ObjDir(compiler.Build());
+   const auto start = std::chrono::steady_clock::now();
+
+   const Signatures signatures{compiler.ObjDir()};
+   const auto signature = Signature(false);
+   const auto precompiledSignature = Signature(true);
+
+   const std::unordered_set<std::string> known(outOfDate.begin(), outOfDate.end());
+   const auto objects = ObjFiles();
+   const auto& files = compiler.TranslationUnits();
+
+   for (size_t i = 0; i < files.size(); ++i) {
+      if (known.count(files[i])) continue;
+      if (!signatures.Matches(objects[i], IsPrecompiledCpp(files[i]) ? precompiledSignature : signature)) {
+         outOfDate.push_back(files[i]);
+         Explain::OutOfDate(objects[i], signatures.Contains(objects[i]) ? "changed command line" : "no recorded command line");
+      }
+   }
+
+   Explain::Checked("Signatures " + compiler.ObjDir(), files.size(), std::chrono::steady_clock::now() - start);
 }
 
-void ActualCompilerVisualStudio::UpdateOutOfDate () 
+void ActualCompiler::SaveSignatures (const std::vector<std::string>& compiled)
 {
-   ::CppOutOfDate checker{ "obj" };
-   checker.OutDir(compiler.ObjDir());
-   checker.Threads(compiler.Threads());
-   checker.Files(compiler.Files());
-   checker.Include(compiler.Includes());
-   checker.PrecompiledHeader(compiler.PrecompiledH());
-   checker.Go();
+   Signatures signatures{compiler.ObjDir()};
+   const auto signature = Signature(false);
+   const auto precompiledSignature = Signature(true);
 
-   outOfDate = checker.OutOfDate();
+   const std::filesystem::path objdir{compiler.ObjDir()};
+
+   for (auto&& file : compiled) {
+      const auto obj = objdir / std::filesystem::path(file).filename().replace_extension(ObjExtension());
+      if (std::filesystem::exists(obj)) {   // The out of date objects were deleted before compiling. Existing ones are new.
+         signatures.Update(obj, IsPrecompiledCpp(file) ? precompiledSignature : signature);
+      }
+   }
+
+   signatures.Save();
 }
 
-bool ActualCompilerVisualStudio::NeedsRebuild ()
+bool ActualCompiler::NeedsRebuild ()
 {
-   CheckParams();
    outOfDate.clear();
+   compiledModules.clear();
+   failed.clear();
+
+   ScanModules();   // Before the signatures, the command line names the BMI directories
 
    if (!compiler.DependencyCheck()) {
-      outOfDate = compiler.Files();
+      outOfDate = compiler.TranslationUnits();
+      for (auto&& obj : ObjFiles()) Explain::OutOfDate(obj, "DependencyCheck(false)");
    }
    else {
       UpdateOutOfDate();
+      UpdateOutOfDateSignatures();
+      UpdateOutOfDateModules();
    }
 
    return !outOfDate.empty();
 }
 
-void ActualCompilerVisualStudio::DeleteOutOfDateObjectFiles ()
+void ActualCompiler::DeleteOutOfDateObjectFiles ()
 {
    const auto files = CompiledObjFiles();
 
@@ -104,81 +178,421 @@ void ActualCompilerVisualStudio::DeleteOutOfDateObjectFiles ()
    }
 }
 
-std::string ActualCompilerVisualStudio::CommandLine ()
+bool ActualCompiler::IsPrecompiledCpp (const std::string& file) const
+{
+   // Objects are named after the filename only, so comparing filenames is enough.
+   return !compiler.PrecompiledCPP().empty() && std::filesystem::path(file).filename() == std::filesystem::path(compiler.PrecompiledCPP()).filename();
+}
+
+std::vector<std::string> ActualCompiler::OutOfDateFiles (bool c) const
+{
+   std::vector<std::string> result;
+   std::copy_if(outOfDate.begin(), outOfDate.end(), std::back_inserter(result), [c] (const std::string& file) { return (std::filesystem::path(file).extension() == ".c") == c; });
+   return result;
+}
+
+void ActualCompiler::RestoreFromCache ()
+{
+   restored.clear();
+   cacheKeys.clear();
+
+   if (!ObjectCache::Enabled() || outOfDate.empty()) return;
+
+   // The key needs all includes of a file, by content. CppDepends finds them without running the preprocessor.
+   ::CppOutOfDate checker{ObjExtension()};   // Sets up the include paths of CppDepends
+   checker.Include(compiler.Includes());
+   checker.PrecompiledHeader(compiler.PrecompiledH());
+
+   const auto signature = Signature(false) + "\n" + CompilerIdentity();
+
+   std::vector<std::string> keys(outOfDate.size());
+   std::vector<std::string> diagnostics(outOfDate.size());
+   std::vector<char> hits(outOfDate.size(), 0);
+   std::atomic<size_t> next{0};
+
+   const auto worker = [&] () {
+      for (size_t i = next++; i < outOfDate.size(); i = next++) {
+         const auto& file = outOfDate[i];
+
+         // The PCH cpp also builds the PCH, which the cache doesn't hold. The key of a module unit would need the BMIs.
+         const auto outputs = IsPrecompiledCpp(file) || IsModuleUnit(file) ? std::vector<std::filesystem::path>{} : CachedOutputs(file);
+         if (outputs.empty()) continue;
+
+         const CppDepends depends{file};
+         const std::vector<std::string> dependencies(depends.Begin(), depends.End());
+
+         keys[i] = ObjectCache::Key(signature, file, dependencies);
+         hits[i] = ObjectCache::Restore(keys[i], outputs, diagnostics[i]);
+         History::Cached(outputs.front().string(), hits[i] != 0);
+      }
+   };
+
+   const auto threads = std::min<size_t>(compiler.Threads() > 0 ? compiler.Threads() : std::max(std::thread::hardware_concurrency(), 1u), outOfDate.size());
+   std::vector<std::thread> threadGroup;
+   for (size_t i = 1; i < threads; ++i) threadGroup.emplace_back(worker);
+   worker();
+   for (auto&& thread : threadGroup) thread.join();
+
+   std::vector<std::string> remaining;
+   for (size_t i = 0; i < outOfDate.size(); ++i) {
+      if (hits[i]) {
+         std::cout << std::filesystem::path(outOfDate[i]).filename().string() << " (cached)\n" << diagnostics[i] << std::flush;
+         restored.push_back(outOfDate[i]);
+      }
+      else {
+         if (!keys[i].empty()) cacheKeys[outOfDate[i]] = keys[i];
+         remaining.push_back(outOfDate[i]);
+      }
+   }
+
+   outOfDate = std::move(remaining);
+}
+
+void ActualCompiler::StoreInCache (const std::string& file, const std::string& diagnostics)
+{
+   const auto it = cacheKeys.find(file);
+   if (it == cacheKeys.end()) return;
+
+   const auto outputs = CachedOutputs(file);
+   for (auto&& output : outputs) {
+      if (!std::filesystem::exists(output)) return;
+   }
+
+   ObjectCache::Store(it->second, outputs, diagnostics);
+}
+
+void ActualCompiler::RecordFailure (const std::string& file, const std::string& diagnostics)
+{
+   const auto lock = std::lock_guard{failedMutex};
+   failed[file] = diagnostics;
+}
+
+std::filesystem::path ActualCompiler::Bmi (const std::string& module) const
+{
+   return std::filesystem::path(compiler.ObjDir()) / "Modules" / (Modules::FileName(module) + "." + BmiExtension());
+}
+
+std::vector<std::filesystem::path> ActualCompiler::ModuleDirectories () const
+{
+   std::vector<std::filesystem::path> result{std::filesystem::path(compiler.ObjDir()) / "Modules"};
+   for (auto&& directory : Modules::RegisteredDirectories()) {
+      if (directory != result.front()) result.push_back(directory);
+   }
+   return result;
+}
+
+bool ActualCompiler::IsModuleUnit (const std::string& file) const
+{
+   if (!moduleGraph) return false;
+
+   const auto& unit = moduleGraph->Of(file);
+   return !unit.provides.empty() || !unit.imports.empty();
+}
+
+void ActualCompiler::ScanModules ()
+{
+   moduleGraph.reset();
+   if (!compiler.Modules()) return;
+
+   const Trace::Scope trace{"Modules " + compiler.ObjDir()};
+
+   std::vector<std::string> sources;
+   for (auto&& file : compiler.TranslationUnits()) {
+      if (std::filesystem::path(file).extension() != ".c") sources.push_back(file);
+   }
+
+   auto graph = std::make_unique<Modules::Graph>(sources);
+   if (graph->Empty()) return;
+
+   std::filesystem::create_directories(std::filesystem::path(compiler.ObjDir()) / "Modules");
+
+   // Also for the targets that follow, they import the BMIs from here
+   for (auto&& file : graph->Providers()) {
+      const auto& module = graph->Of(file).provides;
+      Modules::Register(module, Bmi(module));
+   }
+
+   moduleGraph = std::move(graph);
+}
+
+void ActualCompiler::UpdateOutOfDateModules ()
+{
+   if (!moduleGraph) return;
+
+   std::unordered_set<std::string> known(outOfDate.begin(), outOfDate.end());
+   known.insert(compiledModules.begin(), compiledModules.end());
+   known.insert(restored.begin(), restored.end());
+
+   const auto objects = ObjFiles();
+   const auto& files = compiler.TranslationUnits();
+
+   // Not the cached LastWriteTime(), the BMIs may have been written in this run
+   std::error_code error;
+   for (size_t i = 0; i < files.size(); ++i) {
+      if (known.count(files[i])) continue;
+
+      const auto& unit = moduleGraph->Of(files[i]);
+      if (!unit.provides.empty() && !std::filesystem::exists(Bmi(unit.provides), error)) {
+         outOfDate.push_back(files[i]);
+         Explain::OutOfDate(objects[i], "missing BMI", Bmi(unit.provides).string());
+         continue;
+      }
+
+      const auto objTime = std::filesystem::last_write_time(objects[i], error);
+      if (error) continue;
+
+      for (auto&& module : moduleGraph->Imported(files[i])) {
+         const auto bmi = moduleGraph->Provides(module) ? Bmi(module) : Modules::Registered(module).value_or(std::filesystem::path{});
+         if (bmi.empty()) continue;   // Of the compiler, like std
+
+         const auto bmiTime = std::filesystem::last_write_time(bmi, error);
+         if (error || bmiTime > objTime) {
+            outOfDate.push_back(files[i]);
+            Explain::OutOfDate(objects[i], error ? "missing BMI" : "imported module " + module, bmi.string());
+            break;
+         }
+      }
+   }
+}
+
+void ActualCompiler::CompileModules ()
+{
+   if (!moduleGraph) return;
+
+   // The out of date providers, and the ones importing them: Their BMI depends on the imported BMIs
+   const std::unordered_set<std::string> outdated(outOfDate.begin(), outOfDate.end());
+   std::unordered_set<std::string> providers;
+   std::vector<std::string> ordered;
+
+   for (auto&& file : moduleGraph->Providers()) {
+      const auto prerequisites = moduleGraph->Prerequisites(file);
+      if (outdated.count(file) || std::any_of(prerequisites.begin(), prerequisites.end(), [&] (const std::string& p) { return providers.count(p) != 0; })) {
+         providers.insert(file);
+         ordered.push_back(file);
+      }
+   }
+
+   if (providers.empty()) return;
+
+   const Trace::Scope trace{"Compile modules " + compiler.ObjDir()};
+
+   outOfDate.erase(std::remove_if(outOfDate.begin(), outOfDate.end(), [&] (const std::string& file) { return providers.count(file) != 0; }), outOfDate.end());
+   compiledModules.insert(compiledModules.end(), ordered.begin(), ordered.end());
+
+   // A provider starts when the ones it imports are done, independent ones in parallel
+   std::mutex mutex;
+   std::unordered_map<std::string, size_t> waiting;
+   for (auto&& file : ordered) {
+      const auto prerequisites = moduleGraph->Prerequisites(file);
+      waiting[file] = std::count_if(prerequisites.begin(), prerequisites.end(), [&] (const std::string& p) { return providers.count(p) != 0; });
+   }
+
+   std::atomic<int> errors{0};
+   Supervisor::Batch batch;
+
+   std::function<void (const std::string&)> submit = [&] (const std::string& file) {
+      const auto& unit = moduleGraph->Of(file);
+      const auto bmi = Bmi(unit.provides);
+      std::filesystem::remove(bmi);
+
+      auto job = ModuleJob(file, unit, bmi);
+      job.done = [&, file, bmi] (const Supervisor::Result& result) {
+         std::cout << std::filesystem::path(file).filename().string() << "\n" << result.output << std::flush;   // In one piece, not mixed with the other files
+         if (result.exitCode != 0 || !std::filesystem::exists(bmi)) {   // What imports it isn't started
+            ++errors, RecordFailure(file, result.output);
+            return;
+         }
+
+         try {
+            Modules::Settle(bmi);
+         }
+         catch (std::exception& e) {
+            ++errors, RecordFailure(file, e.what());
+            return;
+         }
+
+         std::vector<std::string> ready;
+         {
+            const auto lock = std::lock_guard{mutex};
+            for (auto&& importer : moduleGraph->Importers(file)) {
+               const auto it = waiting.find(importer);
+               if (it != waiting.end() && --it->second == 0) ready.push_back(importer);
+            }
+         }
+         for (auto&& next : ready) submit(next);
+      };
+      batch.Submit(std::move(job));
+   };
+
+   std::vector<std::string> first;
+   for (auto&& file : ordered) {
+      if (waiting[file] == 0) first.push_back(file);
+   }
+   for (auto&& file : first) submit(file);
+
+   batch.Wait();
+
+   if (errors) throw std::runtime_error("Compile Error");
+
+   UpdateOutOfDateModules();   // The files importing a BMI that changed
+}
+
+// A job like the compiles: One slot of the global limit, the other files and targets fill the rest meanwhile
+static void BuildPrecompiled (Process::Arguments command, const std::filesystem::path& output)
+{
+   Supervisor::Job job;
+   job.arguments = std::move(command);
+   job.environment = ToolChain::Environment();
+   job.action = output.string();
+
+   const auto result = Supervisor::Run(std::move(job));
+   std::cout << result.output << std::flush;
+   if (result.exitCode != 0) throw std::runtime_error("Compile Error");
+}
+
+// Targets with the same header, by the content of everything the file includes, and the same options share the PCH
+static std::string SharedPchKey (const Compiler& compiler, const std::string& file, const std::string& signature)
+{
+   ::CppOutOfDate checker{"o"};   // Sets up the include paths of CppDepends
+   checker.Include(compiler.Includes());
+
+   const CppDepends depends{file};
+   return ObjectCache::Key(signature, compiler.PrecompiledH(), std::vector<std::string>(depends.Begin(), depends.End()));
+}
+
+void ActualCompilerVisualStudio::CheckParams ()
+{
+   if (compiler.ObjDir().empty()) compiler.ObjDir(compiler.Build());
+}
+
+void ActualCompilerVisualStudio::UpdateOutOfDate () 
+{
+   ::CppOutOfDate checker{ "obj" };
+   checker.OutDir(compiler.ObjDir());
+   checker.Threads(compiler.Threads());
+   checker.Files(compiler.TranslationUnits());
+   checker.Include(compiler.Includes());
+   checker.PrecompiledHeader(compiler.PrecompiledH());
+   checker.Go();
+
+   outOfDate = checker.OutOfDate();
+}
+
+Process::Arguments ActualCompilerVisualStudio::CommandLine ()
 {
    bool debug = compiler.Build() == "Debug";
 
-   std::string command = "-nologo -c -EHsc -GF -FC -FS -Zc:inline -GS -DWIN32 -DWINDOWS ";
-   command += "-std:c++latest "; 
+   Process::Arguments command{"-nologo", "-c", "-EHsc", "-GF", "-FC", "-FS", "-Zc:inline", "-GS", "-Brepro", "-DWIN32", "-DWINDOWS"};   // -Brepro: No timestamps in the objects, so unchanged code gives identical objects
+   command.push_back("-std:c++latest");
    
 
-   if (debug) command += "-D_DEBUG ";
-   else command += "-DNDEBUG ";
-
-   for (auto&& define : compiler.Defines()) command += "-D" + define + " ";
+   if (debug) command.push_back("-D_DEBUG");
+   else command.push_back("-DNDEBUG");
 
+   for (auto&& define : compiler.Defines()) command.push_back("-D" + define);
 
-   if (ToolChain::Platform() == "x86") command += "-arch:SSE2 ";
 
+   if (ToolChain::Platform() == "x86") command.push_back("-arch:SSE2");
 
-   if (compiler.CRT() == "Static") command += "-MT";
-   else command += "-MD";
 
-   if (debug) command += "d";
+   std::string crt = compiler.CRT() == "Static" ? "-MT" : "-MD";
+   if (debug) crt += "d";
+   command.push_back(crt);
 
-   command += " ";
 
+   if (debug) command.push_back("-Od");
+   else command.push_back("-Ox");
 
-   if (debug) command += "-Od ";
-   else command += "-Ox ";
 
+   if (debug) command.push_back("-RTC1");
 
-   if (debug) command += "-RTC1 ";
 
+   if (debug) command.push_back("-Zi");
 
-   if (debug) command += "-Zi ";
 
+   for (auto&& include : compiler.Includes()) command.push_back("-I" + include);
 
-   for (auto&& include : compiler.Includes()) command += "-I\"" + include + "\" ";
 
+   command.push_back("-W" + std::to_string(compiler.WarnLevel()));
+   if (compiler.WarningAsError()) command.push_back("-WX");
 
-   command += "-W" + std::to_string(compiler.WarnLevel()) + " ";
-   if (compiler.WarningAsError()) command += "-WX ";
+   for (auto&& disabledWarning : compiler.WarningDisable()) command.push_back("-wd" + std::to_string(disabledWarning));
 
-   for (auto&& disabledWarning : compiler.WarningDisable()) command += "-wd" + std::to_string(disabledWarning) + " ";
 
+   const auto append = [&command] (const std::string& options) {   // Options given as one string: Args(), FB_COMPILER...
+      const auto arguments = Process::Split(options);
+      command.insert(command.end(), arguments.begin(), arguments.end());
+   };
 
-   command += compiler.Args() + " ";
+   append(compiler.Args());
 
 
    std::filesystem::path out(compiler.ObjDir());
    if (!std::filesystem::exists(out)) std::filesystem::create_directories(out);
 
-   command += "-Fo\"" + out.string() + "/\" ";
+   command.push_back("-Fo" + out.string() + "/");
+
 
+   command.push_back("-Fp" + out.string() + "/PrecompiledHeader.pch");
 
-   command += "-Fp\"" + out.string() + "\"/PrecompiledHeader.pch ";
+
+   if (moduleGraph) {
+      for (auto&& directory : ModuleDirectories()) command.insert(command.end(), {"-ifcSearchDir", directory.string()});
+   }
 
 
    const char* env = std::getenv("FB_COMPILER");
-   if (env) command += ToolChain::RemoveGuardCF(env) + " ";
+   if (env) append(ToolChain::RemoveGuardCF(env));
 
    if (debug) {
       env = std::getenv("FB_COMPILER_DEBUG");
-      if (env) command += ToolChain::RemoveGuardCF(env) + " ";
+      if (env) append(ToolChain::RemoveGuardCF(env));
    }
    else {
       env = std::getenv("FB_COMPILER_RELEASE");
-      if (env) command += ToolChain::RemoveGuardCF(env) + " ";
+      if (env) append(ToolChain::RemoveGuardCF(env));
    }
 
    return command;
 }
 
-void ActualCompilerVisualStudio::CompilePrecompiledHeaders ()
+std::string ActualCompilerVisualStudio::Signature (bool precompiledCpp)
 {
-   if (outOfDate.empty()) return;
-   if (compiler.PrecompiledCPP().empty()) return;
+   // Everything that ends up in the object besides the sources: The command line (including FB_COMPILER...),
+   // the toolchain (vcvarsall and its arguments) and how the precompiled header is used.
+   std::string signature = Process::Join(CommandLine()) + "\n";
+   signature += ToolChain::ToolChain() + " " + ToolChain::Platform() + " " + ToolChain::SetEnvBatchCall() + "\n";
+
+   if (!compiler.PrecompiledH().empty()) {
+      signature += (precompiledCpp ? "-Yc " : "-Yu ") + compiler.PrecompiledH() + " " + compiler.PrecompiledCPP() + "\n";
+   }
+
+   return Hash::String(signature);
+}
+
+std::vector<std::filesystem::path> ActualCompilerVisualStudio::CachedOutputs (const std::string& file) const
+{
+   // -Zi writes the debug information of all files into one PDB, the object alone is of no use
+   if (compiler.Build() == "Debug") return {};
+
+   return {(std::filesystem::path(compiler.ObjDir()) / std::filesystem::path(file).filename()).replace_extension("obj")};
+}
+
+std::string ActualCompilerVisualStudio::CompilerIdentity ()
+{
+   // An update of Visual Studio may keep the vcvarsall arguments
+   const auto cl = Process::Find("cl", ToolChain::Environment());
+   if (cl.empty()) return {};
+
+   std::error_code error;
+   return cl.string() + " " + std::to_string(std::filesystem::file_size(cl, error)) + " " + std::to_string(LastWriteTime(cl));
+}
+
+
+std::future<void> ActualCompilerVisualStudio::CompilePrecompiledHeaders ()
+{
+   if (outOfDate.empty()) return {};
+   if (compiler.PrecompiledCPP().empty()) return {};
 
    std::filesystem::path cpp = std::filesystem::canonical(compiler.PrecompiledCPP());
    cpp.make_preferred();
@@ -187,36 +601,58 @@ void ActualCompilerVisualStudio::CompilePrecompiledHeaders ()
       return std::filesystem::equivalent(cpp, f);
    });
 
-   if (it == outOfDate.cend()) return;
+   if (it == outOfDate.cend()) return {};
 
    outOfDate.erase(it);
 
-   std::filesystem::path pch = std::filesystem::path(compiler.ObjDir()) / "PrecompiledHeader.pch";
+   const std::filesystem::path objDir{compiler.ObjDir()};
+   std::filesystem::path pch = objDir / "PrecompiledHeader.pch";
    if (std::filesystem::exists(pch)) std::filesystem::remove(pch);
 
-   std::string command =  "CL " + CommandLine();
-   command += "-Yc\"" + std::filesystem::path{compiler.PrecompiledH()}.filename().string() + "\" ";
-   command += cpp.string();
+   // The options without the ObjDir, the PCH and its object are written where build() says
+   Process::Arguments options;
+   for (auto&& option : CommandLine()) {
+      if (option.rfind("-Fo", 0) != 0 && option.rfind("-Fp", 0) != 0) options.push_back(option);
+   }
+   const auto yc = "-Yc" + std::filesystem::path{compiler.PrecompiledH()}.filename().string();
+
+   const auto build = [=] (const std::filesystem::path& directory) {
+      Process::Arguments command{"CL"};
+      command.insert(command.end(), options.begin(), options.end());
+      command.push_back("-Fo" + directory.string() + "/");
+      command.push_back("-Fp" + (directory / pch.filename()).string());
+      command.push_back(yc);
+      command.push_back(cpp.string());
+
+      BuildPrecompiled(command, directory / pch.filename());
+   };
+
+   // -Zi writes the types of the PCH into the PDB of the ObjDir, the PCH can't go without it
+   if (!SharedPch::Enabled() || compiler.Build() == "Debug") return std::async(std::launch::async, [=] { build(objDir); });
 
-   std::string cmd = ToolChain::SetEnvBatchCall() + " & " + command;
-   int rc = std::system(cmd.c_str());
-   if (rc != 0) throw std::runtime_error("Compile Error");
+   // The key here, CppDepends is set up for this target and RestoreFromCache() runs next
+   const auto signature = Process::Join(options) + "\n" + yc + "\n" + ToolChain::ToolChain() + " " + ToolChain::Platform() + " " + ToolChain::SetEnvBatchCall() + "\n" + CompilerIdentity();
+   const auto key = SharedPchKey(compiler, cpp.string(), signature);
+   const auto obj = std::filesystem::path(cpp.filename()).replace_extension("obj").string();
+   return std::async(std::launch::async, [=] { SharedPch::Obtain(key, {pch.filename().string(), obj}, objDir, build); });
 }
 
 
 class CLMPWorker {
 private:
    std::filesystem::path objdir_;
-   std::string cmdprefix_;
+   Process::Arguments command_;
    std::vector<std::string> source_;
+   unsigned slots_{1};
    bool failed_{ false };
    uint64_t starttime_{0};
 
 public:
-   CLMPWorker(std::string cmdprefix, std::filesystem::path objdir, std::vector<std::string> source)
-      : cmdprefix_(std::move(cmdprefix))
-      , objdir_(std::move(objdir))
+   CLMPWorker(Process::Arguments command, std::filesystem::path objdir, std::vector<std::string> source, unsigned slots)
+      : objdir_(std::move(objdir))
+      , command_(std::move(command))
       , source_(std::move(source))
+      , slots_(slots)
       , starttime_(std::chrono::duration_cast<std::chrono::seconds>(std::chrono::system_clock::now().time_since_epoch()).count())
    {
    }
@@ -224,36 +660,21 @@ public:
    void Wait()
    {
       failed_ = false;
-      const auto path = [&] {
-         std::stringstream ss;
-         ss << "FBuild_CLMPWorker_" << std::this_thread::get_id() << ".rsp";
-         return objdir_ / std::filesystem::path(ss.str());
-      } ();
-
-      try {
-         {
-            std::ofstream message(path, std::ios::trunc);
-            for (const auto& src : source_) {
-               message << "\"" << src << "\" ";
-            }
-         }
-
-         const auto cmd = cmdprefix_ + " @" + path.string();
-         const int rc = std::system(cmd.c_str());
-         if (rc != 0) {
-            failed_ = true;
-         }
-      }
-      catch (std::exception& e) {
-         std::cerr << e.what() << std::endl;
-         failed_ = true;
-      }
-      catch (...) {
-         failed_ = true;
-      }
 
-      std::error_code nothrow;
-      std::filesystem::remove(path, nothrow);
+      Supervisor::Job job;
+      job.arguments = command_;
+      job.arguments.insert(job.arguments.end(), source_.begin(), source_.end());   // Process::Start() switches to a response file, if the command line gets too long
+      job.environment = ToolChain::Environment();
+      job.slots = slots_;
+      job.captureOutput = false;   // CL prints the files as it goes
+      job.done = [this] (const Supervisor::Result& result) {
+         if (!result.output.empty()) std::cerr << result.output << std::endl;   // Couldn't start
+         failed_ = result.exitCode != 0;
+      };
+
+      Supervisor::Batch batch;
+      batch.Submit(std::move(job));
+      batch.Wait();
    }
 
    void UpdateSourceFiles () 
@@ -263,9 +684,7 @@ public:
          return std::filesystem::exists(check) && LastWriteTime(check) >= starttime_;
       }), source_.end());
 
-      static std::random_device rd;
-      static std::mt19937 g(rd());
-      std::shuffle(source_.begin(), source_.end(), g);
+      LongestFirst(source_, objdir_, "obj");
    }
 
    bool IsFailed () const
@@ -281,20 +700,42 @@ public:
 
 
 
+Supervisor::Job ActualCompilerVisualStudio::ModuleJob (const std::string& file, const Modules::Unit& unit, const std::filesystem::path& bmi)
+{
+   Supervisor::Job job;
+   job.arguments = {"CL"};
+   const auto options = CommandLine();
+   job.arguments.insert(job.arguments.end(), options.begin(), options.end());
+
+   if (compiler.PrecompiledH().size()) {
+      job.arguments.push_back("-FI" + compiler.PrecompiledH());
+      job.arguments.push_back("-Yu" + compiler.PrecompiledH());
+   }
+
+   job.arguments.insert(job.arguments.end(), {unit.exported ? "-interface" : "-internalPartition", "-ifcOutput", bmi.string(), file});
+   job.environment = ToolChain::Environment();
+   job.action = (std::filesystem::path(compiler.ObjDir()) / std::filesystem::path(file).filename()).replace_extension("obj").string();
+   return job;
+}
+
 void ActualCompilerVisualStudio::CompileFiles ()
 {
    if (outOfDate.empty()) {
       return;
    }
 
-   std::string commandLine = CommandLine();
+   Process::Arguments command{"CL"};
+   const auto options = CommandLine();
+   command.insert(command.end(), options.begin(), options.end());
 
    if (compiler.PrecompiledH().size()) {
-      commandLine += "-FI\"" + compiler.PrecompiledH() + "\" ";
-      commandLine += "-Yu\"" + compiler.PrecompiledH() + "\" ";
+      command.push_back("-FI" + compiler.PrecompiledH());
+      command.push_back("-Yu" + compiler.PrecompiledH());
    }
 
-   const auto threads = std::clamp(compiler.Threads(), std::max(static_cast<int>(std::thread::hardware_concurrency()), 2), static_cast<int>(outOfDate.size()));
+   // -MP counts against the global limit (jobs=, jobserver) like any other job
+   const auto limit = static_cast<int>(Supervisor::Limit());
+   const auto threads = std::max(std::min({compiler.Threads() > 0 ? compiler.Threads() : limit, limit, static_cast<int>(outOfDate.size())}), 1);
 
    std::vector<std::string> skipped;
    bool failed = false;
@@ -313,11 +754,17 @@ void ActualCompilerVisualStudio::CompileFiles ()
       outOfDate.erase(it, outOfDate.end());
    }
 
+   LongestFirst(outOfDate, compiler.ObjDir(), "obj");   // CL -MP starts the files in the order they are given
+
    {
-      const auto cmdprefix = ToolChain::SetEnvBatchCall() + " & CL " + commandLine + " -MP" + std::to_string(threads) + " ";
-      auto worker = CLMPWorker{cmdprefix, compiler.ObjDir(), outOfDate};
+      auto multiProcess = command;
+      multiProcess.push_back("-MP" + std::to_string(threads));
+      auto worker = CLMPWorker{multiProcess, compiler.ObjDir(), outOfDate, static_cast<unsigned>(threads)};
       worker.Wait();
 
+      // CL prints the diagnostics of all files mixed, the cache gets none. Failed files have no object.
+      for (auto&& cpp : outOfDate) StoreInCache(cpp, {});
+
       if (worker.IsFailed()) {
          worker.UpdateSourceFiles();
          const auto& files = worker.GetSourceFiles();
@@ -332,52 +779,25 @@ void ActualCompilerVisualStudio::CompileFiles ()
 
    std::cout << std::endl;
 
-   std::mutex mutex;
-   std::atomic<int> errors;
-
-   auto threadFunction = [&] () {
-      std::string cpp;
-      std::string command;
-
-      for (;;) {
-         try {
-            {
-               std::lock_guard<std::mutex> lock{mutex};
-               auto it = skipped.rbegin();
-               if (it == skipped.rend()) break;
-               cpp = (*it);
-               skipped.pop_back();
-            }
-
-            command = "CL " + commandLine + " -MP1 \"" + cpp + "\" ";
-
-            std::string cmd = ToolChain::SetEnvBatchCall() + " & " + command;
-            int rc = std::system(cmd.c_str());
-            if (rc != 0) {
-               std::lock_guard<std::mutex> lock{mutex};
-               ++errors;
-            }
-         }
-         catch (std::exception& e) {
-            std::cout << e.what() << std::endl;
-            std::lock_guard<std::mutex> lock{mutex};
-            ++errors;
-         }
-         catch (...) {
-            std::lock_guard<std::mutex> lock{mutex};
-            ++errors;
-         }
-      }
-   };
-
-   std::vector<std::thread> threadGroup;
-   for (int i = 0; i < threads; ++i) {
-      threadGroup.push_back(std::thread{ threadFunction });
+   std::atomic<int> errors{0};
+   Supervisor::Batch batch;
+
+   for (auto&& cpp : skipped) {
+      Supervisor::Job job;
+      job.arguments = command;
+      job.arguments.push_back("-MP1");
+      job.arguments.push_back(cpp);
+      job.environment = ToolChain::Environment();
+      job.action = (std::filesystem::path(compiler.ObjDir()) / std::filesystem::path(cpp).filename()).replace_extension("obj").string();
+      job.done = [this, &errors, cpp] (const Supervisor::Result& result) {
+         std::cout << result.output << std::flush;   // In one piece, not mixed with the other files
+         if (result.exitCode != 0) ++errors, RecordFailure(cpp, result.output);
+         else StoreInCache(cpp, result.output);
+      };
+      batch.Submit(std::move(job));
    }
 
-   for (auto&& thread : threadGroup) {
-      thread.join();
-   }
+   batch.Wait();
 
    if (errors) {
       throw std::runtime_error("Compile Error");
@@ -397,13 +817,29 @@ void ActualCompilerVisualStudio::Compile ()
    CheckParams();
    if (!NeedsRebuild()) return;
 
+   Snapshot::Invalidate();
+
    std::cout << "\nCompiling (" << ToolChain::ToolChain() << " " << ToolChain::Platform() << ")" << std::endl;
 
    compiler.DoBeforeCompile();
 
    DeleteOutOfDateObjectFiles();
-   CompilePrecompiledHeaders();
-   CompileFiles();
+
+   const auto compiling = outOfDate;   // CompilePrecompiledHeaders() takes the PCH out of the list
+   try {
+      auto precompiled = CompilePrecompiledHeaders();   // All files use it, the ObjectCache is searched meanwhile
+      RestoreFromCache();
+      if (precompiled.valid()) precompiled.get();
+
+      CompileModules();
+      CompileFiles();
+   }
+   catch (...) {
+      SaveSignatures(compiling);
+      throw;
+   }
+
+   SaveSignatures(compiling);
 }
 
 
@@ -411,13 +847,1050 @@ void ActualCompilerVisualStudio::Compile ()
 
 
 
+namespace {
 
-void Compiler::Compile ()
-{
-   const auto toolChain = ToolChain::ToolChain();
-   if (toolChain.substr(0, 4) == "MSVC") actualCompiler.reset(new ActualCompilerVisualStudio{*this});
-   else throw std::runtime_error("Unbekannte Toolchain: " + toolChain);
+   // The dependencies from a .d file written by -MMD. Make syntax: "obj: dep dep \" with escaped spaces.
+   std::vector<std::string> ReadDependencyFile (const std::filesystem::path& file)
+   {
+      std::ifstream in{file, std::ios::binary};
+      const std::string content{std::istreambuf_iterator<char>{in}, std::istreambuf_iterator<char>{}};
+
+      std::vector<std::string> result;
+      std::string current;
+      bool target = true;
+
+      const auto flush = [&] () {
+         if (!current.empty() && !target) result.push_back(current);
+         current.clear();
+      };
+
+      for (size_t i = 0; i < content.size(); ++i) {
+         const char ch = content[i];
+
+         if (ch == '\\' && i + 1 < content.size()) {
+            const char next = content[i + 1];
+            if (next == '\n' || next == '\r') {   // Continuation
+               flush();
+               ++i;
+               if (next == '\r' && i + 1 < content.size() && content[i + 1] == '\n') ++i;
+               continue;
+            }
+            if (next == ' ' || next == '#' || next == '\\') {
+               current += next;
+               ++i;
+               continue;
+            }
+         }
+
+         if (ch == '$' && i + 1 < content.size() && content[i + 1] == '$') {
+            current += '$';
+            ++i;
+            continue;
+         }
+
+         if (target && ch == ':' && (i + 1 == content.size() || isspace(static_cast<unsigned char>(content[i + 1])))) {
+            current.clear();
+            target = false;
+            continue;
+         }
+
+         if (ch == '\n' || ch == '\r') {   // Only the first rule counts, -MP would add empty ones for the headers
+            flush();
+            if (!target) break;
+            continue;
+         }
+
+         if (ch == ' ' || ch == '\t') {
+            flush();
+            continue;
+         }
 
-   actualCompiler->Compile();
+         current += ch;
+      }
+
+      flush();
+      return result;
+   }
+
+   // Empty if the object is up to date, otherwise the reason and the deciding dependency
+   std::pair<std::string, std::string> CheckDependencies (const std::filesystem::path& obj)
+   {
+      if (!std::filesystem::exists(obj)) return {"missing object", {}};
+
+      auto dependencyFile = obj;
+      dependencyFile += ".d";
+      if (!std::filesystem::exists(dependencyFile)) return {"missing dependency file", dependencyFile.string()};
+
+      const auto objTime = LastWriteTime(obj);
+
+      for (auto&& dependency : ReadDependencyFile(dependencyFile)) {
+         if (!std::filesystem::exists(dependency)) return {"missing dependency", dependency};
+         if (LastWriteTime(dependency) > objTime) return {"newer dependency", dependency};
+      }
+
+      return {};
+   }
+}
+
+
+
+void ActualCompilerGcc::CheckParams ()
+{
+   if (compiler.ObjDir().empty()) compiler.ObjDir(compiler.Build());
+}
+
+void ActualCompilerGcc::UpdateOutOfDate ()
+{
+   const auto start = std::chrono::steady_clock::now();
+
+   const auto& files = compiler.TranslationUnits();
+   const auto objects = ObjFiles();
+
+   std::vector<char> result(files.size(), 0);
+   std::atomic<size_t> next{0};
+
+   const auto worker = [&] () {
+      for (size_t i = next++; i < files.size(); i = next++) {
+         const auto checkStart = std::chrono::steady_clock::now();
+         const auto [reason, dependency] = CheckDependencies(objects[i]);
+         if (reason.empty()) continue;
+
+         result[i] = 1;
+         Explain::OutOfDate(objects[i], reason, dependency, std::chrono::steady_clock::now() - checkStart);
+      }
+   };
+
+   const auto threads = std::min<size_t>(compiler.Threads() > 0 ? compiler.Threads() : std::max(std::thread::hardware_concurrency(), 1u), files.size());
+   std::vector<std::thread> threadGroup;
+   for (size_t i = 1; i < threads; ++i) threadGroup.emplace_back(worker);
+   worker();
+   for (auto&& thread : threadGroup) thread.join();
+
+   // A changed precompiled header rebuilds everything that uses it
+   if (!compiler.PrecompiledH().empty()) {
+      auto gch = PrecompiledInclude();
+      gch += ToolChain::Clang() ? ".pch" : ".gch";
+      const auto [reason, dependency] = CheckDependencies(gch);
+      if (!reason.empty()) {
+         for (size_t i = 0; i < files.size(); ++i) {
+            if (result[i] || std::filesystem::path(files[i]).extension() == ".c") continue;
+            result[i] = 1;
+            Explain::OutOfDate(objects[i], "precompiled header: " + reason, dependency);
+         }
+      }
+   }
+
+   for (size_t i = 0; i < files.size(); ++i) {
+      if (result[i]) outOfDate.push_back(files[i]);
+   }
+
+   Explain::Checked("Dependencies " + compiler.ObjDir(), files.size(), std::chrono::steady_clock::now() - start);
+}
+
+Process::Arguments ActualCompilerGcc::CommandLine (bool cpp)
+{
+   bool debug = compiler.Build() == "Debug";
+
+   Process::Arguments command{"-c", "-pipe", "-fPIC"};
+   if (cpp) command.push_back("-std=c++20");
+
+
+   if (debug) command.push_back("-D_DEBUG");
+   else command.push_back("-DNDEBUG");
+
+   for (auto&& define : compiler.Defines()) command.push_back("-D" + define);
+
+
+   if (ToolChain::Platform() == "x86") command.push_back("-m32");
+
+
+   if (debug) {
+      command.push_back("-O0");
+      command.push_back("-g");
+   }
+   else command.push_back("-O2");
+
+
+   for (auto&& include : compiler.Includes()) command.push_back("-I" + include);
+
+
+   // WarnLevel() counts like MSVC. WarningDisable() takes MSVC numbers and has no GCC equivalent, use Args() for -Wno-...
+   switch (compiler.WarnLevel()) {
+      case 0:  command.push_back("-w"); break;
+      case 1:  break;
+      case 2:  command.push_back("-Wall"); break;
+      default: command.push_back("-Wall"); command.push_back("-Wextra"); break;
+   }
+   if (compiler.WarningAsError()) command.push_back("-Werror");
+
+
+   // gcc asks the mapper for the BMIs, clang looks in the directories. -Mno-modules keeps the BMIs out of the .d.
+   if (cpp && moduleGraph) {
+      if (ToolChain::Clang()) {
+         for (auto&& directory : ModuleDirectories()) command.push_back("-fprebuilt-module-path=" + directory.string());
+      }
+      else command.insert(command.end(), {"-fmodules-ts", "-fmodule-mapper=" + ModuleMapper().string(), "-Mno-modules"});
+   }
+
+
+   const auto append = [&command] (const std::string& options) {   // Options given as one string: Args(), FB_COMPILER...
+      const auto arguments = Process::Split(options);
+      command.insert(command.end(), arguments.begin(), arguments.end());
+   };
+
+   append(compiler.Args());
+
+
+   const char* env = std::getenv("FB_COMPILER");
+   if (env) append(env);
+
+   if (debug) {
+      env = std::getenv("FB_COMPILER_DEBUG");
+      if (env) append(env);
+   }
+   else {
+      env = std::getenv("FB_COMPILER_RELEASE");
+      if (env) append(env);
+   }
+
+   return command;
+}
+
+std::string ActualCompilerGcc::Signature (bool /*precompiledCpp*/)
+{
+   // The PCH cpp isn't special with gcc, the header is compiled on its own
+   std::string signature = Process::Join(CommandLine(true)) + "\n" + Process::Join(CommandLine(false)) + "\n";
+   signature += ToolChain::ToolChain() + " " + ToolChain::Platform() + " " + ToolChain::CxxCompiler() + " " + ToolChain::CCompiler() + "\n";
+
+   if (!compiler.PrecompiledH().empty()) signature += "-include " + compiler.PrecompiledH() + "\n";
+
+   return Hash::String(signature);
+}
+
+std::filesystem::path ActualCompilerGcc::PrecompiledInclude () const
+{
+   return std::filesystem::path(compiler.ObjDir()) / "PrecompiledHeader.h";
+}
+
+std::vector<std::filesystem::path> ActualCompilerGcc::CachedOutputs (const std::string& file) const
+{
+   const auto obj = (std::filesystem::path(compiler.ObjDir()) / std::filesystem::path(file).filename()).replace_extension("o");
+   auto dependencyFile = obj;
+   dependencyFile += ".d";
+
+   return {obj, dependencyFile};   // Without the .d the next run would compile it again
+}
+
+std::string ActualCompilerGcc::CompilerIdentity ()
+{
+   // Which gcc the PATH finds, and -g records the working directory
+   std::string identity = std::filesystem::current_path().string();
+
+   for (auto&& program : {ToolChain::CxxCompiler(), ToolChain::CCompiler()}) {
+      const auto path = Process::Find(program, ToolChain::Environment());
+      std::error_code error;
+      identity += "\n" + path.string() + " " + std::to_string(std::filesystem::file_size(path, error)) + " " + std::to_string(path.empty() ? 0 : LastWriteTime(path));
+   }
+
+   return identity;
+}
+
+std::string ActualCompilerGcc::BmiExtension () const
+{
+   return ToolChain::Clang() ? "pcm" : "gcm";
+}
+
+std::filesystem::path ActualCompilerGcc::ModuleMapper () const
+{
+   return std::filesystem::path(compiler.ObjDir()) / "Modules" / "Mapper.txt";
+}
+
+// Format: module bmi per line. With the modules of the targets before, gcc has no search path for BMIs.
+void ActualCompilerGcc::WriteModuleMapper ()
+{
+   if (!moduleGraph) return;
+
+   std::string content;
+   for (auto&& [module, bmi] : Modules::Registered()) content += module + " " + bmi.string() + "\n";
+
+   const auto mapper = ModuleMapper();
+   {
+      std::ifstream in{mapper, std::ios::binary};
+      const std::string old{std::istreambuf_iterator<char>{in}, std::istreambuf_iterator<char>{}};
+      if (old == content) return;
+   }
+
+   std::ofstream out{mapper, std::ios::binary | std::ios::trunc};
+   out << content;
+   if (!out.flush()) throw std::runtime_error("Error writing " + mapper.string());
+}
+
+Supervisor::Job ActualCompilerGcc::ModuleJob (const std::string& file, const Modules::Unit& /*unit*/, const std::filesystem::path& bmi)
+{
+   const auto obj = (std::filesystem::path(compiler.ObjDir()) / std::filesystem::path(file).filename()).replace_extension("o");
+   auto dependencyFile = obj;
+   dependencyFile += ".d";
+
+   Supervisor::Job job;
+   job.arguments = {ToolChain::CxxCompiler()};
+   const auto options = CommandLine(true);
+   job.arguments.insert(job.arguments.end(), options.begin(), options.end());
+
+   if (!compiler.PrecompiledH().empty()) job.arguments.insert(job.arguments.end(), {"-include", PrecompiledInclude().string(), "-Winvalid-pch"});
+
+   // gcc writes the BMI where the mapper says, .cppm and .ixx are no C++ to it by their extension
+   if (ToolChain::Clang()) job.arguments.insert(job.arguments.end(), {"-fmodule-output=" + bmi.string(), "-x", "c++-module"});
+   else job.arguments.insert(job.arguments.end(), {"-x", "c++"});
+
+   job.arguments.insert(job.arguments.end(), {"-MMD", "-MF", dependencyFile.string(), "-o", obj.string(), file});
+   job.environment = ToolChain::Environment();
+   job.action = obj.string();
+   return job;
+}
+
+std::future<void> ActualCompilerGcc::CompilePrecompiledHeader ()
+{
+   if (compiler.PrecompiledH().empty()) return {};
+
+   // gcc only uses a .gch next to the included header. The sources include the header with -include
+   // from the ObjDir, so the .gch of each build lives there and not next to the real header.
+   const auto include = PrecompiledInclude();
+   const auto content = "#include \"" + std::filesystem::canonical(compiler.PrecompiledH()).generic_string() + "\"\n";
+
+   bool changed = false;
+   {
+      std::ifstream in{include, std::ios::binary};
+      const std::string old{std::istreambuf_iterator<char>{in}, std::istreambuf_iterator<char>{}};
+      changed = old != content;
+   }
+   if (changed) std::ofstream{include, std::ios::binary | std::ios::trunc} << content;
+
+   auto gch = include;
+   gch += ToolChain::Clang() ? ".pch" : ".gch";
+   if (!changed && CheckDependencies(gch).first.empty()) return {};   // A shared .d names the include of the entry, not this one
+
+   std::filesystem::remove(gch);
+
+   const auto options = CommandLine(true);
+
+   // The .gch/.pch is only used next to an include with the same content, the entry of the SharedPch gets its own
+   const auto build = [=] (const std::filesystem::path& directory) {
+      const auto wrapper = directory / include.filename();
+      if (wrapper != include) std::ofstream{wrapper, std::ios::binary | std::ios::trunc} << content;
+
+      const auto output = directory / gch.filename();
+      auto dependencyFile = output;
+      dependencyFile += ".d";
+
+      Process::Arguments command{ToolChain::CxxCompiler()};
+      command.insert(command.end(), options.begin(), options.end());
+      command.insert(command.end(), {"-x", "c++-header", wrapper.string(), "-o", output.string(), "-MMD", "-MF", dependencyFile.string()});
+
+      BuildPrecompiled(command, output);
+   };
+
+   if (!SharedPch::Enabled()) return std::async(std::launch::async, [=] { build(include.parent_path()); });
+
+   // The key here, CppDepends is set up for this target and RestoreFromCache() runs next
+   const auto signature = Process::Join(options) + "\n" + ToolChain::ToolChain() + " " + ToolChain::Platform() + " " + ToolChain::CxxCompiler() + "\n" + CompilerIdentity();
+   const auto key = SharedPchKey(compiler, compiler.PrecompiledH(), signature);
+   return std::async(std::launch::async, [=] { SharedPch::Obtain(key, {gch.filename().string(), gch.filename().string() + ".d"}, include.parent_path(), build); });
+}
+
+// For the compile of a preprocessed source: Without the options of the preprocessor and their values, "-D X" as well as "-DX"
+static Process::Arguments WithoutPreprocessorOptions (const Process::Arguments& arguments)
+{
+   static const std::vector<std::string> withValue{"-include", "-imacros", "-isystem", "-iquote", "-idirafter", "-iprefix", "-iwithprefix",
+                                                   "-iwithprefixbefore", "-isysroot", "-MF", "-MT", "-MQ", "-Xpreprocessor", "-I", "-D", "-U"};
+   static const std::vector<std::string> joined{"-isystem", "-iquote", "-idirafter", "-iprefix", "-iwithprefix", "-iwithprefixbefore",
+                                                "-isysroot", "-I", "-D", "-U", "-M", "-Wp,"};
+
+   Process::Arguments result;
+
+   for (size_t i = 0; i < arguments.size(); ++i) {
+      const auto& argument = arguments[i];
+
+      if (std::find(withValue.begin(), withValue.end(), argument) != withValue.end()) {
+         ++i;   // And its value
+         continue;
+      }
+
+      if (i > 0 && std::any_of(joined.begin(), joined.end(), [&argument] (const std::string& option) { return argument.rfind(option, 0) == 0; })) continue;
+
+      result.push_back(argument);
+   }
+
+   return result;
+}
+
+void ActualCompilerGcc::CompileFiles (std::vector<std::string> files, bool remote)
+{
+   if (files.empty()) return;
+
+   const std::filesystem::path objdir{compiler.ObjDir()};
+
+   Process::Arguments cCommand{ToolChain::CCompiler()};
+   const auto cOptions = CommandLine(false);
+   cCommand.insert(cCommand.end(), cOptions.begin(), cOptions.end());
+
+   Process::Arguments cppCommand{ToolChain::CxxCompiler()};
+   const auto cppOptions = CommandLine(true);
+   cppCommand.insert(cppCommand.end(), cppOptions.begin(), cppOptions.end());
+
+   const auto workerCppCommand = cppCommand;   // Gets the source preprocessed, the PCH stays here
+
+   if (!compiler.PrecompiledH().empty()) {
+      cppCommand.push_back("-include");
+      cppCommand.push_back(PrecompiledInclude().string());
+      cppCommand.push_back("-Winvalid-pch");
+   }
+
+   std::atomic<int> errors{0};
+   Supervisor::Batch batch;
+
+   const auto finished = [this, &errors] (const std::string& file, int exitCode, const std::string& output) {
+      std::cout << std::filesystem::path(file).filename().string() << "\n" << output << std::flush;   // In one piece, not mixed with the other files
+      if (exitCode != 0) ++errors, RecordFailure(file, output);
+      else StoreInCache(file, output);
+   };
+
+   const auto localJob = [&] (const std::string& file) {
+      const auto obj = (objdir / std::filesystem::path(file).filename()).replace_extension("o");
+      auto dependencyFile = obj;
+      dependencyFile += ".d";
+
+      Supervisor::Job job;
+      job.arguments = std::filesystem::path(file).extension() == ".c" ? cCommand : cppCommand;
+      job.arguments.insert(job.arguments.end(), {"-MMD", "-MF", dependencyFile.string(), "-o", obj.string(), file});
+      job.environment = ToolChain::Environment();
+      job.action = obj.string();
+      return job;
+   };
+
+   const auto workers = !remote || moduleGraph ? decltype(Executor::Available()){} : Executor::Available();   // The workers have no BMIs
+
+   if (workers.empty()) {
+      for (auto&& file : files) {
+         auto job = localJob(file);
+         job.done = [&finished, file] (const Supervisor::Result& result) { finished(file, result.exitCode, result.output); };
+         batch.Submit(std::move(job));
+      }
+
+      batch.Wait();
+
+      if (errors) throw std::runtime_error("Compile Error");
+      return;
+   }
+
+   // Whoever is free takes the next file: The local slots and the slots of the workers
+   LongestFirst(files, objdir, "o");
+   std::mutex mutex;
+   std::deque<std::string> pending(files.begin(), files.end());
+   const auto next = [&] () -> std::optional<std::string> {
+      const auto lock = std::lock_guard{mutex};
+      if (pending.empty()) return std::nullopt;
+      auto file = std::move(pending.front());
+      pending.pop_front();
+      return file;
+   };
+
+   std::function<void (const std::string&)> compileLocally = [&] (const std::string& file) {
+      auto job = localJob(file);
+      job.done = [&, file] (const Supervisor::Result& result) {
+         finished(file, result.exitCode, result.output);
+         if (const auto following = next()) compileLocally(*following);
+      };
+      batch.Submit(std::move(job));
+   };
+
+   // false if the worker failed. The .d comes from the preprocessor.
+   const auto compileRemotely = [&] (Executor::Worker& worker, const std::string& file) {
+      const bool isC = std::filesystem::path(file).extension() == ".c";
+      const auto obj = (objdir / std::filesystem::path(file).filename()).replace_extension("o");
+      auto dependencyFile = obj;
+      dependencyFile += ".d";
+      auto preprocessed = obj;
+      preprocessed.replace_extension(isC ? "i" : "ii");
+
+      Supervisor::Job preprocess;
+      preprocess.arguments = isC ? cCommand : workerCppCommand;
+      if (!isC && !compiler.PrecompiledH().empty()) preprocess.arguments.insert(preprocess.arguments.end(), {"-include", std::filesystem::canonical(compiler.PrecompiledH()).string()});
+      preprocess.arguments.insert(preprocess.arguments.end(), {"-E", "-MMD", "-MF", dependencyFile.string(), "-MT", obj.string(), "-o", preprocessed.string(), file});
+      preprocess.environment = ToolChain::Environment();
+
+      std::promise<Supervisor::Result> promise;
+      auto future = promise.get_future();
+      preprocess.done = [&promise] (const Supervisor::Result& result) { promise.set_value(result); };
+      batch.Submit(std::move(preprocess));
+
+      const auto preprocessResult = future.get();
+      if (preprocessResult.exitCode != 0) {   // The compile would fail the same way
+         finished(file, preprocessResult.exitCode, preprocessResult.output);
+         return true;
+      }
+
+      Executor::Action action;
+      action.arguments = WithoutPreprocessorOptions(isC ? cCommand : workerCppCommand);   // Done by the preprocessor
+      action.inputName = preprocessed.filename().string();
+      {
+         std::ifstream in{preprocessed, std::ios::binary};
+         action.input.assign(std::istreambuf_iterator<char>{in}, std::istreambuf_iterator<char>{});
+      }
+      std::filesystem::remove(preprocessed);
+
+      Executor::Result result;
+      if (!worker.Run(action, result)) return false;
+
+      if (result.exitCode == 0) {
+         std::ofstream out{obj, std::ios::binary | std::ios::trunc};
+         if (!(out << result.object) || !out.flush()) {
+            out.close();
+            std::error_code error;
+            std::filesystem::remove(obj, error);   // No half object with a new timestamp
+            finished(file, -1, "Error writing " + obj.string() + "\n");
+            return true;
+         }
+      }
+
+      finished(file, result.exitCode, result.output);
+      return true;
+   };
+
+   // A quarter of a local slot per worker slot stays free for the preprocessor
+   unsigned remoteSlots = 0;
+   for (auto&& worker : workers) remoteSlots += worker->Slots();
+   const auto limit = Supervisor::Limit();
+   const auto localSlots = std::max(limit - std::min(limit, (remoteSlots + 3) / 4), 1u);
+
+   for (unsigned i = 0; i < localSlots; ++i) {
+      const auto file = next();
+      if (!file) break;
+      compileLocally(*file);
+   }
+
+   std::vector<std::thread> threads;
+   for (auto&& worker : workers) {
+      for (unsigned i = 0; i < worker->Slots(); ++i) {
+         threads.emplace_back([&, worker] {
+            while (worker->Slots() > 0) {   // 0 after a failure, the local slots take over
+               const auto file = next();
+               if (!file) return;
+
+               try {
+                  if (!compileRemotely(*worker, *file)) compileLocally(*file);
+               }
+               catch (std::exception& e) {
+                  finished(*file, -1, std::string(e.what()) + "\n");
+               }
+            }
+         });
+      }
+   }
+
+   for (auto&& thread : threads) thread.join();
+   batch.Wait();   // After the workers, a failed one hands its file to the batch
+
+   if (errors) throw std::runtime_error("Compile Error");
+}
+
+void ActualCompilerGcc::Compile ()
+{
+   CheckParams();
+
+   std::filesystem::create_directories(compiler.ObjDir());
+
+   if (!NeedsRebuild()) return;
+
+   Snapshot::Invalidate();
+
+   std::cout << "\nCompiling (" << ToolChain::ToolChain() << " " << ToolChain::Platform() << ")" << std::endl;
+
+   compiler.DoBeforeCompile();
+
+   DeleteOutOfDateObjectFiles();
+
+   const auto compiling = outOfDate;
+   try {
+      WriteModuleMapper();
+
+      // The C files don't use the PCH, they compile while it's built. Only here, the workers take the C++ files.
+      auto precompiled = CompilePrecompiledHeader();
+      RestoreFromCache();
+      auto cFiles = std::async(std::launch::async, [this, files = OutOfDateFiles(true)] { CompileFiles(files, false); });
+      if (precompiled.valid()) precompiled.get();
+
+      CompileModules();
+      CompileFiles(OutOfDateFiles(false), true);
+      cFiles.get();
+   }
+   catch (...) {
+      SaveSignatures(compiling);
+      throw;
+   }
+
+   SaveSignatures(compiling);
+}
+
+
+
+
+
+
+namespace {
+
+   // emcc prints its subcommands quoted for the shell of the platform
+   Process::Arguments SplitPrinted (std::string_view line)
+   {
+#ifdef _WIN32
+      return Process::Split(line);
+#else
+      Process::Arguments result;
+      std::string current;
+      bool inArgument = false;
+
+      for (size_t i = 0; i < line.size(); ++i) {
+         const char ch = line[i];
+
+         if (ch == '\'') {
+            const auto end = line.find('\'', i + 1);
+            if (end == std::string_view::npos) throw std::runtime_error("Unbalanced quotes in " + std::string{line});
+            current.append(line.substr(i + 1, end - i - 1));
+            i = end;
+            inArgument = true;
+         }
+         else if (ch == '"') {
+            for (++i; i < line.size() && line[i] != '"'; ++i) {
+               if (line[i] == '\\' && i + 1 < line.size()) ++i;
+               current += line[i];
+            }
+            inArgument = true;
+         }
+         else if (ch == '\\' && i + 1 < line.size()) {
+            current += line[++i];
+            inArgument = true;
+         }
+         else if (ch == ' ' || ch == '\t') {
+            if (inArgument) result.push_back(std::move(current));
+            current.clear();
+            inArgument = false;
+         }
+         else {
+            current += ch;
+            inArgument = true;
+         }
+      }
+
+      if (inArgument) result.push_back(std::move(current));
+      return result;
+#endif
+   }
+}
+
+
+
+void ActualCompilerEmscripten::CheckParams ()
+{
+   if (compiler.ObjDir().empty()) compiler.ObjDir(compiler.Build());
+}
+
+void ActualCompilerEmscripten::UpdateOutOfDate ()
+{
+   ::CppOutOfDate checker{ "o" };
+   checker.OutDir(compiler.ObjDir());
+   checker.Threads(compiler.Threads());
+   checker.Files(compiler.TranslationUnits());
+   checker.Include(compiler.Includes());
+   checker.PrecompiledHeader(compiler.PrecompiledH());
+   checker.Go();
+
+   outOfDate = checker.OutOfDate();
+}
+
+Process::Arguments ActualCompilerEmscripten::CommandLine (bool cpp)
+{
+   bool debug = compiler.Build() == "Debug";
+
+   Process::Arguments command{"-c", "-s", "DISABLE_EXCEPTION_CATCHING=0"};   // Same as ActualLinkerEmscripten
+   if (cpp) command.push_back("-std=c++20");
+
+
+   if (debug) command.insert(command.end(), {"-D_DEBUG", "-g", "-O1"});
+   else command.insert(command.end(), {"-DNDEBUG", "-O3"});
+
+   for (auto&& define : compiler.Defines()) command.push_back("-D" + define);
+
+
+   for (auto&& include : compiler.Includes()) command.push_back("-I" + include);
+
+
+   // emcc is clang: Same mapping as ActualCompilerGcc. WarningDisable() takes MSVC numbers and is ignored.
+   switch (compiler.WarnLevel()) {
+      case 0:  command.push_back("-w"); break;
+      case 1:  break;
+      case 2:  command.push_back("-Wall"); break;
+      default: command.push_back("-Wall"); command.push_back("-Wextra"); break;
+   }
+   if (compiler.WarningAsError()) command.push_back("-Werror");
+
+
+   if (cpp && moduleGraph) {
+      for (auto&& directory : ModuleDirectories()) command.push_back("-fprebuilt-module-path=" + directory.string());
+   }
+
+
+   const auto append = [&command] (const std::string& options) {   // Options given as one string: Args(), FB_COMPILER...
+      const auto arguments = Process::Split(options);
+      command.insert(command.end(), arguments.begin(), arguments.end());
+   };
+
+   append(compiler.Args());
+
+
+   const char* env = std::getenv("FB_COMPILER");
+   if (env) append(env);
+
+   if (debug) {
+      env = std::getenv("FB_COMPILER_DEBUG");
+      if (env) append(env);
+   }
+   else {
+      env = std::getenv("FB_COMPILER_RELEASE");
+      if (env) append(env);
+   }
+
+   return command;
+}
+
+std::string ActualCompilerEmscripten::Signature (bool /*precompiledCpp*/)
+{
+   // EMSCRIPTEN points to the installed version, a new one gives new objects
+   const char* emscripten = Snapshot::Getenv("EMSCRIPTEN");
+
+   std::string signature = Process::Join(CommandLine(true)) + "\n" + Process::Join(CommandLine(false)) + "\n";
+   signature += ToolChain::ToolChain() + " " + (emscripten ? emscripten : "") + "\n";
+
+   if (!compiler.PrecompiledH().empty()) signature += "-include-pch " + compiler.PrecompiledH() + "\n";
+
+   return Hash::String(signature);
+}
+
+std::filesystem::path ActualCompilerEmscripten::PrecompiledPch () const
+{
+   return std::filesystem::path(compiler.ObjDir()) / "PrecompiledHeader.pch";
+}
+
+std::vector<std::filesystem::path> ActualCompilerEmscripten::CachedOutputs (const std::string& file) const
+{
+   return {(std::filesystem::path(compiler.ObjDir()) / std::filesystem::path(file).filename()).replace_extension("o")};   // The version of emscripten is part of Signature()
+}
+
+Process::Arguments ActualCompilerEmscripten::Driver (bool cpp)
+{
+   // emcc is a Python script and needs a few hundred ms to start, for every file. What it runs in the
+   // end is clang with a fixed set of flags. Those are asked for once and clang is started directly.
+   Process::Arguments emcc{"emcc"};
+   const auto options = CommandLine(cpp);
+   emcc.insert(emcc.end(), options.begin(), options.end());
+
+   const char* fastPath = std::getenv("FB_EMCC_FASTPATH");
+   if (fastPath && std::string_view{fastPath} == "0") return emcc;
+
+   const char* emscripten = Snapshot::Getenv("EMSCRIPTEN");
+   std::string version;
+   if (emscripten) {
+      std::ifstream in{std::filesystem::path{emscripten} / "emscripten-version.txt"};
+      std::getline(in, version);
+   }
+
+   // The settings (-s ...) change the flags, so all options are part of the key
+   const auto key = Hash::String(version + "\n" + (emscripten ? emscripten : "") + "\n" + Process::Join(emcc));
+
+   const std::filesystem::path objdir{compiler.ObjDir()};
+   const auto cacheFile = objdir / (cpp ? "FBuild_Emcc_cpp.txt" : "FBuild_Emcc_c.txt");
+
+   {
+      std::ifstream in{cacheFile};
+      std::string cachedKey;
+      std::string cachedCommand;
+      if (std::getline(in, cachedKey) && std::getline(in, cachedCommand) && cachedKey == key) return Process::Split(cachedCommand);
+   }
+
+   // With -v emcc prints the clang command for a probe file
+   const auto probe = objdir / (cpp ? "FBuild_EmccProbe.cpp" : "FBuild_EmccProbe.c");
+   auto probeObj = probe;   // One for C and C++, the C files may compile next to the C++ ones
+   probeObj += ".o";
+   std::ofstream{probe} << "int FBuildEmccProbe;\n";
+
+   auto command = emcc;
+   command.insert(command.end(), {"-v", "-c", probe.string(), "-o", probeObj.string()});
+   const auto result = Process::Run(command, ToolChain::Environment(), true);
+
+   std::filesystem::remove(probe);
+   std::filesystem::remove(probeObj);
+
+   if (result.exitCode != 0) return emcc;
+
+   const auto probeName = probe.filename().string();
+
+   std::istringstream lines{result.output};
+   for (std::string line; std::getline(lines, line);) {
+      if (!line.empty() && line.back() == '\r') line.pop_back();
+      if (line.find(probeName) == std::string::npos || line.find("-cc1") != std::string::npos) continue;
+
+      Process::Arguments printed;
+      try {
+         printed = SplitPrinted(line);
+      }
+      catch (const std::runtime_error&) {
+         continue;
+      }
+      if (printed.empty() || std::filesystem::path(printed[0]).stem().string().find("clang") != 0) continue;
+
+      Process::Arguments driver;
+      for (size_t i = 0; i < printed.size(); ++i) {
+         if (printed[i] == "-o") ++i;
+         else if (printed[i] != "-v" && printed[i].find(probeName) == std::string::npos) driver.push_back(printed[i]);
+      }
+
+      std::ofstream{cacheFile, std::ios::trunc} << key << "\n" << Process::Join(driver) << "\n";
+      return driver;
+   }
+
+   return emcc;   // Didn't find the command, an emcc version that prints it differently
+}
+
+std::future<void> ActualCompilerEmscripten::CompilePrecompiledHeaders ()
+{
+   if (outOfDate.empty()) return {};
+   if (compiler.PrecompiledH().empty()) return {};
+
+   // The PCH cpp depends on exactly the precompiled header. If it's out of date, so is the PCH.
+   const auto pchCppOutOfDate = std::any_of(outOfDate.begin(), outOfDate.end(), [this] (const std::string& file) { return IsPrecompiledCpp(file); });
+
+   const auto pch = PrecompiledPch();
+   if (!pchCppOutOfDate && std::filesystem::exists(pch)) return {};
+
+   std::filesystem::remove(pch);
+
+   const auto driver = Driver(true);
+   const auto header = std::filesystem::canonical(compiler.PrecompiledH()).string();
+   const auto build = [=] (const std::filesystem::path& directory) {
+      auto command = driver;
+      command.insert(command.end(), {"-x", "c++-header", header, "-o", (directory / pch.filename()).string()});
+
+      BuildPrecompiled(command, directory / pch.filename());
+   };
+
+   if (!SharedPch::Enabled()) return std::async(std::launch::async, [=] { build(pch.parent_path()); });
+
+   // The key here, CppDepends is set up for this target and RestoreFromCache() runs next
+   const auto key = SharedPchKey(compiler, compiler.PrecompiledH(), Process::Join(driver));
+   return std::async(std::launch::async, [=] { SharedPch::Obtain(key, {pch.filename().string()}, pch.parent_path(), build); });
+}
+
+Supervisor::Job ActualCompilerEmscripten::ModuleJob (const std::string& file, const Modules::Unit& /*unit*/, const std::filesystem::path& bmi)
+{
+   Supervisor::Job job;
+   job.arguments = Driver(true);
+
+   if (!compiler.PrecompiledH().empty()) job.arguments.insert(job.arguments.end(), {"-include-pch", PrecompiledPch().string()});
+
+   const auto obj = (std::filesystem::path(compiler.ObjDir()) / std::filesystem::path(file).filename()).replace_extension("o");
+   job.arguments.insert(job.arguments.end(), {"-fmodule-output=" + bmi.string(), "-x", "c++-module", "-o", obj.string(), file});
+   job.environment = ToolChain::Environment();
+   job.action = obj.string();
+   return job;
+}
+
+void ActualCompilerEmscripten::CompileFiles (const std::vector<std::string>& files)
+{
+   if (files.empty()) return;
+
+   const std::filesystem::path objdir{compiler.ObjDir()};
+
+   const auto isC = [] (const std::string& file) { return std::filesystem::path(file).extension() == ".c"; };
+
+   const auto cCommand = std::any_of(files.begin(), files.end(), isC) ? Driver(false) : Process::Arguments{};
+   auto cppCommand = std::all_of(files.begin(), files.end(), isC) ? Process::Arguments{} : Driver(true);
+
+   if (!compiler.PrecompiledH().empty()) {
+      cppCommand.push_back("-include-pch");
+      cppCommand.push_back(PrecompiledPch().string());
+   }
+
+   std::atomic<int> errors{0};
+   Supervisor::Batch batch;
+
+   for (auto&& file : files) {   // One job per file, emcc has no -MP
+      const auto obj = (objdir / std::filesystem::path(file).filename()).replace_extension("o");
+
+      Supervisor::Job job;
+      job.arguments = isC(file) ? cCommand : cppCommand;
+      job.arguments.insert(job.arguments.end(), {"-o", obj.string(), file});
+      job.environment = ToolChain::Environment();
+      job.action = obj.string();
+      job.done = [this, &errors, file] (const Supervisor::Result& result) {
+         std::cout << std::filesystem::path(file).filename().string() << "\n" << result.output << std::flush;   // In one piece, not mixed with the other files
+         if (result.exitCode != 0) ++errors, RecordFailure(file, result.output);
+         else StoreInCache(file, result.output);
+      };
+      batch.Submit(std::move(job));
+   }
+
+   batch.Wait();
+
+   if (errors) throw std::runtime_error("Compile Error");
+}
+
+void ActualCompilerEmscripten::Compile ()
+{
+   CheckParams();
+
+   std::filesystem::create_directories(compiler.ObjDir());
+
+   if (!NeedsRebuild()) return;
+
+   Snapshot::Invalidate();
+
+   std::cout << "\nCompiling (" << ToolChain::ToolChain() << ")" << std::endl;
+
+   compiler.DoBeforeCompile();
+
+   DeleteOutOfDateObjectFiles();
+
+   const auto compiling = outOfDate;
+   try {
+      // The C files don't use the PCH, they compile while it's built
+      auto precompiled = CompilePrecompiledHeaders();
+      RestoreFromCache();
+      auto cFiles = std::async(std::launch::async, [this, files = OutOfDateFiles(true)] { CompileFiles(files); });
+      if (precompiled.valid()) precompiled.get();
+
+      CompileModules();
+      CompileFiles(OutOfDateFiles(false));
+      cFiles.get();
+   }
+   catch (...) {
+      SaveSignatures(compiling);
+      throw;
+   }
+
+   SaveSignatures(compiling);
+}
+
+
+
+
+
+
+// The includes of the sources by CppDepends, set up like for the dependency check
+static std::vector<std::string> UnityBatches (const Compiler& compiler, const std::vector<std::string>& files, const std::string& objExtension)
+{
+   std::vector<std::string> alone = compiler.MPSkipFiles();
+   if (!compiler.PrecompiledCPP().empty()) alone.push_back(compiler.PrecompiledCPP());
+
+   // A module declaration has to come first in its file, and a BMI comes from one unit
+   if (compiler.Modules()) {
+      for (auto&& file : files) {
+         const auto unit = Modules::Scan(file);
+         if (!unit.provides.empty() || !unit.imports.empty() || !unit.headerUnits.empty()) alone.push_back(file);
+      }
+   }
+
+   ::CppOutOfDate checker{objExtension};   // Sets up the include paths of CppDepends
+   checker.Include(compiler.Includes());
+   checker.PrecompiledHeader(compiler.PrecompiledH());
+
+   return Unity::Batch(files, alone, compiler.ObjDir(), objExtension, compiler.UnityMaxBatchBytes(), [] (const std::string& file) {
+      const CppDepends depends{file};
+      return std::vector<std::string>(depends.Begin(), depends.End());
+   });
+}
+
+// Without a precompiled header: What the files include themselves
+static AutoPrecompiled::Header SynthesizePrecompiledHeader (const Compiler& compiler, const std::string& objExtension)
+{
+   ::CppOutOfDate checker{objExtension};   // Sets up the include paths of CppDepends
+   checker.Include(compiler.Includes());
+
+   return AutoPrecompiled::Synthesize(compiler.Files(), compiler.ObjDir(), objExtension, compiler.AutoPrecompiledMinShare(), [] (const std::string& file) {
+      const CppDepends depends{file};
+      return std::vector<std::string>(depends.Begin(), depends.End());
+   });
+}
+
+void Compiler::Compile ()
+{
+   const Trace::Scope trace{"Compile " + objDir};
+
+   const auto toolChain = ToolChain::ToolChain();
+   if (toolChain.substr(0, 4) == "MSVC") actualCompiler.reset(new ActualCompilerVisualStudio{*this});
+   else if (ToolChain::Gcc()) actualCompiler.reset(new ActualCompilerGcc{*this});
+   else if (toolChain == "EMSCRIPTEN") actualCompiler.reset(new ActualCompilerEmscripten{*this});
+   else throw std::runtime_error("Unbekannte Toolchain: " + toolChain);
+
+   if (objDir.empty()) objDir = Build();   // Like the backends, Unity() and AutoPrecompiledHeader() write there first
+
+   translationUnits.clear();
+   if (precompiledSynthesized) {
+      precompiledHeader.clear();
+      precompiledCpp.clear();
+      precompiledSynthesized = false;
+   }
+
+   // Visual Studio uses the PCH for the C files too
+   const auto withC = std::any_of(allFiles.begin(), allFiles.end(), [] (const std::string& file) { return std::filesystem::path(file).extension() == ".c"; });
+
+   // A forced include before a module declaration is an error
+   if (autoPrecompiled && precompiledHeader.empty() && !modules && !(withC && toolChain.substr(0, 4) == "MSVC")) {
+      const auto synthesized = SynthesizePrecompiledHeader(*this, actualCompiler->ObjExtension());
+      if (!synthesized.h.empty()) {
+         precompiledHeader = synthesized.h;
+         precompiledCpp = synthesized.cpp;
+         precompiledSynthesized = true;
+
+         translationUnits = allFiles;
+         translationUnits.push_back(synthesized.cpp);
+      }
+   }
+   const auto files = TranslationUnits();
+
+   if (!unity) {
+      actualCompiler->Compile();
+      AutoPrecompiled::Report(objDir);
+      return;
+   }
+
+   // A batch that fails: Its files are compiled alone. If that works, the ones named in the diagnostics (all, if none
+   // is named) don't go together with the others and leave the batch for good. Otherwise it's a real error.
+   for (int round = 0;; ++round) {
+      translationUnits = UnityBatches(*this, files, actualCompiler->ObjExtension());
+
+      try {
+         actualCompiler->Compile();
+         AutoPrecompiled::Report(objDir);
+         return;
+      }
+      catch (std::exception&) {
+         std::vector<std::string> suspects;
+         for (auto&& [file, diagnostics] : actualCompiler->Failed()) {
+            if (!Unity::IsUnity(file)) continue;
+
+            const auto members = Unity::Members(file);
+            std::vector<std::string> named;
+            for (auto&& member : members) {
+               if (diagnostics.find(std::filesystem::path(member).filename().string()) != std::string::npos) named.push_back(member);
+            }
+            suspects.insert(suspects.end(), named.empty() ? members.begin() : named.begin(), named.empty() ? members.end() : named.end());
+         }
+
+         if (suspects.empty() || round == 2) throw;
+
+         std::cout << "\nCompiling " << suspects.size() << " files of failed unity batches alone" << std::endl;
+         translationUnits = suspects;
+         actualCompiler->Compile();
+         Unity::Exclude(objDir, suspects);
+      }
+   }
 }
 
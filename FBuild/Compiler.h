@@ -7,10 +7,19 @@
 
 #pragma once
 
+#include <cstdint>
 #include <string>
 #include <vector>
 #include <memory>
+#include <mutex>
 #include <functional>
+#include <filesystem>
+#include <future>
+#include <unordered_map>
+
+#include "Process.h"
+#include "Supervisor.h"
+#include "Modules.h"
 
 
 
@@ -23,16 +32,62 @@ protected:
    Compiler& compiler;
 
    std::vector<std::string> outOfDate;
+   std::vector<std::string> restored;    // Out of date, but found in the ObjectCache
+   std::vector<std::string> compiledModules;   // Out of date, compiled by CompileModules() before the others
 
    std::vector<std::string> ObjFiles (const std::string& extension);
    std::vector<std::string> CompiledObjFiles (const std::string& extension);
 
+   // The backends check the dependencies in UpdateOutOfDate() and hash everything besides the sources in Signature()
+   virtual void        UpdateOutOfDate () { }
+   virtual std::string Signature (bool /*precompiledCpp*/) { return {}; }
+
+   bool NeedsRebuild ();
+   void UpdateOutOfDateSignatures ();
+   void SaveSignatures (const std::vector<std::string>& compiled);
+   void DeleteOutOfDateObjectFiles ();
+   bool IsPrecompiledCpp (const std::string& file) const;
+   std::vector<std::string> OutOfDateFiles (bool c) const;   // The C or the C++ files of outOfDate
+
+   // ObjectCache: The backends name what a compile produces (empty if it can't be cached) and which compiler runs
+   std::unordered_map<std::string, std::string> cacheKeys;   // Source -> key, for the sources that weren't cached
+
+   virtual std::vector<std::filesystem::path> CachedOutputs (const std::string& /*file*/) const { return {}; }
+   virtual std::string                        CompilerIdentity () { return {}; }
+
+   void RestoreFromCache ();
+   void StoreInCache (const std::string& file, const std::string& diagnostics);
+
+   // The files that failed with their diagnostics, for Unity() to find the culprits. Called by the job callbacks.
+   std::mutex                                   failedMutex;
+   std::unordered_map<std::string, std::string> failed;
+
+   void RecordFailure (const std::string& file, const std::string& diagnostics);
+
+   // Modules(): The graph is scanned in NeedsRebuild(). The units that provide a module are compiled by CompileModules()
+   // before CompileFiles(), in the order of their imports, with the jobs of ModuleJob(). Their BMIs are in ObjDir/Modules.
+   std::unique_ptr<Modules::Graph> moduleGraph;   // None without Modules() or if no file provides or imports one
+
+   virtual std::string     BmiExtension () const { return {}; }
+   virtual Supervisor::Job ModuleJob (const std::string& /*file*/, const Modules::Unit& /*unit*/, const std::filesystem::path& /*bmi*/) { return {}; }
+
+   std::filesystem::path              Bmi (const std::string& module) const;
+   std::vector<std::filesystem::path> ModuleDirectories () const;   // Of this target and the ones before, where the compilers look for BMIs
+   bool                               IsModuleUnit (const std::string& file) const;   // Provides or imports one, not for the ObjectCache
+
+   void ScanModules ();
+   void UpdateOutOfDateModules ();   // Imported BMIs newer than the object
+   void CompileModules ();
+
 public:
    ActualCompiler (Compiler& compiler) : compiler{compiler} { }
    virtual ~ActualCompiler () { }
 
    virtual void Compile () { }
 
+   virtual std::string ObjExtension () const { return {}; }
+   const std::unordered_map<std::string, std::string>& Failed () const { return failed; }
+
    virtual std::vector<std::string> ObjFiles ()          { return std::vector<std::string>{}; }
    virtual std::vector<std::string> CompiledObjFiles ()  { return std::vector<std::string>{}; }
 };
@@ -45,12 +100,16 @@ public:
 
 class ActualCompilerVisualStudio : public ActualCompiler {
    void CheckParams ();
-   void UpdateOutOfDate();
-   bool NeedsRebuild ();
-   void DeleteOutOfDateObjectFiles ();
-   void CompilePrecompiledHeaders ();
+   void UpdateOutOfDate () override;
+   std::future<void> CompilePrecompiledHeaders ();   // Takes the PCH cpp out of outOfDate and builds it in the background. Invalid if there's nothing to build.
    void CompileFiles ();
-   std::string CommandLine ();
+   Process::Arguments CommandLine ();   // Options only, without the compiler
+   std::string Signature (bool precompiledCpp) override;
+   std::string ObjExtension () const override { return "obj"; }
+   std::vector<std::filesystem::path> CachedOutputs (const std::string& file) const override;
+   std::string CompilerIdentity () override;
+   std::string BmiExtension () const override { return "ifc"; }
+   Supervisor::Job ModuleJob (const std::string& file, const Modules::Unit& unit, const std::filesystem::path& bmi) override;
 
 public:
    ActualCompilerVisualStudio (Compiler& compiler) : ActualCompiler{compiler} { }
@@ -66,13 +125,49 @@ public:
 
 
 
+class ActualCompilerGcc : public ActualCompiler {
+   void CheckParams ();
+   void UpdateOutOfDate () override;
+   std::future<void> CompilePrecompiledHeader ();   // In the background. Invalid if there's nothing to build.
+   void CompileFiles (std::vector<std::string> files, bool remote);
+   Process::Arguments CommandLine (bool cpp);   // Options only, without the compiler
+   std::string Signature (bool precompiledCpp) override;
+   std::string ObjExtension () const override { return "o"; }
+   std::filesystem::path PrecompiledInclude () const;   // ObjDir/PrecompiledHeader.h, includes the real header. The .gch/.pch is next to it.
+   std::vector<std::filesystem::path> CachedOutputs (const std::string& file) const override;
+   std::string CompilerIdentity () override;
+   std::string BmiExtension () const override;   // gcm, pcm with clang
+   std::filesystem::path ModuleMapper () const;   // ObjDir/Modules/Mapper.txt, where gcc finds the BMIs
+   void WriteModuleMapper ();
+   Supervisor::Job ModuleJob (const std::string& file, const Modules::Unit& unit, const std::filesystem::path& bmi) override;
+
+public:
+   ActualCompilerGcc (Compiler& compiler) : ActualCompiler{compiler} { }
+
+   void Compile () override;
+
+   std::vector<std::string> ObjFiles() override         { return ActualCompiler::ObjFiles("o"); }
+   std::vector<std::string> CompiledObjFiles() override { return ActualCompiler::CompiledObjFiles("o"); }
+};
+
+
+
+
+
+
 class ActualCompilerEmscripten : public ActualCompiler {
    void CheckParams ();
-   bool NeedsRebuild ();
-   void DeleteOutOfDateObjectFiles ();
-   void CompilePrecompiledHeaders ();
-   void CompileFiles ();
-   std::string CommandLine (bool omitObjDir);
+   void UpdateOutOfDate () override;
+   std::future<void> CompilePrecompiledHeaders ();   // In the background. Invalid if there's nothing to build.
+   void CompileFiles (const std::vector<std::string>& files);
+   Process::Arguments CommandLine (bool cpp);   // Options only, without emcc
+   std::string Signature (bool precompiledCpp) override;
+   std::string ObjExtension () const override { return "o"; }
+   std::filesystem::path PrecompiledPch () const;   // ObjDir/PrecompiledHeader.pch
+   Process::Arguments Driver (bool cpp);            // The clang command emcc would run, cached in the ObjDir. emcc itself, if that fails.
+   std::vector<std::filesystem::path> CachedOutputs (const std::string& file) const override;
+   std::string BmiExtension () const override { return "pcm"; }
+   Supervisor::Job ModuleJob (const std::string& file, const Modules::Unit& unit, const std::filesystem::path& bmi) override;
 
 public:
    ActualCompilerEmscripten (Compiler& compiler) : ActualCompiler{compiler} { }
@@ -97,11 +192,18 @@ class Compiler {
    std::vector<std::string> defines;
    std::vector<std::string> allFiles;
    std::vector<std::string> mpskipFiles;
+   bool                     unity;
+   uint64_t                 unityMaxBatchBytes;
+   bool                     modules;
+   std::vector<std::string> translationUnits;   // With Unity(): The unity TUs and the files compiled alone. With AutoPrecompiledHeader(): And its cpp.
    bool                     crtStatic;
    int                      threads;
    std::string              args;
    std::string              precompiledHeader;
    std::string              precompiledCpp;
+   bool                     autoPrecompiled;
+   double                   autoPrecompiledMinShare;
+   bool                     precompiledSynthesized;   // precompiledHeader is the one of AutoPrecompiledHeader()
    bool                     dependencyCheck;
    int                      warnLevel;
    bool                     warningAsError;
@@ -109,7 +211,7 @@ class Compiler {
    std::function<void()>    beforeCompile;
 
 public:
-   Compiler () : actualCompiler{new ActualCompiler{*this}}, threads{0}, debug{false}, crtStatic{false}, dependencyCheck{true}, warnLevel{1}, warningAsError{false} { }
+   Compiler () : actualCompiler{new ActualCompiler{*this}}, threads{0}, debug{false}, unity{false}, unityMaxBatchBytes{512 * 1024}, modules{false}, crtStatic{false}, autoPrecompiled{false}, autoPrecompiledMinShare{0.5}, precompiledSynthesized{false}, dependencyCheck{true}, warnLevel{1}, warningAsError{false} { }
    ~Compiler() = default;
 
    void Build (std::string build) 
@@ -131,9 +233,12 @@ public:
    void Defines (std::vector<std::string> v)               { defines = std::move(v); }
    void Files (std::vector<std::string> v)                 { allFiles = std::move(v); }
    void MPSkipFiles(std::vector<std::string> v)            { mpskipFiles = std::move(v); }
+   void Unity (bool v, uint64_t maxBatchBytes)             { unity = v; unityMaxBatchBytes = maxBatchBytes; }
+   void Modules (bool v)                                   { modules = v; }
    void Threads (int v)                                    { threads = v; }
    void Args (std::string v)                               { args = std::move(v); }
-   void PrecompiledHeader (std::string h, std::string cpp) { precompiledHeader = std::move(h); precompiledCpp = std::move(cpp); }
+   void PrecompiledHeader (std::string h, std::string cpp) { precompiledHeader = std::move(h); precompiledCpp = std::move(cpp); precompiledSynthesized = false; }
+   void AutoPrecompiledHeader (bool v, double minShare)    { autoPrecompiled = v; autoPrecompiledMinShare = minShare; }
    void DependencyCheck (bool v)                           { dependencyCheck = v; }
    void WarnLevel (int v)                                  { warnLevel = v; }
    void WarningAsError (bool v)                            { warningAsError = v; }
@@ -147,11 +252,17 @@ public:
    const std::vector<std::string>& Defines () const           { return defines; }
    const std::vector<std::string>& Files () const             { return allFiles; }
    const std::vector<std::string>& MPSkipFiles() const        { return mpskipFiles; }
+   bool                            Unity () const             { return unity; }
+   uint64_t                        UnityMaxBatchBytes () const { return unityMaxBatchBytes; }
+   bool                            Modules () const           { return modules; }
+   const std::vector<std::string>& TranslationUnits () const  { return translationUnits.empty() ? allFiles : translationUnits; }   // What the backends compile
    int                             Threads () const           { return threads; }
    const std::string&              Args () const              { return args; }
    std::string                     PrecompiledHeader () const { return precompiledHeader.empty() ? "" : precompiledHeader + "; " + precompiledCpp; }
    std::string                     PrecompiledCPP () const    { return precompiledCpp; }
    std::string                     PrecompiledH () const      { return precompiledHeader; }
+   bool                            AutoPrecompiledHeader () const   { return autoPrecompiled; }
+   double                          AutoPrecompiledMinShare () const { return autoPrecompiledMinShare; }
    bool                            DependencyCheck () const   { return dependencyCheck; }
    int                             WarnLevel () const         { return warnLevel; }
    bool                            WarningAsError () const    { return warningAsError; }
@@ -6,11 +6,17 @@
  */
 
 #include "Copy.h"
+#include "Snapshot.h"
+#include "Trace.h"
 
 #include <iostream>
 #include <fstream>
 
-#include <Shlwapi.h>
+#ifdef _WIN32
+   #include <Shlwapi.h>
+#else
+   #include <fnmatch.h>
+#endif
 
 #include "JavaScript.h"
 
@@ -19,6 +25,8 @@ static std::vector<std::filesystem::path> CollectSourceFiles (const std::string&
 {
    std::vector<std::filesystem::path> result;
 
+   Snapshot::Track(p.find_first_of("*?") == std::string::npos ? std::filesystem::path(p) : std::filesystem::path(p).remove_filename());
+
    if (p.find_first_of("*?") == std::string::npos && std::filesystem::exists(p)) {
       if (std::filesystem::is_regular_file(p)) result.push_back(p);
       else {
@@ -34,7 +42,11 @@ static std::vector<std::filesystem::path> CollectSourceFiles (const std::string&
 
       for (auto&& entry : std::filesystem::directory_iterator{path}) {
          if (std::filesystem::is_regular_file(entry.path())) {
+#ifdef _WIN32
             if (::PathMatchSpec(entry.path().filename().string().c_str(), pattern.c_str())) {
+#else
+            if (::fnmatch(pattern.c_str(), entry.path().filename().string().c_str(), 0) == 0) {
+#endif
                result.push_back(entry.path());
             }
          }
@@ -49,6 +61,9 @@ void Copy::DoFile (std::filesystem::path sourceFile, std::filesystem::path destF
    sourceFile.make_preferred();
    destFile.make_preferred();
 
+   Snapshot::Track(sourceFile);
+   Snapshot::Track(destFile);
+
    if (std::filesystem::exists(destFile) && !ignoreTimestamp) {
       const auto sourceTime = std::filesystem::last_write_time(sourceFile);
       const auto destTime = std::filesystem::last_write_time(destFile);
@@ -56,6 +71,9 @@ void Copy::DoFile (std::filesystem::path sourceFile, std::filesystem::path destF
       if (destTime >= sourceTime) return;
    }
 
+   Snapshot::Invalidate();
+
+   const Trace::Scope trace{"Copy " + sourceFile.filename().string(), "copy"};
    std::cout << "Copy " << sourceFile << " to " << destFile << "...";
 
    {
@@ -76,6 +94,7 @@ int Copy::Go ()
 {
    CheckParams();
 
+   const Trace::Scope trace{"Copy to " + dest};
    std::filesystem::create_directories(dest);
 
    auto sourceFiles = CollectSourceFiles(source);
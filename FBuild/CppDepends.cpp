@@ -43,6 +43,7 @@ CppDepends::CppDepends (std::filesystem::path file)
 uint64_t CppDepends::Process (std::filesystem::path file)
 {
    maxTime = 0;
+   newest.clear();
 
    file = std::filesystem::canonical(file);
    file.make_preferred();
@@ -161,7 +162,11 @@ std::vector<std::pair<char, std::string>> CppDepends::Includes (const std::files
 
 bool CppDepends::CheckCache (const std::filesystem::path& file)
 {
-   std::ifstream stream(file.string() + ":CppDepends_Cache5", std::ofstream::in | std::ofstream::ate | std::ofstream::binary);
+#ifndef _WIN32
+   return false;   // The cache lives in an NTFS alternate data stream, elsewhere it would litter the source tree
+#endif
+
+   std::ifstream stream(file.string() + ":CppDepends_Cache6", std::ofstream::in | std::ofstream::ate | std::ofstream::binary);
    if (!stream.good()) return false;
    if (stream.tellg() < sizeof(size_t)) return false;
    stream.seekg(0);
@@ -171,6 +176,8 @@ bool CppDepends::CheckCache (const std::filesystem::path& file)
 
    stream > tmp;
    if (tmp != file.string()) return false;
+   stream > tmp;
+   if (tmp != precompiledHeader.string()) return false;   // The dependencies include those of the precompiled header
 
    uint32_t count = 0;
    stream > count;
@@ -180,6 +187,7 @@ bool CppDepends::CheckCache (const std::filesystem::path& file)
       dependencies.insert(tmp);
       if (ts > maxTime) {
          maxTime = ts;
+         newest = tmp;
       }
    }
 
@@ -193,20 +201,28 @@ void CppDepends::WriteCache (const std::filesystem::path& file)
    {
       std::stringstream ss;
       ss < file.string();
+      ss < precompiledHeader.string();
       ss < static_cast<uint32_t>(dependencies.size());
       for (auto&& dep : dependencies) {
          uint64_t ts = LastWriteTime(dep);
          ss < dep < ts;
-         if (ts > maxTime) maxTime = ts;
+         if (ts > maxTime) {
+            maxTime = ts;
+            newest = dep;
+         }
       }
 
       writeMe = ss.str();
    }
 
+#ifndef _WIN32
+   return;
+#endif
+
    const auto ts = std::filesystem::last_write_time(file);
 
    {
-      std::ofstream stream(file.string() + ":CppDepends_Cache5", std::ofstream::out | std::ofstream::trunc | std::ofstream::binary);
+      std::ofstream stream(file.string() + ":CppDepends_Cache6", std::ofstream::out | std::ofstream::trunc | std::ofstream::binary);
       if (!stream.good()) {
          std::cerr << "Error on writing cache for " << file << std::endl;
          return;
@@ -237,5 +253,6 @@ void CppDepends::AddIncludePath (const std::filesystem::path& path)
 
 void CppDepends::PrecompiledHeader (const std::string& prec)
 {
-   precompiledHeader = std::filesystem::canonical(prec).make_preferred();
+   if (prec.empty()) precompiledHeader.clear();   // canonical("") throws with libstdc++
+   else precompiledHeader = std::filesystem::canonical(prec).make_preferred();
 }
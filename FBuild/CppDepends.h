@@ -29,6 +29,7 @@ public:
    size_t Size () const { return dependencies.size(); }
 
    uint64_t MaxTime () const { return maxTime; }
+   const std::string& Newest () const { return newest; }   // The dependency with MaxTime()
 
    // Beware. These functions are NOT threadsafe
    static void ClearIncludePath ();
@@ -38,6 +39,7 @@ public:
 private:
    std::unordered_set<std::string> dependencies{};
    uint64_t maxTime{0};
+   std::string newest{};
 
    void DoFile (std::filesystem::path file);
    std::vector<std::pair<char, std::string>> Includes (const std::filesystem::path& file);
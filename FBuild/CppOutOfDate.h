@@ -9,6 +9,8 @@
 
 #include "CppDepends.h"
 #include "LastWriteTime.h"
+#include "Explain.h"
+#include "Trace.h"
 
 #include <algorithm>
 #include <string>
@@ -24,7 +26,6 @@ public:
    CppOutOfDate (const std::string& objectFileExtension) 
       : objectFileExtension_{"." + objectFileExtension}
    {
-      scriptTime_ = LastWriteTime("FBuild.js");
       files_.reserve(1000);
 
       CppDepends::ClearIncludePath();
@@ -49,6 +50,9 @@ public:
       if (!cpus) cpus = 2;
       if (numberOfThreads_) cpus = numberOfThreads_;
 
+      const auto start = std::chrono::steady_clock::now();
+      const auto count = files_.size();
+
       for (size_t i = 0; i < cpus; ++i) {
          threadGroup_.emplace_back(std::thread([this] () { Thread(); }));
       }
@@ -56,6 +60,8 @@ public:
       for (auto& thread : threadGroup_) {
          thread.join();
       }
+
+      Explain::Checked("Dependencies " + outdir_, count, std::chrono::steady_clock::now() - start);
    }
 
    const std::vector<std::string>& OutOfDate () const { return outOfDate_; }
@@ -64,7 +70,6 @@ private:
    std::vector<std::thread> threadGroup_;
    std::mutex               outOfDateMutex_;
    std::atomic<size_t>      current_{0};
-   uint64_t                 scriptTime_{0};
    std::string              objectFileExtension_;
 
    std::string              outdir_;
@@ -94,21 +99,28 @@ private:
       outOfDate_.push_back(file);
    }
 
+   void AddOutOfDate (const std::filesystem::path& file, const std::filesystem::path& obj, std::chrono::steady_clock::time_point start, const char* reason, const std::string& dependency = {})
+   {
+      AddOutOfDate(file.string());
+      Explain::OutOfDate(obj.string(), reason, dependency, std::chrono::steady_clock::now() - start);
+   }
+
    void Thread ()
    {
+      const Trace::Scope trace{"Dependencies " + outdir_};
       std::filesystem::path objdir(outdir_);
       std::filesystem::path file;
 
       CppDepends dep;
       for (;;) {
          if (!GetFile(file)) break;
+         const auto start = std::chrono::steady_clock::now();
          auto obj = objdir / file.filename();
          obj.replace_extension(objectFileExtension_);
 
-         if (!std::filesystem::exists(obj)) AddOutOfDate(file.string());
-         else if (!std::filesystem::file_size(obj)) AddOutOfDate(file.string());
-         else if (LastWriteTime(obj) < scriptTime_) AddOutOfDate(file.string());
-         else if (LastWriteTime(obj) < dep.Process(file)) AddOutOfDate(file.string());
+         if (!std::filesystem::exists(obj)) AddOutOfDate(file, obj, start, "missing object");
+         else if (!std::filesystem::file_size(obj)) AddOutOfDate(file, obj, start, "empty object");
+         else if (LastWriteTime(obj) < dep.Process(file)) AddOutOfDate(file, obj, start, "newer dependency", dep.Newest());
       }
    }
 
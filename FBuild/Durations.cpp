@@ -0,0 +1,153 @@
+/*
+ * Any copyright is dedicated to the Public Domain.
+ * http://creativecommons.org/publicdomain/zero/1.0/*
+ *
+ * Author: Frank Barwich
+ */
+
+#include "Durations.h"
+
+#include <filesystem>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <mutex>
+#include <random>
+#include <unordered_map>
+#include <unordered_set>
+
+
+
+namespace {
+
+   std::string Key (const std::string& action)
+   {
+      return std::filesystem::absolute(action).lexically_normal().generic_string();   // No disk access, it's called for every job
+   }
+
+   class Store {
+      std::mutex                                     mutex_;
+      std::unordered_map<std::string, int64_t>       durations_;   // Milliseconds
+      std::unordered_set<std::string>                changed_;
+      int64_t                                        total_{0};
+
+      static std::filesystem::path File ()
+      {
+         return std::filesystem::temp_directory_path() / "FBuild_Durations_v1.txt";
+      }
+
+      // Format: "action" milliseconds
+      static std::unordered_map<std::string, int64_t> Load ()
+      {
+         std::unordered_map<std::string, int64_t> result;
+
+         std::ifstream stream(File());
+         std::string action;
+         int64_t milliseconds = 0;
+
+         while (stream >> std::quoted(action) >> milliseconds) result[action] = milliseconds;
+
+         return result;
+      }
+
+      void Save ()
+      {
+         if (changed_.empty()) return;
+
+         // Another FBuild may have written meanwhile. Only our own jobs are replaced.
+         auto merged = Load();
+         for (auto&& action : changed_) merged[action] = durations_[action];
+
+         auto tmp = File();
+         tmp += "." + std::to_string(std::random_device{}()) + ".tmp";
+
+         {
+            std::ofstream stream(tmp, std::ios::trunc);
+            for (auto&& item : merged) {
+               std::error_code nothrow;
+               if (!std::filesystem::exists(item.first, nothrow)) continue;   // Outputs that are gone
+
+               stream << std::quoted(item.first) << " " << item.second << "\n";
+            }
+
+            if (!stream.flush()) throw std::runtime_error("Error writing " + tmp.string());
+         }
+
+         std::error_code error;
+         std::filesystem::rename(tmp, File(), error);
+         if (error) std::filesystem::remove(tmp, error);
+      }
+
+   public:
+      Store () : durations_(Load())
+      {
+         for (auto&& item : durations_) total_ += item.second;
+      }
+
+      ~Store ()
+      {
+         try {
+            Save();
+         }
+         catch (std::exception& e) {
+            std::cerr << "FBuild: " << File() << ": " << e.what() << "\n";
+         }
+      }
+
+      std::optional<std::chrono::milliseconds> Last (const std::string& action)
+      {
+         const auto key = Key(action);
+
+         const auto lock = std::lock_guard{mutex_};
+         const auto it = durations_.find(key);
+         if (it == durations_.end()) return std::nullopt;
+         return std::chrono::milliseconds{it->second};
+      }
+
+      std::chrono::milliseconds Average ()
+      {
+         const auto lock = std::lock_guard{mutex_};
+         return std::chrono::milliseconds{durations_.empty() ? 0 : total_ / static_cast<int64_t>(durations_.size())};
+      }
+
+      void Record (const std::string& action, std::chrono::milliseconds duration)
+      {
+         const auto key = Key(action);
+
+         const auto lock = std::lock_guard{mutex_};
+         const auto [it, inserted] = durations_.emplace(key, duration.count());
+         if (!inserted) {
+            total_ -= it->second;
+            it->second = (it->second + duration.count()) / 2;   // One slow run on a busy machine doesn't count fully
+         }
+         total_ += it->second;
+         changed_.insert(key);
+      }
+   };
+
+   Store& TheStore ()
+   {
+      static Store store;
+      return store;
+   }
+}
+
+
+
+namespace Durations {
+
+   std::optional<std::chrono::milliseconds> Last (const std::string& action)
+   {
+      return TheStore().Last(action);
+   }
+
+   std::chrono::milliseconds Average ()
+   {
+      return TheStore().Average();
+   }
+
+   void Record (const std::string& action, std::chrono::milliseconds duration)
+   {
+      TheStore().Record(action, duration);
+   }
+}
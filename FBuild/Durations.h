@@ -0,0 +1,23 @@
+/*
+ * Any copyright is dedicated to the Public Domain.
+ * http://creativecommons.org/publicdomain/zero/1.0/*
+ *
+ * Author: Frank Barwich
+ */
+
+#pragma once
+
+#include <chrono>
+#include <optional>
+#include <string>
+
+
+// How long the jobs took in earlier runs, so the Supervisor can start the longest first. A job is known by what it
+// produces (the object, the moc output, ...). Kept in the temp directory like the manifest.
+namespace Durations {
+
+   std::optional<std::chrono::milliseconds> Last (const std::string& action);   // Smoothed over the runs
+   std::chrono::milliseconds                Average ();                         // Of all known jobs, the guess for new ones
+
+   void Record (const std::string& action, std::chrono::milliseconds duration);
+}
@@ -0,0 +1,374 @@
+/*
+ * Any copyright is dedicated to the Public Domain.
+ * http://creativecommons.org/publicdomain/zero/1.0/*
+ *
+ * Author: Frank Barwich
+ */
+
+#include "Executor.h"
+#include "Http.h"
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <fstream>
+#include <iostream>
+#include <mutex>
+#include <random>
+#include <sstream>
+#include <stdexcept>
+#include <thread>
+
+
+
+namespace {
+
+   // Strings with their length in front: "<length>\n<bytes>". Sources and objects are binary.
+   std::string Encode (const std::vector<std::string>& fields)
+   {
+      std::string result;
+      for (auto&& field : fields) result += std::to_string(field.size()) + "\n" + field;
+      return result;
+   }
+
+   std::vector<std::string> Decode (const std::string& data)
+   {
+      std::vector<std::string> result;
+
+      size_t pos = 0;
+      while (pos < data.size()) {
+         const auto newline = data.find('\n', pos);
+         if (newline == std::string::npos) throw std::runtime_error("Invalid message");
+
+         const auto length = static_cast<size_t>(std::stoull(data.substr(pos, newline - pos)));
+         if (length > data.size() - newline - 1) throw std::runtime_error("Invalid message");
+
+         result.push_back(data.substr(newline + 1, length));
+         pos = newline + 1 + length;
+      }
+
+      return result;
+   }
+
+   std::string Unique ()
+   {
+      static std::mutex mutex;
+      static std::mt19937_64 random{std::random_device{}()};
+
+      const auto lock = std::lock_guard{mutex};
+      std::ostringstream result;
+      result << std::hex << random();
+      return result.str();
+   }
+
+   struct Counters {
+      std::atomic<uint64_t> actions{0};
+      std::atomic<uint64_t> failed{0};      // Compile errors
+      std::atomic<uint64_t> fallbacks{0};   // Worker errors, compiled locally
+      std::atomic<uint64_t> sentBytes{0};
+   };
+
+   Counters& TheCounters ()
+   {
+      static Counters counters;
+      return counters;
+   }
+
+
+
+   class HttpWorker : public Executor::Worker {
+      std::string       text_;
+      Http::Url         url_;
+      std::mutex        mutex_;
+      bool              asked_{false};
+      unsigned          slots_{0};
+      std::atomic<bool> broken_{false};
+
+      // A worker that doesn't answer is dropped for the rest of the run. One message.
+      void Failed (const std::exception& e)
+      {
+         if (!broken_.exchange(true)) std::cout << "Worker " << text_ << ": " << e.what() << ", compiling locally" << std::endl;
+      }
+
+   public:
+      explicit HttpWorker (const std::string& url) : text_{url}, url_{Http::Parse(url)} { }
+
+      std::string Name () const override { return text_; }
+
+      unsigned Slots () override
+      {
+         if (broken_) return 0;
+
+         const auto lock = std::lock_guard{mutex_};
+         if (!asked_) {
+            asked_ = true;
+            try {
+               const auto response = Http::Request(url_, "GET", "/slots", {}, std::chrono::seconds{5});
+               if (response.status != 200) throw std::runtime_error("GET /slots failed with " + std::to_string(response.status));
+               slots_ = static_cast<unsigned>(std::stoul(response.body));
+            }
+            catch (std::exception& e) {
+               Failed(e);
+            }
+         }
+
+         return broken_ ? 0 : slots_;
+      }
+
+      bool Run (const Executor::Action& action, Executor::Result& result) override
+      {
+         if (broken_) return false;
+
+         auto fields = action.arguments;
+         fields.push_back(action.inputName);
+         fields.push_back(action.input);
+         const auto request = Encode(fields);
+
+         try {
+            const auto response = Http::Request(url_, "POST", "/compile", request, std::chrono::minutes{10});
+            if (response.status != 200) throw std::runtime_error("POST /compile failed with " + std::to_string(response.status));
+
+            const auto answer = Decode(response.body);
+            if (answer.size() != 3) throw std::runtime_error("Invalid answer");
+
+            result.exitCode = std::stoi(answer[0]);
+            result.output = answer[1];
+            result.object = answer[2];
+         }
+         catch (std::exception& e) {
+            ++TheCounters().fallbacks;
+            Failed(e);
+            return false;
+         }
+
+         auto& counters = TheCounters();
+         ++counters.actions;
+         if (result.exitCode != 0) ++counters.failed;
+         counters.sentBytes += request.size();
+         return true;
+      }
+   };
+
+
+
+   class Registry {
+      std::mutex                                    mutex_;
+      bool                                          initialized_{false};
+      std::vector<std::unique_ptr<Executor::Worker>> workers_;
+
+      void Initialize ()   // Locked
+      {
+         if (initialized_) return;
+         initialized_ = true;
+
+         const char* env = std::getenv("FB_WORKERS");
+         if (!env) return;
+
+         std::istringstream urls{env};
+         for (std::string url; std::getline(urls, url, ',');) {
+            if (!url.empty()) workers_.push_back(std::make_unique<HttpWorker>(url));
+         }
+      }
+
+   public:
+      void Add (std::unique_ptr<Executor::Worker> worker)
+      {
+         const auto lock = std::lock_guard{mutex_};
+         Initialize();
+         workers_.push_back(std::move(worker));
+      }
+
+      void Replace (std::vector<std::unique_ptr<Executor::Worker>> workers)
+      {
+         const auto lock = std::lock_guard{mutex_};
+         initialized_ = true;
+         workers_ = std::move(workers);
+      }
+
+      std::vector<Executor::Worker*> All ()
+      {
+         const auto lock = std::lock_guard{mutex_};
+         Initialize();
+
+         std::vector<Executor::Worker*> result;
+         for (auto&& worker : workers_) result.push_back(worker.get());
+         return result;
+      }
+   };
+
+   Registry& TheRegistry ()
+   {
+      static Registry registry;
+      return registry;
+   }
+
+
+
+   // The slots of the daemon
+   class Slots {
+      std::mutex              mutex_;
+      std::condition_variable free_;
+      unsigned                free_slots_;
+
+   public:
+      explicit Slots (unsigned slots) : free_slots_{slots} { }
+
+      void Acquire ()
+      {
+         auto lock = std::unique_lock{mutex_};
+         free_.wait(lock, [this] { return free_slots_ > 0; });
+         --free_slots_;
+      }
+
+      void Release ()
+      {
+         {
+            const auto lock = std::lock_guard{mutex_};
+            ++free_slots_;
+         }
+         free_.notify_one();
+      }
+   };
+
+   // Options of gcc and clang that run or load other programs, or write files besides the object
+   bool Refused (const std::string& option)
+   {
+      static const std::vector<std::string> prefixes{"@", "-B", "-wrapper", "-fplugin", "-fpass-plugin", "-specs", "--specs", "-load", "-plugin",
+                                                     "-o", "-M", "-save-temps", "-dumpdir", "-dumpbase", "-fdump-", "-fprofile-generate", "-ftime-trace"};
+
+      return std::any_of(prefixes.begin(), prefixes.end(), [&option] (const std::string& prefix) { return option.rfind(prefix, 0) == 0; });
+   }
+
+   // The name of a program without directory and .exe
+   std::string ProgramName (const std::string& program)
+   {
+      auto name = std::filesystem::path(program).filename();
+      if (name.extension() == ".exe") name.replace_extension();
+      return name.string();
+   }
+
+   std::string Compile (const std::vector<std::string>& fields, const std::vector<std::string>& compilers)
+   {
+      if (fields.size() < 3) throw std::runtime_error("Invalid request");
+
+      Process::Arguments arguments(fields.begin(), fields.end() - 2);
+
+      // Only a compiler of the list, found on the PATH here. No path from the network is run.
+      const auto name = ProgramName(arguments.front());
+      if (std::find(compilers.begin(), compilers.end(), name) == compilers.end()) throw std::runtime_error("Not an allowed compiler: " + arguments.front());
+
+      const auto program = Process::Find(name, Process::Current());
+      if (program.empty()) throw std::runtime_error("Compiler not found: " + name);
+      arguments.front() = program.string();
+
+      for (auto it = arguments.begin() + 1; it != arguments.end(); ++it) {
+         if (Refused(*it)) throw std::runtime_error("Option not allowed: " + *it);
+      }
+      const auto inputName = std::filesystem::path(fields[fields.size() - 2]).filename();   // No paths from the network
+      if (inputName.extension() != ".i" && inputName.extension() != ".ii") throw std::runtime_error("Expected a preprocessed source");
+
+      const auto directory = std::filesystem::temp_directory_path() / "FBuildWorker" / Unique();
+      std::filesystem::create_directories(directory);
+
+      const auto input = directory / inputName;
+      const auto object = directory / "object.o";
+      std::ofstream{input, std::ios::binary} << fields.back();
+
+      auto command = arguments;
+      command.insert(command.end(), {"-o", object.string(), input.string()});
+
+      Process::Result result;
+      try {
+         result = Process::Run(command, Process::Current(), true);
+      }
+      catch (std::exception& e) {
+         result.exitCode = -1;
+         result.output = std::string(e.what()) + "\n";
+      }
+
+      std::string content;
+      if (result.exitCode == 0) {
+         std::ifstream in{object, std::ios::binary};
+         content.assign(std::istreambuf_iterator<char>{in}, std::istreambuf_iterator<char>{});
+      }
+
+      std::error_code error;
+      std::filesystem::remove_all(directory, error);
+
+      return Encode({std::to_string(result.exitCode), result.output, content});
+   }
+}
+
+
+
+namespace Executor {
+
+   void Add (std::unique_ptr<Worker> worker)
+   {
+      TheRegistry().Add(std::move(worker));
+   }
+
+   void Workers (const std::vector<std::string>& urls)
+   {
+      std::vector<std::unique_ptr<Worker>> workers;
+      for (auto&& url : urls) workers.push_back(std::make_unique<HttpWorker>(url));
+
+      TheRegistry().Replace(std::move(workers));
+   }
+
+   std::vector<Worker*> Available ()
+   {
+      auto result = TheRegistry().All();
+
+      // Asks the new ones for their slots at once, a worker that is down costs its timeout only once
+      std::vector<std::thread> threads;
+      for (auto&& worker : result) threads.emplace_back([worker] { worker->Slots(); });
+      for (auto&& thread : threads) thread.join();
+
+      result.erase(std::remove_if(result.begin(), result.end(), [] (Worker* worker) { return worker->Slots() == 0; }), result.end());
+      return result;
+   }
+
+   void Statistics (std::ostream& out)
+   {
+      const auto workers = TheRegistry().All();
+      if (workers.empty()) return;
+
+      auto& counters = TheCounters();
+      out << "Workers: " << workers.size() << ", " << counters.actions << " compiles (" << counters.failed << " failed), "
+          << counters.fallbacks << " compiled locally after worker errors, " << (counters.sentBytes >> 20) << " MB sent\n" << std::flush;
+   }
+
+   void Serve (const std::string& address, const std::string& port, unsigned slots, const std::vector<std::string>& compilers)
+   {
+      slots = std::max(slots, 1u);
+
+      std::vector<std::string> names;
+      for (auto&& compiler : compilers) names.push_back(ProgramName(compiler));
+
+      std::cout << "Worker on " << address << ":" << port << ", " << slots << " slots, compilers:";
+      for (auto&& name : names) std::cout << " " << name;
+      std::cout << std::endl;
+
+      static Slots free{slots};
+
+      Http::Serve(address, port, [slots, names] (const Http::Received& request) -> Http::Response {
+         if (request.method == "GET" && request.path == "/slots") return {200, std::to_string(slots)};
+         if (request.method != "POST" || request.path != "/compile") return {404, {}};
+
+         const auto fields = Decode(request.body);
+
+         free.Acquire();
+         try {
+            auto answer = Compile(fields, names);
+            free.Release();
+            return {200, std::move(answer)};
+         }
+         catch (...) {
+            free.Release();
+            throw;
+         }
+      });
+   }
+}
+
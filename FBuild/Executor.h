@@ -0,0 +1,54 @@
+/*
+ * Any copyright is dedicated to the Public Domain.
+ * http://creativecommons.org/publicdomain/zero/1.0/*
+ *
+ * Author: Frank Barwich
+ */
+
+#pragma once
+
+#include "Process.h"
+
+#include <iosfwd>
+#include <memory>
+#include <string>
+#include <vector>
+
+
+// Compiles on other machines. A compile is packaged hermetically: The source preprocessed on this machine and the
+// options, the worker needs nothing but the compiler. The first kind of worker is "FBuild worker" on a TCP port, started
+// on any number of machines, or several times on one for tests. Workers come from Workers() or FB_WORKERS=<url>,<url>.
+namespace Executor {
+
+   struct Action {
+      Process::Arguments arguments;   // Compiler and options. Without the input and the output.
+      std::string        inputName;   // Foo.ii or Foo.i, the compiler tells the language by the extension
+      std::string        input;       // Preprocessed
+   };
+
+   struct Result {
+      int         exitCode{0};
+      std::string output;   // The diagnostics
+      std::string object;
+   };
+
+   class Worker {
+   public:
+      virtual ~Worker () = default;
+
+      virtual std::string Name () const = 0;
+      virtual unsigned    Slots () = 0;                                        // Actions it runs at once. 0 if it's not usable (anymore).
+      virtual bool        Run (const Action& action, Result& result) = 0;      // false if the worker failed, not the compile. Run it locally then.
+   };
+
+   void                 Add (std::unique_ptr<Worker> worker);
+   void                 Workers (const std::vector<std::string>& urls);   // Replaces all workers by "FBuild worker" daemons at the urls
+   std::vector<Worker*> Available ();                                     // With at least one slot
+
+   void Statistics (std::ostream& out);
+
+   // The daemon: "FBuild worker [bind=127.0.0.1] [port=9000] [slots=<cores>] [compilers=gcc,g++,...]". bind=* serves all
+   // interfaces. It only runs the compilers of the list, by name from its own PATH, and refuses options that load or run
+   // other programs or write elsewhere. There's no authentication, the network has to be trusted.
+   void Serve (const std::string& address, const std::string& port, unsigned slots, const std::vector<std::string>& compilers);
+}
@@ -0,0 +1,171 @@
+/*
+ * Any copyright is dedicated to the Public Domain.
+ * http://creativecommons.org/publicdomain/zero/1.0/*
+ *
+ * Author: Frank Barwich
+ */
+
+#include "Explain.h"
+#include "History.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cstdio>
+#include <filesystem>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <map>
+#include <mutex>
+#include <vector>
+
+
+
+namespace {
+
+   struct Entry {
+      std::string              output;
+      std::string              reason;
+      std::string              dependency;
+      std::chrono::nanoseconds check;
+   };
+
+   struct Check {
+      std::string              what;
+      size_t                   files;
+      std::chrono::nanoseconds duration;
+   };
+
+   std::atomic<bool>     enabled{false};
+   std::mutex            mutex;
+   std::vector<Entry>    entries;
+   std::vector<Check>    checks;
+   std::filesystem::path report;
+
+   double Milliseconds (std::chrono::nanoseconds duration)
+   {
+      return std::chrono::duration<double, std::milli>(duration).count();
+   }
+
+   std::string Json (const std::string& text)
+   {
+      std::string result = "\"";
+
+      for (const char ch : text) {
+         switch (ch) {
+            case '"':  result += "\\\""; break;
+            case '\\': result += "\\\\"; break;
+            case '\n': result += "\\n"; break;
+            case '\r': result += "\\r"; break;
+            case '\t': result += "\\t"; break;
+            default:
+               if (static_cast<unsigned char>(ch) < 0x20) {
+                  char buffer[8];
+                  std::snprintf(buffer, sizeof(buffer), "\\u%04x", ch);
+                  result += buffer;
+               }
+               else {
+                  result += ch;
+               }
+         }
+      }
+
+      return result + "\"";
+   }
+}
+
+
+
+namespace Explain {
+
+   void Enable ()
+   {
+      report = std::filesystem::absolute("FBuild_Explain.json");
+      enabled = true;
+   }
+
+   bool Enabled ()
+   {
+      return enabled;
+   }
+
+   void OutOfDate (const std::string& output, const std::string& reason, const std::string& dependency, std::chrono::nanoseconds check)
+   {
+      History::Reason(output, reason);   // Kept with every build, not only with explain=1
+      if (!enabled) return;
+
+      const auto lock = std::lock_guard{mutex};
+      entries.push_back(Entry{output, reason, dependency, check});
+   }
+
+   void Checked (const std::string& what, size_t files, std::chrono::nanoseconds duration)
+   {
+      if (!enabled) return;
+
+      const auto lock = std::lock_guard{mutex};
+      checks.push_back(Check{what, files, duration});
+   }
+
+   void Report ()
+   {
+      if (!enabled) return;
+
+      const auto lock = std::lock_guard{mutex};
+
+      std::map<std::string, size_t> reasons;
+      std::map<std::string, size_t> dependencies;
+      for (auto&& entry : entries) {
+         ++reasons[entry.reason];
+         if (!entry.dependency.empty()) ++dependencies[entry.dependency];
+      }
+
+      std::cout << "\nExplain: " << entries.size() << " outputs out of date\n";
+
+      for (auto&& reason : reasons) {
+         std::cout << "   " << std::setw(7) << reason.second << "  " << reason.first << "\n";
+      }
+
+      // A rebuild storm usually has a single cause. The dependencies responsible for most rebuilds come first.
+      std::vector<std::pair<std::string, size_t>> top(dependencies.begin(), dependencies.end());
+      std::sort(top.begin(), top.end(), [] (const auto& l, const auto& r) { return l.second > r.second; });
+      if (top.size() > 10) top.resize(10);
+
+      if (!top.empty()) {
+         std::cout << "Most rebuilds caused by\n";
+         for (auto&& dependency : top) {
+            std::cout << "   " << std::setw(7) << dependency.second << "  " << dependency.first << "\n";
+         }
+      }
+
+      if (!checks.empty()) {
+         const auto flags = std::cout.flags();
+         std::cout << "Up to date checks\n";
+         for (auto&& check : checks) {
+            std::cout << "   " << std::setw(10) << std::fixed << std::setprecision(1) << Milliseconds(check.duration) << " ms  " << check.files << " files  " << check.what << "\n";
+         }
+         std::cout.flags(flags);
+      }
+
+      std::ofstream stream(report, std::ios::trunc);
+      stream << "{\n  \"outOfDate\": [";
+      for (size_t i = 0; i < entries.size(); ++i) {
+         const auto& entry = entries[i];
+         stream << (i ? ",\n" : "\n")
+                << "    {\"output\": " << Json(entry.output)
+                << ", \"reason\": " << Json(entry.reason)
+                << ", \"dependency\": " << Json(entry.dependency)
+                << ", \"checkMs\": " << Milliseconds(entry.check) << "}";
+      }
+      stream << "\n  ],\n  \"checks\": [";
+      for (size_t i = 0; i < checks.size(); ++i) {
+         const auto& check = checks[i];
+         stream << (i ? ",\n" : "\n")
+                << "    {\"what\": " << Json(check.what)
+                << ", \"files\": " << check.files
+                << ", \"ms\": " << Milliseconds(check.duration) << "}";
+      }
+      stream << "\n  ]\n}\n";
+
+      std::cout << "Report written to " << report.string() << std::endl;
+   }
+}
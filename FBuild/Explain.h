@@ -0,0 +1,25 @@
+/*
+ * Any copyright is dedicated to the Public Domain.
+ * http://creativecommons.org/publicdomain/zero/1.0/*
+ *
+ * Author: Frank Barwich
+ */
+
+#pragma once
+
+#include <chrono>
+#include <string>
+
+
+// explain=1: Records why each output is out of date, with the deciding dependency and the time the check took.
+// At the end a summary is printed and FBuild_Explain.json is written to the directory FBuild was started in.
+namespace Explain {
+
+   void Enable ();
+   bool Enabled ();
+
+   void OutOfDate (const std::string& output, const std::string& reason, const std::string& dependency = {}, std::chrono::nanoseconds check = {});
+   void Checked (const std::string& what, size_t files, std::chrono::nanoseconds duration);   // Timing of a whole up to date check
+
+   void Report ();
+}
@@ -6,12 +6,67 @@
  */
 
 #include "JavaScript.h"
+#include "LastWriteTime.h"
+#include "Snapshot.h"
+#include "Explain.h"
+#include "Process.h"
+#include "Supervisor.h"
+#include "Jobserver.h"
+#include "ObjectCache.h"
+#include "RemoteCache.h"
+#include "Executor.h"
+#include "Trace.h"
+#include "History.h"
 
+#include <chrono>
+#include <filesystem>
 #include <iostream>
+#include <sstream>
 #include <string>
+#include <thread>
 #include <vector>
 
-#include <windows.h>
+#ifdef _WIN32
+   #define NOMINMAX
+   #include <windows.h>
+#else
+   #include <unistd.h>
+#endif
+
+
+static std::string ExecutablePath ()
+{
+#ifdef _WIN32
+   char exe[MAX_PATH];
+   if (!::GetModuleFileNameA(nullptr, exe, MAX_PATH)) return {};
+   return exe;
+#else
+   std::error_code error;
+   return std::filesystem::read_symlink("/proc/self/exe", error).string();
+#endif
+}
+
+// Compares starting a process directly with going through the shell, like FBuild did before.
+static void SpawnBenchmark (const std::string& exe, int count)
+{
+   const auto measure = [count] (const std::function<int ()>& spawn) {
+      const auto start = std::chrono::steady_clock::now();
+      for (int i = 0; i < count; ++i) {
+         if (spawn() != 0) throw std::runtime_error("Benchmark child failed");
+      }
+      return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count() / count;
+   };
+
+   const auto environment = Process::Current();
+   const auto direct = measure([&] { return Process::Run({exe, "spawn-benchmark-child"}, environment).exitCode; });
+   const auto captured = measure([&] { return Process::Run({exe, "spawn-benchmark-child"}, environment, true).exitCode; });
+   const auto shell = measure([&] { return std::system(("\"" + exe + "\" spawn-benchmark-child").c_str()); });
+
+   std::cout << count << " spawns each\n"
+             << "Process::Run:           " << direct << " ms\n"
+             << "Process::Run (capture): " << captured << " ms\n"
+             << "std::system:            " << shell << " ms" << std::endl;
+}
 
 int main (int argc, char** argv)
 {
@@ -19,7 +74,88 @@ int main (int argc, char** argv)
       std::vector<std::string> args;
       for (int i = 1; i < argc; ++i) args.emplace_back(argv[i]);
 
+      if (args.size() == 1 && args[0] == "cache-stats") {
+         TimestampCacheStatistics(std::cout);
+         ObjectCache::Statistics(std::cout);
+         return 0;
+      }
+
+      if (!args.empty() && args[0] == "history") {
+         History::Query({args.begin() + 1, args.end()}, std::cout);
+         return 0;
+      }
+
+      if (!args.empty() && args[0] == "cache-server") {
+         std::string address = "127.0.0.1", port = "8088", directory = "FBuildRemoteCache";
+         for (auto&& arg : args) {
+            if (arg.rfind("bind=", 0) == 0) address = arg.substr(5);
+            if (arg.rfind("port=", 0) == 0) port = arg.substr(5);
+            if (arg.rfind("directory=", 0) == 0) directory = arg.substr(10);
+         }
+         RemoteCache::Serve(address, port, directory);
+         return 0;
+      }
+
+      if (!args.empty() && args[0] == "worker") {
+         std::string address = "127.0.0.1", port = "9000";
+         unsigned slots = std::max(std::thread::hardware_concurrency(), 1u);
+         std::vector<std::string> compilers{"gcc", "g++", "cc", "c++", "clang", "clang++"};
+         for (auto&& arg : args) {
+            if (arg.rfind("bind=", 0) == 0) address = arg.substr(5);
+            if (arg.rfind("port=", 0) == 0) port = arg.substr(5);
+            if (arg.rfind("slots=", 0) == 0) slots = static_cast<unsigned>(std::stoul(arg.substr(6)));
+            if (arg.rfind("compilers=", 0) == 0) {
+               compilers.clear();
+               std::istringstream names{arg.substr(10)};
+               for (std::string name; std::getline(names, name, ',');) {
+                  if (!name.empty()) compilers.push_back(name);
+               }
+            }
+         }
+         Executor::Serve(address, port, slots, compilers);
+         return 0;
+      }
+
+      if (args.size() == 1 && args[0] == "spawn-benchmark-child") return 0;
+
+      if (!args.empty() && args[0] == "spawn-benchmark") {
+         const auto exe = ExecutablePath();
+         if (exe.empty()) throw std::runtime_error("Unable to determine the path of FBuild");
+         SpawnBenchmark(exe, args.size() > 1 ? std::stoi(args[1]) : 200);
+         return 0;
+      }
+
+#ifdef _WIN32
       ::SetPriorityClass(::GetCurrentProcess(), BELOW_NORMAL_PRIORITY_CLASS);
+#else
+      if (::nice(5) == -1) { }   // Best effort, like BELOW_NORMAL_PRIORITY_CLASS. The children inherit it.
+#endif
+
+      for (auto&& arg : args) {   // First, the trace has to be there before the statics that trace themselves
+         if (arg.rfind("trace=", 0) == 0 || arg.rfind("trace:", 0) == 0) Trace::Enable(std::filesystem::absolute(arg.substr(6)));
+      }
+
+      for (auto&& arg : args) {
+         if (arg == "explain=1" || arg == "explain:1") Explain::Enable();
+         if (arg.rfind("jobs=", 0) == 0 || arg.rfind("jobs:", 0) == 0) Supervisor::Limit(static_cast<unsigned>(std::stoul(arg.substr(5))));
+      }
+
+      const auto exe = ExecutablePath();
+
+      bool upToDate = false;
+      {
+         const Trace::Scope trace{"Up to date check"};
+         Snapshot::Begin(exe, args);
+         upToDate = Snapshot::UpToDate();
+      }
+      if (upToDate) {
+         std::cout << "Up to date" << std::endl;
+         return 0;
+      }
+
+      if (!exe.empty()) Snapshot::Track(exe);   // A new FBuild may do things differently
+
+      Supervisor::Limit(Jobserver::Setup(Supervisor::Limit()));   // One budget with nested FBuilds and makes
 
       JavaScript js(args);
 
@@ -32,11 +168,26 @@ int main (int argc, char** argv)
          "   else throw error;"
          "}";
 
-      js.ExecuteString(script, "Script");
+      {
+         const Trace::Scope trace{"FBuild.js"};
+         js.ExecuteString(script, "Script");
+      }
+
+      Snapshot::Save();
+      RemoteCache::Flush();   // Before Trim() removes what's still to upload
+      ObjectCache::Trim();
+      Explain::Report();
+      if (Explain::Enabled()) {
+         Supervisor::Report(std::cout);
+         ObjectCache::Statistics(std::cout);
+         RemoteCache::Statistics(std::cout);
+         Executor::Statistics(std::cout);
+      }
 
       return 0;
    }
    catch (std::exception& e) {
+      Explain::Report();
       std::cerr << e.what() << std::endl;
       return 5;
    }
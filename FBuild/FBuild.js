@@ -5,6 +5,7 @@ if (args.build != "Debug" && args.build != "Release") throw "build='<Release|Deb
 if (args.rebuild == undefined) args.rebuild = false;
 
 ToolChain("x64");
+var msvc = ToolChain().indexOf("MSVC") == 0;
 
 var exe = new Exe;
 exe.Build(args.build);
@@ -13,11 +14,17 @@ exe.DependencyCheck(!args.rebuild);
 exe.CRT("Static");
 exe.Defines("_CRT_SECURE_NO_WARNINGS");
 exe.PrecompiledHeader("Precompiled.h", "Precompiled.cpp");
-exe.WarningLevel(4).WarningAsError(true);
+exe.WarningLevel(4).WarningAsError(msvc);
 
-exe.Output("../" + args.build + "/FBuild.exe");
+exe.Output("../" + args.build + (msvc ? "/FBuild.exe" : "/FBuild"));
 exe.LibPath("../" + args.build);
-exe.Libs("Duktape.lib", "Ws2_32.lib", "Winmm.lib", "Shlwapi.lib");
-exe.LinkArgs("/SUBSYSTEM:CONSOLE /OPT:ICF=4")
+if (msvc) {
+   exe.Libs("Duktape.lib", "Ws2_32.lib", "Winmm.lib", "Shlwapi.lib");
+   exe.LinkArgs("/SUBSYSTEM:CONSOLE /OPT:ICF=4")
+}
+else {
+   exe.CompileArgs("-Wno-comment");   // The "/*" in the licence headers
+   exe.Libs("Duktape.lib", "pthread");
+}
 
 exe.Create();
@@ -7,6 +7,10 @@
 
 #include "FileToCpp.h"
 #include "MemoryMappedFile.h"
+#include "Manifest.h"
+#include "Snapshot.h"
+#include "Explain.h"
+#include "Hash.h"
 
 #include <iostream>
 #include <fstream>
@@ -26,17 +30,42 @@ void FileToCpp::CheckParams ()
    if (!std::filesystem::exists(infile)) throw std::runtime_error("Missing Infile '" + infile + "' for FileToCpp(). File does not exist.");
 }
 
+std::string FileToCpp::Signature () const
+{
+   std::string options;
+   for (auto&& option : {nameForNamespace, nameForArray, nameForPtr, intro, outro, additional}) options += std::to_string(option.size()) + ":" + option + "\n";
+   options += std::string(varConst ? "const" : "") + " " + (terminatingNull ? "null" : "");
+
+   return Hash::String(options);
+}
+
 bool FileToCpp::NeedsRebuild ()
 {
-   if (!dependencyCheck) return true;
-   if (!std::filesystem::exists(outfile)) return true;
-   return std::filesystem::last_write_time(infile) > std::filesystem::last_write_time(outfile);
+   if (!dependencyCheck) {
+      Explain::OutOfDate(outfile, "DependencyCheck(false)");
+      return true;
+   }
+   if (!std::filesystem::exists(outfile)) {
+      Explain::OutOfDate(outfile, "missing output");
+      return true;
+   }
+
+   if (const auto upToDate = Manifest::UpToDate(outfile, {infile}, Signature())) return !*upToDate;
+   if (std::filesystem::last_write_time(infile) > std::filesystem::last_write_time(outfile)) {
+      Explain::OutOfDate(outfile, "newer input", infile);
+      return true;
+   }
+
+   Manifest::Record(outfile, {infile}, Signature());   // Up to date by timestamps. From now on the content counts.
+   return false;
 }
 
 void FileToCpp::Create ()
 {
    CheckParams();
    if (!NeedsRebuild()) return;
+
+   Snapshot::Invalidate();
    bool hasNamespace = !nameForNamespace.empty();
 
    std::ofstream out(outfile, std::ofstream::trunc);
@@ -83,4 +112,9 @@ void FileToCpp::Create ()
 
    if (outro.size()) out << outro;
    out << "\n\n";
+
+   out.close();
+   if (out.fail()) throw std::runtime_error("Error writing " + outfile);
+
+   Manifest::Record(outfile, {infile}, Signature());
 }
@@ -23,6 +23,7 @@ class FileToCpp {
    bool        terminatingNull;
 
    void CheckParams ();
+   std::string Signature () const;   // Of the options, for the Manifest
    bool NeedsRebuild ();
 
 public:
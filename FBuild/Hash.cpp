@@ -0,0 +1,365 @@
+/*
+ * Any copyright is dedicated to the Public Domain.
+ * http://creativecommons.org/publicdomain/zero/1.0/*
+ *
+ * Author: Frank Barwich
+ */
+
+#include "Hash.h"
+#include "MemoryMappedFile.h"
+
+#include "PicoSHA2/picosha2.h"
+
+#include <array>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <stdexcept>
+
+#if defined(_M_X64) || defined(__x86_64__)
+#define FBUILD_SHA_NI 1
+#if defined(_MSC_VER)
+#include <intrin.h>
+#define FBUILD_TARGET_SHA
+#else
+#include <cpuid.h>
+#include <immintrin.h>
+#define FBUILD_TARGET_SHA __attribute__((target("sha,sse4.1,ssse3")))
+#endif
+#endif
+
+
+namespace {
+
+   //
+   // XXH64, see https://github.com/Cyan4973/xxHash/blob/dev/doc/xxhash_spec.md
+   //
+   constexpr uint64_t prime1 = 0x9E3779B185EBCA87ULL;
+   constexpr uint64_t prime2 = 0xC2B2AE3D27D4EB4FULL;
+   constexpr uint64_t prime3 = 0x165667B19E3779F9ULL;
+   constexpr uint64_t prime4 = 0x85EBCA77C2B2AE63ULL;
+   constexpr uint64_t prime5 = 0x27D4EB2F165667C5ULL;
+
+   inline uint64_t RotateLeft (uint64_t value, int bits)
+   {
+      return (value << bits) | (value >> (64 - bits));
+   }
+
+   inline uint64_t Read64 (const unsigned char* p)
+   {
+      uint64_t result;
+      std::memcpy(&result, p, sizeof(result));
+      return result;
+   }
+
+   inline uint32_t Read32 (const unsigned char* p)
+   {
+      uint32_t result;
+      std::memcpy(&result, p, sizeof(result));
+      return result;
+   }
+
+   inline uint64_t Round (uint64_t acc, uint64_t input)
+   {
+      acc += input * prime2;
+      acc = RotateLeft(acc, 31);
+      return acc * prime1;
+   }
+
+   inline uint64_t MergeRound (uint64_t acc, uint64_t value)
+   {
+      acc ^= Round(0, value);
+      return acc * prime1 + prime4;
+   }
+
+   uint64_t Xxh64 (const unsigned char* p, size_t length, uint64_t seed = 0)
+   {
+      const unsigned char* const end = p + length;
+      uint64_t h;
+
+      if (length >= 32) {
+         uint64_t v1 = seed + prime1 + prime2;
+         uint64_t v2 = seed + prime2;
+         uint64_t v3 = seed;
+         uint64_t v4 = seed - prime1;
+
+         const unsigned char* const limit = end - 32;
+         do {
+            v1 = Round(v1, Read64(p));      p += 8;
+            v2 = Round(v2, Read64(p));      p += 8;
+            v3 = Round(v3, Read64(p));      p += 8;
+            v4 = Round(v4, Read64(p));      p += 8;
+         } while (p <= limit);
+
+         h = RotateLeft(v1, 1) + RotateLeft(v2, 7) + RotateLeft(v3, 12) + RotateLeft(v4, 18);
+         h = MergeRound(h, v1);
+         h = MergeRound(h, v2);
+         h = MergeRound(h, v3);
+         h = MergeRound(h, v4);
+      }
+      else {
+         h = seed + prime5;
+      }
+
+      h += static_cast<uint64_t>(length);
+
+      while (p + 8 <= end) {
+         h ^= Round(0, Read64(p));
+         h = RotateLeft(h, 27) * prime1 + prime4;
+         p += 8;
+      }
+
+      if (p + 4 <= end) {
+         h ^= static_cast<uint64_t>(Read32(p)) * prime1;
+         h = RotateLeft(h, 23) * prime2 + prime3;
+         p += 4;
+      }
+
+      while (p < end) {
+         h ^= (*p) * prime5;
+         h = RotateLeft(h, 11) * prime1;
+         ++p;
+      }
+
+      h ^= h >> 33;
+      h *= prime2;
+      h ^= h >> 29;
+      h *= prime3;
+      h ^= h >> 32;
+
+      return h;
+   }
+
+   std::string Hex (const unsigned char* p, size_t length)
+   {
+      static const char digits[] = "0123456789abcdef";
+
+      std::string result(length * 2, '\0');
+      for (size_t i = 0; i < length; ++i) {
+         result[2 * i] = digits[p[i] >> 4];
+         result[2 * i + 1] = digits[p[i] & 0x0f];
+      }
+
+      return result;
+   }
+
+   std::string Fast (const unsigned char* p, size_t length)
+   {
+      const uint64_t h = Xxh64(p, length);
+
+      std::array<unsigned char, 8> bytes;
+      for (size_t i = 0; i < bytes.size(); ++i) {
+         bytes[i] = static_cast<unsigned char>(h >> (56 - 8 * i));
+      }
+
+      return Hex(bytes.data(), bytes.size());
+   }
+
+
+
+   //
+   // SHA-256. With SHA-NI the compression function runs in hardware, otherwise PicoSHA2 does the work.
+   //
+#ifdef FBUILD_SHA_NI
+   bool HasShaExtensions ()
+   {
+      static const bool result = [] {
+#if defined(_MSC_VER)
+         int regs[4]{};
+         __cpuid(regs, 0);
+         if (regs[0] < 7) return false;
+         __cpuid(regs, 1);
+         const bool sse41 = (regs[2] & (1 << 19)) != 0;
+         const bool ssse3 = (regs[2] & (1 << 9)) != 0;
+         __cpuidex(regs, 7, 0);
+         const bool sha = (regs[1] & (1 << 29)) != 0;
+#else
+         unsigned int eax{}, ebx{}, ecx{}, edx{};
+         if (__get_cpuid_max(0, nullptr) < 7) return false;
+         __cpuid(1, eax, ebx, ecx, edx);
+         const bool sse41 = (ecx & (1u << 19)) != 0;
+         const bool ssse3 = (ecx & (1u << 9)) != 0;
+         __cpuid_count(7, 0, eax, ebx, ecx, edx);
+         const bool sha = (ebx & (1u << 29)) != 0;
+#endif
+         return sse41 && ssse3 && sha;
+      } ();
+
+      return result;
+   }
+
+   alignas(16) constexpr uint32_t sha256K[64] = {
+      0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5, 0x3956c25b, 0x59f111f1, 0x923f82a4, 0xab1c5ed5,
+      0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3, 0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174,
+      0xe49b69c1, 0xefbe4786, 0x0fc19dc6, 0x240ca1cc, 0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
+      0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7, 0xc6e00bf3, 0xd5a79147, 0x06ca6351, 0x14292967,
+      0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13, 0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85,
+      0xa2bfe8a1, 0xa81a664b, 0xc24b8b70, 0xc76c51a3, 0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
+      0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5, 0x391c0cb3, 0x4ed8aa4a, 0x5b9cca4f, 0x682e6ff3,
+      0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208, 0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2
+   };
+
+   FBUILD_TARGET_SHA void Sha256Blocks (uint32_t state[8], const unsigned char* data, size_t blocks)
+   {
+      const __m128i mask = _mm_set_epi64x(0x0c0d0e0f08090a0bULL, 0x0405060700010203ULL);
+
+      __m128i tmp = _mm_loadu_si128(reinterpret_cast<const __m128i*>(&state[0]));
+      __m128i state1 = _mm_loadu_si128(reinterpret_cast<const __m128i*>(&state[4]));
+
+      tmp = _mm_shuffle_epi32(tmp, 0xB1);                   // CDAB
+      state1 = _mm_shuffle_epi32(state1, 0x1B);             // EFGH
+      __m128i state0 = _mm_alignr_epi8(tmp, state1, 8);     // ABEF
+      state1 = _mm_blend_epi16(state1, tmp, 0xF0);          // CDGH
+
+      for (; blocks; --blocks, data += 64) {
+         const __m128i abefSave = state0;
+         const __m128i cdghSave = state1;
+
+         __m128i w[16];
+         for (int i = 0; i < 16; ++i) {
+            if (i < 4) {
+               w[i] = _mm_shuffle_epi8(_mm_loadu_si128(reinterpret_cast<const __m128i*>(data + 16 * i)), mask);
+            }
+            else {
+               const __m128i t = _mm_add_epi32(_mm_sha256msg1_epu32(w[i - 4], w[i - 3]), _mm_alignr_epi8(w[i - 1], w[i - 2], 4));
+               w[i] = _mm_sha256msg2_epu32(t, w[i - 1]);
+            }
+
+            __m128i msg = _mm_add_epi32(w[i], _mm_load_si128(reinterpret_cast<const __m128i*>(&sha256K[4 * i])));
+            state1 = _mm_sha256rnds2_epu32(state1, state0, msg);
+            msg = _mm_shuffle_epi32(msg, 0x0E);
+            state0 = _mm_sha256rnds2_epu32(state0, state1, msg);
+         }
+
+         state0 = _mm_add_epi32(state0, abefSave);
+         state1 = _mm_add_epi32(state1, cdghSave);
+      }
+
+      tmp = _mm_shuffle_epi32(state0, 0x1B);                // FEBA
+      state1 = _mm_shuffle_epi32(state1, 0xB1);             // DCHG
+      state0 = _mm_blend_epi16(tmp, state1, 0xF0);          // DCBA
+      state1 = _mm_alignr_epi8(state1, tmp, 8);             // ABEF
+
+      _mm_storeu_si128(reinterpret_cast<__m128i*>(&state[0]), state0);
+      _mm_storeu_si128(reinterpret_cast<__m128i*>(&state[4]), state1);
+   }
+
+   std::string Sha256Hardware (const unsigned char* p, size_t length)
+   {
+      uint32_t state[8] = { 0x6a09e667, 0xbb67ae85, 0x3c6ef372, 0xa54ff53a, 0x510e527f, 0x9b05688c, 0x1f83d9ab, 0x5be0cd19 };
+
+      const size_t full = length / 64;
+      Sha256Blocks(state, p, full);
+
+      // Padding: 0x80, zeros, length in bits (big endian). One or two blocks, depending on the rest.
+      std::array<unsigned char, 128> tail{};
+      const size_t rest = length % 64;
+      std::memcpy(tail.data(), p + full * 64, rest);
+      tail[rest] = 0x80;
+
+      const size_t tailBlocks = rest < 56 ? 1 : 2;
+      const uint64_t bits = static_cast<uint64_t>(length) * 8;
+      for (size_t i = 0; i < 8; ++i) {
+         tail[tailBlocks * 64 - 1 - i] = static_cast<unsigned char>(bits >> (8 * i));
+      }
+
+      Sha256Blocks(state, tail.data(), tailBlocks);
+
+      std::array<unsigned char, 32> digest;
+      for (size_t i = 0; i < 8; ++i) {
+         digest[4 * i] = static_cast<unsigned char>(state[i] >> 24);
+         digest[4 * i + 1] = static_cast<unsigned char>(state[i] >> 16);
+         digest[4 * i + 2] = static_cast<unsigned char>(state[i] >> 8);
+         digest[4 * i + 3] = static_cast<unsigned char>(state[i]);
+      }
+
+      return Hex(digest.data(), digest.size());
+   }
+#endif
+
+   std::string Sha256 (const unsigned char* p, size_t length)
+   {
+#ifdef FBUILD_SHA_NI
+      if (HasShaExtensions()) return Sha256Hardware(p, length);
+#endif
+
+      std::array<unsigned char, picosha2::k_digest_size> digest;
+      picosha2::hash256(p, p + length, digest.begin(), digest.end());
+      return Hex(digest.data(), digest.size());
+   }
+
+   std::string Calculate (const unsigned char* p, size_t length, Hash::Algorithm algorithm)
+   {
+      if (algorithm == Hash::Algorithm::Sha256) return Hash::Name(algorithm) + ":" + Sha256(p, length);
+      return Hash::Name(algorithm) + ":" + Fast(p, length);
+   }
+}
+
+
+
+namespace Hash {
+
+   Algorithm DefaultAlgorithm ()
+   {
+      static const Algorithm result = [] {
+         const char* env = std::getenv("FB_HASH");
+         if (!env) return Algorithm::Fast;
+
+         const std::string name = env;
+         if (name == "sha256") return Algorithm::Sha256;
+         if (name == "fast" || name == "xxh64") return Algorithm::Fast;
+
+         throw std::runtime_error("Unknown hash algorithm FB_HASH=" + name + ". Expected <fast|sha256>");
+      } ();
+
+      return result;
+   }
+
+   std::string Name (Algorithm algorithm)
+   {
+      return algorithm == Algorithm::Sha256 ? "sha256" : "xxh64";
+   }
+
+   std::string String (std::string_view data, Algorithm algorithm)
+   {
+      return Calculate(reinterpret_cast<const unsigned char*>(data.data()), data.size(), algorithm);
+   }
+
+   std::string File (const std::filesystem::path& file, Algorithm algorithm)
+   {
+      if (std::filesystem::file_size(file) == 0) {
+         static const unsigned char empty{};
+         return Calculate(&empty, 0, algorithm);   // Empty files can't be mapped into memory
+      }
+
+      const MemoryMappedFile mmf{file};
+      return Calculate(reinterpret_cast<const unsigned char*>(mmf.CBegin()), mmf.Size(), algorithm);
+   }
+
+   std::string SampledFile (const std::filesystem::path& file, Algorithm algorithm)
+   {
+      constexpr size_t samples = 64;
+      constexpr size_t sampleSize = 64 * 1024;
+
+      if (std::filesystem::file_size(file) <= samples * sampleSize) {
+         return File(file, algorithm);
+      }
+
+      const MemoryMappedFile mmf{file};
+      const auto p = reinterpret_cast<const unsigned char*>(mmf.CBegin());
+      const size_t size = mmf.Size();
+
+      // The size, the first and the last block and evenly spaced blocks in between. Changes which neither alter
+      // the size nor touch one of the samples go unnoticed; that's the deal for not reading the whole file.
+      std::vector<unsigned char> buffer(sizeof(uint64_t) + samples * sampleSize);
+      const uint64_t size64 = size;
+      std::memcpy(buffer.data(), &size64, sizeof(size64));
+
+      const size_t stride = (size - sampleSize) / (samples - 1);
+      for (size_t i = 0; i < samples; ++i) {
+         std::memcpy(buffer.data() + sizeof(uint64_t) + i * sampleSize, p + i * stride, sampleSize);
+      }
+
+      return "sampled-" + Calculate(buffer.data(), buffer.size(), algorithm);
+   }
+}
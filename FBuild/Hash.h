@@ -0,0 +1,30 @@
+/*
+ * Any copyright is dedicated to the Public Domain.
+ * http://creativecommons.org/publicdomain/zero/1.0/*
+ *
+ * Author: Frank Barwich
+ */
+
+#pragma once
+
+#include <string>
+#include <string_view>
+#include <filesystem>
+
+
+namespace Hash {
+
+   // Fast is a non-cryptographic 64 bit hash (XXH64). It's more than good enough to detect changed files.
+   // Sha256 is used, where a cryptographic hash is needed. It uses the SHA extensions of the CPU if available.
+   enum class Algorithm { Fast, Sha256 };
+
+   Algorithm   DefaultAlgorithm ();                 // Environment FB_HASH=<fast|sha256>. Default is fast.
+   std::string Name (Algorithm algorithm);
+
+   // The results are prefixed by the name of the algorithm, eg "xxh64:0123456789abcdef". So hashes of different algorithms never compare equal.
+   std::string String (std::string_view data, Algorithm algorithm = Algorithm::Fast);
+   std::string File (const std::filesystem::path& file, Algorithm algorithm = DefaultAlgorithm());
+
+   // For huge files: Only a few MB spread over the file are hashed. The result is prefixed by "sampled-".
+   std::string SampledFile (const std::filesystem::path& file, Algorithm algorithm = DefaultAlgorithm());
+}
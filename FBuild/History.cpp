@@ -0,0 +1,377 @@
+/*
+ * Any copyright is dedicated to the Public Domain.
+ * http://creativecommons.org/publicdomain/zero/1.0/*
+ *
+ * Author: Frank Barwich
+ */
+
+#include "History.h"
+
+#include <algorithm>
+#include <filesystem>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <map>
+#include <mutex>
+#include <random>
+#include <set>
+#include <sstream>
+#include <unordered_map>
+
+
+
+namespace {
+
+   constexpr uintmax_t maxFileSize = 16 << 20;
+
+   struct Record {
+      int64_t     build{0};        // Seconds since the epoch, when it started
+      std::string action;
+      int64_t     milliseconds{0};
+      int64_t     cpu{0};          // Milliseconds, user and kernel
+      uint64_t    peakMemory{0};   // KB
+      std::string cache{"-"};      // hit, miss or -
+      int         exitCode{0};
+      std::string reason;
+      bool        ran{false};      // Not written
+   };
+
+   std::string Key (const std::string& action)
+   {
+      return std::filesystem::absolute(action).lexically_normal().generic_string();   // Same as Durations
+   }
+
+   std::filesystem::path File ()
+   {
+      return std::filesystem::temp_directory_path() / "FBuild_History_v1.txt";
+   }
+
+   // Format: build "action" milliseconds cpu peakMemory cache exitCode "reason"
+   std::ostream& operator<< (std::ostream& stream, const Record& record)
+   {
+      return stream << record.build << " " << std::quoted(record.action) << " " << record.milliseconds << " " << record.cpu << " "
+                    << record.peakMemory << " " << record.cache << " " << record.exitCode << " " << std::quoted(record.reason) << "\n";
+   }
+
+   std::vector<Record> Load ()
+   {
+      std::vector<Record> result;
+
+      std::ifstream stream(File());
+      Record record;
+      while (stream >> record.build >> std::quoted(record.action) >> record.milliseconds >> record.cpu >> record.peakMemory
+                    >> record.cache >> record.exitCode >> std::quoted(record.reason)) {
+         result.push_back(record);
+      }
+
+      return result;
+   }
+
+   void Compact ()
+   {
+      auto records = Load();
+
+      std::set<int64_t> builds;
+      for (auto&& record : records) builds.insert(record.build);
+      if (builds.size() < 2) return;
+
+      const auto oldest = *std::next(builds.begin(), static_cast<std::ptrdiff_t>(builds.size() / 2));   // The newer half stays
+      records.erase(std::remove_if(records.begin(), records.end(), [oldest] (const Record& record) { return record.build < oldest; }), records.end());
+
+      auto tmp = File();
+      tmp += "." + std::to_string(std::random_device{}()) + ".tmp";
+
+      {
+         std::ofstream stream(tmp, std::ios::trunc);
+         for (auto&& record : records) stream << record;
+         if (!stream.flush()) throw std::runtime_error("Error writing " + tmp.string());
+      }
+
+      std::error_code error;
+      std::filesystem::rename(tmp, File(), error);
+      if (error) std::filesystem::remove(tmp, error);
+   }
+
+   class Store {
+      std::mutex                                mutex_;
+      std::unordered_map<std::string, Record>   actions_;
+      std::unordered_map<std::string, uint64_t> peaks_;   // Earlier builds, loaded when first asked. KB.
+      uint64_t                                  averagePeak_{0};
+      bool                                      peaksLoaded_{false};
+      const int64_t                             build_{std::chrono::duration_cast<std::chrono::seconds>(std::chrono::system_clock::now().time_since_epoch()).count()};
+
+      void LoadPeaks ()   // Locked
+      {
+         if (peaksLoaded_) return;
+         peaksLoaded_ = true;
+
+         for (auto&& record : Load()) {
+            if (record.cache != "hit" && record.peakMemory) peaks_[record.action] = record.peakMemory;   // The file is in build order
+         }
+
+         uint64_t total = 0;
+         for (auto&& peak : peaks_) total += peak.second;
+         averagePeak_ = peaks_.empty() ? 0 : total / peaks_.size();
+      }
+
+      Record& Action (const std::string& output)   // Locked
+      {
+         auto& record = actions_[Key(output)];
+         record.build = build_;
+         return record;
+      }
+
+      void Save ()
+      {
+         bool any = false;
+         for (auto&& action : actions_) any = any || action.second.ran || action.second.cache == "hit";
+         if (!any) return;
+
+         {
+            // Appending, another FBuild may do the same. Every line is written in one piece.
+            std::ofstream stream(File(), std::ios::app);
+            for (auto&& [key, record] : actions_) {
+               if (!record.ran && record.cache != "hit") continue;   // Up to date checks of a build that stopped early
+
+               auto written = record;
+               written.action = key;
+               std::ostringstream line;
+               line << written;
+               stream << line.str() << std::flush;
+            }
+            if (!stream) throw std::runtime_error("Error writing " + File().string());
+         }
+
+         std::error_code error;
+         if (std::filesystem::file_size(File(), error) > maxFileSize) Compact();
+      }
+
+   public:
+      ~Store ()
+      {
+         try {
+            Save();
+         }
+         catch (std::exception& e) {
+            std::cerr << "FBuild: " << File() << ": " << e.what() << "\n";
+         }
+      }
+
+      void Reason (const std::string& output, const std::string& reason)
+      {
+         const auto lock = std::lock_guard{mutex_};
+         Action(output).reason = reason;
+      }
+
+      void Cached (const std::string& output, bool hit)
+      {
+         const auto lock = std::lock_guard{mutex_};
+         Action(output).cache = hit ? "hit" : "miss";
+      }
+
+      void Ran (const std::string& output, int exitCode, std::chrono::milliseconds duration, std::chrono::milliseconds cpu, uint64_t peakMemory)
+      {
+         const auto lock = std::lock_guard{mutex_};
+         auto& record = Action(output);
+         record.ran = true;
+         record.exitCode = exitCode;
+         record.milliseconds = duration.count();
+         record.cpu = cpu.count();
+         record.peakMemory = peakMemory >> 10;
+      }
+
+      std::optional<std::chrono::milliseconds> Took (const std::string& output)
+      {
+         const auto key = Key(output);
+
+         const auto lock = std::lock_guard{mutex_};
+         const auto it = actions_.find(key);
+         if (it == actions_.end() || !it->second.ran || it->second.exitCode != 0) return std::nullopt;
+         return std::chrono::milliseconds{it->second.milliseconds};
+      }
+
+      std::optional<uint64_t> PeakMemory (const std::string& action)
+      {
+         const auto key = Key(action);
+
+         const auto lock = std::lock_guard{mutex_};
+         LoadPeaks();
+         const auto it = peaks_.find(key);
+         if (it == peaks_.end()) return std::nullopt;
+         return it->second << 10;
+      }
+
+      uint64_t AveragePeakMemory ()
+      {
+         const auto lock = std::lock_guard{mutex_};
+         LoadPeaks();
+         return averagePeak_ << 10;
+      }
+   };
+
+   Store& TheStore ()
+   {
+      static Store store;
+      return store;
+   }
+
+   bool Ran (const Record& record)
+   {
+      return record.cache != "hit" && record.exitCode == 0;
+   }
+
+   std::set<int64_t> LastBuilds (const std::vector<Record>& records, size_t count)
+   {
+      std::set<int64_t> builds;
+      for (auto&& record : records) builds.insert(record.build);
+      while (builds.size() > count) builds.erase(builds.begin());
+      return builds;
+   }
+
+   void Slowest (const std::vector<Record>& records, size_t count, std::ostream& stream)
+   {
+      std::unordered_map<std::string, const Record*> latest;
+      for (auto&& record : records) {
+         if (Ran(record)) latest[record.action] = &record;   // The file is in build order
+      }
+
+      std::vector<const Record*> slowest;
+      for (auto&& item : latest) slowest.push_back(item.second);
+      std::sort(slowest.begin(), slowest.end(), [] (const Record* l, const Record* r) { return l->milliseconds > r->milliseconds; });
+      if (slowest.size() > count) slowest.resize(count);
+
+      stream << "      ms   cpu ms  peak MB  action (reason)\n";
+      for (auto&& record : slowest) {
+         stream << std::setw(8) << record->milliseconds << " " << std::setw(8) << record->cpu << " " << std::setw(8) << (record->peakMemory >> 10) << "  "
+                << record->action << (record->reason.empty() ? "" : " (" + record->reason + ")") << "\n";
+      }
+   }
+
+   void Regressions (const std::vector<Record>& records, size_t count, std::ostream& stream)
+   {
+      const auto recent = LastBuilds(records, count);
+
+      struct Times {
+         int64_t recent{0}, recentRuns{0}, before{0}, beforeRuns{0};
+      };
+      std::map<std::string, Times> times;
+
+      for (auto&& record : records) {
+         if (!Ran(record)) continue;
+
+         auto& t = times[record.action];
+         if (recent.count(record.build)) t.recent += record.milliseconds, ++t.recentRuns;
+         else t.before += record.milliseconds, ++t.beforeRuns;
+      }
+
+      struct Regression {
+         std::string action;
+         int64_t     before, recent;
+      };
+      std::vector<Regression> regressions;
+
+      for (auto&& [action, t] : times) {
+         if (!t.recentRuns || !t.beforeRuns) continue;
+
+         const auto before = t.before / t.beforeRuns;
+         const auto now = t.recent / t.recentRuns;
+         if (now - before >= 100 && now * 5 > before * 6) regressions.push_back({action, before, now});   // 20% and 100 ms, below is noise
+      }
+
+      std::sort(regressions.begin(), regressions.end(), [] (const Regression& l, const Regression& r) { return l.recent - l.before > r.recent - r.before; });
+
+      stream << "Slower in the last " << recent.size() << " builds than before\n"
+             << "  before      now  action\n";
+      for (auto&& regression : regressions) {
+         stream << std::setw(8) << regression.before << " " << std::setw(8) << regression.recent << "  " << regression.action << "\n";
+      }
+   }
+
+   void Targets (const std::vector<Record>& records, size_t count, std::ostream& stream)
+   {
+      const auto builds = LastBuilds(records, count);
+
+      struct Total {
+         int64_t milliseconds{0}, cpu{0};
+         size_t  actions{0}, hits{0};
+      };
+      std::map<std::string, Total> totals;
+
+      for (auto&& record : records) {
+         if (!builds.count(record.build)) continue;
+
+         auto& total = totals[std::filesystem::path(record.action).parent_path().generic_string()];
+         total.milliseconds += record.milliseconds;
+         total.cpu += record.cpu;
+         ++total.actions;
+         if (record.cache == "hit") ++total.hits;
+      }
+
+      std::vector<std::pair<std::string, Total>> sorted(totals.begin(), totals.end());
+      std::sort(sorted.begin(), sorted.end(), [] (const auto& l, const auto& r) { return l.second.milliseconds > r.second.milliseconds; });
+
+      stream << "Last " << builds.size() << " builds\n"
+             << "       s    cpu s  actions  cached  directory\n" << std::fixed << std::setprecision(1);
+      for (auto&& [directory, total] : sorted) {
+         stream << std::setw(8) << total.milliseconds / 1000.0 << " " << std::setw(8) << total.cpu / 1000.0 << " " << std::setw(8) << total.actions << " "
+                << std::setw(7) << total.hits << "  " << directory << "\n";
+      }
+      stream << std::defaultfloat;
+   }
+}
+
+
+
+namespace History {
+
+   void Reason (const std::string& output, const std::string& reason)
+   {
+      TheStore().Reason(output, reason);
+   }
+
+   void Cached (const std::string& output, bool hit)
+   {
+      TheStore().Cached(output, hit);
+   }
+
+   void Ran (const std::string& output, int exitCode, std::chrono::milliseconds duration, std::chrono::milliseconds cpu, uint64_t peakMemory)
+   {
+      TheStore().Ran(output, exitCode, duration, cpu, peakMemory);
+   }
+
+   std::optional<std::chrono::milliseconds> Took (const std::string& output)
+   {
+      return TheStore().Took(output);
+   }
+
+   std::optional<uint64_t> PeakMemory (const std::string& action)
+   {
+      return TheStore().PeakMemory(action);
+   }
+
+   uint64_t AveragePeakMemory ()
+   {
+      return TheStore().AveragePeakMemory();
+   }
+
+   void Query (const std::vector<std::string>& args, std::ostream& stream)
+   {
+      const auto what = args.empty() ? std::string{"slowest"} : args[0];
+      const auto number = [&args] (const std::string& name, size_t fallback) {
+         for (auto&& arg : args) {
+            if (arg.rfind(name + "=", 0) == 0) return static_cast<size_t>(std::stoul(arg.substr(name.size() + 1)));
+         }
+         return fallback;
+      };
+
+      const auto records = Load();
+
+      if (what == "slowest") Slowest(records, number("count", 20), stream);
+      else if (what == "regressions") Regressions(records, number("builds", 5), stream);
+      else if (what == "targets") Targets(records, number("builds", 1), stream);
+      else throw std::runtime_error("Unknown history query '" + what + "', try slowest, regressions or targets");
+
+      stream << std::flush;
+   }
+}
@@ -0,0 +1,37 @@
+/*
+ * Any copyright is dedicated to the Public Domain.
+ * http://creativecommons.org/publicdomain/zero/1.0/*
+ *
+ * Author: Frank Barwich
+ */
+
+#pragma once
+
+#include <chrono>
+#include <cstdint>
+#include <optional>
+#include <ostream>
+#include <string>
+#include <vector>
+
+
+// Every build appends what its actions cost to FBuild_History_v1.txt in the temp directory: The duration, CPU time and
+// peak memory of the tool, whether the object cache had the output and why it was out of date. An action is known by
+// what it produces, like in Durations. The file is compacted to the newer half of the builds when it gets too big.
+namespace History {
+
+   void Reason (const std::string& output, const std::string& reason);   // From the up to date checks
+   void Cached (const std::string& output, bool hit);                     // Object cache lookup
+   void Ran (const std::string& output, int exitCode, std::chrono::milliseconds duration, std::chrono::milliseconds cpu, uint64_t peakMemory);
+
+   std::optional<std::chrono::milliseconds> Took (const std::string& output);   // In this build, if it ran
+
+   // Of the latest run in earlier builds, for the Supervisor to admit jobs by memory. Bytes.
+   std::optional<uint64_t> PeakMemory (const std::string& action);
+   uint64_t                AveragePeakMemory ();   // Of all known actions, the guess for new ones
+
+   // FBuild history slowest [count=20]        Slowest actions of their latest run
+   //               regressions [builds=5]     Slower in the last builds than in the ones before
+   //               targets [builds=1]         Time by output directory, ie. by target
+   void Query (const std::vector<std::string>& args, std::ostream& stream);
+}
@@ -0,0 +1,363 @@
+/*
+ * Any copyright is dedicated to the Public Domain.
+ * http://creativecommons.org/publicdomain/zero/1.0/*
+ *
+ * Author: Frank Barwich
+ */
+
+#include "Http.h"
+
+#include <algorithm>
+#include <charconv>
+#include <cstring>
+#include <iostream>
+#include <stdexcept>
+#include <string>
+#include <thread>
+
+#ifdef _WIN32
+   #define NOMINMAX
+   #include <winsock2.h>
+   #include <ws2tcpip.h>
+#else
+   #include <cerrno>
+   #include <netdb.h>
+   #include <netinet/in.h>
+   #include <netinet/tcp.h>
+   #include <signal.h>
+   #include <sys/socket.h>
+   #include <sys/time.h>
+   #include <unistd.h>
+#endif
+
+
+
+namespace {
+
+#ifdef _WIN32
+   using Handle = SOCKET;
+   const Handle invalid = INVALID_SOCKET;
+
+   void CloseHandle (Handle handle) { ::closesocket(handle); }
+
+   struct Startup {
+      Startup ()
+      {
+         WSADATA data;
+         ::WSAStartup(MAKEWORD(2, 2), &data);
+      }
+      ~Startup () { ::WSACleanup(); }
+   };
+#else
+   using Handle = int;
+   const Handle invalid = -1;
+
+   void CloseHandle (Handle handle) { ::close(handle); }
+
+   struct Startup {
+      Startup () { ::signal(SIGPIPE, SIG_IGN); }   // A closed connection is an error of send(), not the end of FBuild
+   };
+#endif
+
+   void Initialize ()
+   {
+      static Startup startup;
+   }
+
+   class Socket {
+      Handle handle_{invalid};
+
+   public:
+      Socket () = default;
+      explicit Socket (Handle handle) : handle_{handle} { }
+      Socket (Socket&& other) noexcept : handle_{other.handle_} { other.handle_ = invalid; }
+      Socket& operator= (Socket&& other) noexcept { std::swap(handle_, other.handle_); return *this; }
+      Socket (const Socket&) = delete;
+      Socket& operator= (const Socket&) = delete;
+      ~Socket () { if (handle_ != invalid) CloseHandle(handle_); }
+
+      Handle Get () const { return handle_; }
+      bool   Valid () const { return handle_ != invalid; }
+
+      void Timeout (std::chrono::milliseconds timeout)
+      {
+#ifdef _WIN32
+         const DWORD value = static_cast<DWORD>(timeout.count());
+#else
+         timeval value{};
+         value.tv_sec = static_cast<decltype(value.tv_sec)>(timeout.count() / 1000);
+         value.tv_usec = static_cast<decltype(value.tv_usec)>(timeout.count() % 1000 * 1000);
+#endif
+         ::setsockopt(handle_, SOL_SOCKET, SO_RCVTIMEO, reinterpret_cast<const char*>(&value), sizeof(value));
+         ::setsockopt(handle_, SOL_SOCKET, SO_SNDTIMEO, reinterpret_cast<const char*>(&value), sizeof(value));
+      }
+
+      bool SendAll (const std::string& data)
+      {
+         size_t sent = 0;
+         while (sent < data.size()) {
+            const auto chunk = static_cast<int>(std::min<size_t>(data.size() - sent, 1 << 20));
+            const auto count = ::send(handle_, data.data() + sent, chunk, 0);
+            if (count <= 0) return false;
+            sent += static_cast<size_t>(count);
+         }
+         return true;
+      }
+
+      // Appends to buffer. 0 at the end of the stream, < 0 on errors.
+      long Receive (std::string& buffer)
+      {
+         char chunk[64 * 1024];
+         const auto count = ::recv(handle_, chunk, static_cast<int>(sizeof(chunk)), 0);
+         if (count > 0) buffer.append(chunk, static_cast<size_t>(count));
+         return static_cast<long>(count);
+      }
+   };
+
+   Socket Connect (const Http::Url& url, std::chrono::milliseconds timeout)
+   {
+      Initialize();
+
+      addrinfo hints{};
+      hints.ai_family = AF_UNSPEC;
+      hints.ai_socktype = SOCK_STREAM;
+
+      addrinfo* addresses = nullptr;
+      if (::getaddrinfo(url.host.c_str(), url.port.c_str(), &hints, &addresses) != 0) throw std::runtime_error("Unknown host " + url.host);
+
+      Socket result;
+      for (auto address = addresses; address; address = address->ai_next) {
+         Socket socket{::socket(address->ai_family, address->ai_socktype, address->ai_protocol)};
+         if (!socket.Valid()) continue;
+
+         socket.Timeout(timeout);
+         if (::connect(socket.Get(), address->ai_addr, static_cast<int>(address->ai_addrlen)) == 0) {
+            result = std::move(socket);
+            break;
+         }
+      }
+
+      ::freeaddrinfo(addresses);
+      if (!result.Valid()) throw std::runtime_error("Unable to connect to " + url.host + ":" + url.port);
+
+      const int noDelay = 1;   // Request and response are written in one piece anyway
+      ::setsockopt(result.Get(), IPPROTO_TCP, TCP_NODELAY, reinterpret_cast<const char*>(&noDelay), sizeof(noDelay));
+
+      return result;
+   }
+
+   std::string Lower (std::string s)
+   {
+      for (char& ch : s) ch = static_cast<char>(tolower(static_cast<unsigned char>(ch)));
+      return s;
+   }
+
+   constexpr size_t maxBody = size_t{1} << 30;   // 1 GB, more is no object
+
+   // A message that isn't valid HTTP, the server answers it with 400
+   struct BadMessage : std::runtime_error {
+      using std::runtime_error::runtime_error;
+   };
+
+   // Reads the header and the body of a request or response. The first line is returned in start.
+   bool ReadMessage (Socket& socket, std::string& start, std::string& body)
+   {
+      std::string buffer;
+      size_t headerEnd = std::string::npos;
+
+      while ((headerEnd = buffer.find("\r\n\r\n")) == std::string::npos) {
+         if (socket.Receive(buffer) <= 0) return false;
+         if (buffer.size() > (1 << 16) && buffer.find("\r\n\r\n") == std::string::npos) return false;   // Not HTTP
+      }
+
+      const auto header = buffer.substr(0, headerEnd);
+      body = buffer.substr(headerEnd + 4);
+
+      const auto firstLine = header.find("\r\n");
+      start = header.substr(0, firstLine);
+
+      size_t length = 0;
+      bool hasLength = false;
+
+      for (size_t pos = firstLine; pos != std::string::npos && pos < header.size();) {
+         const auto end = std::min(header.find("\r\n", pos + 2), header.size());
+         const auto line = header.substr(pos + 2, end - pos - 2);
+         pos = end;
+
+         const auto colon = line.find(':');
+         if (colon == std::string::npos || Lower(line.substr(0, colon)) != "content-length") continue;
+
+         const auto first = line.find_first_not_of(" \t", colon + 1);
+         const auto last = line.find_last_not_of(" \t");
+         if (first == std::string::npos) throw BadMessage("Invalid Content-Length");
+
+         const auto [parsed, error] = std::from_chars(line.data() + first, line.data() + last + 1, length);   // Comes from the network
+         if (error != std::errc{} || parsed != line.data() + last + 1 || length > maxBody) throw BadMessage("Invalid Content-Length: " + line.substr(colon + 1));
+         hasLength = true;
+      }
+
+      if (!hasLength) {   // Until the connection is closed
+         for (;;) {
+            const auto count = socket.Receive(body);
+            if (count == 0) return true;
+            if (count < 0) return false;
+            if (body.size() > maxBody) throw BadMessage("Message too long");
+         }
+      }
+
+      body.reserve(length);
+      while (body.size() < length) {
+         if (socket.Receive(body) <= 0) return false;
+      }
+      body.resize(length);
+
+      return true;
+   }
+
+   std::string StatusText (int status)
+   {
+      switch (status) {
+         case 200: return "OK";
+         case 400: return "Bad Request";
+         case 404: return "Not Found";
+         case 405: return "Method Not Allowed";
+         default:  return "Error";
+      }
+   }
+}
+
+
+
+namespace Http {
+
+   Url Parse (const std::string& url)
+   {
+      const std::string scheme = "http://";
+      if (url.rfind(scheme, 0) != 0) throw std::runtime_error("Expected http://host[:port][/path], got " + url);
+
+      Url result;
+      auto rest = url.substr(scheme.size());
+
+      const auto slash = rest.find('/');
+      if (slash != std::string::npos) {
+         result.path = rest.substr(slash);
+         rest = rest.substr(0, slash);
+      }
+      while (!result.path.empty() && result.path.back() == '/') result.path.pop_back();
+
+      const auto colon = rest.rfind(':');
+      if (colon != std::string::npos && rest.find(']', colon) == std::string::npos) {
+         result.port = rest.substr(colon + 1);
+         rest = rest.substr(0, colon);
+      }
+      if (rest.size() > 1 && rest.front() == '[' && rest.back() == ']') rest = rest.substr(1, rest.size() - 2);   // [::1]
+
+      result.host = rest;
+      if (result.host.empty()) throw std::runtime_error("Missing host in " + url);
+
+      return result;
+   }
+
+   Response Request (const Url& url, const std::string& method, const std::string& path, const std::string& body, std::chrono::milliseconds timeout)
+   {
+      auto socket = Connect(url, timeout);
+
+      std::string request = method + " " + url.path + path + " HTTP/1.1\r\n"
+                          + "Host: " + url.host + ":" + url.port + "\r\n"
+                          + "Connection: close\r\n"
+                          + "Content-Length: " + std::to_string(body.size()) + "\r\n\r\n";
+      request += body;
+
+      if (!socket.SendAll(request)) throw std::runtime_error("Connection to " + url.host + ":" + url.port + " broken");
+
+      std::string status, responseBody;
+      if (!ReadMessage(socket, status, responseBody)) throw std::runtime_error("Connection to " + url.host + ":" + url.port + " broken");
+
+      // HTTP/1.1 200 OK
+      const auto space = status.find(' ');
+      if (space == std::string::npos) throw std::runtime_error("Invalid response from " + url.host + ":" + url.port);
+
+      Response response;
+      response.status = std::atoi(status.c_str() + space + 1);
+      response.body = std::move(responseBody);
+      return response;
+   }
+
+   void Serve (const std::string& address, const std::string& port, const std::function<Response (const Received&)>& handler)
+   {
+      Initialize();
+
+      const bool any = address == "*";
+
+      addrinfo hints{};
+      hints.ai_family = any ? AF_INET6 : AF_UNSPEC;
+      hints.ai_socktype = SOCK_STREAM;
+      hints.ai_flags = AI_PASSIVE;
+
+      addrinfo* addresses = nullptr;
+      if (::getaddrinfo(any ? nullptr : address.c_str(), port.c_str(), &hints, &addresses) != 0) throw std::runtime_error("Invalid address " + address + ":" + port);
+
+      Socket listener{::socket(addresses->ai_family, addresses->ai_socktype, addresses->ai_protocol)};
+      if (!listener.Valid()) {
+         ::freeaddrinfo(addresses);
+         throw std::runtime_error("Unable to create a socket");
+      }
+
+      const int off = 0, on = 1;   // IPv4 as well
+      if (any) ::setsockopt(listener.Get(), IPPROTO_IPV6, IPV6_V6ONLY, reinterpret_cast<const char*>(&off), sizeof(off));
+      ::setsockopt(listener.Get(), SOL_SOCKET, SO_REUSEADDR, reinterpret_cast<const char*>(&on), sizeof(on));
+
+      const bool bound = ::bind(listener.Get(), addresses->ai_addr, static_cast<int>(addresses->ai_addrlen)) == 0;
+      ::freeaddrinfo(addresses);
+      if (!bound || ::listen(listener.Get(), SOMAXCONN) != 0) throw std::runtime_error("Unable to listen on " + address + ":" + port);
+
+      for (;;) {
+         Socket connection{::accept(listener.Get(), nullptr, nullptr)};
+         if (!connection.Valid()) continue;
+
+         std::thread{[&handler] (Socket socket) {
+            const auto reply = [&socket] (const Response& response) {
+               socket.SendAll("HTTP/1.1 " + std::to_string(response.status) + " " + StatusText(response.status) + "\r\n"
+                              + "Connection: close\r\n"
+                              + "Content-Length: " + std::to_string(response.body.size()) + "\r\n\r\n" + response.body);
+            };
+
+            // Nothing a client sends may end the server, only its connection
+            try {
+               socket.Timeout(std::chrono::seconds{60});
+
+               std::string start, body;
+               try {
+                  if (!ReadMessage(socket, start, body)) return;
+               }
+               catch (BadMessage&) {
+                  reply({400, {}});
+                  return;
+               }
+
+               // GET /path HTTP/1.1
+               const auto first = start.find(' ');
+               const auto second = start.find(' ', first + 1);
+               if (first == std::string::npos || second == std::string::npos) {
+                  reply({400, {}});
+                  return;
+               }
+
+               Response response;
+               try {
+                  response = handler({start.substr(0, first), start.substr(first + 1, second - first - 1), std::move(body)});
+               }
+               catch (std::exception& e) {
+                  std::cerr << e.what() << std::endl;
+                  response = {500, {}};
+               }
+
+               reply(response);
+            }
+            catch (std::exception& e) {
+               std::cerr << e.what() << std::endl;
+            }
+         }, std::move(connection)}.detach();
+      }
+   }
+}
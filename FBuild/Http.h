@@ -0,0 +1,45 @@
+/*
+ * Any copyright is dedicated to the Public Domain.
+ * http://creativecommons.org/publicdomain/zero/1.0/*
+ *
+ * Author: Frank Barwich
+ */
+
+#pragma once
+
+#include <chrono>
+#include <functional>
+#include <string>
+
+
+// Just enough HTTP/1.1 for the remote cache and its reference server: One request per connection, bodies with
+// Content-Length, no chunked encoding, no TLS. Meant for the build network, not for the internet.
+namespace Http {
+
+   struct Url {
+      std::string host;
+      std::string port{"80"};
+      std::string path;   // Prefix of all requests, without the trailing '/'
+   };
+
+   Url Parse (const std::string& url);   // http://host[:port][/path]. Throws on anything else.
+
+   struct Response {
+      int         status{0};
+      std::string body;
+   };
+
+   // Throws std::runtime_error if the server can't be reached or the connection breaks
+   Response Request (const Url& url, const std::string& method, const std::string& path, const std::string& body = {},
+                     std::chrono::milliseconds timeout = std::chrono::seconds{30});
+
+   struct Received {
+      std::string method;
+      std::string path;
+      std::string body;
+   };
+
+   // Accepts connections on the address and port until the process ends. Every connection gets a thread of its own.
+   // "*" binds all interfaces, IPv4 and IPv6. Without authentication, only for a trusted network.
+   void Serve (const std::string& address, const std::string& port, const std::function<Response (const Received&)>& handler);
+}
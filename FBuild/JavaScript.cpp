@@ -14,6 +14,13 @@
 #include "DirectorySync.h"
 #include "ToolChain.h"
 #include "MemoryMappedFile.h"
+#include "LastWriteTime.h"
+#include "Snapshot.h"
+#include "Process.h"
+#include "ObjectCache.h"
+#include "RemoteCache.h"
+#include "Executor.h"
+#include "Supervisor.h"
 
 #include "JsCopy.h"
 #include "JsLib.h"
@@ -26,7 +33,13 @@
 #include "JsMoc.h"
 #include "JsUic.h"
 
-#include <Shlwapi.h>
+#include <cctype>
+
+#ifdef _WIN32
+   #include <Shlwapi.h>
+#else
+   #include <fnmatch.h>
+#endif
 
 
 JavaScript::JavaScript (const std::vector<std::string>& args)
@@ -92,6 +105,27 @@ JavaScript::JavaScript (const std::vector<std::string>& args)
    duk_push_c_function(duktapeContext, JsToolChain, DUK_VARARGS);
    duk_put_prop_string(duktapeContext, -2, "ToolChain");
 
+   duk_push_c_function(duktapeContext, JsCacheLimits, 1);
+   duk_put_prop_string(duktapeContext, -2, "CacheLimits");
+
+   duk_push_c_function(duktapeContext, JsCachePolicy, 1);
+   duk_put_prop_string(duktapeContext, -2, "CachePolicy");
+
+   duk_push_c_function(duktapeContext, JsObjectCache, 1);
+   duk_put_prop_string(duktapeContext, -2, "ObjectCache");
+
+   duk_push_c_function(duktapeContext, JsRemoteCache, 1);
+   duk_put_prop_string(duktapeContext, -2, "RemoteCache");
+
+   duk_push_c_function(duktapeContext, JsWorkers, DUK_VARARGS);
+   duk_put_prop_string(duktapeContext, -2, "Workers");
+
+   duk_push_c_function(duktapeContext, JsMaxMemory, 1);
+   duk_put_prop_string(duktapeContext, -2, "MaxMemory");
+
+   duk_push_c_function(duktapeContext, JsMaxLinkJobs, 1);
+   duk_put_prop_string(duktapeContext, -2, "MaxLinkJobs");
+
    duk_pop(duktapeContext);
 
    JsCopy::Register(duktapeContext);
@@ -158,6 +192,7 @@ void JavaScript::ExecuteFile (const std::filesystem::path& script)
 
    std::filesystem::path file = std::filesystem::canonical(script);
    file.make_preferred();
+   Snapshot::Track(file);
 
    std::stringstream contents;
    {
@@ -224,6 +259,7 @@ duk_ret_t JavaScript::JsExecuteFile(duk_context* duktapeContext)
 
    std::filesystem::path file = std::filesystem::canonical(script);
    file.make_preferred();
+   Snapshot::Track(file);
 
    std::stringstream contents;
    {
@@ -242,6 +278,7 @@ duk_ret_t JavaScript::JsSystem(duk_context* duktapeContext)
 
    std::string command = duk_require_string(duktapeContext, 0);
 
+   Snapshot::Invalidate();   // No idea what the command does
    int rc = std::system(command.c_str());
 
    duk_push_int(duktapeContext, rc);
@@ -269,6 +306,8 @@ duk_ret_t JavaScript::JsDelete(duk_context* duktapeContext)
    const std::vector<std::string> files = JavaScriptHelper::AsStringVector(duktapeContext);
    if (files.empty()) JavaScriptHelper::Throw(duktapeContext, "Filename(s) for Delete() expected");
 
+   Snapshot::Invalidate();
+
    try {
       for (const auto& file : files) {
          std::error_code rc;
@@ -286,14 +325,44 @@ duk_ret_t JavaScript::JsRun(duk_context* duktapeContext)
 {
    if (duk_is_constructor_call(duktapeContext)) JavaScriptHelper::Throw(duktapeContext, "Run() can't be constructed");
 
-   std::string command = duk_require_string(duktapeContext, 0);
    bool catchOutput = duk_to_boolean(duktapeContext, 1) != false;
 
+   Snapshot::Invalidate();   // No idea what the command does
+
+   if (duk_is_array(duktapeContext, 0)) {   // Run(["tool", "arg", ...]): Started directly, without a shell
+      const auto arguments = JavaScriptHelper::AsStringVector(duktapeContext, 1);
+      if (arguments.empty()) JavaScriptHelper::Throw(duktapeContext, "Run() needs at least the program");
+
+      Process::Result result;
+      try {
+         result = Process::Run(arguments, ToolChain::Environment(), catchOutput);
+      }
+      catch (std::exception& e) {
+         JavaScriptHelper::Throw(duktapeContext, e.what());
+      }
+
+      if (result.exitCode) {
+         if (catchOutput) std::cout << result.output << std::endl;
+         JavaScriptHelper::Throw(duktapeContext, "Error running command " + Process::Join(arguments));
+      }
+
+      if (!catchOutput) return 0;
+
+      auto pos = result.output.find_last_not_of(" \t\r\n", std::string::npos);
+      if (pos != std::string::npos) result.output.erase(pos + 1);
+
+      duk_push_string(duktapeContext, result.output.c_str());
+      return 1;
+   }
+
+   std::string command = duk_require_string(duktapeContext, 0);
+
    auto tmpfile = std::filesystem::temp_directory_path() / std::filesystem::path{std::tmpnam(nullptr)};
 
    if (catchOutput) command += " 1>" + tmpfile.string() + " 2>&1";
 
-   std::string cmd = ToolChain::SetEnvBatchCall() + " & " + command;
+   const auto batch = ToolChain::SetEnvBatchCall();   // Empty for GCC, the tools are in the PATH
+   std::string cmd = batch.empty() ? command : batch + " & " + command;
    int rc = std::system(cmd.c_str()); 
    if (rc) JavaScriptHelper::Throw(duktapeContext, "Error running command " + command);
 
@@ -323,10 +392,12 @@ duk_ret_t JavaScript::JsTouch(duk_context* duktapeContext)
    const std::vector<std::string> files = JavaScriptHelper::AsStringVector(duktapeContext);
    if (files.empty()) JavaScriptHelper::Throw(duktapeContext, "Filename(s) for Touch() expected");
 
+   Snapshot::Invalidate();
+
    try {
       for (const auto& filename : files) {
-         if (!std::filesystem::exists(filename)) throw std::exception(std::string("File " + filename + " does not exist").c_str());
-         if (!std::filesystem::is_regular_file(filename)) throw std::exception(std::string(filename + " is not a file").c_str());
+         if (!std::filesystem::exists(filename)) throw std::runtime_error("File " + filename + " does not exist");
+         if (!std::filesystem::is_regular_file(filename)) throw std::runtime_error(filename + " is not a file");
 
          std::filesystem::last_write_time(filename, std::filesystem::file_time_type::clock::now());
       }
@@ -360,16 +431,18 @@ duk_ret_t JavaScript::JsGlob(duk_context* duktapeContext)
    duk_push_array(duktapeContext);
    unsigned int idx = 0;
 
-   char buffer[8192];
+   Snapshot::Track(path);   // New or deleted files change the timestamp of the directory
 
    if (std::filesystem::exists(path)) {
       std::for_each(std::filesystem::directory_iterator(path), std::filesystem::directory_iterator(), [&] (const std::filesystem::directory_entry& entry) {
          if (std::filesystem::is_regular_file(entry.path())) {
+#ifdef _WIN32
             if (PathMatchSpec(entry.path().filename().string().c_str(), pattern.c_str())) {
-               char* fullpath = _fullpath(buffer, entry.path().string().c_str(), sizeof(buffer));
-               if (!fullpath) JavaScriptHelper::Throw(duktapeContext, "Error getting full path for " + entry.path().string());
-
-               duk_push_string(duktapeContext, fullpath);
+#else
+            if (::fnmatch(pattern.c_str(), entry.path().filename().string().c_str(), 0) == 0) {
+#endif
+               const auto fullpath = std::filesystem::absolute(entry.path()).lexically_normal().make_preferred().string();
+               duk_push_string(duktapeContext, fullpath.c_str());
                duk_put_prop_index(duktapeContext, -2, idx);
                ++idx;
             }
@@ -392,6 +465,7 @@ duk_ret_t JavaScript::JsBuild(duk_context* duktapeContext)
    try {
       std::filesystem::path file = std::filesystem::canonical("FBuild.js");
       file.make_preferred();
+      Snapshot::Track(file);
 
       std::stringstream contents;
       {
@@ -447,6 +521,8 @@ duk_ret_t JavaScript::JsStringToFile(duk_context* duktapeContext)
    std::string file = duk_require_string(duktapeContext, 0);
    std::string content = duk_to_string(duktapeContext, 1);
 
+   Snapshot::Invalidate();
+
    std::ofstream out(file, std::ofstream::trunc);
    if (out.fail()) JavaScriptHelper::Throw(duktapeContext, "Error opening " + file);
 
@@ -459,7 +535,7 @@ duk_ret_t JavaScript::JsGetEnv(duk_context* duktapeContext)
 {
    if (duk_is_constructor_call(duktapeContext)) JavaScriptHelper::Throw(duktapeContext, "GetEnv() can't be constructed");
 
-   const char* env = std::getenv(duk_require_string(duktapeContext, 0));
+   const char* env = Snapshot::Getenv(duk_require_string(duktapeContext, 0));
    if (env) {
       duk_push_string(duktapeContext, env);
       return 1;
@@ -477,7 +553,11 @@ duk_ret_t JavaScript::JsSetEnv(duk_context* duktapeContext)
    arg += "=";
    arg += duk_require_string(duktapeContext, 1);
 
+#ifdef _WIN32
    int rc = _putenv(arg.c_str());
+#else
+   int rc = ::setenv(duk_require_string(duktapeContext, 0), duk_require_string(duktapeContext, 1), 1);
+#endif
    if (rc) JavaScriptHelper::Throw(duktapeContext, "Error putting environment " + arg);
 
    return 0;
@@ -490,6 +570,8 @@ duk_ret_t JavaScript::JsDirectorySync(duk_context* duktapeContext)
    std::string source = duk_require_string(duktapeContext, 0);
    std::string dest = duk_require_string(duktapeContext, 1);
 
+   Snapshot::Invalidate();   // Depends on whole directory trees
+
    DirectorySync sync(source, dest);
    sync.Go();
 
@@ -510,7 +592,9 @@ duk_ret_t JavaScript::JsToolChain(duk_context* duktapeContext)
    else if (argc == 1 || argc == 2) {
       std::string arg1 = duk_require_string(duktapeContext, 0);
       if (argc == 1 && (arg1 == "x86" || arg1 == "x64")) {
+#ifdef _WIN32
          ToolChain::ToolChain("MSVC");
+#endif
          ToolChain::Platform(arg1);
       }
       else ToolChain::ToolChain(arg1);
@@ -523,3 +607,138 @@ duk_ret_t JavaScript::JsToolChain(duk_context* duktapeContext)
       JavaScriptHelper::Throw(duktapeContext, "To many arguments for ToolChain");
    }
 }
+
+duk_ret_t JavaScript::JsCacheLimits(duk_context* duktapeContext)
+{
+   if (duk_is_constructor_call(duktapeContext)) JavaScriptHelper::Throw(duktapeContext, "CacheLimits() can't be constructed");
+   if (!duk_is_object(duktapeContext, 0)) JavaScriptHelper::Throw(duktapeContext, "CacheLimits() expects an object like {maxEntries: 100000, maxAgeDays: 30}");
+
+   const auto maxEntries = JavaScriptHelper::NumberProperty(duktapeContext, 0, "maxEntries", 0);
+   const auto maxAgeDays = JavaScriptHelper::NumberProperty(duktapeContext, 0, "maxAgeDays", 0);
+   if (maxEntries < 0 || maxAgeDays < 0) JavaScriptHelper::Throw(duktapeContext, "CacheLimits() expects positive limits");
+
+   TimestampCacheLimits(static_cast<size_t>(maxEntries), static_cast<uint32_t>(maxAgeDays));
+
+   return 0;
+}
+
+duk_ret_t JavaScript::JsObjectCache(duk_context* duktapeContext)
+{
+   if (duk_is_constructor_call(duktapeContext)) JavaScriptHelper::Throw(duktapeContext, "ObjectCache() can't be constructed");
+   if (!duk_is_object(duktapeContext, 0)) JavaScriptHelper::Throw(duktapeContext, "ObjectCache() expects an object like {directory: 'C:/FBuildCache', maxSizeMB: 5120}");
+
+   const auto maxSizeMB = JavaScriptHelper::NumberProperty(duktapeContext, 0, "maxSizeMB", 0);
+   if (maxSizeMB < 0) JavaScriptHelper::Throw(duktapeContext, "ObjectCache() expects a positive maxSizeMB");
+
+   duk_get_prop_string(duktapeContext, 0, "directory");
+   const std::string directory = duk_is_string(duktapeContext, -1) ? duk_get_string(duktapeContext, -1) : "";
+   duk_pop(duktapeContext);
+
+   ObjectCache::Directory(directory, static_cast<uint64_t>(maxSizeMB) << 20);   // An empty directory turns the cache off
+
+   return 0;
+}
+
+duk_ret_t JavaScript::JsRemoteCache(duk_context* duktapeContext)
+{
+   if (duk_is_constructor_call(duktapeContext)) JavaScriptHelper::Throw(duktapeContext, "RemoteCache() can't be constructed");
+   if (!duk_is_object(duktapeContext, 0)) JavaScriptHelper::Throw(duktapeContext, "RemoteCache() expects an object like {url: 'http://buildcache:8088', upload: false}");
+
+   duk_get_prop_string(duktapeContext, 0, "url");
+   const std::string url = duk_is_string(duktapeContext, -1) ? duk_get_string(duktapeContext, -1) : "";
+   duk_pop(duktapeContext);
+
+   duk_get_prop_string(duktapeContext, 0, "upload");
+   const bool upload = duk_is_undefined(duktapeContext, -1) || duk_to_boolean(duktapeContext, -1);
+   duk_pop(duktapeContext);
+
+   try {
+      RemoteCache::Server(url, upload);   // An empty url turns the remote cache off
+   }
+   catch (std::exception& e) {
+      JavaScriptHelper::Throw(duktapeContext, e.what());
+   }
+
+   return 0;
+}
+
+duk_ret_t JavaScript::JsWorkers(duk_context* duktapeContext)
+{
+   if (duk_is_constructor_call(duktapeContext)) JavaScriptHelper::Throw(duktapeContext, "Workers() can't be constructed");
+
+   try {
+      Executor::Workers(JavaScriptHelper::AsStringVector(duktapeContext));   // Workers() without urls compiles locally only
+   }
+   catch (std::exception& e) {
+      JavaScriptHelper::Throw(duktapeContext, e.what());
+   }
+
+   return 0;
+}
+
+duk_ret_t JavaScript::JsMaxMemory(duk_context* duktapeContext)
+{
+   if (duk_is_constructor_call(duktapeContext)) JavaScriptHelper::Throw(duktapeContext, "MaxMemory() can't be constructed");
+   if (!duk_is_string(duktapeContext, 0)) JavaScriptHelper::Throw(duktapeContext, "MaxMemory() expects a size like '48G', '512M' or '0' for no limit");
+
+   const std::string size = duk_get_string(duktapeContext, 0);
+
+   size_t end = 0;
+   uint64_t bytes = 0;
+   try {
+      bytes = std::stoull(size, &end);
+   }
+   catch (std::exception&) {
+      JavaScriptHelper::Throw(duktapeContext, "MaxMemory() expects a size like '48G', got '" + size + "'");
+   }
+
+   const std::string units = "BKMGT";
+   const auto unit = end < size.size() ? units.find(static_cast<char>(std::toupper(static_cast<unsigned char>(size[end])))) : 0;
+   if (end + 1 < size.size() || unit == std::string::npos) JavaScriptHelper::Throw(duktapeContext, "MaxMemory() expects a size like '48G', got '" + size + "'");
+
+   Supervisor::MaxMemory(bytes << (10 * unit));
+
+   return 0;
+}
+
+duk_ret_t JavaScript::JsMaxLinkJobs(duk_context* duktapeContext)
+{
+   if (duk_is_constructor_call(duktapeContext)) JavaScriptHelper::Throw(duktapeContext, "MaxLinkJobs() can't be constructed");
+   if (!duk_is_number(duktapeContext, 0) || duk_get_number(duktapeContext, 0) < 0) JavaScriptHelper::Throw(duktapeContext, "MaxLinkJobs() expects a count, 0 for no limit");
+
+   Supervisor::MaxLinkJobs(static_cast<unsigned>(duk_get_number(duktapeContext, 0)));
+
+   return 0;
+}
+
+duk_ret_t JavaScript::JsCachePolicy(duk_context* duktapeContext)
+{
+   if (duk_is_constructor_call(duktapeContext)) JavaScriptHelper::Throw(duktapeContext, "CachePolicy() can't be constructed");
+   if (!duk_is_object(duktapeContext, 0)) JavaScriptHelper::Throw(duktapeContext, "CachePolicy() expects an object like {hash: ['.h', '.cpp'], maxHashBytes: 0, sampledHashAbove: 0}");
+
+   auto policy = TimestampCachePolicy();
+
+   if (duk_get_prop_string(duktapeContext, 0, "hash")) {
+      if (!duk_is_array(duktapeContext, -1)) JavaScriptHelper::Throw(duktapeContext, "CachePolicy() expects an array of extensions for 'hash'");
+
+      policy.hash.clear();
+      duk_enum(duktapeContext, -1, DUK_ENUM_ARRAY_INDICES_ONLY);
+      while (duk_next(duktapeContext, -1, 1)) {
+         policy.hash.push_back(duk_to_string(duktapeContext, -1));
+         duk_pop_2(duktapeContext);
+      }
+      duk_pop(duktapeContext);
+   }
+   duk_pop(duktapeContext);
+
+   const auto maxHashBytes = JavaScriptHelper::NumberProperty(duktapeContext, 0, "maxHashBytes", static_cast<double>(policy.maxHashBytes));
+   const auto sampledHashAbove = JavaScriptHelper::NumberProperty(duktapeContext, 0, "sampledHashAbove", static_cast<double>(policy.sampledHashAbove));
+   if (maxHashBytes < 0 || sampledHashAbove < 0) JavaScriptHelper::Throw(duktapeContext, "CachePolicy() expects positive sizes");
+
+   policy.maxHashBytes = static_cast<uint64_t>(maxHashBytes);
+   policy.sampledHashAbove = static_cast<uint64_t>(sampledHashAbove);
+
+   TimestampCachePolicy(policy);
+
+   return 0;
+}
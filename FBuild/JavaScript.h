@@ -36,6 +36,13 @@ class JavaScript {
    static duk_ret_t JsSetEnv(duk_context* duktapeContext);
    static duk_ret_t JsDirectorySync(duk_context* duktapeContext);
    static duk_ret_t JsToolChain(duk_context* duktapeContext);
+   static duk_ret_t JsCacheLimits(duk_context* duktapeContext);
+   static duk_ret_t JsCachePolicy(duk_context* duktapeContext);
+   static duk_ret_t JsObjectCache(duk_context* duktapeContext);
+   static duk_ret_t JsRemoteCache(duk_context* duktapeContext);
+   static duk_ret_t JsWorkers(duk_context* duktapeContext);
+   static duk_ret_t JsMaxMemory(duk_context* duktapeContext);
+   static duk_ret_t JsMaxLinkJobs(duk_context* duktapeContext);
 
 public:
    JavaScript (const std::vector<std::string>& args);
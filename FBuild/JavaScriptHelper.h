@@ -84,6 +84,14 @@ namespace JavaScriptHelper {
       return result;
    }
 
+   inline double NumberProperty(duk_context* duktapeContext, int index, const char* key, double defaultValue)
+   {
+      double result = defaultValue;
+      if (duk_get_prop_string(duktapeContext, index, key)) result = duk_require_number(duktapeContext, -1);
+      duk_pop(duktapeContext);
+      return result;
+   }
+
    inline void PushArray(duk_context* duktapeContext, const std::vector<std::string>& array)
    {
       duk_push_array(duktapeContext);
@@ -107,12 +115,12 @@ namespace JavaScriptHelper {
    template<typename T>
    T* CppObject(duk_context* duktapeContext)
    {
-      if (!duk_is_object(duktapeContext, -1)) throw std::exception("Internal Error: expected object on top of the stack");
+      if (!duk_is_object(duktapeContext, -1)) throw std::runtime_error("Internal Error: expected object on top of the stack");
       duk_get_prop_string(duktapeContext, -1, "__Ptr");
-      if (!duk_is_pointer(duktapeContext, -1)) throw std::exception("Internal Error: expected property '__Ptr' to hold the C++ Object");
+      if (!duk_is_pointer(duktapeContext, -1)) throw std::runtime_error("Internal Error: expected property '__Ptr' to hold the C++ Object");
       void* ptr = duk_get_pointer(duktapeContext, -1);
       duk_pop(duktapeContext);
-      if (!ptr) throw std::exception("Internal Error: Nullpointer! C++ Object ist Null");
+      if (!ptr) throw std::runtime_error("Internal Error: Nullpointer! C++ Object ist Null");
       return static_cast<T*>(ptr);
    }
 
@@ -0,0 +1,284 @@
+/*
+ * Any copyright is dedicated to the Public Domain.
+ * http://creativecommons.org/publicdomain/zero/1.0/*
+ *
+ * Author: Frank Barwich
+ */
+
+#include "Jobserver.h"
+
+#include <algorithm>
+#include <cstdlib>
+#include <filesystem>
+#include <mutex>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#ifdef _WIN32
+   #define NOMINMAX
+   #include <windows.h>
+#else
+   #include <cerrno>
+   #include <fcntl.h>
+   #include <sys/stat.h>
+   #include <unistd.h>
+#endif
+
+
+
+namespace {
+
+   // --jobserver-auth=fifo:PATH (make 4.4), =R,W (inherited pipe) or =NAME (Windows semaphore). Older makes use --jobserver-fds.
+   std::string AuthFromMakeFlags (const std::string& flags, unsigned& parentSlots)
+   {
+      std::string auth;
+      size_t pos = 0;
+
+      while (pos < flags.size()) {
+         const auto end = std::min(flags.find(' ', pos), flags.size());
+         const auto word = flags.substr(pos, end - pos);
+         pos = end + 1;
+
+         for (const std::string prefix : {"--jobserver-auth=", "--jobserver-fds="}) {
+            if (word.rfind(prefix, 0) == 0) auth = word.substr(prefix.size());   // The last one counts
+         }
+
+         if (word.size() > 2 && word[0] == '-' && word[1] == 'j' && isdigit(static_cast<unsigned char>(word[2]))) parentSlots = static_cast<unsigned>(std::stoul(word.substr(2)));
+      }
+
+      return auth;
+   }
+
+   class Server {
+      std::mutex        mutex_;
+      bool              active_{false};
+      std::vector<char> tokens_;   // make wants the same bytes back
+#ifdef _WIN32
+      HANDLE            semaphore_{nullptr};
+#else
+      int               read_{-1};
+      int               write_{-1};
+      std::string       fifo_;     // Created by us, removed at the end
+      std::vector<int>  inherited_;
+#endif
+
+   public:
+      ~Server ()
+      {
+         const auto lock = std::lock_guard{mutex_};
+         while (!tokens_.empty()) ReleaseOne();
+
+#ifdef _WIN32
+         if (semaphore_) ::CloseHandle(semaphore_);
+#else
+         if (read_ >= 0) ::close(read_);
+         if (write_ >= 0 && write_ != read_) ::close(write_);
+         if (!fifo_.empty()) ::unlink(fifo_.c_str());
+#endif
+      }
+
+      unsigned Setup (unsigned slots)
+      {
+         const auto lock = std::lock_guard{mutex_};
+         if (active_) return slots;
+
+         const char* makeFlags = std::getenv("MAKEFLAGS");
+         unsigned parentSlots = 0;
+         const auto auth = makeFlags ? AuthFromMakeFlags(makeFlags, parentSlots) : std::string{};
+
+         if (!auth.empty() && Join(auth)) {
+            active_ = true;
+            return parentSlots ? std::min(slots, parentSlots) : slots;
+         }
+
+         if (slots > 1) Create(slots);
+         return slots;
+      }
+
+      bool Active ()
+      {
+         const auto lock = std::lock_guard{mutex_};
+         return active_;
+      }
+
+      bool TryAcquire ()
+      {
+         const auto lock = std::lock_guard{mutex_};
+         if (!active_) return false;
+
+#ifdef _WIN32
+         if (::WaitForSingleObject(semaphore_, 0) != WAIT_OBJECT_0) return false;
+         tokens_.push_back('+');
+         return true;
+#else
+         char token = 0;
+         for (;;) {
+            const auto count = ::read(read_, &token, 1);
+            if (count == 1) break;
+            if (count < 0 && errno == EINTR) continue;
+            return false;   // EAGAIN: None left
+         }
+         tokens_.push_back(token);
+         return true;
+#endif
+      }
+
+      void Release ()
+      {
+         const auto lock = std::lock_guard{mutex_};
+         if (!tokens_.empty()) ReleaseOne();
+      }
+
+#ifdef _WIN32
+      void* WaitHandle ()
+      {
+         return semaphore_;
+      }
+
+      void Acquired ()
+      {
+         const auto lock = std::lock_guard{mutex_};
+         tokens_.push_back('+');
+      }
+#else
+      int WaitHandle ()
+      {
+         return read_;
+      }
+
+      std::vector<int> Inherited ()
+      {
+         const auto lock = std::lock_guard{mutex_};
+         return inherited_;
+      }
+#endif
+
+   private:
+      void ReleaseOne ()
+      {
+#ifdef _WIN32
+         ::ReleaseSemaphore(semaphore_, 1, nullptr);
+#else
+         const char token = tokens_.back();
+         while (::write(write_, &token, 1) < 0 && errno == EINTR) { }
+#endif
+         tokens_.pop_back();
+      }
+
+      bool Join (const std::string& auth)
+      {
+#ifdef _WIN32
+         semaphore_ = ::OpenSemaphoreA(SYNCHRONIZE | SEMAPHORE_MODIFY_STATE, FALSE, auth.c_str());
+         return semaphore_ != nullptr;
+#else
+         if (auth.rfind("fifo:", 0) == 0) {
+            read_ = ::open(auth.substr(5).c_str(), O_RDWR | O_NONBLOCK | O_CLOEXEC);
+            write_ = read_;
+            return read_ >= 0;
+         }
+
+         const auto comma = auth.find(',');
+         if (comma == std::string::npos) return false;
+
+         const int read = std::atoi(auth.substr(0, comma).c_str());
+         const int write = std::atoi(auth.substr(comma + 1).c_str());
+         if (read < 0 || write < 0 || ::fcntl(read, F_GETFD) < 0 || ::fcntl(write, F_GETFD) < 0) return false;   // make didn't pass them, the rule isn't marked with +
+
+         // The pipe is shared with make, which reads blocking. Opening it again gives a file description of our own that may be non blocking.
+         read_ = ::open(("/proc/self/fd/" + std::to_string(read)).c_str(), O_RDONLY | O_NONBLOCK | O_CLOEXEC);
+         write_ = write;
+         if (read_ < 0) return false;
+
+         inherited_ = {read, write};
+         return true;
+#endif
+      }
+
+      void Create (unsigned slots)
+      {
+         const auto tokens = slots - 1;   // One job runs without a token
+
+#ifdef _WIN32
+         const auto name = "FBuild_jobserver_" + std::to_string(::GetCurrentProcessId());
+         semaphore_ = ::CreateSemaphoreA(nullptr, static_cast<LONG>(tokens), static_cast<LONG>(tokens), name.c_str());
+         if (!semaphore_) return;
+
+         const auto flags = " -j" + std::to_string(slots) + " --jobserver-auth=" + name;
+         ::_putenv(("MAKEFLAGS=" + flags).c_str());
+#else
+         fifo_ = (std::filesystem::temp_directory_path() / ("FBuild_jobserver_" + std::to_string(::getpid()))).string();
+         ::unlink(fifo_.c_str());
+         if (::mkfifo(fifo_.c_str(), 0600) != 0) {
+            fifo_.clear();
+            return;
+         }
+
+         read_ = ::open(fifo_.c_str(), O_RDWR | O_NONBLOCK | O_CLOEXEC);
+         if (read_ < 0) return;
+         write_ = read_;
+
+         const std::string all(tokens, '+');
+         if (::write(write_, all.data(), all.size()) != static_cast<ssize_t>(all.size())) return;
+
+         const auto flags = " -j" + std::to_string(slots) + " --jobserver-auth=fifo:" + fifo_;
+         ::setenv("MAKEFLAGS", flags.c_str(), 1);
+#endif
+
+         active_ = true;
+      }
+   };
+
+   Server& TheServer ()
+   {
+      static Server server;
+      return server;
+   }
+}
+
+
+
+namespace Jobserver {
+
+   unsigned Setup (unsigned slots)
+   {
+      return TheServer().Setup(slots);
+   }
+
+   bool Active ()
+   {
+      return TheServer().Active();
+   }
+
+   bool TryAcquire ()
+   {
+      return TheServer().TryAcquire();
+   }
+
+   void Release ()
+   {
+      TheServer().Release();
+   }
+
+#ifdef _WIN32
+   void* WaitHandle ()
+   {
+      return TheServer().WaitHandle();
+   }
+
+   void Acquired ()
+   {
+      TheServer().Acquired();
+   }
+#else
+   int WaitHandle ()
+   {
+      return TheServer().WaitHandle();
+   }
+
+   std::vector<int> Inherited ()
+   {
+      return TheServer().Inherited();
+   }
+#endif
+}
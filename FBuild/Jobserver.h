@@ -0,0 +1,32 @@
+/*
+ * Any copyright is dedicated to the Public Domain.
+ * http://creativecommons.org/publicdomain/zero/1.0/*
+ *
+ * Author: Frank Barwich
+ */
+
+#pragma once
+
+#include <vector>
+
+
+// The GNU make jobserver protocol. Started by make (or another FBuild) FBuild takes its tokens from the jobserver
+// in MAKEFLAGS, otherwise it offers its own slots to the children: A fifo on POSIX, a named semaphore on Windows.
+// Like with make, one job always runs without a token; every further slot needs one.
+namespace Jobserver {
+
+   unsigned Setup (unsigned slots);   // Returns the slots to use: The -j of a parent jobserver, if it's smaller
+   bool     Active ();
+
+   bool TryAcquire ();   // One token, doesn't block
+   void Release ();      // Gives one acquired token back
+
+#ifdef _WIN32
+   void* WaitHandle ();   // The semaphore. Waiting for it acquires a token, call Acquired() then.
+   void  Acquired ();
+#else
+   int   WaitHandle ();   // Readable, when there may be a token
+
+   std::vector<int> Inherited ();   // The R,W descriptors of a parent make. MAKEFLAGS names them, so the children get them too.
+#endif
+}
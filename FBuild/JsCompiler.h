@@ -19,6 +19,7 @@ class JsCompiler {
    static duk_ret_t Build(duk_context* duktapeContext);
    static duk_ret_t Files(duk_context* duktapeContext);
    static duk_ret_t MPSkipFiles(duk_context* duktapeContext);
+   static duk_ret_t Unity(duk_context* duktapeContext);
    static duk_ret_t DependencyCheck(duk_context* duktapeContext);
    static duk_ret_t CRT(duk_context* duktapeContext);
    static duk_ret_t ObjDir(duk_context* duktapeContext);
@@ -27,6 +28,8 @@ class JsCompiler {
    static duk_ret_t Threads(duk_context* duktapeContext);
    static duk_ret_t CompileArgs(duk_context* duktapeContext);
    static duk_ret_t PrecompiledHeader(duk_context* duktapeContext);
+   static duk_ret_t AutoPrecompiledHeader(duk_context* duktapeContext);
+   static duk_ret_t Modules(duk_context* duktapeContext);
    static duk_ret_t WarningLevel(duk_context* duktapeContext);
    static duk_ret_t WarningAsError(duk_context* duktapeContext);
    static duk_ret_t WarningDisable(duk_context* duktapeContext);
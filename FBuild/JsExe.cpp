@@ -33,6 +33,9 @@ duk_ret_t JsExe::Constructor(duk_context* duktapeContext)
       duk_push_c_function(duktapeContext, JsExe::MPSkipFiles, DUK_VARARGS);
       duk_put_prop_string(duktapeContext, -2, "MPSkipFiles");
 
+      duk_push_c_function(duktapeContext, JsExe::Unity, DUK_VARARGS);
+      duk_put_prop_string(duktapeContext, -2, "Unity");
+
       duk_push_c_function(duktapeContext, JsExe::DependencyCheck, DUK_VARARGS);
       duk_put_prop_string(duktapeContext, -2, "DependencyCheck");
 
@@ -60,6 +63,12 @@ duk_ret_t JsExe::Constructor(duk_context* duktapeContext)
       duk_push_c_function(duktapeContext, JsExe::PrecompiledHeader, DUK_VARARGS);
       duk_put_prop_string(duktapeContext, -2, "PrecompiledHeader");
 
+      duk_push_c_function(duktapeContext, JsExe::AutoPrecompiledHeader, DUK_VARARGS);
+      duk_put_prop_string(duktapeContext, -2, "AutoPrecompiledHeader");
+
+      duk_push_c_function(duktapeContext, JsExe::Modules, DUK_VARARGS);
+      duk_put_prop_string(duktapeContext, -2, "Modules");
+
       duk_push_c_function(duktapeContext, JsExe::WarningLevel, DUK_VARARGS);
       duk_put_prop_string(duktapeContext, -2, "WarningLevel");
 
@@ -167,6 +176,29 @@ duk_ret_t JsExe::MPSkipFiles(duk_context* duktapeContext)
    }
 }
 
+duk_ret_t JsExe::Unity(duk_context* duktapeContext)
+{
+   try {
+      int args = duk_get_top(duktapeContext);
+
+      duk_push_this(duktapeContext);
+      auto obj = JavaScriptHelper::CppObject<JsExe>(duktapeContext);
+
+      if (!args) duk_push_boolean(duktapeContext, obj->compiler.Unity());
+      else if (args == 1 || (args == 2 && duk_is_object(duktapeContext, 1))) {
+         const auto maxBatchBytes = args == 2 ? JavaScriptHelper::NumberProperty(duktapeContext, 1, "maxBatchBytes", 512 * 1024) : 512 * 1024;
+         if (maxBatchBytes <= 0) JavaScriptHelper::Throw(duktapeContext, "Exe::Unity() expects a positive maxBatchBytes");
+         obj->compiler.Unity(duk_require_boolean(duktapeContext, 0), static_cast<uint64_t>(maxBatchBytes));
+      }
+      else JavaScriptHelper::Throw(duktapeContext, "Exe::Unity() expects true or false and optionally {maxBatchBytes: 524288}");
+
+      return 1;
+   }
+   catch (std::exception& e) {
+      JavaScriptHelper::Throw(duktapeContext, e.what());
+   }
+}
+
 
 duk_ret_t JsExe::DependencyCheck(duk_context* duktapeContext)
 {
@@ -321,6 +353,48 @@ duk_ret_t JsExe::PrecompiledHeader(duk_context* duktapeContext)
    }
 }
 
+duk_ret_t JsExe::AutoPrecompiledHeader(duk_context* duktapeContext)
+{
+   try {
+      int args = duk_get_top(duktapeContext);
+
+      duk_push_this(duktapeContext);
+      auto obj = JavaScriptHelper::CppObject<JsExe>(duktapeContext);
+
+      if (!args) duk_push_boolean(duktapeContext, obj->compiler.AutoPrecompiledHeader());
+      else if (args == 1 || (args == 2 && duk_is_object(duktapeContext, 1))) {
+         const auto minShare = args == 2 ? JavaScriptHelper::NumberProperty(duktapeContext, 1, "minShare", 0.5) : 0.5;
+         if (minShare < 0 || minShare >= 1) JavaScriptHelper::Throw(duktapeContext, "Exe::AutoPrecompiledHeader() expects a minShare from 0 to below 1");
+         obj->compiler.AutoPrecompiledHeader(duk_require_boolean(duktapeContext, 0), minShare);
+      }
+      else JavaScriptHelper::Throw(duktapeContext, "Exe::AutoPrecompiledHeader() expects true or false and optionally {minShare: 0.5}");
+
+      return 1;
+   }
+   catch (std::exception& e) {
+      JavaScriptHelper::Throw(duktapeContext, e.what());
+   }
+}
+
+duk_ret_t JsExe::Modules(duk_context* duktapeContext)
+{
+   try {
+      int args = duk_get_top(duktapeContext);
+
+      duk_push_this(duktapeContext);
+      auto obj = JavaScriptHelper::CppObject<JsExe>(duktapeContext);
+
+      if (!args) duk_push_boolean(duktapeContext, obj->compiler.Modules());
+      else if (args == 1) obj->compiler.Modules(duk_require_boolean(duktapeContext, 0) != 0);
+      else JavaScriptHelper::Throw(duktapeContext, "Exe::Modules() expects true or false");
+
+      return 1;
+   }
+   catch (std::exception& e) {
+      JavaScriptHelper::Throw(duktapeContext, e.what());
+   }
+}
+
 duk_ret_t JsExe::WarningLevel(duk_context* duktapeContext)
 {
    try {
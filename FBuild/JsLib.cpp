@@ -37,6 +37,9 @@ duk_ret_t JsLib::Constructor(duk_context* duktapeContext)
       duk_push_c_function(duktapeContext, JsLib::MPSkipFiles, DUK_VARARGS);
       duk_put_prop_string(duktapeContext, -2, "MPSkipFiles");
 
+      duk_push_c_function(duktapeContext, JsLib::Unity, DUK_VARARGS);
+      duk_put_prop_string(duktapeContext, -2, "Unity");
+
       duk_push_c_function(duktapeContext, JsLib::DependencyCheck, DUK_VARARGS);
       duk_put_prop_string(duktapeContext, -2, "DependencyCheck");
 
@@ -67,6 +70,12 @@ duk_ret_t JsLib::Constructor(duk_context* duktapeContext)
       duk_push_c_function(duktapeContext, JsLib::PrecompiledHeader, DUK_VARARGS);
       duk_put_prop_string(duktapeContext, -2, "PrecompiledHeader");
 
+      duk_push_c_function(duktapeContext, JsLib::AutoPrecompiledHeader, DUK_VARARGS);
+      duk_put_prop_string(duktapeContext, -2, "AutoPrecompiledHeader");
+
+      duk_push_c_function(duktapeContext, JsLib::Modules, DUK_VARARGS);
+      duk_put_prop_string(duktapeContext, -2, "Modules");
+
       duk_push_c_function(duktapeContext, JsLib::WarningLevel, DUK_VARARGS);
       duk_put_prop_string(duktapeContext, -2, "WarningLevel");
 
@@ -153,6 +162,29 @@ duk_ret_t JsLib::MPSkipFiles(duk_context* duktapeContext)
    }
 }
 
+duk_ret_t JsLib::Unity(duk_context* duktapeContext)
+{
+   try {
+      int args = duk_get_top(duktapeContext);
+
+      duk_push_this(duktapeContext);
+      auto obj = JavaScriptHelper::CppObject<JsLib>(duktapeContext);
+
+      if (!args) duk_push_boolean(duktapeContext, obj->compiler.Unity());
+      else if (args == 1 || (args == 2 && duk_is_object(duktapeContext, 1))) {
+         const auto maxBatchBytes = args == 2 ? JavaScriptHelper::NumberProperty(duktapeContext, 1, "maxBatchBytes", 512 * 1024) : 512 * 1024;
+         if (maxBatchBytes <= 0) JavaScriptHelper::Throw(duktapeContext, "Lib::Unity() expects a positive maxBatchBytes");
+         obj->compiler.Unity(duk_require_boolean(duktapeContext, 0), static_cast<uint64_t>(maxBatchBytes));
+      }
+      else JavaScriptHelper::Throw(duktapeContext, "Lib::Unity() expects true or false and optionally {maxBatchBytes: 524288}");
+
+      return 1;
+   }
+   catch (std::exception& e) {
+      JavaScriptHelper::Throw(duktapeContext, e.what());
+   }
+}
+
 
 duk_ret_t JsLib::DependencyCheck(duk_context* duktapeContext)
 {
@@ -322,6 +354,48 @@ duk_ret_t JsLib::PrecompiledHeader(duk_context* duktapeContext)
    }
 }
 
+duk_ret_t JsLib::AutoPrecompiledHeader(duk_context* duktapeContext)
+{
+   try {
+      int args = duk_get_top(duktapeContext);
+
+      duk_push_this(duktapeContext);
+      auto obj = JavaScriptHelper::CppObject<JsLib>(duktapeContext);
+
+      if (!args) duk_push_boolean(duktapeContext, obj->compiler.AutoPrecompiledHeader());
+      else if (args == 1 || (args == 2 && duk_is_object(duktapeContext, 1))) {
+         const auto minShare = args == 2 ? JavaScriptHelper::NumberProperty(duktapeContext, 1, "minShare", 0.5) : 0.5;
+         if (minShare < 0 || minShare >= 1) JavaScriptHelper::Throw(duktapeContext, "Lib::AutoPrecompiledHeader() expects a minShare from 0 to below 1");
+         obj->compiler.AutoPrecompiledHeader(duk_require_boolean(duktapeContext, 0), minShare);
+      }
+      else JavaScriptHelper::Throw(duktapeContext, "Lib::AutoPrecompiledHeader() expects true or false and optionally {minShare: 0.5}");
+
+      return 1;
+   }
+   catch (std::exception& e) {
+      JavaScriptHelper::Throw(duktapeContext, e.what());
+   }
+}
+
+duk_ret_t JsLib::Modules(duk_context* duktapeContext)
+{
+   try {
+      int args = duk_get_top(duktapeContext);
+
+      duk_push_this(duktapeContext);
+      auto obj = JavaScriptHelper::CppObject<JsLib>(duktapeContext);
+
+      if (!args) duk_push_boolean(duktapeContext, obj->compiler.Modules());
+      else if (args == 1) obj->compiler.Modules(duk_require_boolean(duktapeContext, 0) != 0);
+      else JavaScriptHelper::Throw(duktapeContext, "Lib::Modules() expects true or false");
+
+      return 1;
+   }
+   catch (std::exception& e) {
+      JavaScriptHelper::Throw(duktapeContext, e.what());
+   }
+}
+
 duk_ret_t JsLib::WarningLevel(duk_context* duktapeContext)
 {
    try {
@@ -21,6 +21,7 @@ class JsLib {
    static duk_ret_t Build(duk_context* duktapeContext);
    static duk_ret_t Files(duk_context* duktapeContext);
    static duk_ret_t MPSkipFiles(duk_context* duktapeContext);
+   static duk_ret_t Unity(duk_context* duktapeContext);
    static duk_ret_t DependencyCheck(duk_context* duktapeContext);
    static duk_ret_t CRT(duk_context* duktapeContext);
    static duk_ret_t ObjDir(duk_context* duktapeContext);
@@ -29,6 +30,8 @@ class JsLib {
    static duk_ret_t Threads(duk_context* duktapeContext);
    static duk_ret_t CompileArgs(duk_context* duktapeContext);
    static duk_ret_t PrecompiledHeader(duk_context* duktapeContext);
+   static duk_ret_t AutoPrecompiledHeader(duk_context* duktapeContext);
+   static duk_ret_t Modules(duk_context* duktapeContext);
    static duk_ret_t WarningLevel(duk_context* duktapeContext);
    static duk_ret_t WarningAsError(duk_context* duktapeContext);
    static duk_ret_t WarningDisable(duk_context* duktapeContext);
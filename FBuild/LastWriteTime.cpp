@@ -1,20 +1,110 @@
 #include "LastWriteTime.h"
+#include "Hash.h"
+#include "Snapshot.h"
+#include "Trace.h"
 
 #include <optional>
 #include <unordered_map>
 #include <fstream>
 #include <string>
 #include <cctype>
-#include <array>
 #include <iostream>
+#include <deque>
+#include <future>
+#include <condition_variable>
+#include <unordered_set>
+#include <random>
+
+
+
+// Content hashing runs on its own small pool. The callers (eg. the CppOutOfDate threads) just wait for the result,
+// so no lock is held while a file is read. Concurrent requests for the same file are folded into one.
+class HashWorkers {
+   std::mutex                                                                mutex_;
+   std::condition_variable                                                   wakeup_;
+   std::deque<std::function<void()>>                                         queue_;
+   std::unordered_map<std::filesystem::path, std::shared_future<std::string>> inFlight_;
+   std::vector<std::thread>                                                  threads_;
+   bool                                                                      stop_{false};
+
+   void Thread ()
+   {
+      for (;;) {
+         std::function<void()> job;
+         {
+            std::unique_lock lock{mutex_};
+            wakeup_.wait(lock, [this] { return stop_ || !queue_.empty(); });
+            if (queue_.empty()) return;
+            job = std::move(queue_.front());
+            queue_.pop_front();
+         }
+
+         job();
+      }
+   }
+
+public:
+   HashWorkers () = default;
+
+   ~HashWorkers ()
+   {
+      {
+         const auto lock = std::lock_guard{mutex_};
+         stop_ = true;
+      }
+      wakeup_.notify_all();
+
+      for (auto&& thread : threads_) {
+         thread.join();
+      }
+   }
+
+   std::shared_future<std::string> Submit (const std::filesystem::path& file, Hash::Algorithm algorithm, bool sampled)
+   {
+      const auto lock = std::lock_guard{mutex_};
+
+      if (const auto it = inFlight_.find(file); it != end(inFlight_)) {
+         return it->second;
+      }
+
+      if (threads_.empty()) {   // Started on demand. Most builds don't have to hash anything.
+         const auto count = std::max(std::thread::hardware_concurrency(), 2u);
+         for (unsigned int i = 0; i < count; ++i) {
+            threads_.emplace_back([this] { Thread(); });
+         }
+      }
+
+      auto task = std::make_shared<std::packaged_task<std::string()>>([file, algorithm, sampled] {
+         try {
+            return sampled ? Hash::SampledFile(file, algorithm) : Hash::File(file, algorithm);
+         }
+         catch (...) {
+            return std::string{};
+         }
+      });
+
+      auto result = task->get_future().share();
+      inFlight_.insert(std::make_pair(file, result));
+
+      queue_.emplace_back([this, task, file] {
+         (*task)();
+         const auto guard = std::lock_guard{mutex_};
+         inFlight_.erase(file);
+      });
+      wakeup_.notify_one();
+
+      return result;
+   }
+};
+
 
-#include "PicoSHA2/picosha2.h"
 
 class Cache {
 
    struct PersistentValue {
       uint64_t ts{};
       std::string hash;
+      uint64_t used{};   // When the entry was last needed by a build. Granularity is one day, see Touch()
    };
 
    struct PersistentStorageRecord {
@@ -29,7 +119,12 @@ class Cache {
       stream >> output.value.ts;
 
       stream >> output.value.hash;
-      
+      if (output.value.hash == "-") {
+         output.value.hash.clear();
+      }
+
+      stream >> output.value.used;
+
       return stream;
    }
 
@@ -39,7 +134,9 @@ class Cache {
 
       stream << input.value.ts << " ";
 
-      stream << input.value.hash << "\n";
+      stream << (input.value.hash.empty() ? "-" : input.value.hash) << " ";
+
+      stream << input.value.used << "\n";
 
       return stream;
    }
@@ -53,6 +150,26 @@ class Cache {
    std::mutex lastWriteTimeMutex_;
    std::unordered_map<std::filesystem::path, uint64_t> lastWriteTimeCache_;
 
+   Hash::Algorithm algorithm_{Hash::DefaultAlgorithm()};
+   HashWorkers hashWorkers_;
+
+   static constexpr uint64_t day = 24 * 60 * 60;
+
+   std::mutex                      policyMutex_;
+   CachePolicy                     policy_;
+   std::unordered_set<std::string> hashed_{policy_.hash.begin(), policy_.hash.end()};
+
+   std::atomic<size_t>   maxEntries_{250000};
+   std::atomic<uint32_t> maxAgeDays_{60};
+
+   std::atomic<uint64_t> hits_{0};
+   std::atomic<uint64_t> misses_{0};
+
+   // Looks for entries of vanished files while the build is running. Stopped and evaluated when the cache is saved.
+   std::thread                               scanner_;
+   std::atomic<bool>                         stopScanner_{false};
+   std::unordered_set<std::filesystem::path> vanished_;
+
 
 
    uint64_t QueryFileTime (const std::filesystem::path& file)
@@ -68,54 +185,24 @@ class Cache {
       return result;
    }
 
-   std::string QueryFileHash (const std::filesystem::path& file) 
+   static std::filesystem::file_time_type FileTime (uint64_t ts)
    {
-      std::string result;
-
-      try {
-         std::array<unsigned char, picosha2::k_digest_size> bytes;
-         std::ifstream stream(file, std::ios::binary);
-         picosha2::hash256(stream, bytes.begin(), bytes.end());
-         picosha2::bytes_to_hex_string(bytes.begin(), bytes.end(), result);
-      }
-      catch (...) {
-      }
-
-      return result;
-   }                   
-
-   void UpdateCache (const std::filesystem::path& file, PersistentValue& stored) 
-   {
-      const auto ctime = QueryFileTime(file);
-      if (ctime != stored.ts) {
-         auto hash = QueryFileHash(file);
-         if (stored.hash != hash) {
-            stored.hash = std::move(hash);
-            stored.ts = ctime;
-            persistentChanged_ = true;
-         }
-         else {
-            using namespace std::chrono;
-            const auto oldts = file_clock::time_point{file_clock::duration{std::chrono::seconds{stored.ts}}};
-            std::error_code nothrow;
-            std::filesystem::last_write_time(file, oldts, nothrow);
-         }
-      }
+      using namespace std::chrono;
+      return file_clock::time_point{file_clock::duration{std::chrono::seconds{ts}}};
    }
 
-   static bool Skip (std::string extension) 
+   static std::string Lower (std::string text)
    {
-      std::transform(extension.begin(), extension.end(), extension.begin(),[](unsigned char c) { 
+      std::transform(text.begin(), text.end(), text.begin(),[](unsigned char c) { 
          return static_cast<unsigned char>(std::tolower(c)); 
       });
+      return text;
+   }
 
-      return extension != ".h" 
-         && extension != ".c"
-         && extension != ".hpp"
-         && extension != ".cpp" 
-         && extension != ".cxx"
-         && extension != ".rc"
-         && extension != ".js";
+   bool Skip (const std::string& extension) 
+   {
+      const auto lock = std::lock_guard{ policyMutex_ };
+      return hashed_.count(Lower(extension)) == 0;
    }
 
    uint64_t QueryPersistent (const std::filesystem::path& file) 
@@ -126,16 +213,64 @@ class Cache {
          }
 
          const auto normalized = std::filesystem::canonical(file);
+         const auto ctime = QueryFileTime(normalized);
+
+         PersistentValue stored;
+         {
+            const auto lock = std::lock_guard{ persistentMutex_ };
+            const auto it = persistentCache_.find(normalized);
+
+            if (it == end(persistentCache_)) {
+               // Seen for the first time. The content gets hashed lazily, once the timestamp changes.
+               ++misses_;
+               persistentChanged_ = true;
+               persistentCache_.insert(std::make_pair(normalized, PersistentValue{ ctime, {}, now() }));
+               return ctime;
+            }
+
+            Touch(it->second);
+
+            if (it->second.ts == ctime) {
+               ++hits_;
+               return ctime;
+            }
+
+            stored = it->second;
+         }
+
+         uint64_t maxHashBytes, sampledHashAbove;
+         {
+            const auto lock = std::lock_guard{ policyMutex_ };
+            maxHashBytes = policy_.maxHashBytes;
+            sampledHashAbove = policy_.sampledHashAbove;
+         }
+
+         const auto size = std::filesystem::file_size(normalized);
+         if (maxHashBytes && size > maxHashBytes) {   // Too expensive, the timestamp has to do
+            const auto lock = std::lock_guard{ persistentMutex_ };
+            ++misses_;
+            persistentChanged_ = true;
+            persistentCache_[normalized] = PersistentValue{ ctime, {}, now() };
+            return ctime;
+         }
+
+         auto hash = hashWorkers_.Submit(normalized, algorithm_, sampledHashAbove && size > sampledHashAbove).get();
+
          const auto lock = std::lock_guard{ persistentMutex_ };
-         const auto it = persistentCache_.find(normalized);
 
-         if (it != end(persistentCache_)) {
-            UpdateCache(normalized, it->second);
-            return it->second.ts;
+         // A sampled hash only exists if the script opted in with sampledHashAbove: It accepts that an edit between the samples is missed
+         if (!stored.hash.empty() && stored.hash == hash) {
+            // Same content, only the timestamp changed (checkout, touch, ...). Keep the old timestamp.
+            ++hits_;
+            std::error_code nothrow;
+            std::filesystem::last_write_time(normalized, FileTime(stored.ts), nothrow);
+            return stored.ts;
          }
 
+         ++misses_;
          persistentChanged_ = true;
-         return persistentCache_.insert(std::make_pair(normalized, PersistentValue{ QueryFileTime(normalized), QueryFileHash(normalized) })).first->second.ts;
+         persistentCache_[normalized] = PersistentValue{ ctime, std::move(hash), now() };
+         return ctime;
       }
       catch (...) {
       }
@@ -164,7 +299,20 @@ class Cache {
 
    static std::filesystem::path CacheFile() 
    {
-      return std::filesystem::temp_directory_path() / "FBuild_TimestampCache_v1.txt";
+      return std::filesystem::temp_directory_path() / "FBuild_TimestampCache_v3.txt";
+   }
+
+   static std::filesystem::path StatisticsFile() 
+   {
+      return std::filesystem::temp_directory_path() / "FBuild_TimestampCache_v3.stats";
+   }
+
+   void Touch (PersistentValue& value)
+   {
+      if (value.used + day < now()) {   // Writing the whole cache just for a new 'used' is only worth it once a day
+         value.used = now();
+         persistentChanged_ = true;
+      }
    }
 
    static uint64_t now() 
@@ -181,6 +329,7 @@ class Cache {
 
    static std::unordered_map<std::filesystem::path, PersistentValue> LoadCacheFile ()
    {
+      const Trace::Scope trace{"Load timestamp cache"};
       std::unordered_map<std::filesystem::path, PersistentValue> result;
 
       try {
@@ -190,9 +339,6 @@ class Cache {
 
          PersistentStorageRecord record;
          while (stream >> record) {
-            if (Skip(record.file.extension().string())) {
-               continue;
-            }
             if (InvalidValueFromBuggyVersion(record)) {
                record.value.ts = now();
             }
@@ -206,9 +352,88 @@ class Cache {
       return result;
    }
 
+   void StartScanner ()
+   {
+      std::vector<std::filesystem::path> candidates;
+      for (auto&& item : persistentCache_) {
+         if (item.second.used + day < now()) {   // Files used recently obviously still exist
+            candidates.push_back(item.first);
+         }
+      }
+
+      if (candidates.empty()) {
+         return;
+      }
+
+      // Short builds won't get through the whole list. Shuffled, every entry gets its turn sooner or later.
+      std::shuffle(candidates.begin(), candidates.end(), std::mt19937{std::random_device{}()});
+
+      scanner_ = std::thread([this, candidates = std::move(candidates)] {
+         for (auto&& file : candidates) {
+            if (stopScanner_) {
+               break;
+            }
+
+            std::error_code nothrow;
+            if (!std::filesystem::exists(file, nothrow) && !nothrow) {
+               vanished_.insert(file);
+            }
+         }
+      });
+   }
+
+   size_t Compact ()
+   {
+      stopScanner_ = true;
+      if (scanner_.joinable()) {
+         scanner_.join();
+      }
+
+      const uint64_t maxAge = maxAgeDays_ * day;
+      const uint64_t cutoff = now() > maxAge ? now() - maxAge : 0;
+
+      size_t evicted = 0;
+
+      for (auto it = persistentCache_.begin(); it != persistentCache_.end(); ) {
+         if (it->second.used < cutoff || vanished_.count(it->first)) {
+            it = persistentCache_.erase(it);
+            ++evicted;
+         }
+         else {
+            ++it;
+         }
+      }
+
+      const size_t maxEntries = maxEntries_;
+      if (persistentCache_.size() > maxEntries) {   // Least recently used go first
+         std::vector<std::pair<uint64_t, std::filesystem::path>> byAge;
+         byAge.reserve(persistentCache_.size());
+         for (auto&& item : persistentCache_) {
+            byAge.emplace_back(item.second.used, item.first);
+         }
+
+         const auto surplus = persistentCache_.size() - maxEntries;
+         std::nth_element(byAge.begin(), byAge.begin() + static_cast<std::ptrdiff_t>(surplus), byAge.end());
+         for (size_t i = 0; i < surplus; ++i) {
+            persistentCache_.erase(byAge[i].second);
+         }
+
+         evicted += surplus;
+      }
+
+      if (evicted) {
+         persistentChanged_ = true;
+      }
+
+      return evicted;
+   }
+
    void SaveCacheFile() 
    {
+      const Trace::Scope trace{"Save timestamp cache"};
       try {
+         const auto evicted = Compact();
+
          if (persistentChanged_) {
             { // merge
                auto meanwhile = LoadCacheFile();
@@ -220,23 +445,69 @@ class Cache {
                }
             }
 
-            std::vector<char> iobuffer(4096 * 16, '\0');
-            std::ofstream stream(CacheFile(), std::ios::trunc);
-            stream.rdbuf()->pubsetbuf(iobuffer.data(), iobuffer.size());
+            // Written to a temporary file first. A crash or a parallel build never sees a half written cache.
+            auto tmp = CacheFile();
+            tmp += "." + std::to_string(std::random_device{}()) + ".tmp";
+
+            {
+               std::vector<char> iobuffer(4096 * 16, '\0');
+               std::ofstream stream(tmp, std::ios::trunc);
+               stream.rdbuf()->pubsetbuf(iobuffer.data(), iobuffer.size());
+
+               for (auto&& item : persistentCache_) {
+                  stream << PersistentStorageRecord{item.first, std::move(item.second)};
+               }
+
+               if (!stream.flush()) {
+                  throw std::runtime_error("Error writing " + tmp.string());
+               }
+            }
 
-            for (auto&& item : persistentCache_) {
-               stream << PersistentStorageRecord{item.first, std::move(item.second)};
+            std::error_code error;
+            std::filesystem::rename(tmp, CacheFile(), error);
+            if (error) {
+               std::filesystem::remove(tmp, error);
             }
          }
+
+         SaveStatistics(Statistics{1, hits_, misses_, evicted});
       }
       catch (std::exception& e) {
          std::cerr << "FBuild: " << CacheFile() << ": " << e.what() << "\n";
       }
    }
 
+   struct Statistics {
+      uint64_t builds{};
+      uint64_t hits{};
+      uint64_t misses{};
+      uint64_t evicted{};
+   };
+
+   static Statistics LoadStatistics ()
+   {
+      Statistics result;
+      std::ifstream stream(StatisticsFile());
+      stream >> result.builds >> result.hits >> result.misses >> result.evicted;
+      return result;
+   }
+
+   static void SaveStatistics (const Statistics& current)
+   {
+      auto total = LoadStatistics();
+      total.builds += current.builds;
+      total.hits += current.hits;
+      total.misses += current.misses;
+      total.evicted += current.evicted;
+
+      std::ofstream stream(StatisticsFile(), std::ios::trunc);
+      stream << total.builds << " " << total.hits << " " << total.misses << " " << total.evicted << "\n";
+   }
+
 public:
    Cache () : persistentCache_(LoadCacheFile())
    {
+      StartScanner();
    }
 
    ~Cache () 
@@ -256,6 +527,48 @@ public:
 
       return actual;
    }
+
+   void Limits (size_t maxEntries, uint32_t maxAgeDays)
+   {
+      if (maxEntries) maxEntries_ = maxEntries;
+      if (maxAgeDays) maxAgeDays_ = maxAgeDays;
+   }
+
+   CachePolicy Policy ()
+   {
+      const auto lock = std::lock_guard{ policyMutex_ };
+      return policy_;
+   }
+
+   void Policy (const CachePolicy& policy)
+   {
+      const auto lock = std::lock_guard{ policyMutex_ };
+      policy_ = policy;
+      hashed_.clear();
+      for (auto&& extension : policy_.hash) {
+         hashed_.insert(Lower(extension.empty() || extension[0] == '.' ? extension : "." + extension));
+      }
+   }
+
+   static void PrintStatistics (std::ostream& out)
+   {
+      const auto cache = LoadCacheFile();
+      const auto statistics = LoadStatistics();
+
+      std::error_code nothrow;
+      const auto size = std::filesystem::file_size(CacheFile(), nothrow);
+
+      const auto idle = std::count_if(cache.begin(), cache.end(), [] (const auto& item) { return item.second.used + 30 * day < now(); });
+      const auto hashed = std::count_if(cache.begin(), cache.end(), [] (const auto& item) { return !item.second.hash.empty(); });
+      const auto lookups = statistics.hits + statistics.misses;
+
+      out << "Timestamp cache " << CacheFile().string() << "\n"
+          << "   Size:     " << (nothrow ? 0 : size) << " bytes, " << cache.size() << " entries (" << hashed << " hashed)\n"
+          << "   Idle:     " << idle << " entries not used for more than 30 days\n"
+          << "   Builds:   " << statistics.builds << "\n"
+          << "   Hit rate: " << (lookups ? 100.0 * static_cast<double>(statistics.hits) / static_cast<double>(lookups) : 0.0) << "% (" << statistics.hits << " hits, " << statistics.misses << " misses)\n"
+          << "   Evicted:  " << statistics.evicted << " entries\n";
+   }
 };
 
 
@@ -266,8 +579,35 @@ public:
 
 
 
+static Cache& TheCache ()
+{
+   static Cache cache;
+   return cache;
+}
+
 uint64_t LastWriteTime (const std::filesystem::path& file)
 {
-   static auto cache = Cache{};
-   return cache.LastWriteTime(file);
+   const auto result = TheCache().LastWriteTime(file);
+   Snapshot::Track(file);
+   return result;
+}
+
+void TimestampCacheLimits (size_t maxEntries, uint32_t maxAgeDays)
+{
+   TheCache().Limits(maxEntries, maxAgeDays);
+}
+
+void TimestampCacheStatistics (std::ostream& out)
+{
+   Cache::PrintStatistics(out);
+}
+
+CachePolicy TimestampCachePolicy ()
+{
+   return TheCache().Policy();
+}
+
+void TimestampCachePolicy (const CachePolicy& policy)
+{
+   TheCache().Policy(policy);
 }
@@ -1,5 +1,20 @@
 #pragma once
 
 #include <filesystem>
+#include <iosfwd>
+#include <string>
+#include <vector>
 
 uint64_t LastWriteTime (const std::filesystem::path& file);
+
+void TimestampCacheLimits (size_t maxEntries, uint32_t maxAgeDays);   // 0 keeps the current limit
+void TimestampCacheStatistics (std::ostream& out);
+
+struct CachePolicy {
+   std::vector<std::string> hash{".h", ".c", ".hpp", ".cpp", ".cxx", ".rc", ".js"};   // Only files with these extensions are hashed
+   uint64_t maxHashBytes{0};                                                         // Bigger files only use the timestamp. 0 for no limit
+   uint64_t sampledHashAbove{0};                                                     // Bigger files get a sampled hash, a match keeps the old timestamp though an edit between the samples is missed. 0 to always hash everything
+};
+
+CachePolicy TimestampCachePolicy ();
+void        TimestampCachePolicy (const CachePolicy& policy);
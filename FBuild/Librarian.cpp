@@ -7,6 +7,13 @@
 
 #include "Librarian.h"
 #include "ToolChain.h"
+#include "Manifest.h"
+#include "Snapshot.h"
+#include "Explain.h"
+#include "Process.h"
+#include "Trace.h"
+#include "Supervisor.h"
+#include "Hash.h"
 
 #include <cstdlib>
 #include <algorithm>
@@ -16,23 +23,76 @@
 
 
 
+std::string ActualLibrarian::Signature () const
+{
+   const auto command = Command();
+   if (command.empty()) return {};
+
+   const auto tool = Process::Find(command.front(), ToolChain::Environment());
+   return Hash::String(Process::Join(command) + "\n" + ToolChain::ToolChain() + " " + ToolChain::Platform() + "\n" + Manifest::Identity(tool));
+}
+
 bool ActualLibrarian::NeedsRebuild () const
 {
-   if (!librarian.DependencyCheck()) return true;
-   if (!std::filesystem::exists(librarian.Output())) return true;
+   signature = Signature();
+
+   if (!librarian.DependencyCheck()) {
+      Explain::OutOfDate(librarian.Output(), "DependencyCheck(false)");
+      return true;
+   }
+   if (!std::filesystem::exists(librarian.Output())) {
+      Explain::OutOfDate(librarian.Output(), "missing output");
+      return true;
+   }
+
+   if (const auto upToDate = Manifest::UpToDate(librarian.Output(), librarian.Files(), signature)) return !*upToDate;
 
    const auto parentTime = std::filesystem::last_write_time(librarian.Output());
 
    for (auto&& f : librarian.Files()) {
-      if (std::filesystem::last_write_time(f) > parentTime) return true;
+      if (std::filesystem::last_write_time(f) > parentTime) {
+         Explain::OutOfDate(librarian.Output(), "newer input", f);
+         return true;
+      }
    }
 
+   Manifest::Record(librarian.Output(), librarian.Files(), signature);   // Up to date by timestamps. From now on the content counts.
    return false;
 }
 
+Process::Result ActualLibrarian::Run (const Process::Arguments& command) const
+{
+   return Run(command, ToolChain::Environment());
+}
+
+Process::Result ActualLibrarian::Run (const Process::Arguments& command, const Process::Environment& environment) const
+{
+   Supervisor::Job job;
+   job.arguments = command;   // Long command lines go into a response file
+   job.environment = environment;
+   job.captureOutput = false;
+   job.action = librarian.Output();
+   return Supervisor::Run(std::move(job));
+}
+
+void ActualLibrarian::RecordManifest () const
+{
+   Manifest::Record(librarian.Output(), librarian.Files(), signature);
+}
 
 
 
+
+Process::Arguments ActualLibrarianVisualStudio::Command () const
+{
+   Process::Arguments command{"Lib", "-NOLOGO", "-Brepro"};   // Reproducible: Same objects, same lib. See Manifest
+   command.push_back("-OUT:" + librarian.Output());
+   
+   for (auto&& f : librarian.Files()) command.push_back(f);
+
+   return command;
+}
+
 void ActualLibrarianVisualStudio::Create ()
 {
    if (librarian.Files().empty()) return;
@@ -40,36 +100,70 @@ void ActualLibrarianVisualStudio::Create ()
 
    if (!NeedsRebuild()) return;
 
+   Snapshot::Invalidate();
+
    std::cout << "\nCreating Lib (" << ToolChain::ToolChain() << " " << ToolChain::Platform() << ")" << std::endl;
 
    librarian.DoBeforeLink();
 
    std::filesystem::create_directories(std::filesystem::path(librarian.Output()).remove_filename());
 
-   std::string command = "-NOLOGO ";
-   command += "-OUT:\"" + librarian.Output() + "\" ";
-   
-   for (auto&& f : librarian.Files()) command += "\"" + f + "\" ";
-
-   if (command.size() > 8000) {
-      auto rsp = std::filesystem::temp_directory_path() / std::filesystem::path(librarian.Output()).filename();
-      rsp.replace_extension(".rsp");
-      std::ofstream responseFile(rsp.string(), std::fstream::trunc);
-      responseFile << command;
-      command = "Lib @" + rsp.string();
-   }
-   else {
-      command.insert(0, "Lib ");
-   }
+   const auto result = Run(Command());
+   if (result.exitCode != 0) throw std::runtime_error("Error creating lib");
+
+   RecordManifest();
+}
+
+
+
 
-   std::string cmd = ToolChain::SetEnvBatchCall() + " & " + command;
-   int rc = std::system(cmd.c_str());
-   if (rc != 0) throw std::runtime_error("Error creating lib");
+
+Process::Arguments ActualLibrarianGcc::Command () const
+{
+   Process::Arguments command{ToolChain::Archiver(), "rcsD", librarian.Output()};   // D: No timestamps, same objects give the same lib. See Manifest
+
+   for (auto&& f : librarian.Files()) command.push_back(f);
+
+   return command;
 }
 
+void ActualLibrarianGcc::Create ()
+{
+   if (librarian.Files().empty()) return;
+   if (librarian.Output().empty()) throw std::runtime_error("Mising 'Output'");
+
+   if (!NeedsRebuild()) return;
+
+   Snapshot::Invalidate();
+
+   std::cout << "\nCreating Lib (" << ToolChain::ToolChain() << " " << ToolChain::Platform() << ")" << std::endl;
 
+   librarian.DoBeforeLink();
+
+   if (std::filesystem::exists(librarian.Output())) std::filesystem::remove(librarian.Output());   // ar only adds and replaces members
 
+   std::filesystem::create_directories(std::filesystem::path(librarian.Output()).remove_filename());
 
+   const auto result = Run(Command());
+   if (result.exitCode != 0) throw std::runtime_error("Error creating lib");
+
+   RecordManifest();
+}
+
+
+
+
+
+Process::Arguments ActualLibrarianEmscripten::Command () const
+{
+   Process::Arguments command{"emcc", "-s", "DISABLE_EXCEPTION_CATCHING=0", "-s", "ALLOW_MEMORY_GROWTH=1", "--memory-init-file", "0"};
+
+   command.insert(command.end(), {"-o", librarian.Output()});
+
+   for (auto&& f : librarian.Files()) command.push_back(f);
+
+   return command;
+}
 
 void ActualLibrarianEmscripten::Create ()
 {
@@ -78,6 +172,8 @@ void ActualLibrarianEmscripten::Create ()
 
    if (!NeedsRebuild()) return;
 
+   Snapshot::Invalidate();
+
    std::cout << "\nCreating Lib (" << ToolChain::ToolChain() << ")" << std::endl;
 
    librarian.DoBeforeLink();
@@ -86,14 +182,10 @@ void ActualLibrarianEmscripten::Create ()
 
    std::filesystem::create_directories(std::filesystem::path(librarian.Output()).remove_filename());
 
-   std::string command = "emcc -s DISABLE_EXCEPTION_CATCHING=0 -s ALLOW_MEMORY_GROWTH=1 --memory-init-file 0 ";
+   const auto result = Run(Command(), Process::Current());
+   if (result.exitCode != 0) throw std::runtime_error("Error creating lib");
 
-   command += "-o \"" + librarian.Output() + "\" ";
-
-   for (auto&& f : librarian.Files()) command += "\"" + f + "\" ";
-
-   int rc = std::system(command.c_str());
-   if (rc != 0) throw std::runtime_error("Error creating lib");
+   RecordManifest();
 }
 
 
@@ -102,8 +194,11 @@ void ActualLibrarianEmscripten::Create ()
 
 void Librarian::Create ()
 {
+   const Trace::Scope trace{"Library " + output};
+
    const auto toolChain = ToolChain::ToolChain();
    if (toolChain.substr(0, 4) == "MSVC") actualLibrarian.reset(new ActualLibrarianVisualStudio{*this});
+   else if (ToolChain::Gcc()) actualLibrarian.reset(new ActualLibrarianGcc{*this});
    else if (toolChain == "EMSCRIPTEN") actualLibrarian.reset(new ActualLibrarianEmscripten{*this});
    else throw std::runtime_error("Unbekannte Toolchain: " + toolChain);
 
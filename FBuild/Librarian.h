@@ -7,6 +7,8 @@
 
 #pragma once
 
+#include "Process.h"
+
 #include <string>
 #include <vector>
 #include <memory>
@@ -18,7 +20,17 @@ class ActualLibrarian {
 protected:
    Librarian& librarian;
 
+   // The command line is built before BeforeLink() runs, the signature is the one NeedsRebuild() compared
+   mutable std::string signature;
+
+   virtual Process::Arguments Command () const { return {}; }
+
+   std::string Signature () const;   // Of the command line and the archiver, for the Manifest
    bool NeedsRebuild () const;
+   void RecordManifest () const;
+
+   Process::Result Run (const Process::Arguments& command) const;   // Through the Supervisor, like the compiles
+   Process::Result Run (const Process::Arguments& command, const Process::Environment& environment) const;
 
 public:
    ActualLibrarian (Librarian& librarian) : librarian{librarian} { }
@@ -32,6 +44,8 @@ public:
 
 
 class ActualLibrarianVisualStudio : public ActualLibrarian {
+   Process::Arguments Command () const override;
+
 public:
    ActualLibrarianVisualStudio (Librarian& librarian) : ActualLibrarian{librarian} { }
 
@@ -42,7 +56,22 @@ public:
 
 
 
+class ActualLibrarianGcc : public ActualLibrarian {
+   Process::Arguments Command () const override;
+
+public:
+   ActualLibrarianGcc (Librarian& librarian) : ActualLibrarian{librarian} { }
+
+   void Create () override;
+};
+
+
+
+
+
 class ActualLibrarianEmscripten : public ActualLibrarian {
+   Process::Arguments Command () const override;
+
 public:
    ActualLibrarianEmscripten (Librarian& librarian) : ActualLibrarian{librarian} { }
 
@@ -7,6 +7,15 @@
 
 #include "Linker.h"
 #include "ToolChain.h"
+#include "Manifest.h"
+#include "Snapshot.h"
+#include "Explain.h"
+#include "Process.h"
+#include "ObjectCache.h"
+#include "Trace.h"
+#include "Supervisor.h"
+#include "History.h"
+#include "Hash.h"
 
 #include <algorithm>
 #include <fstream>
@@ -26,33 +35,154 @@ inline bool Exe (const std::string& filename)
 
 
 
-bool ActualLinker::NeedsRebuild () const
+std::vector<std::string> ActualLinker::LibFiles () const
 {
-   if (!linker.DependencyCheck()) return true;
-   if (!std::filesystem::exists(linker.Output())) return true;
-
-   const auto parentTime = std::filesystem::last_write_time(linker.Output());
-
-   for (auto&& file : linker.Files()) {
-      if (std::filesystem::last_write_time(file) > parentTime) return true;
-   }
+   std::vector<std::string> result;
 
    for (auto&& lib : linker.Libs()) {
       for (auto&& path : linker.Libpath()) {
          const auto file = path + "/" + lib;
-         if (std::filesystem::exists(file)) {
-            if (std::filesystem::last_write_time(file) > parentTime) return true;
-         }
+         if (std::filesystem::exists(file)) result.push_back(file);
+      }
+   }
+
+   return result;
+}
+
+std::vector<std::string> ActualLinker::Inputs () const
+{
+   std::vector<std::string> result = linker.Files();
+
+   const auto libs = LibFiles();
+   result.insert(result.end(), libs.begin(), libs.end());
+
+   return result;
+}
+
+std::string ActualLinker::Signature () const
+{
+   const auto command = Command();
+   if (command.empty()) return {};
+
+   const auto tool = Process::Find(command.front(), ToolChain::Environment());
+   return Hash::String(Process::Join(command) + "\n" + ToolChain::ToolChain() + " " + ToolChain::Platform() + "\n" + Manifest::Identity(tool));
+}
+
+bool ActualLinker::NeedsRebuild () const
+{
+   signature = Signature();
+
+   if (!linker.DependencyCheck()) {
+      Explain::OutOfDate(linker.Output(), "DependencyCheck(false)");
+      return true;
+   }
+   if (!std::filesystem::exists(linker.Output())) {
+      Explain::OutOfDate(linker.Output(), "missing output");
+      return true;
+   }
+
+   const auto inputs = Inputs();
+
+   if (const auto upToDate = Manifest::UpToDate(linker.Output(), inputs, signature)) return !*upToDate;
+
+   const auto parentTime = std::filesystem::last_write_time(linker.Output());
+
+   for (auto&& file : inputs) {
+      if (std::filesystem::last_write_time(file) > parentTime) {
+         Explain::OutOfDate(linker.Output(), "newer input", file);
+         return true;
       }
    }
 
+   Manifest::Record(linker.Output(), inputs, signature);   // Up to date by timestamps. From now on the content counts.
    return false;
 }
 
+void ActualLinker::RecordManifest () const
+{
+   Manifest::Record(linker.Output(), Inputs(), signature);
+}
 
+std::string ActualLinker::CacheKey (const Process::Arguments& command) const
+{
+   if (!ObjectCache::Enabled()) return {};
 
+   // Which linker the PATH finds. The objects are part of the command line, by path, and of the inputs, by content.
+   const auto tool = Process::Find(command.front(), ToolChain::Environment());
+   return ObjectCache::Key(Process::Join(command) + "\n" + Manifest::Identity(tool), linker.Output(), Inputs());
+}
+
+Process::Result ActualLinker::Run (const Process::Arguments& command) const
+{
+   return Run(command, ToolChain::Environment());
+}
+
+Process::Result ActualLinker::Run (const Process::Arguments& command, const Process::Environment& environment) const
+{
+   Supervisor::Job job;
+   job.arguments = command;   // Long command lines go into a response file
+   job.environment = environment;
+   job.captureOutput = false;
+   job.action = linker.Output();   // Its time, CPU and memory go into the history
+   job.link = true;
+   return Supervisor::Run(std::move(job));
+}
+
+bool ActualLinker::RestoreFromCache (const std::string& key, const std::vector<std::filesystem::path>& outputs) const
+{
+   if (key.empty()) return false;
 
+   std::string diagnostics;
+   const bool hit = ObjectCache::Restore(key, outputs, diagnostics);
+   History::Cached(linker.Output(), hit);
+   if (!hit) return false;
 
+   std::cout << std::filesystem::path(linker.Output()).filename().string() << " (cached)\n" << diagnostics << std::flush;
+   RecordManifest();
+   return true;
+}
+
+
+
+
+
+
+Process::Arguments ActualLinkerVisualStudio::Command () const
+{
+   bool debug = linker.Build() == "Debug";
+
+   Process::Arguments command{"link", "-NOLOGO", "-LARGEADDRESSAWARE", "-STACK:3000000"};
+   const auto append = [&command] (const std::string& options) {
+      const auto arguments = Process::Split(options);
+      command.insert(command.end(), arguments.begin(), arguments.end());
+   };
+
+   if (debug) append("-DEBUG -DEBUG:FASTLINK");
+   else command.push_back("-INCREMENTAL:NO");
+   if (!Exe(linker.Output())) command.push_back("-DLL");
+   command.push_back("-OUT:" + linker.Output());
+   if (!linker.ImportLib().empty()) command.push_back("-IMPLIB:" + linker.ImportLib());
+   if (!linker.Def().empty()) command.push_back("-DEF:" + linker.Def());
+   append(linker.Args());
+
+   for (auto&& f : linker.Libpath()) command.push_back("-LIBPATH:" + f);
+   for (auto&& f : linker.Libs()) command.push_back(f);
+   for (auto&& f : linker.Files()) command.push_back(f);
+
+   const char* env = std::getenv("FB_LINKER");
+   if (env) append(ToolChain::RemoveGuardCF(env));
+
+   if (debug) {
+      env = std::getenv("FB_LINKER_DEBUG");
+      if (env) append(ToolChain::RemoveGuardCF(env));
+   }
+   else {
+      env = std::getenv("FB_LINKER_RELEASE");
+      if (env) append(ToolChain::RemoveGuardCF(env));
+   }
+
+   return command;
+}
 
 void ActualLinkerVisualStudio::Link ()
 {
@@ -61,6 +191,8 @@ void ActualLinkerVisualStudio::Link ()
 
    if (!NeedsRebuild()) return;
 
+   Snapshot::Invalidate();
+
    std::cout << "\nLinking (" << ToolChain::ToolChain() << " " << ToolChain::Platform() << ")" << std::endl;
 
    linker.DoBeforeLink();
@@ -68,46 +200,130 @@ void ActualLinkerVisualStudio::Link ()
    std::filesystem::create_directories(std::filesystem::path(linker.Output()).remove_filename());
 
    bool debug = linker.Build() == "Debug";
+   const auto command = Command();
 
-   std::string command = "-NOLOGO -LARGEADDRESSAWARE -STACK:3000000 ";
-   if (debug) command += "-DEBUG -DEBUG:FASTLINK ";
-   else command += "-INCREMENTAL:NO ";
-   if (!Exe(linker.Output())) command += "-DLL ";
-   command += "-OUT:\"" + linker.Output() + "\" ";
-   if (!linker.ImportLib().empty()) command += "-IMPLIB:\"" + linker.ImportLib() + "\" ";
-   if (!linker.Def().empty()) command += "-DEF:\"" + linker.Def() + "\" ";
-   if (!linker.Args().empty()) command += linker.Args() + " ";
+   // -DEBUG:FASTLINK leaves the debug information in the objects, the executable alone is of no use
+   const auto cacheKey = debug ? std::string{} : CacheKey(command);
+   std::vector<std::filesystem::path> cached{linker.Output()};
+   if (!linker.ImportLib().empty()) cached.push_back(linker.ImportLib());
+   if (RestoreFromCache(cacheKey, cached)) return;
 
-   for (auto&& f : linker.Libpath()) command += "-LIBPATH:\"" + f + "\" ";
-   for (auto&& f : linker.Libs()) command += "\"" + f + "\" ";
-   for (auto&& f : linker.Files()) command += "\"" + f + "\" ";
+   const auto result = Run(command);
+   if (result.exitCode != 0) throw std::runtime_error("Link-Error");
+
+   if (!cacheKey.empty()) ObjectCache::Store(cacheKey, cached, {});
+   RecordManifest();
+}
+
+
+
+
+
+
+
+std::vector<std::string> ActualLinkerGcc::LibArguments () const
+{
+   std::vector<std::string> result;
+
+   for (auto&& lib : linker.Libs()) {
+      if (!std::filesystem::path(lib).has_extension()) {
+         result.push_back("-l" + lib);
+         continue;
+      }
+
+      const auto path = std::find_if(linker.Libpath().begin(), linker.Libpath().end(), [&lib] (const std::string& p) { return std::filesystem::exists(p + "/" + lib); });
+      result.push_back(path != linker.Libpath().end() ? *path + "/" + lib : lib);
+   }
+
+   return result;
+}
+
+Process::Arguments ActualLinkerGcc::Command () const
+{
+   bool debug = linker.Build() == "Debug";
+
+   Process::Arguments command{ToolChain::CxxCompiler()};   // Links the C++ runtime, ld is called by the driver
+   const auto append = [&command] (const std::string& options) {
+      const auto arguments = Process::Split(options);
+      command.insert(command.end(), arguments.begin(), arguments.end());
+   };
+
+   const auto extension = std::filesystem::path(linker.Output()).extension();
+   if (extension == ".so" || extension == ".dll" || extension == ".dylib") command.push_back("-shared");
+   if (ToolChain::Platform() == "x86") command.push_back("-m32");
+   if (debug) command.push_back("-g");
+   command.insert(command.end(), {"-o", linker.Output()});
+   append(linker.Args());
+
+   for (auto&& f : linker.Files()) command.push_back(f);
+   for (auto&& f : linker.Libpath()) command.push_back("-L" + f);
+   for (auto&& f : LibArguments()) command.push_back(f);   // After the objects, the GNU linker resolves left to right
 
    const char* env = std::getenv("FB_LINKER");
-   if (env) command += ToolChain::RemoveGuardCF(env) + " ";
+   if (env) append(env);
 
    if (debug) {
       env = std::getenv("FB_LINKER_DEBUG");
-      if (env) command += ToolChain::RemoveGuardCF(env) + " ";
+      if (env) append(env);
    }
    else {
       env = std::getenv("FB_LINKER_RELEASE");
-      if (env) command += ToolChain::RemoveGuardCF(env) + " ";
+      if (env) append(env);
    }
 
-   if (command.size() > 8000) {
-      auto rsp = std::filesystem::temp_directory_path() / std::filesystem::path(linker.Output()).filename();
-      rsp.replace_extension(".rsp");
-      std::ofstream responseFile(rsp.string(), std::fstream::trunc);
-      responseFile << command;
-      command = "link @" + rsp.string();
-   }
-   else {
-      command.insert(0, "link ");
+   return command;
+}
+
+std::vector<std::string> ActualLinkerGcc::LibFiles () const
+{
+   std::vector<std::string> result;
+
+   for (auto&& lib : linker.Libs()) {
+      // The first directory with one of them, the shared one first like ld
+      const auto names = std::filesystem::path(lib).has_extension() ? std::vector<std::string>{lib} : std::vector<std::string>{"lib" + lib + ".so", "lib" + lib + ".a"};
+
+      const auto found = [&] {
+         for (auto&& path : linker.Libpath()) {
+            for (auto&& name : names) {
+               const auto file = path + "/" + name;
+               if (std::filesystem::exists(file)) return file;
+            }
+         }
+         return std::string{};
+      }();
+
+      if (!found.empty()) result.push_back(found);
    }
 
-   std::string cmd = ToolChain::SetEnvBatchCall() + " & " + command;
-   int rc = std::system(cmd.c_str());
-   if (rc != 0) throw std::runtime_error("Link-Error");
+   return result;
+}
+
+void ActualLinkerGcc::Link ()
+{
+   if (linker.Files().empty()) return;
+   if (linker.Output().empty()) throw std::runtime_error("Mising 'Output'");
+
+   if (!NeedsRebuild()) return;
+
+   Snapshot::Invalidate();
+
+   std::cout << "\nLinking (" << ToolChain::ToolChain() << " " << ToolChain::Platform() << ")" << std::endl;
+
+   linker.DoBeforeLink();
+
+   std::filesystem::create_directories(std::filesystem::path(linker.Output()).remove_filename());
+
+   const auto command = Command();
+
+   const auto cacheKey = CacheKey(command);
+   const std::vector<std::filesystem::path> cached{linker.Output()};
+   if (RestoreFromCache(cacheKey, cached)) return;
+
+   const auto result = Run(command);
+   if (result.exitCode != 0) throw std::runtime_error("Link-Error");
+
+   if (!cacheKey.empty()) ObjectCache::Store(cacheKey, cached, {});
+   RecordManifest();
 }
 
 
@@ -138,6 +354,26 @@ std::vector<std::string> ActualLinkerEmscripten::LibsWithPath () const
    return result;
 }
 
+Process::Arguments ActualLinkerEmscripten::Command () const
+{
+   bool debug = linker.Build() == "Debug";
+
+   Process::Arguments command{"emcc", "-s", "DISABLE_EXCEPTION_CATCHING=0", "-s", "ALLOW_MEMORY_GROWTH=1", "--memory-init-file", "0"};
+
+   if (debug) command.insert(command.end(), {"-g", "-O1", "-D_DEBUG"});
+   else command.insert(command.end(), {"-O3", "-DNDEBUG"});
+
+   const auto args = Process::Split(linker.Args());
+   command.insert(command.end(), args.begin(), args.end());
+
+   command.insert(command.end(), {"-o", linker.Output()});
+
+   for (auto&& f : linker.Files()) command.push_back(f);
+   for (auto&& f : LibsWithPath()) command.push_back(f);
+
+   return command;
+}
+
 void ActualLinkerEmscripten::Link ()
 {
    if (linker.Files().empty()) return;
@@ -145,6 +381,8 @@ void ActualLinkerEmscripten::Link ()
 
    if (!NeedsRebuild()) return;
 
+   Snapshot::Invalidate();
+
    std::cout << "\nLinking (" << ToolChain::ToolChain() << ")" << std::endl;
 
    linker.DoBeforeLink();
@@ -153,23 +391,12 @@ void ActualLinkerEmscripten::Link ()
 
    std::filesystem::create_directories(std::filesystem::path(linker.Output()).remove_filename());
 
-   bool debug = linker.Build() == "Debug";
-
-
-   std::string command = "emcc -s DISABLE_EXCEPTION_CATCHING=0 -s ALLOW_MEMORY_GROWTH=1 --memory-init-file 0 ";
+   const auto command = Command();
 
-   if (debug) command += "-g -O1 -D_DEBUG ";
-   else command += "-O3 -DNDEBUG ";
+   const auto result = Run(command, Process::Current());
+   if (result.exitCode != 0) throw std::runtime_error("Link-Error");
 
-   if (!linker.Args().empty()) command += linker.Args() + " ";
-
-   command += "-o \"" + linker.Output() + "\" ";
-
-   for (auto&& f : linker.Files()) command += "\"" + f + "\" ";
-   for (auto&& f : LibsWithPath()) command += "\"" + f + "\" ";
-
-   int rc = std::system(command.c_str());
-   if (rc != 0) throw std::runtime_error("Link-Error");
+   RecordManifest();
 }
 
 
@@ -181,8 +408,11 @@ void ActualLinkerEmscripten::Link ()
 
 void Linker::Link ()
 {
+   const Trace::Scope trace{"Link " + output};
+
    const auto toolChain = ToolChain::ToolChain();
    if (toolChain.substr(0, 4) == "MSVC") actualLinker.reset(new ActualLinkerVisualStudio{*this});
+   else if (ToolChain::Gcc()) actualLinker.reset(new ActualLinkerGcc{*this});
    else if (toolChain == "EMSCRIPTEN") actualLinker.reset(new ActualLinkerEmscripten{*this});
    else throw std::runtime_error("Unbekannte Toolchain: " + toolChain);
 
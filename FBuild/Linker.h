@@ -12,6 +12,9 @@
 #include <iterator>
 #include <memory>
 #include <functional>
+#include <filesystem>
+
+#include "Process.h"
 
 
 
@@ -21,7 +24,23 @@ class ActualLinker {
 protected:
    Linker& linker;
 
+   // The command line is built before BeforeLink() runs, the signature is the one NeedsRebuild() compared
+   mutable std::string signature;
+
+   virtual Process::Arguments Command () const { return {}; }
+   virtual std::vector<std::string> LibFiles () const;   // The libs as files on the Libpath, the ones found
+
+   std::vector<std::string> Inputs () const;   // Objects and libs, by content for the Manifest and the ObjectCache
+   std::string Signature () const;   // Of the command line and the linker, for the Manifest
    bool NeedsRebuild () const;
+   void RecordManifest () const;
+
+   // ObjectCache: A link is cached by its command line, the linker and the content of its inputs. Empty if the cache is off.
+   std::string CacheKey (const Process::Arguments& command) const;
+   bool        RestoreFromCache (const std::string& key, const std::vector<std::filesystem::path>& outputs) const;
+
+   Process::Result Run (const Process::Arguments& command) const;   // Through the Supervisor, like the compiles
+   Process::Result Run (const Process::Arguments& command, const Process::Environment& environment) const;
 
 public:
    ActualLinker (Linker& linker) : linker{linker} { }
@@ -36,6 +55,8 @@ public:
 
 
 class ActualLinkerVisualStudio : public ActualLinker {
+   Process::Arguments Command () const override;
+
 public:
    ActualLinkerVisualStudio (Linker& linker) : ActualLinker{linker} { }
 
@@ -47,8 +68,25 @@ public:
 
 
 
+class ActualLinkerGcc : public ActualLinker {
+   std::vector<std::string> LibArguments () const;   // Libs with extension by path, others as -l<lib>
+   std::vector<std::string> LibFiles () const override;   // -l<lib> as the lib<lib>.so or lib<lib>.a the linker takes
+   Process::Arguments Command () const override;
+
+public:
+   ActualLinkerGcc (Linker& linker) : ActualLinker{linker} { }
+
+   void Link () override;
+};
+
+
+
+
+
+
 class ActualLinkerEmscripten : public ActualLinker {
    std::vector<std::string> LibsWithPath () const;
+   Process::Arguments Command () const override;
 
 public:
    ActualLinkerEmscripten (Linker& linker) : ActualLinker{linker} { }
@@ -0,0 +1,269 @@
+/*
+ * Any copyright is dedicated to the Public Domain.
+ * http://creativecommons.org/publicdomain/zero/1.0/*
+ *
+ * Author: Frank Barwich
+ */
+
+#include "Manifest.h"
+#include "Hash.h"
+#include "Snapshot.h"
+#include "Explain.h"
+#include "LastWriteTime.h"
+
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <mutex>
+#include <random>
+#include <unordered_map>
+#include <unordered_set>
+
+
+
+namespace {
+
+   struct FileState {
+      std::string path;
+      int64_t     time{};   // Raw ticks of last_write_time. Only compared for equality.
+      std::string hash;
+   };
+
+   struct Step {
+      FileState              output;
+      std::string            signature;
+      std::vector<FileState> inputs;
+   };
+
+   int64_t Time (const std::filesystem::path& file)
+   {
+      Snapshot::Track(file);
+      return std::filesystem::last_write_time(file).time_since_epoch().count();
+   }
+
+   std::string Key (const std::filesystem::path& file)
+   {
+      return std::filesystem::weakly_canonical(file).make_preferred().string();
+   }
+
+
+
+   class Manifests {
+      std::mutex                            mutex_;
+      std::unordered_map<std::string, Step> steps_;
+      std::unordered_set<std::string>       changed_;
+
+      static std::filesystem::path File ()
+      {
+         return std::filesystem::temp_directory_path() / "FBuild_Manifest_v2.txt";
+      }
+
+      // Format:
+      //    > "output" time hash
+      //    = "signature"
+      //    < "input" time hash
+      //    < ...
+      static std::unordered_map<std::string, Step> Load ()
+      {
+         std::unordered_map<std::string, Step> result;
+
+         std::ifstream stream(File());
+         std::string marker;
+         Step* current = nullptr;
+
+         FileState state;
+         while (stream >> marker) {
+            if (marker == "=") {
+               std::string signature;
+               stream >> std::quoted(signature);
+               if (current) current->signature = signature;
+               continue;
+            }
+
+            if (!(stream >> std::quoted(state.path) >> state.time >> state.hash)) break;
+
+            if (marker == ">") {
+               current = &result[state.path];
+               current->output = state;
+               current->inputs.clear();
+            }
+            else if (marker == "<" && current) {
+               current->inputs.push_back(state);
+            }
+         }
+
+         return result;
+      }
+
+      void Save ()
+      {
+         if (changed_.empty()) {
+            return;
+         }
+
+         // Another FBuild (other tree, same temp dir) may have written meanwhile. Only our own steps are replaced.
+         auto merged = Load();
+         for (auto&& output : changed_) {
+            merged[output] = steps_[output];
+         }
+
+         auto tmp = File();
+         tmp += "." + std::to_string(std::random_device{}()) + ".tmp";
+
+         {
+            std::ofstream stream(tmp, std::ios::trunc);
+            for (auto&& item : merged) {
+               std::error_code nothrow;
+               if (!std::filesystem::exists(item.first, nothrow)) continue;   // Outputs that are gone
+
+               const auto& step = item.second;
+               stream << "> " << std::quoted(step.output.path) << " " << step.output.time << " " << step.output.hash << "\n";
+               stream << "= " << std::quoted(step.signature) << "\n";
+               for (auto&& input : step.inputs) {
+                  stream << "< " << std::quoted(input.path) << " " << input.time << " " << input.hash << "\n";
+               }
+            }
+
+            if (!stream.flush()) {
+               throw std::runtime_error("Error writing " + tmp.string());
+            }
+         }
+
+         std::error_code error;
+         std::filesystem::rename(tmp, File(), error);
+         if (error) {
+            std::filesystem::remove(tmp, error);
+         }
+      }
+
+      // Same content as recorded? The hash is only calculated if the timestamp differs.
+      static bool Unchanged (FileState& recorded, const std::filesystem::path& file)
+      {
+         const auto time = Time(file);
+         if (time == recorded.time) {
+            return true;
+         }
+
+         if (Hash::File(file) != recorded.hash) {
+            return false;
+         }
+
+         recorded.time = time;
+         return true;
+      }
+
+   public:
+      Manifests () : steps_(Load())
+      {
+      }
+
+      ~Manifests ()
+      {
+         try {
+            Save();
+         }
+         catch (std::exception& e) {
+            std::cerr << "FBuild: " << File() << ": " << e.what() << "\n";
+         }
+      }
+
+      std::optional<bool> UpToDate (const std::filesystem::path& output, const std::vector<std::string>& inputs, const std::string& signature)
+      {
+         const auto key = Key(output);
+
+         const auto lock = std::lock_guard{mutex_};
+
+         const auto it = steps_.find(key);
+         if (it == steps_.end()) {
+            return std::nullopt;
+         }
+
+         auto& step = it->second;
+
+         const auto outOfDate = [&output] (const char* reason, const std::string& dependency = {}) {
+            Explain::OutOfDate(output.string(), reason, dependency);
+            return false;
+         };
+
+         if (step.signature != signature) {
+            return outOfDate("changed command line");
+         }
+
+         if (step.inputs.size() != inputs.size()) {
+            return outOfDate("different inputs");
+         }
+
+         if (!std::filesystem::exists(output)) {
+            return outOfDate("missing output");
+         }
+
+         if (!Unchanged(step.output, output)) {
+            return outOfDate("output modified");
+         }
+
+         for (size_t i = 0; i < inputs.size(); ++i) {
+            if (step.inputs[i].path != Key(inputs[i])) return outOfDate("different inputs", inputs[i]);
+            if (!std::filesystem::exists(inputs[i])) return outOfDate("missing input", inputs[i]);
+            if (!Unchanged(step.inputs[i], inputs[i])) return outOfDate("changed input", inputs[i]);
+         }
+
+         changed_.insert(key);   // The timestamps may have been updated
+         return true;
+      }
+
+      void Record (const std::filesystem::path& output, const std::vector<std::string>& inputs, const std::string& signature)
+      {
+         Step step;
+         step.output = FileState{Key(output), Time(output), Hash::File(output)};
+         step.signature = signature;
+         for (auto&& input : inputs) {
+            step.inputs.push_back(FileState{Key(input), Time(input), Hash::File(input)});
+         }
+
+         const auto lock = std::lock_guard{mutex_};
+
+         const auto it = steps_.find(step.output.path);
+         if (it != steps_.end() && it->second.output.hash == step.output.hash && it->second.output.time != step.output.time) {
+            // Same output as before: Restore the old timestamp, nothing further down has to be rebuilt because of it.
+            std::error_code nothrow;
+            std::filesystem::last_write_time(output, std::filesystem::file_time_type{std::filesystem::file_time_type::duration{it->second.output.time}}, nothrow);
+            if (!nothrow) {
+               step.output.time = it->second.output.time;
+            }
+         }
+
+         changed_.insert(step.output.path);
+         steps_[step.output.path] = std::move(step);
+      }
+   };
+
+   Manifests& TheManifests ()
+   {
+      static Manifests manifests;
+      return manifests;
+   }
+}
+
+
+
+namespace Manifest {
+
+   std::optional<bool> UpToDate (const std::filesystem::path& output, const std::vector<std::string>& inputs, const std::string& signature)
+   {
+      return TheManifests().UpToDate(output, inputs, signature);
+   }
+
+   void Record (const std::filesystem::path& output, const std::vector<std::string>& inputs, const std::string& signature)
+   {
+      TheManifests().Record(output, inputs, signature);
+   }
+
+   std::string Identity (const std::filesystem::path& tool)
+   {
+      std::error_code error;
+      const auto size = std::filesystem::file_size(tool, error);
+      const auto time = tool.empty() ? 0 : LastWriteTime(tool);
+
+      return tool.string() + " " + std::to_string(error ? 0 : size) + " " + std::to_string(time);
+   }
+}
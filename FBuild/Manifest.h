@@ -0,0 +1,32 @@
+/*
+ * Any copyright is dedicated to the Public Domain.
+ * http://creativecommons.org/publicdomain/zero/1.0/*
+ *
+ * Author: Frank Barwich
+ */
+
+#pragma once
+
+#include <filesystem>
+#include <optional>
+#include <string>
+#include <vector>
+
+
+// Content based up to date checks for build steps (Link, Lib, FileToCpp, Moc, ...). A step is identified by its output.
+// For every step the content hashes of its inputs and its output are recorded. Inputs with a changed timestamp but
+// the same content don't trigger the step. And if a step produces the same output again, the previous timestamp
+// of the output is restored, so the steps further down don't see a change either (early cutoff).
+// The signature stands for everything else the output depends on: The command line, the tool and its options. A step
+// with another signature than recorded runs again.
+namespace Manifest {
+
+   // std::nullopt if nothing is recorded for the output yet. The caller has to fall back to the timestamps then.
+   std::optional<bool> UpToDate (const std::filesystem::path& output, const std::vector<std::string>& inputs, const std::string& signature);
+
+   // After the step ran successfully, or was found up to date by timestamps.
+   void Record (const std::filesystem::path& output, const std::vector<std::string>& inputs, const std::string& signature);
+
+   // Of a tool for the signatures: Its path, size and timestamp. Another version of the tool gives another signature.
+   std::string Identity (const std::filesystem::path& tool);
+}
@@ -9,8 +9,17 @@
 
 #include "MemoryMappedFile.h"
 
-#define NOMINMAX
-#include <Windows.h>
+#ifdef _WIN32
+   #define NOMINMAX
+   #include <Windows.h>
+#else
+   #include <cerrno>
+   #include <cstring>
+   #include <fcntl.h>
+   #include <sys/mman.h>
+   #include <sys/stat.h>
+   #include <unistd.h>
+#endif
 
 
 MemoryMappedFile::MemoryMappedFile(const std::filesystem::path& file, uint64_t size, Mode mode) : file_{file}, size_{size}, mode_{mode}
@@ -22,6 +31,8 @@ MemoryMappedFile::MemoryMappedFile(const std::filesystem::path& file, uint64_t s
    CreateMemoryMapping();
 }
 
+#ifdef _WIN32
+
 std::string MemoryMappedFile::ErrorMessage() const
 {
    const auto lastError = ::GetLastError();
@@ -92,3 +103,51 @@ void MemoryMappedFile::CreateMemoryMapping()
    if (!ptr) throw std::runtime_error{"Couldn't map the file " + file_.string() + " into memory\n" + ErrorMessage()};
    memoryMapping_.reset(ptr, ::UnmapViewOfFile);
 }
+
+#else
+
+std::string MemoryMappedFile::ErrorMessage() const
+{
+   const auto lastError = errno;
+   return std::string(std::strerror(lastError)) + " (" + std::to_string(lastError) + ")";
+}
+
+void MemoryMappedFile::OpenFile()
+{
+   const int fd = ::open(file_.c_str(), mode_ == Mode::ReadOnly ? O_RDONLY | O_CLOEXEC : O_RDWR | O_CREAT | O_CLOEXEC, 0644);
+   if (fd < 0) throw std::runtime_error{"Error opening file " + file_.string() + "\n" + ErrorMessage()};
+   fileHandle_.reset(new int{fd}, [] (int* handle) { ::close(*handle); delete handle; });
+}
+
+void MemoryMappedFile::CreateFMapping()
+{
+   const int fd = *static_cast<int*>(fileHandle_.get());
+
+   if (size_ == 0) {
+      struct stat status{};
+      if (::fstat(fd, &status) != 0) throw std::runtime_error{"Unable to determine the file size (fstat) for " + file_.string() + "\n" + ErrorMessage()};
+
+      size_ = static_cast<uint64_t>(status.st_size);
+   }
+   else {
+      if (::ftruncate(fd, static_cast<off_t>(size_)) != 0) throw std::runtime_error {"Unable to truncate file (ftruncate) for " + file_.string() + "\n" + ErrorMessage()};
+   }
+
+   if (size_ == 0) throw std::runtime_error{"Can't map the empty file " + file_.string() + " into memory"};
+
+   // No mapping object on POSIX, mmap() works on the file directly
+}
+
+void MemoryMappedFile::CreateMemoryMapping()
+{
+   const int fd = *static_cast<int*>(fileHandle_.get());
+   const int protection = mode_ == Mode::ReadOnly ? PROT_READ : PROT_READ | PROT_WRITE;
+
+   void* ptr = ::mmap(nullptr, size_, protection, MAP_SHARED, fd, 0);
+   if (ptr == MAP_FAILED) throw std::runtime_error{"Couldn't map the file " + file_.string() + " into memory\n" + ErrorMessage()};
+
+   const auto size = size_;
+   memoryMapping_.reset(static_cast<char*>(ptr), [size] (char* memory) { ::munmap(memory, size); });
+}
+
+#endif
@@ -7,10 +7,12 @@
 
 #include "Moc.h"
 #include "MemoryMappedFile.h"
+#include "Manifest.h"
+#include "Snapshot.h"
+#include "Explain.h"
+#include "Supervisor.h"
 
 #include <filesystem>
-#include <mutex>
-#include <thread>
 #include <atomic>
 #include <iostream>
 #include <fstream>
@@ -21,6 +23,7 @@ Moc::Moc (const std::string& qtBinDirectory)
    if (!std::filesystem::exists(exe)) throw std::runtime_error{exe.string() + " doesn't exist"};
    exe.make_preferred();
    mocExe_ = exe.string();
+   signature_ = Manifest::Identity(exe);
 }
 
 void Moc::Compile()
@@ -30,61 +33,44 @@ void Moc::Compile()
 
    if (!std::filesystem::exists(outDir_)) std::filesystem::create_directories(outDir_);
 
-   std::vector<std::string> todo{files_};
    std::atomic<uint32_t> errors{0};
-   std::mutex mutex{};
+   Supervisor::Batch batch;
 
-   const auto threadFunction = [&] () {
-      std::string file{};
-      std::string outFile{};
-      std::string command{};
+   for (auto&& file : files_) {
+      try {
+         const auto outFile = OutFile(file);
+         outFiles_.emplace_back(outFile);
 
-      for (;;) {
-         try {
-            {
-               std::lock_guard guard{mutex};
-               const auto it = todo.rbegin();
-               if (it == todo.rend()) break;
-               file = (*it);
-               todo.pop_back();
-
-               outFile = OutFile(file);
-               outFiles_.emplace_back(outFile);
-            }
+         if (!NeedsRebuild(file, outFile)) continue;
 
-            if (!NeedsRebuild(file, outFile)) continue;
+         Snapshot::Invalidate();
 
-            if (!NeedsMoc(file)) {
+         if (!NeedsMoc(file)) {
+            {
                std::ofstream emptyFile{outFile, std::ofstream::trunc};
             }
-            else {
-               std::cout << "Moc: " << file << std::endl;
-
-               command = mocExe_ + " -o \"" + outFile + "\" ";
-               command += file;
-               int rc = std::system(command.c_str());
-               if (rc != 0) ++errors;
-            }
-
-         }
-         catch (std::exception& e) {
-            std::cout << e.what() << std::endl;
-            ++errors;
+            Manifest::Record(outFile, {file}, signature_);
+            continue;
          }
-         catch (...) {
-            ++errors;
-         }
-      }
-   };
 
-   size_t threadCount = std::thread::hardware_concurrency();
-   if (!threadCount) threadCount = 2;
-   if (threadCount > todo.size()) threadCount = todo.size();
-
-   std::vector<std::thread> threads;
-   for (size_t i = 0; i < threadCount; ++i) threads.emplace_back(std::thread{threadFunction});
+         Supervisor::Job job;
+         job.arguments = {mocExe_, "-o", outFile, file};
+         job.environment = Process::Current();
+         job.action = outFile;
+         job.done = [this, &errors, file, outFile] (const Supervisor::Result& result) {
+            std::cout << "Moc: " << file << "\n" << result.output << std::flush;
+            if (result.exitCode != 0) ++errors;
+            else Manifest::Record(outFile, {file}, signature_);
+         };
+         batch.Submit(std::move(job));
+      }
+      catch (std::exception& e) {
+         std::cout << e.what() << std::endl;
+         ++errors;
+      }
+   }
 
-   for (auto&& thread : threads) thread.join();
+   batch.Wait();
 
    if (errors) throw std::runtime_error("Moc Error");
 
@@ -110,10 +96,23 @@ std::string Moc::OutFile(const std::string& inFile) const
 
 bool Moc::NeedsRebuild(const std::string& inFile, const std::string& outFile) const
 {
-   if (!dependencyCheck_) return true;
-   if (!std::filesystem::exists(outFile)) return true;
+   if (!dependencyCheck_) {
+      Explain::OutOfDate(outFile, "DependencyCheck(false)");
+      return true;
+   }
+   if (!std::filesystem::exists(outFile)) {
+      Explain::OutOfDate(outFile, "missing output");
+      return true;
+   }
+
+   if (const auto upToDate = Manifest::UpToDate(outFile, {inFile}, signature_)) return !*upToDate;
+   if (std::filesystem::last_write_time(outFile) < std::filesystem::last_write_time(inFile)) {
+      Explain::OutOfDate(outFile, "newer input", inFile);
+      return true;
+   }
 
-   return std::filesystem::last_write_time(outFile) < std::filesystem::last_write_time(inFile);
+   Manifest::Record(outFile, {inFile}, signature_);   // Up to date by timestamps. From now on the content counts.
+   return false;
 }
 
 bool Moc::NeedsMoc(const std::string& file) const
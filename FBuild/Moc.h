@@ -31,6 +31,7 @@ public:
 
 private:
    std::string              mocExe_;
+   std::string              signature_;   // Of moc.exe, for the Manifest. Another Qt runs moc again.
    std::string              outDir_;
    std::vector<std::string> files_;
    std::string              prefix_ = {"Moc_"};
@@ -0,0 +1,344 @@
+/*
+ * Any copyright is dedicated to the Public Domain.
+ * http://creativecommons.org/publicdomain/zero/1.0/*
+ *
+ * Author: Frank Barwich
+ */
+
+#include "Modules.h"
+#include "Hash.h"
+
+#include <algorithm>
+#include <cctype>
+#include <fstream>
+#include <functional>
+#include <iomanip>
+#include <map>
+#include <mutex>
+#include <set>
+#include <stdexcept>
+
+
+
+namespace {
+
+   std::mutex                                             registryMutex;
+   std::unordered_map<std::string, std::filesystem::path> registry;
+
+   std::mutex settleMutex;
+
+   // Comments become a space, the newlines stay. Literals are kept, a "//" in a string isn't a comment.
+   std::string WithoutComments (const std::string& text)
+   {
+      std::string result;
+      result.reserve(text.size());
+
+      for (size_t i = 0; i < text.size(); ++i) {
+         const char ch = text[i];
+         const char next = i + 1 < text.size() ? text[i + 1] : '\0';
+
+         if (ch == '/' && next == '/') {
+            while (i < text.size() && text[i] != '\n') ++i;
+            result += ' ';
+            if (i < text.size()) result += '\n';
+         }
+         else if (ch == '/' && next == '*') {
+            for (i += 2; i < text.size() && !(text[i] == '*' && i + 1 < text.size() && text[i + 1] == '/'); ++i) {
+               if (text[i] == '\n') result += '\n';
+            }
+            ++i;
+            result += ' ';
+         }
+         else if (ch == '"' || ch == '\'') {
+            result += ch;
+            for (++i; i < text.size() && text[i] != ch && text[i] != '\n'; ++i) {
+               if (text[i] == '\\' && i + 1 < text.size()) result += text[i++];
+               result += text[i];
+            }
+            if (i < text.size()) result += text[i];
+         }
+         else result += ch;
+      }
+
+      return result;
+   }
+
+   bool IsIdentifier (char ch)
+   {
+      return std::isalnum(static_cast<unsigned char>(ch)) || ch == '_';
+   }
+
+   // "export module", "import"... at the start of a line: The keyword and what follows up to the ';'
+   bool Keyword (const std::string& line, size_t& pos, const std::string& keyword)
+   {
+      if (line.compare(pos, keyword.size(), keyword) != 0) return false;
+      if (pos + keyword.size() < line.size() && IsIdentifier(line[pos + keyword.size()])) return false;   // importer, module_count...
+
+      pos += keyword.size();
+      while (pos < line.size() && std::isspace(static_cast<unsigned char>(line[pos]))) ++pos;
+      return true;
+   }
+
+   // Without the whitespace, empty if it's no module name (import = 5; in code from before C++20)
+   std::string Name (const std::string& text)
+   {
+      std::string result;
+      for (const char ch : text) {
+         if (std::isspace(static_cast<unsigned char>(ch))) continue;
+         if (!IsIdentifier(ch) && ch != '.' && ch != ':') return {};
+         result += ch;
+      }
+      return result;
+   }
+
+   std::filesystem::file_time_type::rep Time (const std::filesystem::path& file)
+   {
+      return std::filesystem::last_write_time(file).time_since_epoch().count();
+   }
+}
+
+
+
+namespace Modules {
+
+   Unit Scan (const std::filesystem::path& file)
+   {
+      std::ifstream in{file, std::ios::binary};
+      const std::string content{std::istreambuf_iterator<char>{in}, std::istreambuf_iterator<char>{}};
+
+      Unit unit;
+      std::string module;   // Of the module declaration, for import :P;
+
+      const auto text = WithoutComments(content);
+      for (size_t begin = 0; begin < text.size();) {
+         auto end = text.find('\n', begin);
+         if (end == std::string::npos) end = text.size();
+         const auto line = text.substr(begin, end - begin);
+         begin = end + 1;
+
+         size_t pos = line.find_first_not_of(" \t\r");
+         if (pos == std::string::npos) continue;
+
+         const bool exported = Keyword(line, pos, "export");
+         const bool isModule = Keyword(line, pos, "module");
+         if (!isModule && !Keyword(line, pos, "import")) continue;
+
+         const auto semicolon = line.find(';', pos);
+         if (semicolon == std::string::npos) continue;
+         const auto rest = line.substr(pos, semicolon - pos);
+
+         if (isModule) {
+            const auto name = Name(rest);
+            if (name.empty() || name[0] == ':') continue;   // module; and module :private;
+
+            const auto colon = name.find(':');
+            module = name.substr(0, colon);
+
+            if (colon != std::string::npos || exported) {
+               unit.provides = name;
+               unit.exported = exported;
+            }
+            else unit.imports.push_back(module);   // An implementation unit
+         }
+         else if (!rest.empty() && (rest[0] == '<' || rest[0] == '"')) {
+            unit.headerUnits.push_back(rest.substr(0, rest.find_last_not_of(" \t") + 1));
+         }
+         else {
+            const auto name = Name(rest);
+            if (name.empty()) continue;
+
+            unit.imports.push_back(name[0] == ':' ? module + name : name);
+         }
+      }
+
+      return unit;
+   }
+
+   std::string FileName (const std::string& module)
+   {
+      auto result = module;
+      std::replace(result.begin(), result.end(), ':', '-');
+      return result;
+   }
+
+
+
+   Graph::Graph (const std::vector<std::string>& files) : files_{files}
+   {
+      for (size_t i = 0; i < files_.size(); ++i) {
+         units_.push_back(Scan(files_[i]));
+         index_[files_[i]] = i;
+
+         const auto& provides = units_.back().provides;
+         if (provides.empty()) continue;
+
+         const auto [it, inserted] = providers_.emplace(provides, i);
+         if (!inserted) throw std::runtime_error("Module " + provides + " is provided by " + files_[it->second] + " and " + files_[i]);
+      }
+
+      importers_.resize(units_.size());
+      for (size_t i = 0; i < units_.size(); ++i) {
+         for (auto&& module : units_[i].imports) {
+            const auto it = providers_.find(module);
+            if (it != providers_.end() && it->second != i) importers_[it->second].push_back(i);
+         }
+      }
+
+      // Depth first, a provider after the ones it imports
+      std::vector<char> state(units_.size(), 0);   // 1: Being visited, 2: Done
+      std::vector<size_t> path;
+
+      const std::function<void (size_t)> visit = [&] (size_t i) {
+         if (state[i] == 2) return;
+         if (state[i] == 1) {
+            std::string cycle;
+            for (auto it = std::find(path.begin(), path.end(), i); it != path.end(); ++it) cycle += units_[*it].provides + " -> ";
+            throw std::runtime_error("Modules import each other: " + cycle + units_[i].provides);
+         }
+
+         state[i] = 1;
+         path.push_back(i);
+         for (auto&& module : units_[i].imports) {
+            const auto it = providers_.find(module);
+            if (it != providers_.end() && it->second != i) visit(it->second);
+         }
+         path.pop_back();
+         state[i] = 2;
+
+         order_.push_back(i);
+      };
+
+      for (size_t i = 0; i < units_.size(); ++i) {
+         if (!units_[i].provides.empty()) visit(i);
+      }
+   }
+
+   bool Graph::Empty () const
+   {
+      return std::all_of(units_.begin(), units_.end(), [] (const Unit& unit) { return unit.provides.empty() && unit.imports.empty(); });
+   }
+
+   const Unit& Graph::Of (const std::string& file) const
+   {
+      static const Unit none;
+
+      const auto it = index_.find(file);
+      return it != index_.end() ? units_[it->second] : none;
+   }
+
+   bool Graph::Provides (const std::string& module) const
+   {
+      return providers_.count(module) != 0;
+   }
+
+   std::vector<std::string> Graph::Providers () const
+   {
+      std::vector<std::string> result;
+      for (auto&& i : order_) result.push_back(files_[i]);
+      return result;
+   }
+
+   std::vector<std::string> Graph::Prerequisites (const std::string& file) const
+   {
+      const auto self = index_.at(file);
+
+      std::vector<std::string> result;
+      for (auto&& module : units_[self].imports) {
+         const auto it = providers_.find(module);
+         if (it != providers_.end() && it->second != self && std::find(result.begin(), result.end(), files_[it->second]) == result.end()) {
+            result.push_back(files_[it->second]);
+         }
+      }
+      return result;
+   }
+
+   std::vector<std::string> Graph::Importers (const std::string& file) const
+   {
+      std::vector<std::string> result;
+      for (auto&& i : importers_[index_.at(file)]) result.push_back(files_[i]);
+      return result;
+   }
+
+   std::vector<std::string> Graph::Imported (const std::string& file) const
+   {
+      std::vector<std::string> result;
+      std::set<std::string> seen;
+      std::vector<std::string> todo = units_[index_.at(file)].imports;
+
+      while (!todo.empty()) {
+         const auto module = todo.back();
+         todo.pop_back();
+         if (!seen.insert(module).second) continue;
+
+         result.push_back(module);
+
+         const auto it = providers_.find(module);
+         if (it != providers_.end()) todo.insert(todo.end(), units_[it->second].imports.begin(), units_[it->second].imports.end());
+      }
+
+      return result;
+   }
+
+
+
+   void Register (const std::string& module, const std::filesystem::path& bmi)
+   {
+      const auto lock = std::lock_guard{registryMutex};
+      registry[module] = bmi;
+   }
+
+   std::optional<std::filesystem::path> Registered (const std::string& module)
+   {
+      const auto lock = std::lock_guard{registryMutex};
+      const auto it = registry.find(module);
+      if (it == registry.end()) return std::nullopt;
+      return it->second;
+   }
+
+   std::map<std::string, std::filesystem::path> Registered ()
+   {
+      const auto lock = std::lock_guard{registryMutex};
+      return {registry.begin(), registry.end()};
+   }
+
+   std::vector<std::filesystem::path> RegisteredDirectories ()
+   {
+      const auto lock = std::lock_guard{registryMutex};
+
+      std::set<std::filesystem::path> directories;
+      for (auto&& item : registry) directories.insert(item.second.parent_path());
+      return {directories.begin(), directories.end()};
+   }
+
+   // Format: "bmi" hash time
+   bool Settle (const std::filesystem::path& bmi)
+   {
+      const auto lock = std::lock_guard{settleMutex};
+
+      const auto file = bmi.parent_path() / "Bmi.txt";
+      std::map<std::string, std::pair<std::string, std::filesystem::file_time_type::rep>> known;
+      {
+         std::ifstream stream(file);
+         std::string name, hash;
+         std::filesystem::file_time_type::rep time;
+         while (stream >> std::quoted(name) >> hash >> time) known[name] = {hash, time};
+      }
+
+      const auto name = bmi.filename().string();
+      const auto hash = Hash::File(bmi);
+
+      const auto it = known.find(name);
+      if (it != known.end() && it->second.first == hash) {
+         std::filesystem::last_write_time(bmi, std::filesystem::file_time_type{std::filesystem::file_time_type::duration{it->second.second}});
+         return false;
+      }
+
+      known[name] = {hash, Time(bmi)};
+
+      std::ofstream stream(file, std::ios::trunc);
+      for (auto&& [n, entry] : known) stream << std::quoted(n) << " " << entry.first << " " << entry.second << "\n";
+      if (!stream.flush()) throw std::runtime_error("Error writing " + file.string());
+
+      return true;
+   }
+}
@@ -0,0 +1,68 @@
+/*
+ * Any copyright is dedicated to the Public Domain.
+ * http://creativecommons.org/publicdomain/zero/1.0/*
+ *
+ * Author: Frank Barwich
+ */
+
+#pragma once
+
+#include <filesystem>
+#include <map>
+#include <optional>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+
+// Modules(true): The sources are scanned for the module declarations of C++20. Since P1857 they start a line like
+// preprocessor directives, so the scan needs no preprocessor. The units that provide a module (interfaces and
+// partitions) are compiled first, in the order of their imports, and write a BMI to ObjDir/Modules. A BMI that comes
+// out the same keeps its old timestamp, so the files importing it aren't compiled again. Header units are scanned,
+// but left to the compiler.
+namespace Modules {
+
+   struct Unit {
+      std::string              provides;         // "M", "M:P" for a partition. Empty for other files.
+      bool                     exported{false};  // export module: Part of the interface, not an internal partition
+      std::vector<std::string> imports;          // Named modules and partitions as "M:P". A module implementation unit imports its module.
+      std::vector<std::string> headerUnits;      // import <h>; and import "h";
+   };
+
+   Unit Scan (const std::filesystem::path& file);
+
+   std::string FileName (const std::string& module);   // Of the BMI without the extension, M:P gives M-P like clang and cl expect
+
+
+   class Graph {
+      std::vector<std::string>                       files_;
+      std::vector<Unit>                              units_;
+      std::unordered_map<std::string, size_t>        index_;       // File -> units_
+      std::unordered_map<std::string, size_t>        providers_;   // Module -> units_
+      std::vector<std::vector<size_t>>               importers_;
+      std::vector<size_t>                            order_;       // Providers, imported ones first
+
+   public:
+      explicit Graph (const std::vector<std::string>& files);   // Throws if a module is provided twice or modules import each other
+
+      bool Empty () const;   // No file provides or imports a module
+
+      const Unit&              Of (const std::string& file) const;                 // An empty one for files not scanned
+      bool                     Provides (const std::string& module) const;
+      std::vector<std::string> Providers () const;                               // Imported ones first
+      std::vector<std::string> Prerequisites (const std::string& file) const;    // The providers of this target it imports
+      std::vector<std::string> Importers (const std::string& file) const;        // Of this target, that import what the file provides
+      std::vector<std::string> Imported (const std::string& file) const;         // Modules, also the ones the imported ones import
+   };
+
+
+   // Modules of the targets built before, for the ones that follow in the same run
+   void                                 Register (const std::string& module, const std::filesystem::path& bmi);
+   std::optional<std::filesystem::path> Registered (const std::string& module);
+   std::map<std::string, std::filesystem::path> Registered ();
+   std::vector<std::filesystem::path>   RegisteredDirectories ();
+
+   // After the compile of a provider: false, and the BMI gets its timestamp back, if it's the same as before.
+   // The hashes are kept next to the BMIs in Bmi.txt.
+   bool Settle (const std::filesystem::path& bmi);
+}
@@ -0,0 +1,296 @@
+/*
+ * Any copyright is dedicated to the Public Domain.
+ * http://creativecommons.org/publicdomain/zero/1.0/*
+ *
+ * Author: Frank Barwich
+ */
+
+#include "ObjectCache.h"
+#include "Hash.h"
+#include "RemoteCache.h"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <fstream>
+#include <iomanip>
+#include <mutex>
+#include <ostream>
+#include <random>
+#include <sstream>
+#include <unordered_map>
+
+
+
+namespace {
+
+   // <directory>/<first two characters>/<key>/ holds the outputs as 0, 1, ... and the diagnostics.
+   // The time of the entry directory is the last use.
+   struct Cache {
+      std::mutex            mutex;
+      std::filesystem::path directory;
+      uint64_t              maxBytes{5ull << 30};
+      bool                  initialized{false};
+
+      std::atomic<uint64_t> hits{0};
+      std::atomic<uint64_t> misses{0};
+      std::atomic<uint64_t> stored{0};
+      std::atomic<uint64_t> storedBytes{0};
+   };
+
+   Cache& TheCache ()
+   {
+      static Cache cache;
+      return cache;
+   }
+
+   std::filesystem::path CacheDirectory ()
+   {
+      auto& cache = TheCache();
+      const auto lock = std::lock_guard{cache.mutex};
+
+      if (!cache.initialized) {
+         cache.initialized = true;
+         if (const char* env = std::getenv("FB_OBJECT_CACHE"); env && *env) cache.directory = env;
+      }
+
+      // The remote cache downloads into the local one
+      if (cache.directory.empty() && RemoteCache::Enabled()) cache.directory = std::filesystem::temp_directory_path() / "FBuildObjectCache";
+
+      return cache.directory;
+   }
+
+   std::filesystem::path EntryDirectory (const std::string& key)
+   {
+      const auto name = key.substr(key.find(':') + 1);   // Without the name of the algorithm
+      return CacheDirectory() / name.substr(0, 2) / name;
+   }
+
+   // Many sources include the same headers
+   std::string FileHash (const std::string& file)
+   {
+      static std::mutex mutex;
+      static std::unordered_map<std::string, std::string> hashes;
+
+      {
+         const auto lock = std::lock_guard{mutex};
+         const auto it = hashes.find(file);
+         if (it != hashes.end()) return it->second;
+      }
+
+      auto hash = Hash::File(file);
+
+      const auto lock = std::lock_guard{mutex};
+      return hashes.emplace(file, std::move(hash)).first->second;
+   }
+
+   std::string Unique ()
+   {
+      static std::mutex mutex;
+      static std::mt19937_64 random{std::random_device{}()};
+
+      const auto lock = std::lock_guard{mutex};
+      std::ostringstream result;
+      result << std::hex << random();
+      return result.str();
+   }
+
+   // Persistent counters, so cache-stats can show more than a single run. Concurrent runs may lose a few counts.
+   void AddToTotals (uint64_t hits, uint64_t misses)
+   {
+      const auto file = CacheDirectory() / "stats.txt";
+
+      uint64_t totalHits = 0, totalMisses = 0;
+      {
+         std::ifstream in{file};
+         in >> totalHits >> totalMisses;
+      }
+
+      std::ofstream out{file, std::ios::trunc};
+      out << (totalHits + hits) << " " << (totalMisses + misses) << "\n";
+   }
+}
+
+
+
+namespace ObjectCache {
+
+   void Directory (const std::filesystem::path& directory, uint64_t maxBytes)
+   {
+      auto& cache = TheCache();
+      const auto lock = std::lock_guard{cache.mutex};
+
+      cache.initialized = true;
+      cache.directory = directory.empty() ? directory : std::filesystem::absolute(directory);
+      if (maxBytes) cache.maxBytes = maxBytes;
+   }
+
+   bool Enabled ()
+   {
+      return !CacheDirectory().empty();
+   }
+
+   std::string Key (std::string_view signature, const std::filesystem::path& source, const std::vector<std::string>& dependencies)
+   {
+      // The path of the source is part of the key: Debug information and the dependency files of gcc contain it
+      std::string key{signature};
+      key += "\n" + std::filesystem::absolute(source).lexically_normal().generic_string() + "\n";
+
+      auto sorted = dependencies;
+      std::sort(sorted.begin(), sorted.end());
+
+      for (auto&& dependency : sorted) {
+         key += std::filesystem::path(dependency).filename().string() + " " + FileHash(dependency) + "\n";
+      }
+
+      return Hash::String(key, Hash::Algorithm::Sha256);
+   }
+
+   bool Restore (const std::string& key, const std::vector<std::filesystem::path>& outputs, std::string& diagnostics)
+   {
+      auto& cache = TheCache();
+      const auto entry = EntryDirectory(key);
+
+      std::error_code error;
+      const auto complete = [&] () {
+         for (size_t i = 0; i < outputs.size(); ++i) {
+            if (!std::filesystem::is_regular_file(entry / std::to_string(i), error)) return false;
+         }
+         return std::filesystem::is_regular_file(entry / "diagnostics", error);
+      };
+
+      if (!complete() && !(RemoteCache::Fetch(key, entry, outputs.size()) && complete())) {
+         ++cache.misses;
+         return false;
+      }
+
+      for (size_t i = 0; i < outputs.size(); ++i) {
+         const auto cached = entry / std::to_string(i);
+
+         std::filesystem::remove(outputs[i], error);
+         std::filesystem::create_hard_link(cached, outputs[i], error);
+         if (error) std::filesystem::copy_file(cached, outputs[i], std::filesystem::copy_options::overwrite_existing, error);   // Other volume: copy_file clones where the filesystem can
+         if (error) {
+            ++cache.misses;
+            return false;
+         }
+
+         std::filesystem::last_write_time(outputs[i], std::filesystem::file_time_type::clock::now(), error);   // Newer than the sources, or it's out of date again
+      }
+
+      std::ifstream in{entry / "diagnostics", std::ios::binary};
+      diagnostics.assign(std::istreambuf_iterator<char>{in}, std::istreambuf_iterator<char>{});
+
+      std::filesystem::last_write_time(entry, std::filesystem::file_time_type::clock::now(), error);   // Recently used
+      ++cache.hits;
+      return true;
+   }
+
+   void Store (const std::string& key, const std::vector<std::filesystem::path>& outputs, const std::string& diagnostics)
+   {
+      auto& cache = TheCache();
+      const auto entry = EntryDirectory(key);
+
+      std::error_code error;
+      if (std::filesystem::exists(entry, error)) return;
+
+      // Written next to the entry and renamed, so a concurrent run never sees half an entry
+      const auto temporary = entry.parent_path() / ("tmp." + Unique());
+      std::filesystem::create_directories(temporary, error);
+      if (error) return;
+
+      uint64_t bytes = 0;
+      for (size_t i = 0; i < outputs.size() && !error; ++i) {
+         std::filesystem::copy_file(outputs[i], temporary / std::to_string(i), error);
+         if (!error) bytes += std::filesystem::file_size(outputs[i], error);
+      }
+
+      if (!error) {
+         std::ofstream{temporary / "diagnostics", std::ios::binary} << diagnostics;
+         std::filesystem::rename(temporary, entry, error);
+      }
+
+      if (error) {
+         std::filesystem::remove_all(temporary, error);
+         return;
+      }
+
+      ++cache.stored;
+      cache.storedBytes += bytes;
+
+      RemoteCache::Upload(key, entry, outputs.size());
+   }
+
+   void Trim ()
+   {
+      auto& cache = TheCache();
+      if (!Enabled()) return;
+
+      if (cache.hits || cache.misses) AddToTotals(cache.hits, cache.misses);
+      if (!cache.stored) return;   // Nothing grew
+
+      struct Entry {
+         std::filesystem::path           path;
+         std::filesystem::file_time_type used;
+         uint64_t                        bytes;
+      };
+
+      std::vector<Entry> entries;
+      uint64_t total = 0;
+
+      std::error_code error;
+      for (auto&& prefix : std::filesystem::directory_iterator{CacheDirectory(), error}) {
+         if (!prefix.is_directory(error)) continue;
+
+         for (auto&& entry : std::filesystem::directory_iterator{prefix.path(), error}) {
+            uint64_t bytes = 0;
+            for (auto&& file : std::filesystem::directory_iterator{entry.path(), error}) bytes += file.file_size(error);
+
+            entries.push_back({entry.path(), entry.last_write_time(error), bytes});
+            total += bytes;
+         }
+      }
+
+      if (total <= cache.maxBytes) return;
+
+      std::sort(entries.begin(), entries.end(), [] (const Entry& a, const Entry& b) { return a.used < b.used; });
+
+      const auto target = cache.maxBytes / 10 * 9;   // Some room, so not every run has to trim
+      for (auto&& entry : entries) {
+         if (total <= target) break;
+         std::filesystem::remove_all(entry.path, error);
+         total -= entry.bytes;
+      }
+   }
+
+   void Statistics (std::ostream& out)
+   {
+      auto& cache = TheCache();
+      const auto directory = CacheDirectory();
+
+      if (directory.empty()) {
+         out << "Object cache: off (ObjectCache() or FB_OBJECT_CACHE=<dir>)\n";
+         return;
+      }
+
+      uint64_t totalHits = 0, totalMisses = 0;
+      {
+         std::ifstream in{directory / "stats.txt"};
+         in >> totalHits >> totalMisses;
+      }
+
+      uint64_t entries = 0, bytes = 0;
+      std::error_code error;
+      for (auto&& file : std::filesystem::recursive_directory_iterator{directory, error}) {
+         if (file.is_regular_file(error) && file.path().filename() != "stats.txt") {
+            bytes += file.file_size(error);
+            if (file.path().filename() == "diagnostics") ++entries;
+         }
+      }
+
+      out << "Object cache: " << directory.string() << "\n"
+          << "   entries: " << entries << ", " << (bytes >> 20) << " MB of " << (cache.maxBytes >> 20) << " MB\n"
+          << "   this run: " << cache.hits << " hits, " << cache.misses << " misses, " << cache.stored << " stored (" << (cache.storedBytes >> 20) << " MB)\n"
+          << "   total: " << totalHits << " hits, " << totalMisses << " misses\n" << std::flush;
+   }
+}
@@ -0,0 +1,35 @@
+/*
+ * Any copyright is dedicated to the Public Domain.
+ * http://creativecommons.org/publicdomain/zero/1.0/*
+ *
+ * Author: Frank Barwich
+ */
+
+#pragma once
+
+#include <filesystem>
+#include <iosfwd>
+#include <string>
+#include <string_view>
+#include <vector>
+
+
+// Compiled objects by the content of everything that went into them. Switching branches or worktrees gets the
+// objects back instead of compiling them again. Off unless ObjectCache() or the environment FB_OBJECT_CACHE=<dir> gives a directory.
+// Entries are restored by hardlink, or copied (the filesystem may clone them) if that fails. Local misses are looked up
+// in the RemoteCache, if there is one.
+namespace ObjectCache {
+
+   void Directory (const std::filesystem::path& directory, uint64_t maxBytes = 0);   // 0 keeps the limit, default 5 GB
+   bool Enabled ();
+
+   // signature: Command line and compiler. dependencies: The source and everything it includes, hashed by content.
+   // The absolute path of the source is part of it, as are the paths on the command line. Another checkout gets other keys.
+   std::string Key (std::string_view signature, const std::filesystem::path& source, const std::vector<std::string>& dependencies);
+
+   bool Restore (const std::string& key, const std::vector<std::filesystem::path>& outputs, std::string& diagnostics);
+   void Store (const std::string& key, const std::vector<std::filesystem::path>& outputs, const std::string& diagnostics);
+
+   void Trim ();                                // Removes the least recently used entries above the limit. At the end of a run.
+   void Statistics (std::ostream& out);          // Hits and misses of this run and in total, size
+}
@@ -0,0 +1,631 @@
+/*
+ * Any copyright is dedicated to the Public Domain.
+ * http://creativecommons.org/publicdomain/zero/1.0/*
+ *
+ * Author: Frank Barwich
+ */
+
+#include "Process.h"
+#include "Jobserver.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cctype>
+#include <cstring>
+#include <fstream>
+#include <mutex>
+#include <random>
+#include <unordered_map>
+
+#ifdef _WIN32
+   #define NOMINMAX
+   #include <windows.h>
+#else
+   #include <cerrno>
+   #include <fcntl.h>
+   #include <spawn.h>
+   #include <sys/wait.h>
+   #include <unistd.h>
+
+   extern char** environ;
+#endif
+
+
+
+namespace {
+
+#ifdef _WIN32
+   constexpr char   pathSeparator = ';';
+   constexpr size_t commandLineLimit = 32000;   // CreateProcess() takes 32767 characters
+   constexpr size_t batchLineLimit = 8191;      // cmd.exe takes no more
+#else
+   constexpr char   pathSeparator = ':';
+#endif
+
+   bool NeedsQuotes (const std::string& argument)
+   {
+      return argument.empty() || argument.find_first_of(" \t\n\v\"") != std::string::npos;
+   }
+
+#ifdef _WIN32
+   std::string Lower (std::string text)
+   {
+      for (char& ch : text) ch = static_cast<char>(std::tolower(static_cast<unsigned char>(ch)));
+      return text;
+   }
+
+   bool Batch (const std::filesystem::path& program)
+   {
+      const auto extension = Lower(program.extension().string());
+      return extension == ".bat" || extension == ".cmd";
+   }
+
+   // cmd.exe parses the line before the batch file gets it: The escapes of CreateProcess() mean nothing to it, & | < > ^ ( )
+   // only lose their meaning between quotes and %VAR% expands even there. "" is a quote within quotes for cmd.exe and
+   // for the programs the batch file passes the argument on to.
+   std::string BatchJoin (const Process::Arguments& arguments)
+   {
+      std::string result;
+
+      for (auto&& argument : arguments) {
+         if (argument.find_first_of("\r\n") != std::string::npos) throw std::runtime_error("A line break can't be passed to a batch file: " + argument);
+         if (!result.empty()) result += ' ';
+
+         if (!argument.empty() && argument.find_first_of(" \t\"&|<>^()%!,;=") == std::string::npos) {
+            result += argument;
+            continue;
+         }
+
+         result += '"';
+         size_t backslashes = 0;
+         for (char ch : argument) {
+            backslashes = ch == '\\' ? backslashes + 1 : 0;
+            if (ch == '"') result += "\"\"";
+            else if (ch == '%') result += "%%cd:~,%";   // %cd:~,% expands to nothing, so no %VAR% is formed
+            else result += ch;
+         }
+         result.append(backslashes, '\\');   // Don't escape the closing quote
+         result += '"';
+      }
+
+      return result;
+   }
+
+   std::string BatchCommandLine (const Process::Arguments& arguments)
+   {
+      return "cmd.exe /d /s /c \"" + BatchJoin(arguments) + "\"";   // /s: Only the outer quotes are removed
+   }
+#endif
+
+   size_t Length (const Process::Arguments& arguments)
+   {
+      size_t result = 0;
+      for (auto&& argument : arguments) {
+         result += argument.size() + 3;   // Separator and quotes
+      }
+      return result;
+   }
+
+   bool TooLong (const Process::Arguments& arguments, const Process::Environment& environment)
+   {
+#ifdef _WIN32
+      const auto program = Process::Find(arguments[0], environment);
+      if (Batch(program)) {
+         auto line = arguments;
+         line[0] = program.string();
+         return BatchCommandLine(line).size() > batchLineLimit;
+      }
+
+      return Length(arguments) > commandLineLimit;
+#else
+      // Arguments and environment share ARG_MAX. Half of it is plenty and leaves room for the pointers.
+      static const size_t limit = [] {
+         const auto max = ::sysconf(_SC_ARG_MAX);
+         return max > 0 ? static_cast<size_t>(max) / 2 : size_t{64 * 1024};
+      } ();
+
+      return Length(arguments) + Length(environment) > limit;
+#endif
+   }
+
+#ifndef _WIN32
+   // gcc and clang read @file like a shell: ' and " quote, \ escapes any character, also within quotes
+   std::string ResponseFileJoin (const Process::Arguments& arguments)
+   {
+      std::string result;
+
+      for (auto&& argument : arguments) {
+         if (!result.empty()) result += ' ';
+
+         result += '"';
+         for (char ch : argument) {
+            if (ch == '\\' || ch == '"' || ch == '\'') result += '\\';
+            result += ch;
+         }
+         result += '"';
+      }
+
+      return result;
+   }
+#endif
+
+   // Everything but the program goes into a response file. All the tools we start understand @file.
+   class ResponseFile {
+      std::filesystem::path file_;
+
+   public:
+      explicit ResponseFile (Process::Arguments& arguments)
+      {
+         file_ = std::filesystem::temp_directory_path() / ("FBuild_" + std::to_string(std::random_device{}()) + ".rsp");
+
+         std::ofstream stream(file_, std::ios::trunc);
+#ifdef _WIN32
+         stream << Process::Join(Process::Arguments(arguments.begin() + 1, arguments.end()));
+#else
+         stream << ResponseFileJoin(Process::Arguments(arguments.begin() + 1, arguments.end()));
+#endif
+         if (!stream.flush()) throw std::runtime_error("Error writing response file " + file_.string());
+
+         arguments.resize(1);
+         arguments.push_back("@" + file_.string());
+      }
+
+      ~ResponseFile ()
+      {
+         std::error_code nothrow;
+         std::filesystem::remove(file_, nothrow);
+      }
+
+      ResponseFile (const ResponseFile&) = delete;
+      ResponseFile& operator= (const ResponseFile&) = delete;
+   };
+
+
+
+#ifdef _WIN32
+   std::string ErrorMessage ()
+   {
+      const auto lastError = ::GetLastError();
+
+      std::string result;
+      LPSTR message{};
+
+      const auto count = ::FormatMessageA(FORMAT_MESSAGE_ALLOCATE_BUFFER | FORMAT_MESSAGE_FROM_SYSTEM, nullptr, lastError, 0, reinterpret_cast<LPSTR>(&message), 0, nullptr);
+      if (count) {
+         result = message;
+         ::LocalFree(message);
+      }
+
+      return result + " (" + std::to_string(lastError) + ")";
+   }
+
+   // Anonymous pipes can't do overlapped IO, which the Supervisor needs to wait for many of them at once
+   void CreateOverlappedPipe (HANDLE& readPipe, HANDLE& writePipe)
+   {
+      static std::atomic<unsigned> counter{0};
+      const auto name = "\\\\.\\pipe\\FBuild_" + std::to_string(::GetCurrentProcessId()) + "_" + std::to_string(++counter);
+
+      readPipe = ::CreateNamedPipeA(name.c_str(), PIPE_ACCESS_INBOUND | FILE_FLAG_OVERLAPPED | FILE_FLAG_FIRST_PIPE_INSTANCE, PIPE_TYPE_BYTE | PIPE_WAIT | PIPE_REJECT_REMOTE_CLIENTS, 1, 0, 64 * 1024, 0, nullptr);
+      if (readPipe == INVALID_HANDLE_VALUE) throw std::runtime_error("Error creating pipe: " + ErrorMessage());
+
+      SECURITY_ATTRIBUTES security{sizeof(SECURITY_ATTRIBUTES), nullptr, TRUE};
+      writePipe = ::CreateFileA(name.c_str(), GENERIC_WRITE, 0, &security, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+      if (writePipe == INVALID_HANDLE_VALUE) {
+         const auto message = ErrorMessage();
+         ::CloseHandle(readPipe);
+         throw std::runtime_error("Error creating pipe: " + message);
+      }
+   }
+
+   Process::Child Spawn (Process::Arguments arguments, const Process::Environment& environment, bool captureOutput)
+   {
+      const auto program = Process::Find(arguments[0], environment);
+
+      std::string application = program.string();
+      arguments[0] = application;
+      std::string commandLine = Process::Join(arguments);
+
+      if (Batch(program)) {   // emcc.bat and friends need the command interpreter
+         application = Process::Get(environment, "ComSpec");
+         if (application.empty()) application = "C:\\Windows\\System32\\cmd.exe";
+         commandLine = BatchCommandLine(arguments);
+      }
+
+      // Only the standard handles are inherited. Otherwise parallel jobs would inherit each others pipes.
+      HANDLE input = ::GetStdHandle(STD_INPUT_HANDLE);
+      HANDLE output = ::GetStdHandle(STD_OUTPUT_HANDLE);
+      HANDLE error = ::GetStdHandle(STD_ERROR_HANDLE);
+
+      HANDLE readPipe = nullptr;
+      HANDLE writePipe = nullptr;
+
+      if (captureOutput) {
+         CreateOverlappedPipe(readPipe, writePipe);
+         output = writePipe;
+         error = writePipe;
+      }
+
+      std::vector<HANDLE> inherit;
+      for (HANDLE handle : {input, output, error}) {
+         if (handle && handle != INVALID_HANDLE_VALUE && std::find(inherit.begin(), inherit.end(), handle) == inherit.end()) {
+            ::SetHandleInformation(handle, HANDLE_FLAG_INHERIT, HANDLE_FLAG_INHERIT);
+            inherit.push_back(handle);
+         }
+      }
+
+      SIZE_T size = 0;
+      ::InitializeProcThreadAttributeList(nullptr, 1, 0, &size);
+      std::vector<char> attributes(size);
+      const auto attributeList = reinterpret_cast<LPPROC_THREAD_ATTRIBUTE_LIST>(attributes.data());
+      ::InitializeProcThreadAttributeList(attributeList, 1, 0, &size);
+      if (!inherit.empty()) {
+         ::UpdateProcThreadAttribute(attributeList, 0, PROC_THREAD_ATTRIBUTE_HANDLE_LIST, inherit.data(), inherit.size() * sizeof(HANDLE), nullptr, nullptr);
+      }
+
+      STARTUPINFOEXA startupInfo{};
+      startupInfo.StartupInfo.cb = sizeof(startupInfo);
+      startupInfo.StartupInfo.dwFlags = STARTF_USESTDHANDLES;
+      startupInfo.StartupInfo.hStdInput = input;
+      startupInfo.StartupInfo.hStdOutput = output;
+      startupInfo.StartupInfo.hStdError = error;
+      startupInfo.lpAttributeList = attributeList;
+
+      std::string block;
+      for (auto&& variable : environment) {
+         block += variable;
+         block += '\0';
+      }
+      block += '\0';
+
+      PROCESS_INFORMATION processInfo{};
+      const auto started = ::CreateProcessA(application.c_str(), commandLine.data(), nullptr, nullptr, !inherit.empty(), EXTENDED_STARTUPINFO_PRESENT, block.data(), nullptr, &startupInfo.StartupInfo, &processInfo);
+      const auto message = started ? std::string{} : ErrorMessage();
+
+      ::DeleteProcThreadAttributeList(attributeList);
+      if (writePipe) ::CloseHandle(writePipe);
+
+      if (!started) {
+         if (readPipe) ::CloseHandle(readPipe);
+         throw std::runtime_error("Error starting " + program.string() + ": " + message);
+      }
+
+      ::CloseHandle(processInfo.hThread);
+
+      Process::Child child;
+      child.process = processInfo.hProcess;
+      child.output = readPipe;
+      return child;
+   }
+
+   Process::Result Wait (Process::Child& child)
+   {
+      Process::Result result;
+
+      if (child.output) {
+         OVERLAPPED overlapped{};
+         overlapped.hEvent = ::CreateEventA(nullptr, TRUE, FALSE, nullptr);
+
+         char buffer[4096];
+         for (;;) {
+            DWORD read = 0;
+            if (!::ReadFile(child.output, buffer, sizeof(buffer), nullptr, &overlapped) && ::GetLastError() != ERROR_IO_PENDING) break;
+            if (!::GetOverlappedResult(child.output, &overlapped, &read, TRUE)) break;   // ERROR_BROKEN_PIPE: Done
+            result.output.append(buffer, read);
+         }
+
+         ::CloseHandle(overlapped.hEvent);
+         ::CloseHandle(child.output);
+         child.output = nullptr;
+      }
+
+      DWORD exitCode = 0;
+      ::WaitForSingleObject(child.process, INFINITE);
+      ::GetExitCodeProcess(child.process, &exitCode);
+      ::CloseHandle(child.process);
+      child.process = nullptr;
+
+      result.exitCode = static_cast<int>(exitCode);
+      return result;
+   }
+#else
+   Process::Child Spawn (Process::Arguments arguments, const Process::Environment& environment, bool captureOutput)
+   {
+      const auto program = Process::Find(arguments[0], environment);
+
+      std::vector<char*> argv;
+      for (auto&& argument : arguments) argv.push_back(const_cast<char*>(argument.c_str()));
+      argv.push_back(nullptr);
+
+      std::vector<char*> envp;
+      for (auto&& variable : environment) envp.push_back(const_cast<char*>(variable.c_str()));
+      envp.push_back(nullptr);
+
+      int pipe[2] = {-1, -1};
+      if (captureOutput && ::pipe2(pipe, O_CLOEXEC) != 0) {
+         throw std::runtime_error(std::string("Error creating pipe: ") + std::strerror(errno));
+      }
+
+      posix_spawn_file_actions_t actions;
+      ::posix_spawn_file_actions_init(&actions);
+      if (captureOutput) {
+         ::posix_spawn_file_actions_adddup2(&actions, pipe[1], STDOUT_FILENO);
+         ::posix_spawn_file_actions_adddup2(&actions, pipe[1], STDERR_FILENO);
+      }
+#if defined(__GLIBC__) && (__GLIBC__ > 2 || (__GLIBC__ == 2 && __GLIBC_MINOR__ >= 34))
+      // Nothing leaks into the tools, but the jobserver pipe of a parent make: MAKEFLAGS still names it.
+      // close() of a descriptor that isn't open is ignored in the child.
+      const auto keep = Jobserver::Inherited();
+      const int from = keep.empty() ? 3 : *std::max_element(keep.begin(), keep.end()) + 1;
+      for (int fd = 3; fd < from; ++fd) {
+         if (std::find(keep.begin(), keep.end(), fd) == keep.end()) ::posix_spawn_file_actions_addclose(&actions, fd);
+      }
+      ::posix_spawn_file_actions_addclosefrom_np(&actions, from);   // close_range() in the child
+#endif
+
+      // glibc implements posix_spawn() with clone(CLONE_VM | CLONE_VFORK): No copy of the address space.
+      pid_t pid = 0;
+      const int rc = ::posix_spawn(&pid, program.c_str(), &actions, nullptr, argv.data(), envp.data());
+      ::posix_spawn_file_actions_destroy(&actions);
+
+      if (captureOutput) ::close(pipe[1]);
+
+      if (rc != 0) {
+         if (captureOutput) ::close(pipe[0]);
+         throw std::runtime_error("Error starting " + program.string() + ": " + std::strerror(rc));
+      }
+
+      Process::Child child;
+      child.pid = pid;
+      child.output = pipe[0];
+      return child;
+   }
+
+   Process::Result Wait (Process::Child& child)
+   {
+      Process::Result result;
+
+      if (child.output >= 0) {
+         char buffer[4096];
+         for (;;) {
+            const auto count = ::read(child.output, buffer, sizeof(buffer));
+            if (count > 0) result.output.append(buffer, static_cast<size_t>(count));
+            else if (count < 0 && errno == EINTR) continue;
+            else break;
+         }
+         ::close(child.output);
+         child.output = -1;
+      }
+
+      int status = 0;
+      while (::waitpid(child.pid, &status, 0) < 0 && errno == EINTR) {
+      }
+      child.pid = -1;
+
+      result.exitCode = Process::ExitCode(status);
+      return result;
+   }
+#endif
+}
+
+
+
+namespace Process {
+
+   Environment Current ()
+   {
+      Environment result;
+
+#ifdef _WIN32
+      const auto block = ::GetEnvironmentStringsA();
+      if (block) {
+         for (const char* p = block; *p; p += std::strlen(p) + 1) {
+            if (*p != '=') result.emplace_back(p);   // Skip the hidden "=C:=C:\..." entries
+         }
+         ::FreeEnvironmentStringsA(block);
+      }
+#else
+      for (char** p = environ; *p; ++p) {
+         result.emplace_back(*p);
+      }
+#endif
+
+      return result;
+   }
+
+   std::string Get (const Environment& environment, std::string_view name)
+   {
+      for (auto&& variable : environment) {
+         const auto pos = variable.find('=');
+         if (pos != name.size()) continue;
+
+#ifdef _WIN32
+         if (Lower(variable.substr(0, pos)) == Lower(std::string(name))) return variable.substr(pos + 1);   // Case insensitive on Windows
+#else
+         if (variable.compare(0, pos, name) == 0) return variable.substr(pos + 1);
+#endif
+      }
+
+      return {};
+   }
+
+   Arguments Split (std::string_view commandLine)
+   {
+      Arguments result;
+
+      std::string current;
+      bool inArgument = false;
+      bool quoted = false;
+
+      for (size_t i = 0; i < commandLine.size(); ++i) {
+         const char ch = commandLine[i];
+
+         if (!quoted && (ch == ' ' || ch == '\t' || ch == '\n' || ch == '\r')) {
+            if (inArgument) result.push_back(std::move(current));
+            current.clear();
+            inArgument = false;
+            continue;
+         }
+
+         inArgument = true;
+
+         if (ch == '\\') {   // Backslashes are only special in front of a quote
+            size_t count = 0;
+            while (i < commandLine.size() && commandLine[i] == '\\') {
+               ++count;
+               ++i;
+            }
+
+            if (i < commandLine.size() && commandLine[i] == '"') {
+               current.append(count / 2, '\\');
+               if (count % 2) current += '"';
+               else --i;   // The quote is handled in the next round
+            }
+            else {
+               current.append(count, '\\');
+               --i;
+            }
+         }
+         else if (ch == '"') {
+            if (quoted && i + 1 < commandLine.size() && commandLine[i + 1] == '"') {
+               current += '"';
+               ++i;
+            }
+            else {
+               quoted = !quoted;
+            }
+         }
+         else {
+            current += ch;
+         }
+      }
+
+      if (inArgument) result.push_back(std::move(current));
+
+      return result;
+   }
+
+   std::string Join (const Arguments& arguments)
+   {
+      std::string result;
+
+      for (auto&& argument : arguments) {
+         if (!result.empty()) result += ' ';
+
+         if (!NeedsQuotes(argument)) {
+            result += argument;
+            continue;
+         }
+
+         result += '"';
+         for (size_t i = 0; i < argument.size(); ++i) {
+            size_t backslashes = 0;
+            while (i < argument.size() && argument[i] == '\\') {
+               ++backslashes;
+               ++i;
+            }
+
+            if (i == argument.size()) {
+               result.append(backslashes * 2, '\\');   // Don't escape the closing quote
+               break;
+            }
+
+            if (argument[i] == '"') {
+               result.append(backslashes * 2 + 1, '\\');
+            }
+            else {
+               result.append(backslashes, '\\');
+            }
+            result += argument[i];
+         }
+         result += '"';
+      }
+
+      return result;
+   }
+
+   std::filesystem::path Find (const std::string& program, const Environment& environment)
+   {
+      const std::filesystem::path path{program};
+      if (path.has_parent_path()) {
+         return path;
+      }
+
+      const auto searchPath = Get(environment, "PATH");
+
+      static std::mutex mutex;
+      static std::unordered_map<std::string, std::filesystem::path> cache;
+
+      const auto key = program + '\n' + searchPath;
+      {
+         const auto lock = std::lock_guard{mutex};
+         const auto it = cache.find(key);
+         if (it != cache.end()) return it->second;
+      }
+
+      std::vector<std::string> extensions{""};
+#ifdef _WIN32
+      if (!path.has_extension()) {
+         auto pathext = Get(environment, "PATHEXT");
+         if (pathext.empty()) pathext = ".COM;.EXE;.BAT;.CMD";
+
+         extensions.clear();
+         size_t start = 0;
+         for (size_t end = 0; end != std::string::npos; start = end + 1) {
+            end = pathext.find(';', start);
+            extensions.push_back(pathext.substr(start, end - start));
+         }
+      }
+#endif
+
+      std::filesystem::path result = path;
+
+      size_t start = 0;
+      for (size_t end = 0; end != std::string::npos && result == path; start = end + 1) {
+         end = searchPath.find(pathSeparator, start);
+         const auto directory = searchPath.substr(start, end - start);
+         if (directory.empty()) continue;
+
+         for (auto&& extension : extensions) {
+            auto candidate = std::filesystem::path(directory) / (program + extension);
+            std::error_code nothrow;
+            if (std::filesystem::is_regular_file(candidate, nothrow)) {
+               result = std::move(candidate);
+               break;
+            }
+         }
+      }
+
+      const auto lock = std::lock_guard{mutex};
+      cache[key] = result;
+      return result;
+   }
+
+#ifndef _WIN32
+   int ExitCode (int status)
+   {
+      return WIFEXITED(status) ? WEXITSTATUS(status) : 128 + WTERMSIG(status);
+   }
+#endif
+
+   Child Start (const Arguments& arguments, const Environment& environment, bool captureOutput)
+   {
+      if (arguments.empty()) throw std::runtime_error("Nothing to run");
+
+      if (!TooLong(arguments, environment)) {
+         return Spawn(arguments, environment, captureOutput);
+      }
+
+      auto shortened = arguments;
+      const auto responseFile = std::make_shared<const ResponseFile>(shortened);
+
+      auto child = Spawn(shortened, environment, captureOutput);
+      child.responseFile = responseFile;
+      return child;
+   }
+
+   Result Run (const Arguments& arguments, const Environment& environment, bool captureOutput)
+   {
+      auto child = Start(arguments, environment, captureOutput);
+      return Wait(child);
+   }
+}
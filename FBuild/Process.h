@@ -0,0 +1,56 @@
+/*
+ * Any copyright is dedicated to the Public Domain.
+ * http://creativecommons.org/publicdomain/zero/1.0/*
+ *
+ * Author: Frank Barwich
+ */
+
+#pragma once
+
+#include <filesystem>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <vector>
+
+
+// Starts tools directly, without a shell in between. The arguments are passed as they are, the environment
+// (usually ToolChain::Environment()) is handed over explicitly. A response file is only used, if the command
+// line exceeds the limit of the OS.
+namespace Process {
+
+   using Arguments   = std::vector<std::string>;
+   using Environment = std::vector<std::string>;   // "NAME=value"
+
+   struct Result {
+      int         exitCode{0};
+      std::string output;     // stdout and stderr, if captured
+   };
+
+   Environment Current ();                                            // Environment of FBuild itself
+   std::string Get (const Environment& environment, std::string_view name);
+
+   Arguments   Split (std::string_view commandLine);                   // Splits options given as one string (Args(), FB_COMPILER, ...). Windows rules.
+   std::string Join (const Arguments& arguments);                      // Quotes where needed. The inverse of Split().
+
+   std::filesystem::path Find (const std::string& program, const Environment& environment);   // Searches the PATH of the environment
+
+   // A started process. Run() waits for it, the Supervisor waits for many of them at once.
+   struct Child {
+#ifdef _WIN32
+      void* process{nullptr};   // HANDLE
+      void* output{nullptr};    // Read end of an overlapped pipe, if the output is captured
+#else
+      int   pid{-1};
+      int   output{-1};         // Read end of the pipe, if the output is captured
+#endif
+      std::shared_ptr<const void> responseFile;   // Deleted with the last copy
+   };
+
+   Child  Start (const Arguments& arguments, const Environment& environment, bool captureOutput = false);
+   Result Run (const Arguments& arguments, const Environment& environment, bool captureOutput = false);
+
+#ifndef _WIN32
+   int ExitCode (int status);   // Of waitpid()
+#endif
+}
@@ -0,0 +1,404 @@
+/*
+ * Any copyright is dedicated to the Public Domain.
+ * http://creativecommons.org/publicdomain/zero/1.0/*
+ *
+ * Author: Frank Barwich
+ */
+
+#include "RemoteCache.h"
+#include "Http.h"
+#include "Hash.h"
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <fstream>
+#include <iostream>
+#include <mutex>
+#include <optional>
+#include <random>
+#include <sstream>
+#include <thread>
+#include <vector>
+
+
+
+namespace {
+
+   std::string ReadFile (const std::filesystem::path& file)
+   {
+      std::ifstream in{file, std::ios::binary};
+      if (!in) throw std::runtime_error("Unable to read " + file.string());
+      return {std::istreambuf_iterator<char>{in}, std::istreambuf_iterator<char>{}};
+   }
+
+   void WriteFile (const std::filesystem::path& file, const std::string& content)
+   {
+      std::ofstream out{file, std::ios::binary | std::ios::trunc};
+      out << content;
+      if (!out) throw std::runtime_error("Unable to write " + file.string());
+   }
+
+   std::string Unique ()
+   {
+      static std::mutex mutex;
+      static std::mt19937_64 random{std::random_device{}()};
+
+      const auto lock = std::lock_guard{mutex};
+      std::ostringstream result;
+      result << std::hex << random();
+      return result.str();
+   }
+
+   // "sha256:0123..." -> "0123..."
+   std::string Hex (const std::string& digest)
+   {
+      return digest.substr(digest.find(':') + 1);
+   }
+
+   std::string Digest (const std::string& content)
+   {
+      return Hex(Hash::String(content, Hash::Algorithm::Sha256));
+   }
+
+   // Names of the server's files come from the network
+   bool ValidHex (const std::string& hex)
+   {
+      return hex.size() == 64 && hex.find_first_not_of("0123456789abcdef") == std::string::npos;
+   }
+
+   std::vector<std::filesystem::path> EntryFiles (const std::filesystem::path& directory, size_t outputs)
+   {
+      std::vector<std::filesystem::path> result;
+      for (size_t i = 0; i < outputs; ++i) result.push_back(directory / std::to_string(i));
+      result.push_back(directory / "diagnostics");
+      return result;
+   }
+
+   constexpr std::chrono::seconds flushDeadline{60};   // For all uploads left at the end of the run
+
+   struct Upload {
+      std::string           key;
+      std::filesystem::path directory;
+      size_t                outputs;
+   };
+
+   class Remote {
+      std::mutex              mutex_;
+      std::condition_variable changed_;
+      std::optional<Http::Url> url_;
+      std::string             text_;
+      bool                    upload_{true};
+      bool                    initialized_{false};
+      std::atomic<bool>       broken_{false};
+
+      std::deque<Upload>      queue_;
+      size_t                  busy_{0};
+      bool                    stop_{false};
+      std::thread             uploader_;
+
+      void Initialize ()   // Locked
+      {
+         if (initialized_) return;
+         initialized_ = true;
+
+         if (const char* env = std::getenv("FB_REMOTE_CACHE"); env && *env) {
+            url_ = Http::Parse(env);
+            text_ = env;
+         }
+      }
+
+      void Uploader ()
+      {
+         auto lock = std::unique_lock{mutex_};
+
+         for (;;) {
+            changed_.wait(lock, [this] { return stop_ || !queue_.empty(); });
+            if (stop_) return;
+
+            if (broken_) {   // Nothing more goes to a server that failed
+               dropped += queue_.size();
+               queue_.clear();
+               changed_.notify_all();
+               continue;
+            }
+
+            const auto upload = std::move(queue_.front());
+            queue_.pop_front();
+            ++busy_;
+
+            lock.unlock();
+            Put(upload);
+            lock.lock();
+
+            --busy_;
+            changed_.notify_all();
+         }
+      }
+
+      void Put (const Upload& upload)
+      {
+         try {
+            std::string entry;
+            uint64_t bytes = 0;
+
+            for (auto&& file : EntryFiles(upload.directory, upload.outputs)) {
+               if (broken_) return;   // Failed meanwhile, or Flush() gave up
+
+               const auto content = ReadFile(file);
+               const auto digest = Digest(content);
+
+               const auto response = Http::Request(Url(), "PUT", "/cas/" + digest, content);
+               if (response.status != 200) throw std::runtime_error("PUT of a blob failed with " + std::to_string(response.status));
+
+               entry += digest + "\n";
+               bytes += content.size();
+            }
+
+            // After the blobs, so no client ever gets an entry with missing blobs
+            const auto response = Http::Request(Url(), "PUT", "/ac/" + Hex(upload.key), entry);
+            if (response.status != 200) throw std::runtime_error("PUT of an entry failed with " + std::to_string(response.status));
+
+            ++uploads;
+            uploadedBytes += bytes;
+         }
+         catch (std::exception& e) {
+            Failed(e);
+         }
+      }
+
+   public:
+      std::atomic<uint64_t> hits{0};
+      std::atomic<uint64_t> misses{0};
+      std::atomic<uint64_t> downloadedBytes{0};
+      std::atomic<uint64_t> uploads{0};
+      std::atomic<uint64_t> uploadedBytes{0};
+      std::atomic<uint64_t> errors{0};
+      std::atomic<uint64_t> dropped{0};
+
+      ~Remote ()
+      {
+         {
+            const auto lock = std::lock_guard{mutex_};
+            stop_ = true;   // What wasn't flushed is lost, the build failed then
+         }
+         changed_.notify_all();
+         if (uploader_.joinable()) uploader_.join();
+      }
+
+      void Server (const std::string& url, bool upload)
+      {
+         const auto lock = std::lock_guard{mutex_};
+         initialized_ = true;
+         url_ = url.empty() ? std::nullopt : std::optional<Http::Url>{Http::Parse(url)};
+         text_ = url;
+         upload_ = upload;
+         broken_ = false;
+      }
+
+      bool Enabled ()
+      {
+         const auto lock = std::lock_guard{mutex_};
+         Initialize();
+         return url_.has_value() && !broken_;
+      }
+
+      bool Uploads ()
+      {
+         const auto lock = std::lock_guard{mutex_};
+         return upload_;
+      }
+
+      Http::Url Url ()
+      {
+         const auto lock = std::lock_guard{mutex_};
+         return *url_;
+      }
+
+      std::string Text ()
+      {
+         const auto lock = std::lock_guard{mutex_};
+         Initialize();
+         return text_;
+      }
+
+      // A server that doesn't answer would slow down every compile. One message, then the run goes on without it.
+      void Failed (const std::exception& e)
+      {
+         ++errors;
+         if (!broken_.exchange(true)) std::cout << "Remote cache " << Text() << ": " << e.what() << ", continuing without it" << std::endl;
+      }
+
+      void Queue (Upload upload)
+      {
+         {
+            const auto lock = std::lock_guard{mutex_};
+            if (broken_) {
+               ++dropped;
+               return;
+            }
+            if (!uploader_.joinable()) uploader_ = std::thread{[this] { Uploader(); }};
+            queue_.push_back(std::move(upload));
+         }
+         changed_.notify_all();
+      }
+
+      void Flush ()
+      {
+         auto lock = std::unique_lock{mutex_};
+         if (changed_.wait_for(lock, flushDeadline, [this] { return (queue_.empty() && busy_ == 0) || !uploader_.joinable(); })) return;
+
+         // A slow server doesn't hold up the end of the run. The running upload stops after its current request.
+         std::cout << "Remote cache " << text_ << ": " << queue_.size() + busy_ << " uploads not done after "
+                   << std::chrono::duration_cast<std::chrono::seconds>(flushDeadline).count() << " s, dropped" << std::endl;
+         dropped += queue_.size() + busy_;
+         queue_.clear();
+         broken_ = true;
+      }
+   };
+
+   Remote& TheRemote ()
+   {
+      static Remote remote;
+      return remote;
+   }
+}
+
+
+
+namespace RemoteCache {
+
+   void Server (const std::string& url, bool upload)
+   {
+      TheRemote().Server(url, upload);
+   }
+
+   bool Enabled ()
+   {
+      return TheRemote().Enabled();
+   }
+
+   bool Fetch (const std::string& key, const std::filesystem::path& directory, size_t outputs)
+   {
+      auto& remote = TheRemote();
+      if (!remote.Enabled()) return false;
+
+      const auto temporary = directory.parent_path() / ("tmp." + Unique());
+      std::error_code error;
+
+      try {
+         const auto entry = Http::Request(remote.Url(), "GET", "/ac/" + Hex(key));
+         if (entry.status == 404) {
+            ++remote.misses;
+            return false;
+         }
+         if (entry.status != 200) throw std::runtime_error("GET of an entry failed with " + std::to_string(entry.status));
+
+         std::vector<std::string> digests;
+         std::istringstream lines{entry.body};
+         for (std::string line; std::getline(lines, line);) digests.push_back(line);
+
+         const auto files = EntryFiles(directory, outputs);
+         if (digests.size() != files.size()) {   // Another set of outputs, eg. by an older FBuild
+            ++remote.misses;
+            return false;
+         }
+
+         std::filesystem::create_directories(temporary);
+
+         uint64_t bytes = 0;
+         for (size_t i = 0; i < files.size(); ++i) {
+            const auto blob = Http::Request(remote.Url(), "GET", "/cas/" + digests[i]);
+            if (blob.status != 200 || Digest(blob.body) != digests[i]) {   // Evicted by the server, or broken
+               std::filesystem::remove_all(temporary, error);
+               ++remote.misses;
+               return false;
+            }
+
+            WriteFile(temporary / files[i].filename(), blob.body);
+            bytes += blob.body.size();
+         }
+
+         std::filesystem::rename(temporary, directory, error);   // Fails, if a concurrent run was faster. Fine as well.
+         std::filesystem::remove_all(temporary, error);
+
+         ++remote.hits;
+         remote.downloadedBytes += bytes;
+         return std::filesystem::exists(directory / "diagnostics", error);
+      }
+      catch (std::exception& e) {
+         std::filesystem::remove_all(temporary, error);
+         remote.Failed(e);
+         return false;
+      }
+   }
+
+   void Upload (const std::string& key, const std::filesystem::path& directory, size_t outputs)
+   {
+      auto& remote = TheRemote();
+      if (!remote.Enabled() || !remote.Uploads()) return;
+
+      remote.Queue({key, directory, outputs});
+   }
+
+   void Flush ()
+   {
+      TheRemote().Flush();
+   }
+
+   void Statistics (std::ostream& out)
+   {
+      auto& remote = TheRemote();
+      const auto server = remote.Text();
+
+      if (server.empty()) {
+         out << "Remote cache: off (RemoteCache() or FB_REMOTE_CACHE=http://host:port)\n" << std::flush;
+         return;
+      }
+
+      out << "Remote cache: " << server << (remote.Uploads() ? "" : " (read only)") << "\n"
+          << "   this run: " << remote.hits << " hits, " << remote.misses << " misses, " << (remote.downloadedBytes >> 20) << " MB down, "
+          << remote.uploads << " uploads, " << (remote.uploadedBytes >> 20) << " MB up, " << remote.dropped << " dropped, " << remote.errors << " errors\n" << std::flush;
+   }
+
+   void Serve (const std::string& address, const std::string& port, const std::filesystem::path& directory)
+   {
+      std::filesystem::create_directories(directory);
+      std::cout << "Remote cache on " << address << ":" << port << ", " << std::filesystem::absolute(directory).string() << std::endl;
+
+      Http::Serve(address, port, [directory] (const Http::Received& request) -> Http::Response {
+         // /cas/<hex> or /ac/<hex>
+         const auto slash = request.path.find('/', 1);
+         if (slash == std::string::npos) return {400, {}};
+
+         const auto kind = request.path.substr(1, slash - 1);
+         const auto name = request.path.substr(slash + 1);
+         if ((kind != "cas" && kind != "ac") || !ValidHex(name)) return {400, {}};
+
+         const auto file = directory / kind / name.substr(0, 2) / name;
+
+         if (request.method == "GET") {
+            std::error_code error;
+            if (!std::filesystem::is_regular_file(file, error)) return {404, {}};
+            return {200, ReadFile(file)};
+         }
+
+         if (request.method == "PUT") {
+            if (kind == "cas" && Digest(request.body) != name) return {400, {}};
+
+            // Written next to it and renamed, so a concurrent GET never sees half a file
+            std::filesystem::create_directories(file.parent_path());
+            const auto temporary = file.parent_path() / ("tmp." + Unique());
+            WriteFile(temporary, request.body);
+
+            std::error_code error;
+            std::filesystem::rename(temporary, file, error);
+            if (error) std::filesystem::remove(temporary, error);
+            return {200, {}};
+         }
+
+         return {405, {}};
+      });
+   }
+}
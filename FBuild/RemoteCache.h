@@ -0,0 +1,41 @@
+/*
+ * Any copyright is dedicated to the Public Domain.
+ * http://creativecommons.org/publicdomain/zero/1.0/*
+ *
+ * Author: Frank Barwich
+ */
+
+#pragma once
+
+#include <filesystem>
+#include <iosfwd>
+#include <string>
+
+
+// The ObjectCache shared by several machines through a server. Off unless RemoteCache() or the environment
+// FB_REMOTE_CACHE=http://host:port gives a server. The protocol is content addressed, over plain HTTP:
+//    GET/PUT /cas/<digest>   A blob: An output or the diagnostics. The server checks the digest (SHA-256) on PUT.
+//    GET/PUT /ac/<key>       The entry of an ObjectCache key: The digests of the outputs and of the diagnostics, one per line.
+// The keys contain absolute paths: The source, the -I and output options and the working directory. The cached .d files
+// of gcc do as well. Machines only share entries, if their checkouts are at the same path (eg. /build/src on all agents).
+// Downloads happen on a miss of the local cache. Uploads run in the background and never block the build; at the end
+// of the run FBuild waits for the remaining ones, at most a minute. If the server isn't reachable, the run goes on without
+// it and the queued uploads are dropped.
+namespace RemoteCache {
+
+   void Server (const std::string& url, bool upload = true);   // An empty url turns it off. Without upload the cache is only read.
+   bool Enabled ();
+
+   // Fetches the entry into directory, laid out like an entry of the ObjectCache. false on a miss or any error.
+   bool Fetch (const std::string& key, const std::filesystem::path& directory, size_t outputs);
+
+   // Queues the upload of a local entry
+   void Upload (const std::string& key, const std::filesystem::path& directory, size_t outputs);
+
+   void Flush ();                           // Waits for the queued uploads, drops what isn't done after a minute
+   void Statistics (std::ostream& out);
+
+   // The reference server for tests and benchmarks: "FBuild cache-server [bind=127.0.0.1] [port=8088] [directory=FBuildRemoteCache]".
+   // bind=* serves all interfaces. Whoever reaches it can put objects into the builds, the network has to be trusted.
+   void Serve (const std::string& address, const std::string& port, const std::filesystem::path& directory);
+}
@@ -9,21 +9,20 @@
 #include "CppDepends.h"
 #include "ToolChain.h"
 #include "LastWriteTime.h"
+#include "Snapshot.h"
+#include "Explain.h"
+#include "Process.h"
 
 #include <algorithm>
 #include <cstdlib>
 #include <filesystem>
 
 
-inline std::string Inc(const std::vector<std::string>& includes)
+inline void Inc(Process::Arguments& command, const std::vector<std::string>& includes)
 {
-   std::string ret;
-   
    for (const auto& include : includes) {
-      ret += "-I\"" + include + "\" ";
+      command.push_back("-I" + include);
    }
-
-   return ret;
 }
 
 std::string ResourceCompiler::Outfile (const std::string& infile) const
@@ -37,11 +36,22 @@ std::string ResourceCompiler::Outfile (const std::string& infile) const
 
 bool ResourceCompiler::NeedsRebuild (const std::string& infile, const std::string& outfile) const
 {
-   if (!dependencyCheck) return true;
-   if (!std::filesystem::exists(outfile)) return true;
+   if (!dependencyCheck) {
+      Explain::OutOfDate(outfile, "DependencyCheck(false)");
+      return true;
+   }
+   if (!std::filesystem::exists(outfile)) {
+      Explain::OutOfDate(outfile, "missing output");
+      return true;
+   }
 
    CppDepends dep(infile);
-   return LastWriteTime(outfile) < dep.MaxTime(); 
+   if (LastWriteTime(outfile) < dep.MaxTime()) {
+      Explain::OutOfDate(outfile, "newer dependency", dep.Newest());
+      return true;
+   }
+
+   return false;
 }
 
 void ResourceCompiler::Compile () const
@@ -56,13 +66,16 @@ void ResourceCompiler::Compile () const
    std::for_each(files.cbegin(), files.cend(), [&] (const std::string& file) {
       std::string outfile = Outfile(file);
       if (NeedsRebuild(file, outfile)) {
+         Snapshot::Invalidate();
          if (++count) std::cout << "\nCompiling Resources (" << ToolChain::ToolChain() << " " << ToolChain::Platform() << ")" << std::endl;
          if (std::filesystem::exists(outfile)) std::filesystem::remove(outfile);
-         std::string command = "RC -nologo " + Inc(includes) + " -fo\"" + outfile + "\" " + file;
+         Process::Arguments command{"RC", "-nologo"};
+         Inc(command, includes);
+         command.push_back("-fo" + outfile);
+         command.push_back(file);
 
-         std::string cmd = ToolChain::SetEnvBatchCall() + " & " + command;
-         int rc = std::system(cmd.c_str());
-         if (rc != 0) throw std::runtime_error("Error compiling resources");
+         const auto result = Process::Run(command, ToolChain::Environment());
+         if (result.exitCode != 0) throw std::runtime_error("Error compiling resources");
       }
    });
 }
@@ -0,0 +1,138 @@
+/*
+ * Any copyright is dedicated to the Public Domain.
+ * http://creativecommons.org/publicdomain/zero/1.0/*
+ *
+ * Author: Frank Barwich
+ */
+
+#include "SharedPch.h"
+#include "Trace.h"
+
+#include <chrono>
+#include <cstdlib>
+#include <fstream>
+#include <iostream>
+#include <thread>
+
+
+
+namespace {
+
+   constexpr auto poll = std::chrono::milliseconds{200};
+   constexpr auto staleLock = std::chrono::minutes{15};   // No PCH takes that long, the FBuild that built it is gone
+   constexpr auto unused = std::chrono::hours{24 * 7};
+
+   std::filesystem::path Root ()
+   {
+      return std::filesystem::temp_directory_path() / "FBuild_Pch_v1";
+   }
+
+   std::filesystem::path Entry (const std::string& key)
+   {
+      return Root() / key.substr(key.find(':') + 1);   // Without the name of the algorithm
+   }
+
+   std::chrono::nanoseconds Age (const std::filesystem::path& file)
+   {
+      std::error_code error;
+      const auto time = std::filesystem::last_write_time(file, error);
+      if (error) return {};
+
+      return std::filesystem::file_time_type::clock::now() - time;
+   }
+
+   void Touch (const std::filesystem::path& file)
+   {
+      std::ofstream{file, std::ios::trunc};
+   }
+
+   void RemoveUnused (const std::filesystem::path& except)
+   {
+      std::error_code error;
+      for (auto&& entry : std::filesystem::directory_iterator(Root(), error)) {
+         if (entry.path() == except || std::filesystem::exists(entry.path() / "building", error)) continue;
+         if (Age(entry.path() / "used") > unused) std::filesystem::remove_all(entry.path(), error);
+      }
+   }
+}
+
+
+
+namespace SharedPch {
+
+   bool Enabled ()
+   {
+      const char* env = std::getenv("FB_SHARED_PCH");
+      return !env || std::string(env) != "0";
+   }
+
+   void Obtain (const std::string& key, const std::vector<std::string>& files, const std::filesystem::path& objDir,
+                const std::function<void (const std::filesystem::path& directory)>& build)
+   {
+      const auto entry = Entry(key);
+      const auto complete = entry / "complete";
+      const auto lock = entry / "building";   // Creating a directory is atomic, the one who created it builds the entry
+
+      std::error_code error;
+      std::filesystem::create_directories(entry, error);
+      if (error) {
+         build(objDir);   // No temp directory to share, on its own like before
+         return;
+      }
+
+      const Trace::Scope trace{"Shared PCH " + entry.filename().string()};
+
+      bool waiting = false;
+      while (!std::filesystem::exists(complete, error)) {
+         if (std::filesystem::create_directory(lock, error)) {
+            if (std::filesystem::exists(complete, error)) {   // Finished between the two checks
+               std::filesystem::remove(lock, error);
+               break;
+            }
+
+            try {
+               for (auto&& file : files) std::filesystem::remove(entry / file, error);   // Of one that failed
+               build(entry);
+               Touch(complete);
+            }
+            catch (...) {
+               std::filesystem::remove(lock, error);
+               throw;
+            }
+
+            std::filesystem::remove(lock, error);
+            RemoveUnused(entry);
+            break;
+         }
+
+         if (error) {
+            build(objDir);   // Can't lock, on its own
+            return;
+         }
+
+         if (Age(lock) > staleLock) {
+            std::filesystem::remove(lock, error);
+            continue;
+         }
+
+         if (!waiting) {
+            waiting = true;
+            std::cout << "Waiting for the precompiled header " << entry.filename().string() << ", another target builds it" << std::endl;
+         }
+
+         std::this_thread::sleep_for(poll);
+      }
+
+      Touch(entry / "used");
+
+      for (auto&& file : files) {
+         const auto shared = entry / file;
+         const auto local = objDir / file;
+
+         std::filesystem::remove(local, error);
+         std::filesystem::create_hard_link(shared, local, error);
+         if (error) std::filesystem::copy_file(shared, local, std::filesystem::copy_options::overwrite_existing, error);   // Other volume
+         if (error) throw std::runtime_error("Unable to get " + local.string() + " from " + shared.string() + ": " + error.message());
+      }
+   }
+}
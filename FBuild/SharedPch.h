@@ -0,0 +1,28 @@
+/*
+ * Any copyright is dedicated to the Public Domain.
+ * http://creativecommons.org/publicdomain/zero/1.0/*
+ *
+ * Author: Frank Barwich
+ */
+
+#pragma once
+
+#include <filesystem>
+#include <functional>
+#include <string>
+#include <vector>
+
+
+// Targets with the same precompiled header, by the content of everything it includes, and the same command line share
+// one PCH in FBuild_Pch_v1 in the temp directory instead of building it each in its ObjDir. The first FBuild (or target)
+// to need an entry builds it, the others wait for it and hardlink the files into their ObjDir. Entries are never
+// changed once complete. The ones not used for a week are removed. The environment FB_SHARED_PCH=0 turns it off.
+namespace SharedPch {
+
+   bool Enabled ();
+
+   // build writes the files into the directory it gets, which is the entry of the key. The files are hardlinked (or
+   // copied) from there to the same names in objDir.
+   void Obtain (const std::string& key, const std::vector<std::string>& files, const std::filesystem::path& objDir,
+                const std::function<void (const std::filesystem::path& directory)>& build);
+}
@@ -0,0 +1,64 @@
+/*
+ * Any copyright is dedicated to the Public Domain.
+ * http://creativecommons.org/publicdomain/zero/1.0/*
+ *
+ * Author: Frank Barwich
+ */
+
+#include "Signatures.h"
+
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+
+
+
+Signatures::Signatures (const std::filesystem::path& objDir)
+   : file_{objDir / "FBuild_Signatures.txt"}
+{
+   std::ifstream stream(file_);
+
+   std::string object;
+   std::string signature;
+   while (stream >> std::quoted(object) >> signature) {
+      signatures_[object] = signature;
+   }
+}
+
+bool Signatures::Contains (const std::filesystem::path& object) const
+{
+   return signatures_.count(object.filename().string()) != 0;
+}
+
+bool Signatures::Matches (const std::filesystem::path& object, const std::string& signature) const
+{
+   const auto it = signatures_.find(object.filename().string());
+   return it != signatures_.end() && it->second == signature;
+}
+
+void Signatures::Update (const std::filesystem::path& object, const std::string& signature)
+{
+   auto& stored = signatures_[object.filename().string()];
+   if (stored != signature) {
+      stored = signature;
+      changed_ = true;
+   }
+}
+
+void Signatures::Save ()
+{
+   if (!changed_) {
+      return;
+   }
+
+   std::ofstream stream(file_, std::ios::trunc);
+   for (auto&& item : signatures_) {
+      stream << std::quoted(item.first) << " " << item.second << "\n";
+   }
+
+   if (!stream.flush()) {
+      std::cerr << "FBuild: Error writing " << file_.string() << std::endl;
+   }
+
+   changed_ = false;
+}
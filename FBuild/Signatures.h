@@ -0,0 +1,30 @@
+/*
+ * Any copyright is dedicated to the Public Domain.
+ * http://creativecommons.org/publicdomain/zero/1.0/*
+ *
+ * Author: Frank Barwich
+ */
+
+#pragma once
+
+#include <filesystem>
+#include <string>
+#include <unordered_map>
+
+
+// Remembers the signature (hash of command line, environment, toolchain, ...) each object file was built with.
+// An object with a different signature is out of date, no matter what the timestamps say.
+// Every object directory has its own file FBuild_Signatures.txt.
+class Signatures {
+   std::filesystem::path                        file_;
+   std::unordered_map<std::string, std::string> signatures_;   // Filename of the object -> signature
+   bool                                         changed_{false};
+
+public:
+   explicit Signatures (const std::filesystem::path& objDir);
+
+   bool Contains (const std::filesystem::path& object) const;
+   bool Matches (const std::filesystem::path& object, const std::string& signature) const;
+   void Update (const std::filesystem::path& object, const std::string& signature);
+   void Save ();
+};
@@ -0,0 +1,290 @@
+/*
+ * Any copyright is dedicated to the Public Domain.
+ * http://creativecommons.org/publicdomain/zero/1.0/*
+ *
+ * Author: Frank Barwich
+ */
+
+#include "Snapshot.h"
+#include "Hash.h"
+
+#include <atomic>
+#include <cstring>
+#include <fstream>
+#include <iomanip>
+#include <map>
+#include <mutex>
+#include <thread>
+#include <unordered_map>
+
+#ifdef _WIN32
+   #define NOMINMAX
+   #include <windows.h>
+#else
+   extern char** environ;
+#endif
+
+
+
+namespace {
+
+   struct Fingerprint {
+      int64_t  time{0};
+      uint64_t size{0};
+
+      bool operator== (const Fingerprint& other) const { return time == other.time && size == other.size; }
+      bool operator!= (const Fingerprint& other) const { return !(*this == other); }
+   };
+
+   Fingerprint Of (const std::filesystem::path& path)
+   {
+      std::error_code nothrow;
+      const auto status = std::filesystem::status(path, nothrow);
+      if (!std::filesystem::exists(status)) {
+         return Fingerprint{0, UINT64_MAX};
+      }
+
+      Fingerprint result;
+      result.time = std::filesystem::last_write_time(path, nothrow).time_since_epoch().count();
+      if (std::filesystem::is_regular_file(status)) {
+         result.size = std::filesystem::file_size(path, nothrow);
+      }
+      return result;
+   }
+
+   // PATH and FB_*: Which tools run and how FBuild itself works. Everything else counts only when it's read, the shell
+   // changes OLDPWD, SHLVL and the like all the time.
+   std::string Environment ()
+   {
+      std::string result;
+
+      const auto add = [&result] (const char* variable) {
+         if (std::strncmp(variable, "PATH=", 5) != 0 && std::strncmp(variable, "FB_", 3) != 0) return;
+         result += variable;
+         result += '\n';
+      };
+
+#ifdef _WIN32
+      const auto block = ::GetEnvironmentStringsA();
+      if (block) {
+         for (const char* p = block; *p; p += std::strlen(p) + 1) add(p);
+         ::FreeEnvironmentStringsA(block);
+      }
+#else
+      for (char** p = environ; *p; ++p) add(*p);
+#endif
+
+      return Hash::String(result);
+   }
+
+   // Of a variable's value for the snapshot file, the values themselves stay out of it. "-" if it isn't set.
+   std::string Value (const char* value)
+   {
+      return value ? Hash::String(value) : std::string{"-"};
+   }
+
+
+
+   class Snapshots {
+      std::mutex                                   mutex_;
+      std::unordered_map<std::string, Fingerprint> tracked_;
+      std::atomic<bool>                            invalid_{false};
+      std::filesystem::path                        file_;
+      std::string                                  environment_;
+      std::map<std::string, std::string>           variables_;   // The ones read, by the hash of their value
+
+   public:
+      void Begin (const std::string& executable, const std::vector<std::string>& args)
+      {
+         // Another FBuild has a snapshot of its own, even with the same arguments
+         std::string key = executable + '\n' + std::filesystem::current_path().string();
+         for (auto&& arg : args) {
+            key += '\n' + arg;
+         }
+
+         auto name = Hash::String(key, Hash::Algorithm::Fast);
+         name.erase(0, name.find(':') + 1);
+
+         file_ = std::filesystem::temp_directory_path() / ("FBuild_Snapshot_" + name + ".txt");
+         environment_ = Environment();
+      }
+
+      // Format:
+      //    environment-hash
+      //    count of variables
+      //    "name" value-hash
+      //    ...
+      //    "path" time size
+      //    ...
+      bool UpToDate ()
+      {
+         if (Check()) {
+            return true;
+         }
+
+         std::error_code nothrow;
+         std::filesystem::remove(file_, nothrow);   // Outdated. Saved again if this run turns out to change nothing.
+         return false;
+      }
+
+      bool Check () const
+      {
+         std::ifstream stream(file_);
+
+         std::string environment;
+         if (!(stream >> environment) || environment != environment_) {
+            return false;
+         }
+
+         size_t variables = 0;
+         if (!(stream >> variables)) {
+            return false;
+         }
+
+         for (size_t i = 0; i < variables; ++i) {
+            std::string name, value;
+            if (!(stream >> std::quoted(name) >> value) || value != Value(std::getenv(name.c_str()))) {
+               return false;
+            }
+         }
+
+         std::vector<std::pair<std::filesystem::path, Fingerprint>> entries;
+         std::string path;
+         Fingerprint fingerprint;
+         while (stream >> std::quoted(path) >> fingerprint.time >> fingerprint.size) {
+            entries.emplace_back(path, fingerprint);
+         }
+
+         if (entries.empty()) {
+            return false;
+         }
+
+         // The file system answers stats in parallel much faster. Each thread checks every n-th entry.
+         std::atomic<bool> changed{false};
+
+         const size_t count = std::clamp<size_t>(entries.size() / 256, 1, std::max(std::thread::hardware_concurrency(), 1u));
+         std::vector<std::thread> threads;
+
+         for (size_t t = 0; t < count; ++t) {
+            threads.emplace_back([&entries, &changed, t, count] {
+               for (size_t i = t; i < entries.size() && !changed; i += count) {
+                  if (Of(entries[i].first) != entries[i].second) {
+                     changed = true;
+                  }
+               }
+            });
+         }
+
+         for (auto&& thread : threads) {
+            thread.join();
+         }
+
+         return !changed;
+      }
+
+      void Track (const std::filesystem::path& path)
+      {
+         if (invalid_) {
+            return;
+         }
+
+         std::error_code nothrow;
+         auto key = std::filesystem::absolute(path, nothrow).make_preferred().string();
+
+         {
+            const auto lock = std::lock_guard{mutex_};
+            if (tracked_.count(key)) return;
+         }
+
+         const auto fingerprint = Of(key);
+
+         const auto lock = std::lock_guard{mutex_};
+         tracked_.emplace(std::move(key), fingerprint);
+      }
+
+      const char* Getenv (const char* name)
+      {
+         const char* value = std::getenv(name);
+
+         const auto lock = std::lock_guard{mutex_};
+         variables_.emplace(name, Value(value));
+         return value;
+      }
+
+      void Invalidate ()
+      {
+         invalid_ = true;
+      }
+
+      void Save ()
+      {
+         std::error_code nothrow;
+
+         if (invalid_ || file_.empty()) {
+            std::filesystem::remove(file_, nothrow);
+            return;
+         }
+
+         auto tmp = file_;
+         tmp += ".tmp";
+
+         {
+            std::ofstream stream(tmp, std::ios::trunc);
+            stream << environment_ << "\n";
+
+            const auto lock = std::lock_guard{mutex_};
+            stream << variables_.size() << "\n";
+            for (auto&& variable : variables_) {
+               stream << std::quoted(variable.first) << " " << variable.second << "\n";
+            }
+
+            for (auto&& item : tracked_) {
+               stream << std::quoted(item.first) << " " << item.second.time << " " << item.second.size << "\n";
+            }
+         }
+
+         std::filesystem::rename(tmp, file_, nothrow);
+      }
+   };
+
+   Snapshots& TheSnapshots ()
+   {
+      static Snapshots snapshots;
+      return snapshots;
+   }
+}
+
+
+
+namespace Snapshot {
+
+   void Begin (const std::string& executable, const std::vector<std::string>& args)
+   {
+      TheSnapshots().Begin(executable, args);
+   }
+
+   bool UpToDate ()
+   {
+      return TheSnapshots().UpToDate();
+   }
+
+   void Track (const std::filesystem::path& path)
+   {
+      TheSnapshots().Track(path);
+   }
+
+   const char* Getenv (const char* name)
+   {
+      return TheSnapshots().Getenv(name);
+   }
+
+   void Invalidate ()
+   {
+      TheSnapshots().Invalidate();
+   }
+
+   void Save ()
+   {
+      TheSnapshots().Save();
+   }
+}
@@ -0,0 +1,29 @@
+/*
+ * Any copyright is dedicated to the Public Domain.
+ * http://creativecommons.org/publicdomain/zero/1.0/*
+ *
+ * Author: Frank Barwich
+ */
+
+#pragma once
+
+#include <filesystem>
+#include <string>
+#include <vector>
+
+
+// Fast path for builds with nothing to do. A run which didn't change anything leaves a snapshot of everything it
+// looked at: the scripts, the globbed directories, every file whose timestamp was checked, the environment variables
+// it read, PATH and FB_*, the FBuild executable and the arguments. If none of it changed, the next run wouldn't change
+// anything either, so FBuild stops right away without running the scripts.
+namespace Snapshot {
+
+   void Begin (const std::string& executable, const std::vector<std::string>& args);   // Before anything else is done
+   bool UpToDate ();                                    // Snapshot of the last run exists and nothing changed
+
+   void Track (const std::filesystem::path& path);      // A file or directory the build depends on. Needn't exist.
+   const char* Getenv (const char* name);               // std::getenv(), the variable becomes part of the snapshot
+   void Invalidate ();                                  // The run changed something (compiled, copied, Run(), ...)
+
+   void Save ();                                        // After a successful run. Only written, if not invalidated.
+}
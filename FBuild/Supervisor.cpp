@@ -0,0 +1,975 @@
+/*
+ * Any copyright is dedicated to the Public Domain.
+ * http://creativecommons.org/publicdomain/zero/1.0/*
+ *
+ * Author: Frank Barwich
+ */
+
+#include "Supervisor.h"
+#include "Jobserver.h"
+#include "Durations.h"
+#include "Trace.h"
+#include "History.h"
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <filesystem>
+#include <iomanip>
+#include <fstream>
+#include <iostream>
+#include <limits>
+#include <mutex>
+#include <optional>
+#include <thread>
+
+#ifdef _WIN32
+   #define NOMINMAX
+   #include <windows.h>
+   #include <psapi.h>
+#else
+   #include <cerrno>
+   #include <csignal>
+   #include <cstdlib>
+   #include <fcntl.h>
+   #include <sys/epoll.h>
+   #include <sys/eventfd.h>
+   #include <sys/file.h>
+   #include <sys/resource.h>
+   #include <sys/syscall.h>
+   #include <sys/wait.h>
+   #include <unistd.h>
+#endif
+
+
+
+struct Supervisor::Batch::State {
+   size_t outstanding{0};   // Queued and running jobs
+   bool   cancelled{false};
+
+   // For the estimated makespan: The expected durations and slots of the jobs since the batch was last idle
+   std::chrono::steady_clock::time_point                     start;
+   std::vector<std::pair<std::chrono::milliseconds, unsigned>> expected;
+   bool                                                      allKnown{true};
+};
+
+
+
+namespace {
+
+#ifdef _WIN32
+   constexpr size_t maxProcesses = (MAXIMUM_WAIT_OBJECTS - 2) / 2;   // A process handle and a pipe event each, plus the wake up event and the jobserver
+#endif
+
+   constexpr uint64_t reserveMemory = uint64_t{1} << 30;   // For the system and FBuild itself
+   constexpr std::chrono::seconds growing{2};              // Until a job got near its peak memory
+   constexpr std::chrono::milliseconds recheck{250};       // While the governor holds jobs back
+
+   struct Queued {
+      Supervisor::Job                           job;
+      std::shared_ptr<Supervisor::Batch::State> batch;
+      std::chrono::milliseconds                 expected{0};
+      uint64_t                                  memory{0};   // Peak of the last run
+   };
+
+   std::optional<uint64_t> AvailableMemory ()
+   {
+#ifdef _WIN32
+      MEMORYSTATUSEX status{};
+      status.dwLength = sizeof(status);
+      if (!::GlobalMemoryStatusEx(&status)) return std::nullopt;
+      return status.ullAvailPhys;
+#else
+      std::ifstream meminfo{"/proc/meminfo"};
+      std::string name;
+      uint64_t kB = 0;
+      while (meminfo >> name >> kB) {
+         if (name == "MemAvailable:") return kB * 1024;
+         meminfo.ignore(std::numeric_limits<std::streamsize>::max(), '\n');
+      }
+      return std::nullopt;
+#endif
+   }
+
+   std::optional<double> LoadAverage ()
+   {
+#ifdef _WIN32
+      return std::nullopt;   // Windows has none
+#else
+      double load = 0;
+      if (::getloadavg(&load, 1) != 1) return std::nullopt;
+      return load;
+#endif
+   }
+
+   // Longest processing time first on the slots, like StartQueued() does it
+   std::chrono::milliseconds Makespan (std::vector<std::pair<std::chrono::milliseconds, unsigned>> jobs, unsigned limit)
+   {
+      std::sort(jobs.begin(), jobs.end(), [] (const auto& a, const auto& b) { return a.first > b.first; });
+
+      std::vector<std::chrono::milliseconds> free(limit, std::chrono::milliseconds{0});
+      for (auto&& [duration, slots] : jobs) {
+         std::sort(free.begin(), free.end());
+         const auto count = std::min<size_t>(std::max(slots, 1u), free.size());
+         const auto start = free[count - 1];   // When enough slots are free
+         for (size_t i = 0; i < count; ++i) free[i] = start + duration;
+      }
+
+      return free.empty() ? std::chrono::milliseconds{0} : *std::max_element(free.begin(), free.end());
+   }
+
+   struct Running {
+      Queued             queued;
+      unsigned           slots{0};
+      unsigned           lane{0};   // In the trace
+      Process::Child     child;
+      Supervisor::Result result;
+      bool               exited{false};
+      bool               killed{false};
+#ifdef _WIN32
+      OVERLAPPED         overlapped{};
+      bool               reading{false};
+#else
+      int                pidfd{-1};
+      int                status{0};
+      rusage             usage{};
+#endif
+      char               buffer[4096];
+   };
+
+   std::chrono::microseconds Microseconds (std::chrono::steady_clock::duration duration)
+   {
+      return std::chrono::duration_cast<std::chrono::microseconds>(duration);
+   }
+
+
+
+   class Loop {
+      std::mutex              mutex_;
+      std::condition_variable finished_;
+      std::deque<Queued>      queue_;
+      unsigned                limit_{std::max(std::thread::hardware_concurrency(), 1u)};
+      uint64_t                maxMemory_{0};
+      bool                    stop_{false};
+
+      // Statistics
+      size_t                    jobs_{0};
+      std::chrono::microseconds wall_{0};
+      std::chrono::microseconds user_{0};
+      std::chrono::microseconds kernel_{0};
+      uint64_t                  peakMemory_{0};
+      std::chrono::microseconds longest_{0};
+      std::string               longestJob_;
+      std::chrono::milliseconds estimatedMakespan_{0};
+      std::chrono::milliseconds actualMakespan_{0};
+      size_t                    estimatedBatches_{0};
+      size_t                    heldByMemory_{0};
+      size_t                    heldByLoad_{0};
+
+      // Only touched by the supervisor thread
+      std::vector<std::unique_ptr<Running>> running_;
+      unsigned                              used_{0};
+      unsigned                              tokens_{0};           // From the jobserver, for all but one of the used slots
+      bool                                  waitingForToken_{false};
+      std::vector<bool>                     lanes_;               // Busy ones, for the trace
+      size_t                                tracedQueued_{0};
+      size_t                                tracedRunning_{0};
+      uint64_t                              committed_{0};        // Memory of the running jobs, by their estimates
+      bool                                  throttled_{false};    // The governor holds jobs back, WaitForEvents() looks again soon
+
+#ifdef _WIN32
+      HANDLE wake_{nullptr};
+#else
+      int    epoll_{-1};
+      int    wake_{-1};
+      bool   watchingJobserver_{false};
+#endif
+
+      std::thread thread_;   // Last member, everything else is initialized when it starts
+
+   public:
+      Loop ()
+      {
+         Jobserver::Active();   // Constructed first, so it outlives the loop
+
+#ifdef _WIN32
+         wake_ = ::CreateEventA(nullptr, FALSE, FALSE, nullptr);
+         if (!wake_) throw std::runtime_error("Unable to create the supervisor event");
+#else
+         epoll_ = ::epoll_create1(EPOLL_CLOEXEC);
+         wake_ = ::eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+         if (epoll_ < 0 || wake_ < 0) throw std::runtime_error("Unable to create the supervisor event loop");
+
+         epoll_event event{};
+         event.events = EPOLLIN;
+         event.data.u64 = 0;
+         ::epoll_ctl(epoll_, EPOLL_CTL_ADD, wake_, &event);
+#endif
+         thread_ = std::thread{[this] { Run(); }};
+      }
+
+      ~Loop ()
+      {
+         {
+            const auto lock = std::lock_guard{mutex_};
+            stop_ = true;
+         }
+         Wake();
+         thread_.join();
+
+#ifdef _WIN32
+         ::CloseHandle(wake_);
+#else
+         ::close(wake_);
+         ::close(epoll_);
+#endif
+      }
+
+      Loop (const Loop&) = delete;
+      Loop& operator= (const Loop&) = delete;
+
+      void Submit (Queued queued)
+      {
+         const auto last = queued.job.action.empty() ? std::nullopt : Durations::Last(queued.job.action);
+         queued.expected = last ? *last : queued.job.action.empty() ? std::chrono::milliseconds{0} : Durations::Average();
+         queued.memory = queued.job.action.empty() ? 0 : History::PeakMemory(queued.job.action).value_or(History::AveragePeakMemory());
+
+         {
+            const auto lock = std::lock_guard{mutex_};
+            auto& batch = *queued.batch;
+            if (batch.cancelled) return;
+
+            if (batch.outstanding == 0) {
+               batch.start = std::chrono::steady_clock::now();
+               batch.expected.clear();
+               batch.allKnown = true;
+            }
+            ++batch.outstanding;
+            batch.expected.emplace_back(queued.expected, queued.job.slots);
+            batch.allKnown = batch.allKnown && last.has_value();
+
+            // Behind the ones that take as long or longer, equal ones keep their order
+            const auto position = std::find_if(queue_.begin(), queue_.end(), [&queued] (const Queued& other) { return other.expected < queued.expected; });
+            queue_.insert(position, std::move(queued));
+         }
+         Wake();
+      }
+
+      void Wait (const Supervisor::Batch::State& batch)
+      {
+         auto lock = std::unique_lock{mutex_};
+         finished_.wait(lock, [&batch] { return batch.outstanding == 0; });
+      }
+
+      void Cancel (const std::shared_ptr<Supervisor::Batch::State>& batch)
+      {
+         {
+            const auto lock = std::lock_guard{mutex_};
+            batch->cancelled = true;
+            batch->allKnown = false;   // No makespan for what didn't run
+
+            const auto it = std::remove_if(queue_.begin(), queue_.end(), [&batch] (const Queued& queued) { return queued.batch == batch; });
+            batch->outstanding -= static_cast<size_t>(std::distance(it, queue_.end()));
+            queue_.erase(it, queue_.end());
+         }
+         finished_.notify_all();
+         Wake();
+      }
+
+      void Limit (unsigned slots)
+      {
+         {
+            const auto lock = std::lock_guard{mutex_};
+            limit_ = std::max(slots, 1u);
+         }
+         Wake();
+      }
+
+      unsigned Limit ()
+      {
+         const auto lock = std::lock_guard{mutex_};
+         return limit_;
+      }
+
+      void MaxMemory (uint64_t bytes)
+      {
+         {
+            const auto lock = std::lock_guard{mutex_};
+            maxMemory_ = bytes;
+         }
+         Wake();
+      }
+
+      void Report (std::ostream& stream)
+      {
+         const auto lock = std::lock_guard{mutex_};
+
+         const auto seconds = [] (std::chrono::microseconds time) { return std::chrono::duration<double>(time).count(); };
+
+         stream << std::fixed << std::setprecision(1)
+                << "Jobs: " << jobs_ << " (limit " << limit_ << (Jobserver::Active() ? ", jobserver" : "") << "), "
+                << "wall " << seconds(wall_) << " s, user " << seconds(user_) << " s, kernel " << seconds(kernel_) << " s, "
+                << "peak memory " << (peakMemory_ >> 20) << " MB\n";
+         if (jobs_) stream << "Longest job: " << seconds(longest_) << " s " << longestJob_ << "\n";
+         if (heldByMemory_ || heldByLoad_) stream << "Held back jobs " << heldByMemory_ << " times for memory, " << heldByLoad_ << " times for the load of the machine\n";
+         if (estimatedBatches_) stream << "Makespan of " << estimatedBatches_ << " batches with known durations: estimated " << seconds(estimatedMakespan_) << " s, actual " << seconds(actualMakespan_) << " s\n";
+         stream << std::defaultfloat << std::flush;
+      }
+
+   private:
+      void Wake ()
+      {
+#ifdef _WIN32
+         ::SetEvent(wake_);
+#else
+         const uint64_t one = 1;
+         [[maybe_unused]] const auto written = ::write(wake_, &one, sizeof(one));
+#endif
+      }
+
+      void Run ()
+      {
+         for (;;) {
+            StartQueued();
+            KillCancelled();
+
+            if (running_.empty()) {
+               const auto lock = std::lock_guard{mutex_};
+               if (stop_) {
+                  for (; tokens_; --tokens_) Jobserver::Release();
+                  return;
+               }
+            }
+
+            WaitForEvents();
+
+            for (size_t i = 0; i < running_.size();) {
+               if (running_[i]->exited) {
+                  auto running = std::move(running_[i]);
+                  running_.erase(running_.begin() + static_cast<std::ptrdiff_t>(i));
+                  Finish(*running);
+               }
+               else {
+                  ++i;
+               }
+            }
+         }
+      }
+
+      void StartQueued ()
+      {
+         waitingForToken_ = false;
+         const bool wasThrottled = throttled_;
+         throttled_ = false;
+
+         for (;;) {
+            Queued next;
+            unsigned slots = 0;
+            {
+               const auto lock = std::lock_guard{mutex_};
+               if (stop_ || queue_.empty()) break;
+
+               slots = std::min(queue_.front().job.slots, limit_);   // A job bigger than the limit runs alone
+               if (!running_.empty() && used_ + slots > limit_) break;
+               if (!running_.empty() && !Admit(queue_.front(), wasThrottled)) {
+                  throttled_ = true;
+                  break;
+               }
+#ifdef _WIN32
+               if (running_.size() >= maxProcesses) break;
+#endif
+               if (!AcquireTokens(used_ + slots - 1) && !running_.empty()) {
+                  waitingForToken_ = true;   // Keeps what it got, WaitForEvents() watches the jobserver
+                  break;
+               }
+
+               next = std::move(queue_.front());
+               queue_.pop_front();
+            }
+
+            Launch(std::move(next), slots);
+         }
+
+         if (!waitingForToken_) {
+            for (; tokens_ + 1 > std::max(used_, 1u); --tokens_) Jobserver::Release();   // Others may need them more
+         }
+
+         if (Trace::Enabled()) {
+            size_t queued = 0;
+            {
+               const auto lock = std::lock_guard{mutex_};
+               queued = queue_.size();
+            }
+            if (queued != tracedQueued_) Trace::Counter("Queued jobs", static_cast<int64_t>(tracedQueued_ = queued));
+            if (running_.size() != tracedRunning_) Trace::Counter("Running jobs", static_cast<int64_t>(tracedRunning_ = running_.size()));
+         }
+      }
+
+      // The governor. Only asked while jobs run, so one job always starts. Locked.
+      bool Admit (const Queued& queued, bool wasThrottled)
+      {
+         const auto held = [wasThrottled] (size_t& count) {
+            if (!wasThrottled) ++count;   // Counted once per pause, not for every look
+            return false;
+         };
+
+         if (maxMemory_ && committed_ + queued.memory > maxMemory_) return held(heldByMemory_);
+
+         if (const auto available = AvailableMemory()) {
+            uint64_t starting = 0;   // Not at their peak yet, the available memory doesn't show them fully
+            const auto now = std::chrono::steady_clock::now();
+            for (auto&& running : running_) {
+               if (now - running->result.usage.start < growing) starting += running->queued.memory;
+            }
+            if (*available < queued.memory + starting + reserveMemory) return held(heldByMemory_);
+         }
+
+         if (const auto load = LoadAverage()) {
+            const auto cores = std::max(std::thread::hardware_concurrency(), 1u);
+            if (*load - used_ > cores) return held(heldByLoad_);   // Others keep the machine busy
+         }
+
+         return true;
+      }
+
+      bool AcquireTokens (unsigned needed)
+      {
+         if (!Jobserver::Active()) return true;
+
+         while (tokens_ < needed && Jobserver::TryAcquire()) ++tokens_;
+         return tokens_ >= needed;   // Nothing running: Starts anyway, with the token every process has
+      }
+
+      void Launch (Queued queued, unsigned slots)
+      {
+         auto running = std::make_unique<Running>();
+         running->queued = std::move(queued);
+         running->result.usage.start = std::chrono::steady_clock::now();
+
+         const auto lane = std::find(lanes_.begin(), lanes_.end(), false);
+         running->lane = static_cast<unsigned>(lane - lanes_.begin());
+         if (lane == lanes_.end()) lanes_.push_back(true);
+         else *lane = true;
+
+         const auto& job = running->queued.job;
+         try {
+            running->child = Process::Start(job.arguments, job.environment, job.captureOutput);
+         }
+         catch (std::exception& e) {
+            running->result.exitCode = -1;
+            running->result.output = std::string(e.what()) + "\n";
+            running->result.usage.end = running->result.usage.start;
+            Complete(*running);
+            return;
+         }
+
+         running->slots = slots;
+         used_ += slots;
+         committed_ += running->queued.memory;
+
+         Watch(*running);
+         running_.push_back(std::move(running));
+      }
+
+      void KillCancelled ()
+      {
+         const auto lock = std::lock_guard{mutex_};
+
+         for (auto&& running : running_) {
+            if (!running->killed && (stop_ || running->queued.batch->cancelled)) {
+               running->killed = true;
+               running->result.cancelled = true;
+               Kill(*running);
+            }
+         }
+      }
+
+      void Finish (Running& running)
+      {
+         Reap(running);
+         used_ -= running.slots;
+         committed_ -= running.queued.memory;
+         running.result.usage.end = std::chrono::steady_clock::now();
+         Complete(running);
+      }
+
+      void Complete (Running& running)
+      {
+         const auto& job = running.queued.job;
+         const auto& result = running.result;
+
+         {
+            const auto lock = std::lock_guard{mutex_};
+
+            const auto wall = Microseconds(result.usage.end - result.usage.start);
+            ++jobs_;
+            wall_ += wall;
+            user_ += result.usage.user;
+            kernel_ += result.usage.kernel;
+            peakMemory_ = std::max(peakMemory_, result.usage.peakMemory);
+            if (wall >= longest_) {
+               longest_ = wall;
+               longestJob_ = job.arguments.empty() ? std::string{} : job.arguments.front() + " " + job.arguments.back();
+            }
+         }
+
+         lanes_[running.lane] = false;
+         if (Trace::Enabled()) {
+            const auto name = !job.action.empty() ? std::filesystem::path(job.action).filename().string()
+                            : job.arguments.empty() ? std::string{} : std::filesystem::path(job.arguments.front()).filename().string() + " " + std::filesystem::path(job.arguments.back()).filename().string();
+            Trace::Job(running.lane + 1, name, Process::Join(job.arguments), result.exitCode, result.usage.start, result.usage.end);
+         }
+
+         if (!job.action.empty() && !result.cancelled) {
+            const auto wall = std::chrono::duration_cast<std::chrono::milliseconds>(result.usage.end - result.usage.start);
+            if (result.exitCode == 0) Durations::Record(job.action, wall);
+            History::Ran(job.action, result.exitCode, wall, std::chrono::duration_cast<std::chrono::milliseconds>(result.usage.user + result.usage.kernel), result.usage.peakMemory);
+         }
+
+         if (job.done) {
+            try {
+               job.done(result);
+            }
+            catch (std::exception& e) {
+               std::cerr << e.what() << std::endl;
+            }
+            catch (...) {
+               std::cerr << "Unknown error in job callback" << std::endl;
+            }
+         }
+
+         {
+            const auto lock = std::lock_guard{mutex_};
+            auto& batch = *running.queued.batch;
+
+            if (--batch.outstanding == 0 && batch.allKnown && batch.expected.size() > 1) {
+               estimatedMakespan_ += Makespan(batch.expected, limit_);
+               actualMakespan_ += std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - batch.start);
+               ++estimatedBatches_;
+            }
+         }
+         finished_.notify_all();
+      }
+
+
+
+#ifdef _WIN32
+      void Watch (Running& running)
+      {
+         if (!running.child.output) return;
+
+         running.overlapped.hEvent = ::CreateEventA(nullptr, TRUE, FALSE, nullptr);
+         StartRead(running);
+      }
+
+      void StartRead (Running& running)
+      {
+         while (running.child.output) {
+            if (::ReadFile(running.child.output, running.buffer, sizeof(running.buffer), nullptr, &running.overlapped)) {
+               DWORD read = 0;
+               ::GetOverlappedResult(running.child.output, &running.overlapped, &read, FALSE);
+               running.result.output.append(running.buffer, read);
+               continue;
+            }
+
+            if (::GetLastError() == ERROR_IO_PENDING) {
+               running.reading = true;
+               return;
+            }
+
+            CloseOutput(running);   // ERROR_BROKEN_PIPE: The process and its children closed their end
+         }
+      }
+
+      void ReadCompleted (Running& running)
+      {
+         DWORD read = 0;
+         if (::GetOverlappedResult(running.child.output, &running.overlapped, &read, FALSE)) {
+            running.reading = false;
+            running.result.output.append(running.buffer, read);
+            StartRead(running);
+         }
+         else if (::GetLastError() != ERROR_IO_INCOMPLETE) {
+            running.reading = false;
+            CloseOutput(running);
+         }
+      }
+
+      void CloseOutput (Running& running)
+      {
+         if (running.reading) {
+            ::CancelIoEx(running.child.output, &running.overlapped);
+
+            DWORD read = 0;
+            if (::GetOverlappedResult(running.child.output, &running.overlapped, &read, TRUE)) {
+               running.result.output.append(running.buffer, read);
+            }
+            running.reading = false;
+         }
+
+         ::CloseHandle(running.child.output);
+         running.child.output = nullptr;
+
+         ::CloseHandle(running.overlapped.hEvent);
+         running.overlapped.hEvent = nullptr;
+      }
+
+      void WaitForEvents ()
+      {
+         std::vector<HANDLE> handles{wake_};
+         std::vector<std::pair<Running*, bool>> owners{{nullptr, false}};   // Running and whether it's the process handle
+
+         const auto jobserver = waitingForToken_ ? handles.size() : 0;
+         if (jobserver) {
+            handles.push_back(Jobserver::WaitHandle());
+            owners.emplace_back(nullptr, false);
+         }
+
+         for (auto&& running : running_) {
+            if (!running->exited) {
+               handles.push_back(running->child.process);
+               owners.emplace_back(running.get(), true);
+            }
+            if (running->reading) {
+               handles.push_back(running->overlapped.hEvent);
+               owners.emplace_back(running.get(), false);
+            }
+         }
+
+         const auto rc = ::WaitForMultipleObjects(static_cast<DWORD>(handles.size()), handles.data(), FALSE, throttled_ ? static_cast<DWORD>(recheck.count()) : INFINITE);
+         if (rc >= WAIT_OBJECT_0 + handles.size()) return;
+
+         // WaitForMultipleObjects() only reports the first signalled handle. Look at the others too, so no job starves.
+         for (size_t i = rc - WAIT_OBJECT_0; i < handles.size(); ++i) {
+            if (i != rc - WAIT_OBJECT_0 && ::WaitForSingleObject(handles[i], 0) != WAIT_OBJECT_0) continue;
+
+            if (jobserver && i == jobserver) {   // A successful wait on the semaphore took the token
+               Jobserver::Acquired();
+               ++tokens_;
+               continue;
+            }
+
+            const auto [running, process] = owners[i];
+            if (!running) continue;
+
+            if (process) running->exited = true;
+            else ReadCompleted(*running);
+         }
+      }
+
+      void Reap (Running& running)
+      {
+         if (running.child.output) {
+            if (running.reading) ReadCompleted(running);   // What was written before the exit
+            if (running.child.output) CloseOutput(running);   // Child processes (mspdbsrv) may keep the pipe open
+         }
+
+         DWORD exitCode = 0;
+         ::GetExitCodeProcess(running.child.process, &exitCode);
+         running.result.exitCode = static_cast<int>(exitCode);
+
+         const auto microseconds = [] (const FILETIME& time) {
+            return std::chrono::microseconds{((static_cast<uint64_t>(time.dwHighDateTime) << 32) | time.dwLowDateTime) / 10};
+         };
+
+         FILETIME creation{}, exit{}, kernel{}, user{};
+         if (::GetProcessTimes(running.child.process, &creation, &exit, &kernel, &user)) {
+            running.result.usage.user = microseconds(user);
+            running.result.usage.kernel = microseconds(kernel);
+         }
+
+         PROCESS_MEMORY_COUNTERS memory{};
+         if (::K32GetProcessMemoryInfo(running.child.process, &memory, sizeof(memory))) {
+            running.result.usage.peakMemory = memory.PeakWorkingSetSize;
+         }
+
+         ::CloseHandle(running.child.process);
+         running.child.process = nullptr;
+      }
+
+      void Kill (Running& running)
+      {
+         ::TerminateProcess(running.child.process, 1);
+      }
+#else
+      enum : uint64_t { pipeEvent = 0, exitEvent = 1 };   // Tag in the lowest bit of the Running pointer
+      enum : uint64_t { wakeEvent = 0, jobserverEvent = 2 };   // No Running lives there
+
+      void Watch (Running& running)
+      {
+         const auto tag = reinterpret_cast<uint64_t>(&running);
+
+         if (running.child.output >= 0) {
+            ::fcntl(running.child.output, F_SETFL, ::fcntl(running.child.output, F_GETFL) | O_NONBLOCK);
+
+            epoll_event event{};
+            event.events = EPOLLIN;
+            event.data.u64 = tag | pipeEvent;
+            ::epoll_ctl(epoll_, EPOLL_CTL_ADD, running.child.output, &event);
+         }
+
+#ifdef SYS_pidfd_open
+         running.pidfd = static_cast<int>(::syscall(SYS_pidfd_open, running.child.pid, 0));   // Linux 5.3. Without it the loop polls.
+         if (running.pidfd >= 0) {
+            epoll_event event{};
+            event.events = EPOLLIN;
+            event.data.u64 = tag | exitEvent;
+            ::epoll_ctl(epoll_, EPOLL_CTL_ADD, running.pidfd, &event);
+         }
+#endif
+      }
+
+      void ReadOutput (Running& running)
+      {
+         while (running.child.output >= 0) {
+            const auto count = ::read(running.child.output, running.buffer, sizeof(running.buffer));
+            if (count > 0) running.result.output.append(running.buffer, static_cast<size_t>(count));
+            else if (count < 0 && errno == EINTR) continue;
+            else if (count < 0 && errno == EAGAIN) return;
+            else CloseOutput(running);
+         }
+      }
+
+      void CloseOutput (Running& running)
+      {
+         ::epoll_ctl(epoll_, EPOLL_CTL_DEL, running.child.output, nullptr);
+         ::close(running.child.output);
+         running.child.output = -1;
+      }
+
+      void CheckExited (Running& running)
+      {
+         const auto pid = ::wait4(running.child.pid, &running.status, WNOHANG, &running.usage);
+         if (pid == running.child.pid) {
+            running.exited = true;
+         }
+         else if (pid < 0 && errno != EINTR) {
+            running.status = 255 << 8;
+            running.exited = true;
+         }
+      }
+
+      void WaitForEvents ()
+      {
+         bool polling = false;
+         for (auto&& running : running_) {
+            if (running->pidfd < 0) polling = true;
+         }
+
+         if (waitingForToken_ != watchingJobserver_) {   // Level triggered: Only while waiting, otherwise free tokens would spin the loop
+            epoll_event event{};
+            event.events = EPOLLIN;
+            event.data.u64 = jobserverEvent;
+            ::epoll_ctl(epoll_, waitingForToken_ ? EPOLL_CTL_ADD : EPOLL_CTL_DEL, Jobserver::WaitHandle(), &event);
+            watchingJobserver_ = waitingForToken_;
+         }
+
+         epoll_event events[64];
+         const int count = ::epoll_wait(epoll_, events, 64, polling ? 10 : throttled_ ? static_cast<int>(recheck.count()) : -1);
+
+         for (int i = 0; i < count; ++i) {
+            const auto data = events[i].data.u64;
+            if (data == wakeEvent) {
+               uint64_t value = 0;
+               [[maybe_unused]] const auto read = ::read(wake_, &value, sizeof(value));
+               continue;
+            }
+            if (data == jobserverEvent) continue;   // StartQueued() tries to get the token
+
+            auto& running = *reinterpret_cast<Running*>(data & ~uint64_t{1});
+            if ((data & 1) == exitEvent) CheckExited(running);
+            else ReadOutput(running);
+         }
+
+         if (polling) {
+            for (auto&& running : running_) {
+               if (running->pidfd < 0 && !running->exited) CheckExited(*running);
+            }
+         }
+      }
+
+      void Reap (Running& running)
+      {
+         if (running.child.output >= 0) {
+            ReadOutput(running);   // What was written before the exit
+            if (running.child.output >= 0) CloseOutput(running);   // Child processes may keep the pipe open
+         }
+
+         if (running.pidfd >= 0) {
+            ::epoll_ctl(epoll_, EPOLL_CTL_DEL, running.pidfd, nullptr);
+            ::close(running.pidfd);
+            running.pidfd = -1;
+         }
+
+         const auto microseconds = [] (const timeval& time) {
+            return std::chrono::microseconds{static_cast<int64_t>(time.tv_sec) * 1000000 + time.tv_usec};
+         };
+
+         running.result.exitCode = Process::ExitCode(running.status);
+         running.result.usage.user = microseconds(running.usage.ru_utime);
+         running.result.usage.kernel = microseconds(running.usage.ru_stime);
+         running.result.usage.peakMemory = static_cast<uint64_t>(running.usage.ru_maxrss) * 1024;   // Linux reports kB
+      }
+
+      void Kill (Running& running)
+      {
+         ::kill(running.child.pid, SIGTERM);
+      }
+#endif
+   };
+
+   Loop& TheLoop ()
+   {
+      static Loop loop;
+      return loop;
+   }
+
+
+
+   std::atomic<unsigned> maxLinkJobs{0};
+
+   // One of MaxLinkJobs() slots for all FBuilds on the machine: A lock file with flock() on POSIX, a named mutex on Windows.
+   // The system releases them when an FBuild dies, so there are no stale locks.
+   class LinkSlot {
+#ifdef _WIN32
+      HANDLE mutex_{nullptr};
+#else
+      int    file_{-1};
+#endif
+
+   public:
+      explicit LinkSlot (unsigned count)
+      {
+         for (bool first = true; count; first = false) {
+            bool usable = false;   // Neither files nor mutexes: No limit rather than waiting forever
+            for (unsigned i = 0; i < count; ++i) {
+               if (TryLock(i, usable)) return;
+            }
+            if (!usable) return;
+
+            if (first) std::cout << "Waiting for one of " << count << " link slots (MaxLinkJobs)" << std::endl;
+            std::this_thread::sleep_for(std::chrono::milliseconds{200});
+         }
+      }
+
+      ~LinkSlot ()
+      {
+#ifdef _WIN32
+         if (mutex_) {
+            ::ReleaseMutex(mutex_);
+            ::CloseHandle(mutex_);
+         }
+#else
+         if (file_ >= 0) ::close(file_);   // Unlocks
+#endif
+      }
+
+      LinkSlot (const LinkSlot&) = delete;
+      LinkSlot& operator= (const LinkSlot&) = delete;
+
+   private:
+      bool TryLock (unsigned slot, bool& usable)
+      {
+         const auto name = "FBuild_link_" + std::to_string(slot);
+
+#ifdef _WIN32
+         // Global\: Shared with the other sessions, eg. a CI agent running as a service. Without the right for it, this session.
+         auto mutex = ::CreateMutexA(nullptr, FALSE, ("Global\\" + name).c_str());
+         if (!mutex && ::GetLastError() == ERROR_ACCESS_DENIED) mutex = ::CreateMutexA(nullptr, FALSE, name.c_str());
+         if (!mutex) return false;
+         usable = true;
+
+         const auto rc = ::WaitForSingleObject(mutex, 0);
+         if (rc == WAIT_OBJECT_0 || rc == WAIT_ABANDONED) {   // Abandoned: Its FBuild died
+            mutex_ = mutex;
+            return true;
+         }
+         ::CloseHandle(mutex);
+         return false;
+#else
+         const auto path = std::filesystem::temp_directory_path() / (name + ".lock");
+         const int file = ::open(path.c_str(), O_RDWR | O_CREAT | O_CLOEXEC, 0666);
+         if (file < 0) return false;
+         usable = true;
+
+         if (::flock(file, LOCK_EX | LOCK_NB) == 0) {
+            file_ = file;
+            return true;
+         }
+         ::close(file);
+         return false;
+#endif
+      }
+   };
+}
+
+
+
+namespace Supervisor {
+
+   void Limit (unsigned slots)
+   {
+      TheLoop().Limit(slots);
+   }
+
+   unsigned Limit ()
+   {
+      return TheLoop().Limit();
+   }
+
+   void MaxMemory (uint64_t bytes)
+   {
+      TheLoop().MaxMemory(bytes);
+   }
+
+   void MaxLinkJobs (unsigned count)
+   {
+      maxLinkJobs = count;
+   }
+
+   void Report (std::ostream& stream)
+   {
+      TheLoop().Report(stream);
+   }
+
+   Result Run (Job job)
+   {
+      Result result;
+      job.done = [&result] (const Result& r) { result = r; };
+
+      const LinkSlot slot{job.link ? maxLinkJobs.load() : 0};   // Held until the link is done
+
+      Batch batch;
+      batch.Submit(std::move(job));
+      batch.Wait();
+      return result;
+   }
+
+
+
+   Batch::Batch () : state_{std::make_shared<State>()}
+   {
+   }
+
+   Batch::~Batch ()
+   {
+      TheLoop().Cancel(state_);
+      TheLoop().Wait(*state_);
+   }
+
+   void Batch::Submit (Job job)
+   {
+      TheLoop().Submit(Queued{std::move(job), state_});
+   }
+
+   void Batch::Wait ()
+   {
+      TheLoop().Wait(*state_);
+   }
+
+   void Batch::Cancel ()
+   {
+      TheLoop().Cancel(state_);
+   }
+}
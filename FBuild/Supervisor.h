@@ -0,0 +1,80 @@
+/*
+ * Any copyright is dedicated to the Public Domain.
+ * http://creativecommons.org/publicdomain/zero/1.0/*
+ *
+ * Author: Frank Barwich
+ */
+
+#pragma once
+
+#include "Process.h"
+
+#include <chrono>
+#include <functional>
+#include <memory>
+#include <ostream>
+
+
+// One thread starts all tool processes, waits for them and collects their output. Windows: WaitForMultipleObjects()
+// on the process handles and overlapped pipes, Linux: epoll on pidfds and pipes. The number of jobs running at once
+// is limited globally, no matter how many compilers, mocs... submit work. Queued jobs start longest first, by their
+// durations in earlier runs, so a slow file doesn't start last and keep everything waiting. While jobs run, the next one
+// only starts if the machine has the memory it took last time (see History) and isn't loaded by others.
+namespace Supervisor {
+
+   struct Usage {
+      std::chrono::steady_clock::time_point start;
+      std::chrono::steady_clock::time_point end;
+      std::chrono::microseconds             user{0};
+      std::chrono::microseconds             kernel{0};
+      uint64_t                              peakMemory{0};   // Bytes
+   };
+
+   struct Result : Process::Result {
+      Usage usage;
+      bool  cancelled{false};
+   };
+
+   struct Job {
+      Process::Arguments                  arguments;
+      Process::Environment                environment;
+      unsigned                            slots{1};              // CL -MP8 counts as 8
+      bool                                captureOutput{true};   // Printed in one piece when the job ended, so parallel jobs don't mix their output
+      std::function<void (const Result&)> done;                  // Called by the supervisor thread. Not called for jobs that were cancelled before they started.
+      std::string                         action;                // What the job produces, eg. the object. Its duration is recorded. Empty: Not recorded, starts after the known ones.
+      bool                                link{false};           // Run() waits for a slot of MaxLinkJobs() first
+   };
+
+   void     Limit (unsigned slots);   // Command line jobs=<n>. Default is the number of cores.
+   unsigned Limit ();
+
+   void MaxMemory (uint64_t bytes);     // MaxMemory("48G"): For the peak memory of all running jobs together, as in earlier runs. 0: No limit.
+   // MaxLinkJobs(2): Links running at once on the machine, by all FBuilds together. LTO links take a lot. 0: No limit.
+   // One FBuild links one target after the other anyway, the limit is for several FBuilds run by make or a script.
+   void MaxLinkJobs (unsigned count);
+
+   void Report (std::ostream& stream);   // Jobs, CPU times, peak memory and the estimated against the actual makespan so far
+
+   Result Run (Job job);   // A single job, eg. a link. Waits for it.
+
+
+   // The jobs of one stage. The destructor cancels what's left.
+   class Batch {
+   public:
+      struct State;
+
+   private:
+      std::shared_ptr<State> state_;
+
+   public:
+      Batch ();
+      ~Batch ();
+
+      Batch (const Batch&) = delete;
+      Batch& operator= (const Batch&) = delete;
+
+      void Submit (Job job);
+      void Wait ();     // Until all submitted jobs are done
+      void Cancel ();   // Queued jobs are dropped, running ones are killed
+   };
+}
@@ -6,22 +6,36 @@
 */
 
 #include "ToolChain.h"
+#include "Process.h"
+#include "Snapshot.h"
 
 #include <filesystem>
 #include <iostream>
+#include <map>
+#include <mutex>
 
 
 namespace ToolChain {
 
    static std::string toolchain;
+#ifdef _WIN32
    static std::string platform = "x86";
+#else
+   static std::string platform = "x64";
+#endif
+
+   static bool IsGccFamily (std::string_view name)
+   {
+      return name.substr(0, 3) == "GCC" || name.substr(0, 5) == "CLANG";
+   }
 
    static void CurrentFromEnvironment()
    {
-      const char* envVersion = std::getenv("VisualStudioVersion");
+#ifdef _WIN32
+      const char* envVersion = Snapshot::Getenv("VisualStudioVersion");
       if (!envVersion) return;    
 
-      const char* envPath = std::getenv("PATH");
+      const char* envPath = Snapshot::Getenv("PATH");
       if (!envPath) return;
 
       std::string version = envVersion;
@@ -32,6 +46,9 @@ namespace ToolChain {
             toolchain += ch;
          }
       }
+#else
+      toolchain = "GCC";
+#endif
    }
 
    void ToolChain(std::string_view newToolchain)
@@ -43,8 +60,11 @@ namespace ToolChain {
       else if (newToolchain.substr(0, 4) == "MSVC") {
          ToolChain::toolchain.assign(newToolchain.begin(), newToolchain.end());
       }
+      else if (IsGccFamily(newToolchain)) {
+         ToolChain::toolchain.assign(newToolchain.begin(), newToolchain.end());
+      }
       else if (newToolchain == "EMSCRIPTEN") {
-         const char* emscriptenEnv = std::getenv("EMSCRIPTEN");
+         const char* emscriptenEnv = Snapshot::Getenv("EMSCRIPTEN");
          if (!emscriptenEnv) throw std::runtime_error("Could not find environment variable 'EMSCRIPTEN'");
 
          ToolChain::toolchain.assign(newToolchain.begin(), newToolchain.end());
@@ -57,6 +77,13 @@ namespace ToolChain {
    std::string ToolChain()
    {
       if (!toolchain.empty()) return toolchain;
+
+      const char* envToolchain = Snapshot::Getenv("FB_TOOLCHAIN");
+      if (envToolchain && IsGccFamily(envToolchain)) {
+         toolchain = envToolchain;
+         return toolchain;
+      }
+
       CurrentFromEnvironment();
       if (!toolchain.empty()) return toolchain;
 
@@ -75,19 +102,53 @@ namespace ToolChain {
       return platform;
    }
 
+   bool Gcc ()
+   {
+      return IsGccFamily(ToolChain());
+   }
+
+   bool Clang ()
+   {
+      return ToolChain().substr(0, 5) == "CLANG";
+   }
+
+   static std::string Versioned (const std::string& program)
+   {
+      const auto tchain = ToolChain();
+      const auto version = tchain.substr(Clang() ? 5 : 3);
+      return version.empty() ? program : program + "-" + version;
+   }
+
+   std::string CCompiler ()
+   {
+      return Versioned(Clang() ? "clang" : "gcc");
+   }
+
+   std::string CxxCompiler ()
+   {
+      return Versioned(Clang() ? "clang++" : "g++");
+   }
+
+   std::string Archiver ()
+   {
+      return "ar";
+   }
+
    std::string SetEnvBatchCall()
    {
       auto tchain = ToolChain();
 
+      if (Gcc()) return {};   // The compiler has to be in the PATH
+
       if (tchain.substr(0, 4) == "MSVC") {
          auto envname = ToolChain();
          envname.erase(0, 4);
          envname.insert(0, "VS");
          envname += "COMNTOOLS";
 
-         auto commtoolsPathEnv = std::getenv(envname.c_str());
+         auto commtoolsPathEnv = Snapshot::Getenv(envname.c_str());
          if (!commtoolsPathEnv) {
-            commtoolsPathEnv = std::getenv("VSAPPIDDIR"); // Aaaaargh. This points to the IDE-Directory. VS2017 no longer sets an COMNTOOLSxxx Env. Except if you're building from the VS2017 commandline, then COMNTOOLSxxx is set. So... Yeah...
+            commtoolsPathEnv = Snapshot::Getenv("VSAPPIDDIR"); // Aaaaargh. This points to the IDE-Directory. VS2017 no longer sets an COMNTOOLSxxx Env. Except if you're building from the VS2017 commandline, then COMNTOOLSxxx is set. So... Yeah...
 
             if (!commtoolsPathEnv) throw std::runtime_error("Environmentvariable " + envname + " not found");
          }
@@ -119,7 +180,7 @@ namespace ToolChain {
          return "CALL " + cmd + " >nul";   // vcvarsall.bat spews out redundant crap -> nul    
       }
       else if (tchain == "EMSCRIPTEN") {
-         const char* emscriptenEnv = std::getenv("EMSCRIPTEN");
+         const char* emscriptenEnv = Snapshot::Getenv("EMSCRIPTEN");
          if (!emscriptenEnv) throw std::runtime_error("Could not find environment variable 'EMSCRIPTEN'");
 
          std::string batchfile = emscriptenEnv;
@@ -139,6 +200,43 @@ namespace ToolChain {
       }
    }
 
+   const std::vector<std::string>& Environment ()
+   {
+      static std::mutex mutex;
+      static std::map<std::string, Process::Environment> environments;
+
+      const auto key = ToolChain() + '|' + Platform();
+
+      const auto lock = std::lock_guard{mutex};
+      auto& environment = environments[key];
+      if (!environment.empty()) return environment;
+
+      if (Gcc()) {
+         environment = Process::Current();
+         return environment;
+      }
+
+#ifdef _WIN32
+      // Runs vcvarsall.bat / emsdk_env.bat a single time instead of once per tool invocation
+      const auto command = SetEnvBatchCall() + " && set";
+      const auto pipe = _popen(command.c_str(), "r");
+      if (!pipe) throw std::runtime_error("Error running " + command);
+
+      char buffer[8192];
+      while (std::fgets(buffer, sizeof(buffer), pipe)) {
+         std::string line = buffer;
+         while (!line.empty() && (line.back() == '\n' || line.back() == '\r')) line.pop_back();
+         if (line.find('=') != std::string::npos) environment.push_back(std::move(line));
+      }
+
+      if (_pclose(pipe) != 0 || environment.empty()) throw std::runtime_error("Error running " + command);
+#else
+      environment = Process::Current();
+#endif
+
+      return environment;
+   }
+
    std::string RemoveGuardCF (const char* env)
    {
       std::string tmp = env;
@@ -9,6 +9,7 @@
 
 #include <string>
 #include <string_view>
+#include <vector>
 
 
 namespace ToolChain {
@@ -19,7 +20,15 @@ namespace ToolChain {
    void        Platform (std::string_view newPlatform);
    std::string Platform ();
 
+   // GCC and CLANG, optionally with a version: GCC13 runs g++-13, CLANG17 runs clang++-17. Default on Linux is GCC or environment FB_TOOLCHAIN.
+   bool        Gcc ();     // GCC or CLANG, gcc style command lines
+   bool        Clang ();
+   std::string CCompiler ();
+   std::string CxxCompiler ();
+   std::string Archiver ();
+
    std::string SetEnvBatchCall ();
+   const std::vector<std::string>& Environment ();   // Environment after SetEnvBatchCall(). Captured once per toolchain and platform.
    std::string RemoveGuardCF (const char* env);
 }
 
@@ -0,0 +1,173 @@
+/*
+ * Any copyright is dedicated to the Public Domain.
+ * http://creativecommons.org/publicdomain/zero/1.0/*
+ *
+ * Author: Frank Barwich
+ */
+
+#include "Trace.h"
+
+#include <atomic>
+#include <cstdio>
+#include <fstream>
+#include <iostream>
+#include <mutex>
+#include <set>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+
+
+namespace {
+
+   std::atomic<bool> enabled{false};   // Not in the Recorder, asking is fine before and after its lifetime
+
+   std::string Escaped (const std::string& s)
+   {
+      std::string result;
+      result.reserve(s.size());
+
+      for (const char ch : s) {
+         switch (ch) {
+            case '"':  result += "\\\""; break;
+            case '\\': result += "\\\\"; break;
+            case '\n': result += "\\n"; break;
+            case '\r': result += "\\r"; break;
+            case '\t': result += "\\t"; break;
+            default:
+               if (static_cast<unsigned char>(ch) < 0x20) {
+                  char buffer[8];
+                  std::snprintf(buffer, sizeof(buffer), "\\u%04x", static_cast<unsigned>(ch));
+                  result += buffer;
+               }
+               else result += ch;
+         }
+      }
+
+      return result;
+   }
+
+   class Recorder {
+      std::mutex                                 mutex_;
+      std::filesystem::path                      file_;
+      std::chrono::steady_clock::time_point      origin_{std::chrono::steady_clock::now()};
+      std::vector<std::string>                   events_;
+      std::unordered_map<std::thread::id, int>   threads_;
+      std::set<unsigned>                         lanes_;
+
+      int64_t Microseconds (std::chrono::steady_clock::time_point time) const
+      {
+         return std::chrono::duration_cast<std::chrono::microseconds>(time - origin_).count();
+      }
+
+      int ThreadId ()   // Locked. Small numbers, in the order the threads showed up.
+      {
+         const auto [it, inserted] = threads_.emplace(std::this_thread::get_id(), static_cast<int>(threads_.size()) + 1);
+         if (inserted) {
+            const auto name = it->second == 1 ? std::string{"Main"} : "Thread " + std::to_string(it->second);
+            events_.push_back(R"({"ph":"M","name":"thread_name","pid":1,"tid":)" + std::to_string(it->second) + R"(,"args":{"name":")" + name + R"("}})");
+         }
+         return it->second;
+      }
+
+      void Write ()
+      {
+         std::ofstream out{file_, std::ios::binary | std::ios::trunc};
+
+         out << "{\"traceEvents\":[\n"
+             << R"({"ph":"M","name":"process_name","pid":1,"args":{"name":"FBuild"}},)" << "\n"
+             << R"({"ph":"M","name":"process_name","pid":2,"args":{"name":"Jobs"}})";
+
+         for (auto&& lane : lanes_) {
+            out << ",\n" << R"({"ph":"M","name":"thread_name","pid":2,"tid":)" << lane << R"(,"args":{"name":"Slot )" << lane << "\"}}";
+         }
+
+         for (auto&& event : events_) out << ",\n" << event;
+
+         out << "\n],\"displayTimeUnit\":\"ms\"}\n";
+
+         if (!out.flush()) std::cerr << "FBuild: Unable to write " << file_.string() << std::endl;
+      }
+
+   public:
+      explicit Recorder (std::filesystem::path file) : file_{std::move(file)}
+      {
+      }
+
+      ~Recorder ()
+      {
+         enabled = false;
+         const auto lock = std::lock_guard{mutex_};
+         Write();
+      }
+
+      void Complete (const std::string& name, const char* category, std::chrono::steady_clock::time_point start, std::chrono::steady_clock::time_point end)
+      {
+         const auto lock = std::lock_guard{mutex_};
+         events_.push_back(R"({"ph":"X","cat":")" + std::string(category) + R"(","name":")" + Escaped(name) + R"(","pid":1,"tid":)" + std::to_string(ThreadId())
+                           + R"(,"ts":)" + std::to_string(Microseconds(start)) + R"(,"dur":)" + std::to_string(Microseconds(end) - Microseconds(start)) + "}");
+      }
+
+      void Job (unsigned lane, const std::string& name, const std::string& command, int exitCode,
+                std::chrono::steady_clock::time_point start, std::chrono::steady_clock::time_point end)
+      {
+         const auto lock = std::lock_guard{mutex_};
+         lanes_.insert(lane);
+         events_.push_back(R"({"ph":"X","cat":"job","name":")" + Escaped(name) + R"(","pid":2,"tid":)" + std::to_string(lane)
+                           + R"(,"ts":)" + std::to_string(Microseconds(start)) + R"(,"dur":)" + std::to_string(Microseconds(end) - Microseconds(start))
+                           + R"(,"args":{"command":")" + Escaped(command) + R"(","exitCode":)" + std::to_string(exitCode) + "}}");
+      }
+
+      void Counter (const char* name, int64_t value)
+      {
+         const auto now = std::chrono::steady_clock::now();
+         const auto lock = std::lock_guard{mutex_};
+         events_.push_back(R"({"ph":"C","name":")" + std::string(name) + R"(","pid":2,"ts":)" + std::to_string(Microseconds(now))
+                           + R"(,"args":{"value":)" + std::to_string(value) + "}}");
+      }
+   };
+
+   Recorder& TheRecorder (const std::filesystem::path& file = {})
+   {
+      static Recorder recorder{file};
+      return recorder;
+   }
+}
+
+
+
+namespace Trace {
+
+   void Enable (const std::filesystem::path& file)
+   {
+      TheRecorder(file);
+      enabled = true;
+   }
+
+   bool Enabled ()
+   {
+      return enabled;
+   }
+
+   Scope::Scope (std::string name, const char* category)
+      : name_{std::move(name)}, category_{category}, start_{std::chrono::steady_clock::now()}, enabled_{Enabled()}
+   {
+   }
+
+   Scope::~Scope ()
+   {
+      if (enabled_) TheRecorder().Complete(name_, category_, start_, std::chrono::steady_clock::now());
+   }
+
+   void Job (unsigned lane, const std::string& name, const std::string& command, int exitCode,
+             std::chrono::steady_clock::time_point start, std::chrono::steady_clock::time_point end)
+   {
+      if (Enabled()) TheRecorder().Job(lane, name, command, exitCode, start, end);
+   }
+
+   void Counter (const char* name, int64_t value)
+   {
+      if (Enabled()) TheRecorder().Counter(name, value);
+   }
+}
@@ -0,0 +1,44 @@
+/*
+ * Any copyright is dedicated to the Public Domain.
+ * http://creativecommons.org/publicdomain/zero/1.0/*
+ *
+ * Author: Frank Barwich
+ */
+
+#pragma once
+
+#include <chrono>
+#include <cstdint>
+#include <filesystem>
+#include <string>
+
+
+// trace=<file>: Where the wall time goes, as a Chrome Trace Event file for Perfetto (ui.perfetto.dev) or chrome://tracing.
+// The phases of FBuild are shown on the lanes of its threads, the jobs of the Supervisor on one lane per slot, with
+// counters for the queued and running jobs. The file is written when FBuild exits, after the caches are saved.
+namespace Trace {
+
+   void Enable (const std::filesystem::path& file);   // Before anything else, so the trace outlives the caches saved at exit
+   bool Enabled ();
+
+   // A phase on the calling thread, from construction to destruction
+   class Scope {
+      std::string                           name_;
+      const char*                           category_;
+      std::chrono::steady_clock::time_point start_;
+      bool                                  enabled_;
+
+   public:
+      explicit Scope (std::string name, const char* category = "phase");
+      ~Scope ();
+
+      Scope (const Scope&) = delete;
+      Scope& operator= (const Scope&) = delete;
+   };
+
+   // A job of the Supervisor on the lane of its slot
+   void Job (unsigned lane, const std::string& name, const std::string& command, int exitCode,
+             std::chrono::steady_clock::time_point start, std::chrono::steady_clock::time_point end);
+
+   void Counter (const char* name, int64_t value);
+}
@@ -6,10 +6,12 @@
  */
 
 #include "Uic.h"
+#include "Manifest.h"
+#include "Snapshot.h"
+#include "Explain.h"
+#include "Supervisor.h"
 
 #include <filesystem>
-#include <mutex>
-#include <thread>
 #include <atomic>
 #include <iostream>
 
@@ -19,6 +21,7 @@ Uic::Uic(const std::string& qtBinDirectory)
    if (!std::filesystem::exists(exe)) throw std::runtime_error{exe.string() + " doesn't exist"};
    exe.make_preferred();
    uicExe_ = exe.string();
+   signature_ = Manifest::Identity(exe);
 }
 
 void Uic::Compile()
@@ -28,57 +31,38 @@ void Uic::Compile()
 
    if (!std::filesystem::exists(outDir_)) std::filesystem::create_directories(outDir_);
 
-   std::vector<std::string> todo{files_};
    std::atomic<uint32_t> errors{0};
-   std::mutex mutex{};
-
-   const auto threadFunction = [&] () {
-      std::string file{};
-      std::string outFile{};
-      std::string command{};
-
-      for (;;) {
-         try {
-            {
-               std::lock_guard guard{mutex};
-               const auto it = todo.rbegin();
-               if (it == todo.rend()) break;
-               file = (*it);
-               todo.pop_back();
-
-               outFile = OutFile(file);
-
-               const auto full = std::filesystem::canonical(outFile);
-               outFiles_.emplace_back(full.string());
-            }
-
-            if (!NeedsRebuild(file, outFile)) continue;
-
-            std::cout << "Moc: " << file << std::endl;
-
-            command = uicExe_ + " -o \"" + outFile + "\" ";
-            command += file;
-            int rc = std::system(command.c_str());
-            if (rc != 0) ++errors;
-         }
-         catch (std::exception& e) {
-            std::cout << e.what() << std::endl;
-            ++errors;
-         }
-         catch (...) {
-            ++errors;
-         }
-      }
-   };
+   Supervisor::Batch batch;
+
+   for (auto&& file : files_) {
+      try {
+         const auto outFile = OutFile(file);
 
-   size_t threadCount = std::thread::hardware_concurrency();
-   if (!threadCount) threadCount = 2;
-   if (threadCount > todo.size()) threadCount = todo.size();
+         const auto full = std::filesystem::canonical(outFile);
+         outFiles_.emplace_back(full.string());
 
-   std::vector<std::thread> threads;
-   for (size_t i = 0; i < threadCount; ++i) threads.emplace_back(std::thread{threadFunction});
+         if (!NeedsRebuild(file, outFile)) continue;
 
-   for (auto&& thread : threads) thread.join();
+         Snapshot::Invalidate();
+
+         Supervisor::Job job;
+         job.arguments = {uicExe_, "-o", outFile, file};
+         job.environment = Process::Current();
+         job.action = outFile;
+         job.done = [this, &errors, file, outFile] (const Supervisor::Result& result) {
+            std::cout << "Uic: " << file << "\n" << result.output << std::flush;
+            if (result.exitCode != 0) ++errors;
+            else Manifest::Record(outFile, {file}, signature_);
+         };
+         batch.Submit(std::move(job));
+      }
+      catch (std::exception& e) {
+         std::cout << e.what() << std::endl;
+         ++errors;
+      }
+   }
+
+   batch.Wait();
 
    if (errors) throw std::runtime_error("UIC Error");
 }
@@ -95,8 +79,21 @@ std::string Uic::OutFile(const std::string& inFile) const
 
 bool Uic::NeedsRebuild(const std::string& inFile, const std::string& outFile) const
 {
-   if (!dependencyCheck_) return true;
-   if (!std::filesystem::exists(outFile)) return true;
-
-   return std::filesystem::last_write_time(outFile) < std::filesystem::last_write_time(inFile);
+   if (!dependencyCheck_) {
+      Explain::OutOfDate(outFile, "DependencyCheck(false)");
+      return true;
+   }
+   if (!std::filesystem::exists(outFile)) {
+      Explain::OutOfDate(outFile, "missing output");
+      return true;
+   }
+
+   if (const auto upToDate = Manifest::UpToDate(outFile, {inFile}, signature_)) return !*upToDate;
+   if (std::filesystem::last_write_time(outFile) < std::filesystem::last_write_time(inFile)) {
+      Explain::OutOfDate(outFile, "newer input", inFile);
+      return true;
+   }
+
+   Manifest::Record(outFile, {inFile}, signature_);   // Up to date by timestamps. From now on the content counts.
+   return false;
 }
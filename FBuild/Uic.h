@@ -30,6 +30,7 @@ public:
 
 private:
    std::string              uicExe_;
+   std::string              signature_;   // Of uic.exe, for the Manifest. Another Qt runs uic again.
    std::string              outDir_;
    std::vector<std::string> files_;
    std::string              prefix_{"ui_"};
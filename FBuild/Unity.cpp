@@ -0,0 +1,305 @@
+/*
+ * Any copyright is dedicated to the Public Domain.
+ * http://creativecommons.org/publicdomain/zero/1.0/*
+ *
+ * Author: Frank Barwich
+ */
+
+#include "Unity.h"
+#include "Durations.h"
+#include "Supervisor.h"
+#include "Snapshot.h"
+
+#include <algorithm>
+#include <filesystem>
+#include <fstream>
+#include <iomanip>
+#include <set>
+#include <sstream>
+#include <unordered_map>
+#include <unordered_set>
+
+
+
+namespace {
+
+   const std::string prefix = "FBuildUnity_";
+
+   constexpr size_t candidates = 16;        // Batches with room a new file is compared with, the latest ones
+   constexpr double minimumShared = 0.5;   // Of the includes of a new file, to join a batch
+
+   struct Group {
+      unsigned                        number{0};
+      std::vector<std::string>        members;
+      uint64_t                        bytes{0};
+      double                          cost{0};   // Milliseconds, estimated
+      std::unordered_set<std::string> includes;
+      bool                            includesKnown{false};
+   };
+
+   std::filesystem::path Directory (const std::string& objDir)
+   {
+      return std::filesystem::path(objDir) / "Unity";
+   }
+
+   std::filesystem::path UnityFile (const std::string& objDir, unsigned number)
+   {
+      return Directory(objDir) / (prefix + std::to_string(number) + ".cpp");
+   }
+
+   std::string Normal (const std::string& file)
+   {
+      return std::filesystem::absolute(file).lexically_normal().generic_string();
+   }
+
+   bool IsCpp (const std::string& file)
+   {
+      const auto extension = std::filesystem::path(file).extension();
+      return extension == ".cpp" || extension == ".cc" || extension == ".cxx";
+   }
+
+   uint64_t Bytes (const std::string& file)
+   {
+      std::error_code error;
+      const auto size = std::filesystem::file_size(file, error);
+      return error ? 0 : size;
+   }
+
+   // Format: "file" per line
+   std::unordered_set<std::string> LoadExcluded (const std::string& objDir)
+   {
+      std::unordered_set<std::string> result;
+
+      std::ifstream stream(Directory(objDir) / "Excluded.txt");
+      std::string file;
+      while (stream >> std::quoted(file)) result.insert(file);
+
+      return result;
+   }
+
+   std::string Content (const std::vector<std::string>& members)
+   {
+      std::string content = "// Generated by FBuild for Unity(true). Written again only when the batch changes.\n";
+      for (auto&& member : members) content += "#include \"" + member + "\"\n";
+      return content;
+   }
+
+   void WriteIfChanged (const std::filesystem::path& file, const std::string& content)
+   {
+      {
+         std::ifstream in{file, std::ios::binary};
+         const std::string existing{std::istreambuf_iterator<char>{in}, std::istreambuf_iterator<char>{}};
+         if (existing == content) return;   // Same timestamp, the batch isn't compiled again
+      }
+
+      Snapshot::Invalidate();
+
+      std::ofstream out{file, std::ios::binary | std::ios::trunc};
+      out << content;
+      if (!out.flush()) throw std::runtime_error("Error writing " + file.string());
+   }
+
+   void Remove (const std::string& objDir, const std::string& objExtension, unsigned number)
+   {
+      std::error_code error;
+      std::filesystem::remove(UnityFile(objDir, number), error);
+      std::filesystem::remove(std::filesystem::path(objDir) / (prefix + std::to_string(number) + "." + objExtension), error);
+   }
+}
+
+
+
+namespace Unity {
+
+   std::vector<std::string> Batch (const std::vector<std::string>& files, const std::vector<std::string>& alone, const std::string& objDir,
+                                   const std::string& objExtension, uint64_t maxBatchBytes, const Dependencies& dependencies)
+   {
+      std::filesystem::create_directories(Directory(objDir));
+
+      const auto excluded = LoadExcluded(objDir);
+      std::unordered_set<std::string> single;
+      for (auto&& file : alone) single.insert(Normal(file));
+
+      std::vector<std::string> result;
+      std::vector<std::string> eligible;
+      std::unordered_set<std::string> unassigned;
+
+      for (auto&& file : files) {
+         const auto normal = Normal(file);
+         if (!IsCpp(file) || single.count(normal) || excluded.count(normal)) result.push_back(file);
+         else if (unassigned.insert(normal).second) eligible.push_back(normal);
+      }
+
+      // The batches of the last run keep their members
+      std::vector<Group> groups;
+      std::set<unsigned> numbers;
+
+      for (auto&& entry : std::filesystem::directory_iterator(Directory(objDir))) {
+         const auto name = entry.path().stem().string();
+         if (name.rfind(prefix, 0) != 0 || entry.path().extension() != ".cpp") continue;
+
+         Group group;
+         group.number = static_cast<unsigned>(std::stoul(name.substr(prefix.size())));
+         numbers.insert(group.number);
+
+         for (auto&& member : Members(entry.path().string())) {
+            if (unassigned.erase(member)) group.members.push_back(member);
+         }
+
+         if (group.members.empty()) Remove(objDir, objExtension, group.number);
+         else groups.push_back(std::move(group));
+      }
+
+      std::sort(groups.begin(), groups.end(), [] (const Group& l, const Group& r) { return l.number < r.number; });
+
+      const auto nextNumber = [&numbers] () {
+         unsigned number = 0;
+         while (numbers.count(number)) ++number;
+         numbers.insert(number);
+         return number;
+      };
+
+      // The cost of a file: Its share of the time its batch took, by bytes. Without history only the bytes count.
+      double knownCost = 0, knownBytes = 0;
+      for (auto&& group : groups) {
+         for (auto&& member : group.members) group.bytes += Bytes(member);
+
+         const auto obj = std::filesystem::path(objDir) / (prefix + std::to_string(group.number) + "." + objExtension);
+         if (const auto last = Durations::Last(obj.string())) {
+            knownCost += static_cast<double>(last->count());
+            knownBytes += static_cast<double>(group.bytes);
+         }
+      }
+      const auto costPerByte = knownBytes > 0 ? knownCost / knownBytes : 0.0;
+
+      double total = 0;
+      for (auto&& file : eligible) total += static_cast<double>(Bytes(file)) * costPerByte;
+      for (auto&& group : groups) group.cost = static_cast<double>(group.bytes) * costPerByte;
+
+      // Twice as many batches as slots at least, so no batch keeps the others waiting at the end
+      const auto targetCost = total / (2.0 * Supervisor::Limit());
+      const auto fits = [&] (const Group& group, uint64_t bytes, double cost) {
+         return group.members.empty() || (group.bytes + bytes <= maxBatchBytes && (targetCost <= 0 || group.cost + cost <= targetCost));
+      };
+
+      // Too big for the limit or for its share of the time: Halves, the first keeps the number
+      for (size_t i = 0; i < groups.size(); ++i) {
+         while (groups[i].members.size() > 1 && (groups[i].bytes > maxBatchBytes || (targetCost > 0 && groups[i].cost > 2 * targetCost))) {
+            Group half;
+            half.number = nextNumber();
+            const auto middle = groups[i].members.begin() + static_cast<std::ptrdiff_t>(groups[i].members.size() / 2);
+            half.members.assign(middle, groups[i].members.end());
+            groups[i].members.erase(middle, groups[i].members.end());
+
+            for (auto&& member : half.members) {
+               const auto bytes = Bytes(member);
+               half.bytes += bytes;
+               groups[i].bytes -= bytes;
+            }
+            half.cost = static_cast<double>(half.bytes) * costPerByte;
+            groups[i].cost = static_cast<double>(groups[i].bytes) * costPerByte;
+
+            groups.push_back(std::move(half));
+         }
+      }
+
+      // New files join the batch they share the most includes with. By path, the neighbours usually share the most.
+      std::vector<std::string> added;
+      for (auto&& file : eligible) {
+         if (unassigned.count(file)) added.push_back(file);
+      }
+      std::sort(added.begin(), added.end());
+
+      std::vector<size_t> open;   // Indices of the batches with room, the latest last
+      for (size_t i = 0; i < groups.size(); ++i) {
+         if (fits(groups[i], 1, 0)) open.push_back(i);
+      }
+
+      for (auto&& file : added) {
+         const auto bytes = Bytes(file);
+         const auto cost = static_cast<double>(bytes) * costPerByte;
+         const auto includes = dependencies(file);
+
+         size_t best = groups.size();
+         double bestShared = minimumShared;
+
+         for (size_t k = open.size() > candidates ? open.size() - candidates : 0; k < open.size(); ++k) {
+            auto& group = groups[open[k]];
+            if (!fits(group, bytes, cost)) continue;
+
+            if (!group.includesKnown) {
+               for (auto&& member : group.members) {
+                  for (auto&& include : dependencies(member)) group.includes.insert(include);
+               }
+               group.includesKnown = true;
+            }
+
+            size_t shared = 0;
+            for (auto&& include : includes) shared += group.includes.count(include);
+            const auto fraction = includes.empty() ? 1.0 : static_cast<double>(shared) / static_cast<double>(includes.size());
+            if (fraction >= bestShared) {
+               bestShared = fraction;
+               best = open[k];
+            }
+         }
+
+         if (best == groups.size()) {
+            Group group;
+            group.number = nextNumber();
+            group.includesKnown = true;
+            groups.push_back(std::move(group));
+            open.push_back(best);
+         }
+
+         auto& group = groups[best];
+         group.members.push_back(file);
+         group.bytes += bytes;
+         group.cost += cost;
+         group.includes.insert(includes.begin(), includes.end());
+
+         if (!fits(group, 1, 0)) open.erase(std::find(open.begin(), open.end(), best));
+      }
+
+      for (auto&& group : groups) {
+         const auto unity = UnityFile(objDir, group.number);
+         WriteIfChanged(unity, Content(group.members));
+         result.push_back(unity.string());
+      }
+
+      return result;
+   }
+
+   bool IsUnity (const std::string& file)
+   {
+      const auto path = std::filesystem::path(file);
+      return path.stem().string().rfind(prefix, 0) == 0 && path.parent_path().filename() == "Unity";
+   }
+
+   std::vector<std::string> Members (const std::string& unity)
+   {
+      std::vector<std::string> result;
+
+      std::ifstream stream(unity);
+      std::string line;
+      while (std::getline(stream, line)) {
+         if (line.rfind("#include \"", 0) != 0) continue;
+
+         const auto end = line.rfind('"');
+         if (end > 10) result.push_back(line.substr(10, end - 10));
+      }
+
+      return result;
+   }
+
+   void Exclude (const std::string& objDir, const std::vector<std::string>& files)
+   {
+      auto excluded = LoadExcluded(objDir);
+      for (auto&& file : files) excluded.insert(Normal(file));
+
+      std::set<std::string> sorted(excluded.begin(), excluded.end());
+
+      std::ofstream stream(Directory(objDir) / "Excluded.txt", std::ios::trunc);
+      for (auto&& file : sorted) stream << std::quoted(file) << "\n";
+      if (!stream.flush()) throw std::runtime_error("Error writing " + (Directory(objDir) / "Excluded.txt").string());
+   }
+}
@@ -0,0 +1,33 @@
+/*
+ * Any copyright is dedicated to the Public Domain.
+ * http://creativecommons.org/publicdomain/zero/1.0/*
+ *
+ * Author: Frank Barwich
+ */
+
+#pragma once
+
+#include <cstdint>
+#include <functional>
+#include <string>
+#include <vector>
+
+
+// Unity(true, {maxBatchBytes: 524288}): The sources are compiled in batches, each one included by a generated unity TU
+// in ObjDir/Unity, so the headers they share are parsed once per batch instead of once per file. New files join the
+// batch they share the most includes with (by CppDepends). A batch keeps its members as long as they exist, adding a
+// file doesn't rebuild the others. Batches that took much longer than the others in earlier runs are split. Files that
+// fail in a batch but compile alone are listed in ObjDir/Unity/Excluded.txt and compiled alone from then on.
+namespace Unity {
+
+   using Dependencies = std::function<std::vector<std::string> (const std::string& file)>;   // All includes of a file
+
+   // What to compile instead of the files: The unity TUs, the files given as 'alone' (the PCH cpp, MPSkipFiles),
+   // the C files and the excluded ones.
+   std::vector<std::string> Batch (const std::vector<std::string>& files, const std::vector<std::string>& alone, const std::string& objDir,
+                                   const std::string& objExtension, uint64_t maxBatchBytes, const Dependencies& dependencies);
+
+   bool                     IsUnity (const std::string& file);
+   std::vector<std::string> Members (const std::string& unity);
+   void                     Exclude (const std::string& objDir, const std::vector<std::string>& files);
+}